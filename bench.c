@@ -0,0 +1,1278 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * Micro-benchmarks of the library. Each benchmark prints one line per measure,
+ * made of space separated key=value pairs.
+ *
+ * ./bench [name] runs the benchmark of that name, or all of them. The suite
+ * times the scanning API on generated archives of several shapes, and
+ * ./bench generate writes such an archive, see generate().
+ */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the counter of /proc/self/io the scanf format matches, or zero if it is unknown.
+ */
+static uint64_t io_counter(const char *format) {
+    char                line[64];
+    unsigned long long  value   = 0;
+    FILE                *io     = fopen("/proc/self/io", "r");
+    if (io == NULL) return 0;
+    while (fgets(line, sizeof(line), io) != NULL && sscanf(line, format, &value) != 1);
+    fclose(io);
+    return value;
+}
+
+/**
+ * Returns the number of read system calls the process made so far, or zero if it is unknown.
+ */
+static uint64_t read_syscalls(void) {
+    return io_counter("syscr: %llu");
+}
+
+/**
+ * Returns the number of bytes the process read so far, page cache hits included, or zero if it is unknown.
+ */
+static uint64_t read_bytes(void) {
+    return io_counter("rchar: %llu");
+}
+
+/**
+ * Fills header with a valid ustar header for an entry of the given name, size and type.
+ */
+static void make_header(tar_header_t *header, const char *name, uint64_t size, char typeflag) {
+    memset(header, 0, sizeof(tar_header_t));
+    memcpy(header->name, name, strnlen(name, sizeof(header->name)));
+    snprintf(header->mode,  sizeof(header->mode),  "%07o", typeflag == DIRTYPE ? 0755 : 0644);
+    snprintf(header->uid,   sizeof(header->uid),   "%07o", 1000);
+    snprintf(header->gid,   sizeof(header->gid),   "%07o", 1000);
+    snprintf(header->size,  sizeof(header->size),  "%011llo", (unsigned long long) size);
+    snprintf(header->mtime, sizeof(header->mtime), "%011llo", 1671043200ULL);
+    header->typeflag = typeflag;
+    memcpy(header->magic,   TMAGIC,     TMAGLEN);
+    memcpy(header->version, TVERSION,   TVERSLEN);
+    strcpy(header->uname, "bench");
+    strcpy(header->gname, "bench");
+    snprintf(header->chksum, sizeof(header->chksum), "%06o", header_checksum(header));
+    header->chksum[7] = ' ';
+}
+
+/**
+ * Header validation as check_archive() did before the checksum kernels: signed byte sum, then a
+ * second loop patching up the chksum field.
+ */
+static int legacy_check_header(tar_header_t *header) {
+    if (strncmp(header->magic,   TMAGIC,     TMAGLEN) != 0)  return -1;
+    if (strncmp(header->version, TVERSION,   TVERSLEN) != 0) return -2;
+
+    uint64_t sum                = 0;
+    uint64_t expected_chksum    = strtoll(header->chksum, NULL, 8);
+
+    char *header_char = (char *) header;
+    for (int i = 0; i < sizeof(*header); i++)        sum += *(header_char + i);
+    for (int i = 0; i < sizeof(header->chksum); i++) sum -= ((uint8_t) header->chksum[i] - (uint8_t) ' ');
+
+    if (sum != expected_chksum) return -3;
+    return 0;
+}
+
+/**
+ * Fills headers with n_headers valid headers, the names of which contain bytes with the high bit set.
+ */
+static void make_headers(tar_header_t *headers, size_t n_headers) {
+    char name[100];
+    for (size_t i = 0; i < n_headers; i++) {
+        snprintf(name, sizeof(name), "dir%zu/caf\xc3\xa9-%zu.txt", i % 97, i);
+        make_header(&headers[i], name, i % 4096, REGTYPE);
+    }
+}
+
+/**
+ * Measures the number of headers validated per second by each checksum kernel.
+ */
+static void bench_checksum(size_t n_headers, int rounds) {
+    tar_header_t    *headers    = malloc(n_headers * sizeof(tar_header_t));
+    volatile int    sink        = 0;
+    make_headers(headers, n_headers);
+
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n_headers; i++) sink += legacy_check_header(&headers[i]);
+    }
+    double elapsed = now() - start;
+    printf("bench=checksum variant=legacy headers_per_sec=%.0f invalid=%d\n", n_headers * rounds / elapsed, -sink / 3 / rounds);
+
+    const char *kernels[] = {"scalar", "sse2", "avx2"};
+    for (int k = TAR_CHECKSUM_SCALAR; k <= TAR_CHECKSUM_AVX2; k++) {
+        sink  = 0;
+        start = now();
+        for (int r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < n_headers; i++) sink += header_checksum_with(&headers[i], k);
+        }
+        elapsed = now() - start;
+        printf("bench=checksum variant=%s headers_per_sec=%.0f\n", kernels[k], n_headers * rounds / elapsed);
+    }
+
+    sink  = 0;
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n_headers; i++) sink += check_header(&headers[i]);
+    }
+    elapsed = now() - start;
+    printf("bench=checksum variant=check_header headers_per_sec=%.0f invalid=%d\n", n_headers * rounds / elapsed, -sink / 3 / rounds);
+
+    free(headers);
+}
+
+/**
+ * Measures decoding the numeric fields of a header, size, mtime, mode and chksum, with strtoll() as
+ * the library first did, one digit at a time, and 8 bytes at a time as header_number() does. A third
+ * of the headers end their numbers with a space and another third pad them with leading spaces.
+ */
+static void bench_decode(size_t n_headers, int rounds) {
+    tar_header_t    *headers    = malloc(n_headers * sizeof(tar_header_t));
+    uint64_t        sums[3]     = {0};
+    make_headers(headers, n_headers);
+    for (size_t i = 0; i < n_headers; i++) {
+        unsigned long long size = i % 4096;
+        if (i % 3 == 1) snprintf(headers[i].size, sizeof(headers[i].size), "%010llo ", size);
+        if (i % 3 == 2) snprintf(headers[i].size, sizeof(headers[i].size), "%11llo", size);
+    }
+
+    const char *variants[] = {"strtoll", "scalar", "swar"};
+    for (int v = 0; v < 3; v++) {
+        double start = now();
+        for (int r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < n_headers; i++) {
+                const tar_header_t *h = &headers[i];
+                if (v == 0) {
+                    sums[v] += strtoll(h->size, NULL, 8) + strtoll(h->mtime, NULL, 8) + strtoll(h->mode, NULL, 8) + strtoll(h->chksum, NULL, 8);
+                } else if (v == 1) {
+                    sums[v] += octal_scalar(h->size, sizeof(h->size)) + octal_scalar(h->mtime, sizeof(h->mtime))
+                               + octal_scalar(h->mode, sizeof(h->mode)) + octal_scalar(h->chksum, sizeof(h->chksum));
+                } else {
+                    sums[v] += header_number(h->size, sizeof(h->size)) + header_number(h->mtime, sizeof(h->mtime))
+                               + header_number(h->mode, sizeof(h->mode)) + header_number(h->chksum, sizeof(h->chksum));
+                }
+            }
+        }
+        double elapsed = now() - start;
+        printf("bench=decode variant=%s headers_per_sec=%.0f ns_per_header=%.2f same_values=%s\n", variants[v],
+               n_headers * rounds / elapsed, elapsed * 1e9 / (n_headers * rounds), sums[v] == sums[0] ? "yes" : "no");
+    }
+    free(headers);
+}
+
+/**
+ * Writes an archive of n_headers files of file_size bytes to a temporary file, the path of which is written to path.
+ * Returns a file descriptor of the archive.
+ */
+static int make_archive(char *path, size_t n_headers, uint64_t file_size) {
+    int             fd          = mkstemp(path);
+    size_t          entry_size  = BLOCKSIZE + BLOCK_ALIGN(file_size);
+    uint8_t         *archive    = calloc(n_headers * entry_size + 2 * BLOCKSIZE, 1);
+    tar_header_t    *headers    = malloc(n_headers * sizeof(tar_header_t));
+    make_headers(headers, n_headers);
+    for (size_t i = 0; i < n_headers; i++) {
+        tar_header_t *header = (tar_header_t *) (archive + i * entry_size);
+        *header = headers[i];
+        snprintf(header->size, sizeof(header->size), "%011llo", (unsigned long long) file_size);
+        snprintf(header->chksum, sizeof(header->chksum), "%06o", header_checksum(header));
+        header->chksum[7] = ' ';
+        memset(header + 1, 'a' + i % 26, file_size);
+    }
+    if (write(fd, archive, n_headers * entry_size + 2 * BLOCKSIZE) < 0) perror("write");
+    free(headers);
+    free(archive);
+    return fd;
+}
+
+/* Distributions of the sizes of the files of a generated archive */
+#define SIZES_FIXED     0       /* every file is max_size bytes */
+#define SIZES_UNIFORM   1       /* uniform between 0 and max_size bytes */
+#define SIZES_LOG       2       /* log-uniform up to max_size bytes: many small files, a few large ones */
+
+/* The shape of a generated archive, see generate_archive() */
+typedef struct archive_shape
+{
+    const char  *name;
+    size_t      n_entries;      /* number of files, directories and symlinks */
+    uint64_t    max_size;       /* largest size of a file, in bytes */
+    int         sizes;          /* one of the SIZES_* values */
+    unsigned    depth;          /* largest number of directories a path goes through */
+    double      symlink_ratio;  /* share of the entries which are symlinks to files */
+} archive_shape_t;
+
+/* The paths of the entries of a generated archive, by type */
+typedef struct generated
+{
+    char    **files;
+    char    **dirs;
+    char    **links;
+    size_t  n_files;
+    size_t  n_dirs;
+    size_t  n_links;
+} generated_t;
+
+/**
+ * Returns the next number of a pseudo-random sequence, the same ones for the same initial seed.
+ */
+static uint64_t next_random(uint64_t *seed) {
+    *seed = *seed * 6364136223846793005u + 1442695040888963407u;
+    return *seed >> 33;
+}
+
+/**
+ * Writes an entry to out, a header then size bytes of data, and adds its path to paths.
+ */
+static void put_entry(FILE *out, const char *name, uint64_t size, char typeflag, const char *linkname,
+                      const uint8_t *data, char ***paths, size_t *n_paths) {
+    tar_header_t header;
+    make_header(&header, name, size, typeflag);
+    if (linkname != NULL) {
+        memcpy(header.linkname, linkname, strnlen(linkname, sizeof(header.linkname)));
+        memset(header.chksum, 0, sizeof(header.chksum));
+        snprintf(header.chksum, sizeof(header.chksum), "%06o", header_checksum(&header));
+        header.chksum[7] = ' ';
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(data, 1, BLOCK_ALIGN(size), out);
+
+    *paths              = realloc(*paths, (*n_paths + 1) * sizeof(char *));
+    (*paths)[(*n_paths)++] = strdup(name);
+}
+
+/**
+ * Writes an archive of the given shape to a new file at path, deterministically for a given seed, and sets
+ * generated to the paths of its entries. Directories are written before their content, and each new one is
+ * put in one of the last ones, so that paths get as deep as the shape allows. Symlinks point to a file of
+ * the same directory. Paths are cut at 100 bytes, which a depth up to 12 stays under.
+ * Returns a file descriptor of the archive, or -1 if it could not be written.
+ */
+static int generate_archive(const char *path, const archive_shape_t *shape, uint64_t seed, generated_t *generated) {
+    FILE        *out        = fopen(path, "w+");
+    uint8_t     *data       = malloc(BLOCK_ALIGN(shape->max_size) + 1);
+    unsigned    *depths     = malloc((shape->n_entries + 1) * sizeof(unsigned));
+    char        name[101];
+    if (out == NULL || data == NULL || depths == NULL) {
+        if (out != NULL) fclose(out);
+        free(data);
+        free(depths);
+        return -1;
+    }
+    memset(generated, 0, sizeof(generated_t));
+    for (uint64_t i = 0; i < BLOCK_ALIGN(shape->max_size); i++) data[i] = 'a' + i % 26;
+
+    for (size_t i = 0; i < shape->n_entries; i++) {
+        uint64_t    draw        = next_random(&seed);
+        double      fraction    = (draw % 10000) / 10000.0;
+        size_t      n_dirs      = generated->n_dirs;
+
+        // the directory of the entry, the root being the last one of depths
+        size_t      dir         = n_dirs > 0 ? n_dirs - 1 - next_random(&seed) % (n_dirs < 8 ? n_dirs : 8) : 0;
+        const char  *dir_path   = n_dirs > 0 ? generated->dirs[dir] : "";
+        unsigned    depth       = n_dirs > 0 ? depths[dir] : 0;
+
+        if (fraction < shape->symlink_ratio && generated->n_files > 0) {
+            // a link next to a file, to its name
+            const char  *target = generated->files[next_random(&seed) % generated->n_files];
+            const char  *slash  = strrchr(target, '/');
+            snprintf(name, sizeof(name), "%.*sl%zu", slash ? (int) (slash - target + 1) : 0, target, i);
+            put_entry(out, name, 0, SYMTYPE, slash ? slash + 1 : target, data, &generated->links, &generated->n_links);
+        } else if (fraction < shape->symlink_ratio + 1.0 / 16 || n_dirs == 0) {
+            if (depth == shape->depth) {
+                dir_path    = "";
+                depth       = 0;
+            }
+            snprintf(name, sizeof(name), "%sd%zu/", dir_path, i);
+            depths[n_dirs] = depth + 1;
+            put_entry(out, name, 0, DIRTYPE, NULL, data, &generated->dirs, &generated->n_dirs);
+        } else {
+            uint64_t size = shape->max_size;
+            if (shape->sizes == SIZES_UNIFORM) {
+                size = next_random(&seed) % (shape->max_size + 1);
+            } else if (shape->sizes == SIZES_LOG) {
+                unsigned bits = 0;
+                while ((1ULL << bits) < shape->max_size) bits++;
+                size = next_random(&seed) % ((1ULL << (next_random(&seed) % (bits + 1))) + 1);
+                if (size > shape->max_size) size = shape->max_size;
+            }
+            snprintf(name, sizeof(name), "%sf%zu.txt", dir_path, i);
+            put_entry(out, name, size, REGTYPE, NULL, data, &generated->files, &generated->n_files);
+        }
+    }
+
+    static const uint8_t end[2 * BLOCKSIZE];
+    fwrite(end, 1, sizeof(end), out);
+    free(data);
+    free(depths);
+    if (fflush(out) != 0) {
+        fclose(out);
+        return -1;
+    }
+    int fd = dup(fileno(out));
+    fclose(out);
+    return fd;
+}
+
+static void bench_check_archive(size_t n_headers, int rounds) {
+    char    path[]  = "/tmp/lib_tar_bench_XXXXXX";
+    int     fd      = make_archive(path, n_headers, 0);
+    unlink(path);
+
+    int     ret     = 0;
+    double  start   = now();
+    for (int r = 0; r < rounds; r++) ret = check_archive(fd);
+    double  elapsed = now() - start;
+    printf("bench=check_archive headers=%d headers_per_sec=%.0f\n", ret, n_headers * rounds / elapsed);
+
+    close(fd);
+}
+
+/**
+ * Measures the time to get the index of an archive of n_headers entries by scanning it, and by
+ * loading its sidecar.
+ */
+static void bench_sidecar(size_t n_headers) {
+    char        path[]          = "/tmp/lib_tar_bench_XXXXXX";
+    char        sidecar[64];
+    int         fd              = make_archive(path, n_headers, 0);
+    tar_index_t *index;
+    snprintf(sidecar, sizeof(sidecar), "%s.idx", path);
+
+    double  start   = now();
+    int     ret     = tar_index_build(fd, &index);
+    double  build   = now() - start;
+    tar_index_save(index, fd, sidecar);
+    tar_index_free(index);
+
+    start = now();
+    ret   = tar_index_load(fd, sidecar, &index);
+    double load = now() - start;
+    printf("bench=sidecar entries=%d build_ms=%.3f load_ms=%.3f found=%d\n", ret, build * 1e3, load * 1e3,
+           ret >= 0 ? tar_index_exists(index, "dir0/caf\xc3\xa9-0.txt") : 0);
+    if (ret >= 0) tar_index_free(index);
+
+    unlink(sidecar);
+    unlink(path);
+    close(fd);
+}
+
+/**
+ * Measures bringing the index of an archive of n_headers entries up to date after n_appended entries were
+ * appended to it, from its sidecar, against indexing it again.
+ */
+static void bench_append(size_t n_headers, size_t n_appended) {
+    char            path[]  = "/tmp/lib_tar_bench_XXXXXX";
+    char            sidecar[64];
+    int             fd      = make_archive(path, n_headers, 0);
+    tar_index_t     *index;
+    tar_writer_t    *writer;
+    snprintf(sidecar, sizeof(sidecar), "%s.idx", path);
+
+    tar_index_open(fd, sidecar, &index);
+    tar_writer_append(fd, index, &writer);
+    for (size_t i = 0; i < n_appended; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "appended/%zu.txt", i);
+        tar_writer_add_buffer(writer, name, (const uint8_t *) "appended\n", 9, 0644, 1671043200);
+    }
+    tar_writer_close(writer);
+    tar_index_free(index);
+
+    double  start   = now();
+    int     ret     = tar_index_open(fd, sidecar, &index);
+    double  update  = now() - start;
+    tar_index_free(index);
+
+    start = now();
+    tar_index_build(fd, &index);
+    double build = now() - start;
+    tar_index_free(index);
+    printf("bench=append entries=%d appended=%zu update_ms=%.3f build_ms=%.3f\n", ret, n_appended, update * 1e3, build * 1e3);
+
+    unlink(sidecar);
+    unlink(path);
+    close(fd);
+}
+
+/**
+ * Measures random reads of single entries of a gzip compressed archive, decoded from its checkpoints,
+ * against decoding the archive from its start.
+ */
+static void bench_compressed(size_t n_headers, uint64_t file_size, int n_reads) {
+    char    path[]  = "/tmp/lib_tar_bench_XXXXXX";
+    char    gz_path[64], checkpoints[64], command[256];
+    int     fd      = make_archive(path, n_headers, file_size);
+    close(fd);
+    snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+    snprintf(checkpoints, sizeof(checkpoints), "%s.gz.ckpt", path);
+    snprintf(command, sizeof(command), "gzip -1 -c %s > %s", path, gz_path);
+    if (system(command) != 0) perror(command);
+    unlink(path);
+
+    // the first scan decodes the whole archive and records the checkpoints
+    int         gz_fd = open(gz_path, O_RDONLY);
+    tar_index_t *index;
+    tar_source_attach(gz_fd, checkpoints, 0);
+    double  start   = now();
+    int     ret     = tar_index_build(gz_fd, &index);
+    double  scan    = now() - start;
+
+    uint64_t    size;
+    uint32_t    n_checkpoints;
+    tar_source_info(gz_fd, &size, &n_checkpoints);
+
+    uint8_t buffer[4096];
+    char    name[64];
+    srand(1);
+    start = now();
+    for (int i = 0; i < n_reads; i++) {
+        size_t entry    = (size_t) rand() % n_headers;
+        size_t len      = sizeof(buffer);
+        snprintf(name, sizeof(name), "dir%zu/caf\xc3\xa9-%zu.txt", entry % 97, entry);
+        tar_index_read_file(gz_fd, index, name, 0, buffer, &len);
+    }
+    double read = (now() - start) / n_reads;
+    tar_source_detach(gz_fd);
+
+    // without checkpoints, reading the last entry decodes everything before it
+    tar_source_attach(gz_fd, NULL, 0);
+    size_t len = sizeof(buffer);
+    snprintf(name, sizeof(name), "dir%zu/caf\xc3\xa9-%zu.txt", (n_headers - 1) % 97, n_headers - 1);
+    start = now();
+    tar_index_read_file(gz_fd, index, name, 0, buffer, &len);
+    double prefix = now() - start;
+    tar_source_detach(gz_fd);
+
+    struct stat gz_st, ckpt_st;
+    fstat(gz_fd, &gz_st);
+    if (stat(checkpoints, &ckpt_st) < 0) ckpt_st.st_size = 0;
+    printf("bench=compressed entries=%d archive_mb=%.1f gzip_mb=%.1f checkpoints=%u checkpoint_kb=%.1f scan_ms=%.1f "
+           "read_us=%.1f prefix_read_ms=%.1f\n", ret, size / 1048576.0, gz_st.st_size / 1048576.0, n_checkpoints,
+           ckpt_st.st_size / 1024.0, scan * 1e3, read * 1e6, prefix * 1e3);
+
+    tar_index_free(index);
+    close(gz_fd);
+    unlink(checkpoints);
+    unlink(gz_path);
+}
+
+static void hash_data(const tar_entry_t *entry, const uint8_t *data, size_t len, void *user_data) {
+    if (len > 0) *(uint64_t *) user_data ^= hash_name((const char *) data, len);
+}
+
+/**
+ * Measures validating, indexing and hashing an archive in a single pass over a pipe.
+ */
+static void bench_stream(size_t n_headers, uint64_t file_size) {
+    char    path[]  = "/tmp/lib_tar_bench_XXXXXX";
+    char    command[64];
+    int     fd      = make_archive(path, n_headers, file_size);
+    close(fd);
+    snprintf(command, sizeof(command), "cat %s", path);
+
+    FILE        *input  = popen(command, "r");
+    tar_index_t *index;
+    uint64_t    hash    = 0;
+    double      start   = now();
+    int         ret     = tar_stream_check(fileno(input), &index, hash_data, &hash);
+    double      elapsed = now() - start;
+    pclose(input);
+
+    double mb = (n_headers * (BLOCKSIZE + BLOCK_ALIGN(file_size))) / 1048576.0;
+    printf("bench=stream entries=%d archive_mb=%.1f mb_per_s=%.1f entries_per_s=%.0f\n", ret, mb, mb / elapsed,
+           ret / elapsed);
+    if (ret >= 0) tar_index_free(index);
+    unlink(path);
+}
+
+typedef struct {
+    tar_archive_t   *archive;
+    int             n_ops;
+} read_arg_t;
+
+static void *read_loop(void *arg) {
+    read_arg_t  *r = arg;
+    uint8_t     buffer[4096];
+    for (int i = 0; i < r->n_ops; i++) {
+        size_t len = sizeof(buffer);
+        tar_read_file(r->archive, "folder2/lib_tar.c", (i * 512) % 8192, buffer, &len);
+    }
+    return NULL;
+}
+
+/**
+ * Measures the read_file() throughput of 1 to 16 threads sharing a single handle on archive.tar.
+ */
+static void bench_threads(int n_ops) {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    for (int flags = 0; flags <= TAR_OPEN_INDEX; flags += TAR_OPEN_INDEX) {
+        tar_archive_t *archive;
+        if (tar_open(fd, flags, &archive) < 0) break;
+
+        for (int n_threads = 1; n_threads <= 16; n_threads *= 2) {
+            pthread_t   threads[16];
+            read_arg_t  arg     = {archive, n_ops / n_threads};
+            double      start   = now();
+            for (int i = 0; i < n_threads; i++) pthread_create(&threads[i], NULL, read_loop, &arg);
+            for (int i = 0; i < n_threads; i++) pthread_join(threads[i], NULL);
+            double elapsed = now() - start;
+            printf("bench=threads archive=%s threads=%d ops_per_sec=%.0f\n",
+                   flags ? "indexed" : "scanned", n_threads, arg.n_ops * n_threads / elapsed);
+        }
+        tar_close(archive);
+    }
+    close(fd);
+}
+
+/**
+ * Measures a reader paging through every file of archive.tar in chunks of chunk_size bytes, rounds times,
+ * with and without a cache on the handle.
+ */
+static void bench_cache(size_t chunk_size, int rounds) {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    // the regular files of the archive and their sizes
+    char        names[64][sizeof(((tar_header_t *) 0)->name) + 1];
+    uint64_t    sizes[64];
+    int         n_files = 0;
+    tar_iter_t  *iter;
+    tar_entry_t entry;
+    tar_iter_open(fd, &iter);
+    while (n_files < 64 && tar_iter_next(iter, &entry) > 0) {
+        if (entry.typeflag != REGTYPE && entry.typeflag != AREGTYPE) continue;
+        strcpy(names[n_files], entry.name);
+        sizes[n_files++] = entry.size;
+    }
+    tar_iter_close(iter);
+
+    uint8_t *buffer = malloc(chunk_size);
+    for (int variant = 0; variant < 4; variant++) {
+        int             indexed = variant & 1;
+        int             cached  = variant & 2;
+        tar_archive_t   *archive;
+        if (tar_open(fd, indexed ? TAR_OPEN_INDEX : 0, &archive) < 0) break;
+        if (cached) tar_enable_cache(archive, 1 << 20);
+
+        uint64_t    n_ops       = 0;
+        uint64_t    syscalls    = read_syscalls();
+        double      start       = now();
+        for (int r = 0; r < rounds; r++) {
+            for (int f = 0; f < n_files; f++) {
+                for (uint64_t offset = 0; offset < sizes[f]; offset += chunk_size) {
+                    size_t len = chunk_size;
+                    tar_read_file(archive, names[f], offset, buffer, &len);
+                    n_ops++;
+                }
+            }
+        }
+        double elapsed = now() - start;
+        syscalls = read_syscalls() - syscalls;
+
+        tar_cache_stats_t stats;
+        tar_cache_stats(archive, &stats);
+        printf("bench=cache archive=%s cache=%s chunk=%zu ops_per_sec=%.0f syscalls_per_op=%.3f hit_rate=%.3f\n",
+               indexed ? "indexed" : "scanned", cached ? "on" : "off", chunk_size, n_ops / elapsed, (double) syscalls / n_ops,
+               stats.hits + stats.misses ? (double) stats.hits / (stats.hits + stats.misses) : 0.0);
+        tar_close(archive);
+    }
+    free(buffer);
+    close(fd);
+}
+
+/**
+ * Measures reading n_reads files picked at random among n_files files of file_size bytes, one at a time
+ * and as a single batch.
+ */
+static void bench_read_many(size_t n_files, uint64_t file_size, size_t n_reads) {
+    char                path[]      = "/tmp/lib_tar_bench_XXXXXX";
+    int                 fd          = make_archive(path, n_files, file_size);
+    tar_read_request_t  *requests   = malloc(n_reads * sizeof(tar_read_request_t));
+    char                (*names)[100] = malloc(n_files * sizeof(*names));
+    uint8_t             *buffers    = malloc(n_reads * file_size);
+    tar_archive_t       *archive;
+    unlink(path);
+
+    for (size_t i = 0; i < n_files; i++) snprintf(names[i], sizeof(names[i]), "dir%zu/caf\xc3\xa9-%zu.txt", i % 97, i);
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+
+    srand(42);
+    for (size_t i = 0; i < n_reads; i++) {
+        requests[i].path    = names[rand() % n_files];
+        requests[i].offset  = 0;
+        requests[i].dest    = buffers + i * file_size;
+    }
+
+    for (int batched = 0; batched <= 1; batched++) {
+        for (size_t i = 0; i < n_reads; i++) requests[i].len = file_size;
+
+        uint64_t    syscalls    = read_syscalls();
+        double      start       = now();
+        if (batched) {
+            tar_read_many(archive, requests, n_reads);
+        } else {
+            for (size_t i = 0; i < n_reads; i++) {
+                requests[i].ret = tar_read_file(archive, requests[i].path, 0, requests[i].dest, &requests[i].len);
+            }
+        }
+        double elapsed = now() - start;
+        syscalls = read_syscalls() - syscalls;
+
+        int failed = 0;
+        for (size_t i = 0; i < n_reads; i++) failed += requests[i].ret != 0 || requests[i].len != file_size;
+        printf("bench=read_many variant=%s files=%zu reads=%zu files_per_sec=%.0f syscalls=%llu failed=%d\n",
+               batched ? "batch" : "one_by_one", n_files, n_reads, n_reads / elapsed, (unsigned long long) syscalls, failed);
+    }
+
+    tar_close(archive);
+    free(buffers);
+    free(names);
+    free(requests);
+    close(fd);
+}
+
+static void count_completion(tar_read_request_t *request, void *user_data) {
+    *(size_t *) user_data += request->len;
+}
+
+/**
+ * Measures reading n_reads chunks of chunk_size bytes at random offsets of n_files files of file_size bytes,
+ * synchronously then asynchronously with each backend at queue depths 1 to 64. The archive is dropped from
+ * the page cache before each measure.
+ */
+static void bench_aio(size_t n_files, uint64_t file_size, size_t chunk_size, size_t n_reads) {
+    char                path[]      = "/tmp/lib_tar_bench_XXXXXX";
+    int                 fd          = make_archive(path, n_files, file_size);
+    tar_read_request_t  *requests   = malloc(n_reads * sizeof(tar_read_request_t));
+    char                (*names)[100] = malloc(n_files * sizeof(*names));
+    uint8_t             *buffers    = malloc(64 * chunk_size);
+    tar_archive_t       *archive;
+    unlink(path);
+
+    for (size_t i = 0; i < n_files; i++) snprintf(names[i], sizeof(names[i]), "dir%zu/caf\xc3\xa9-%zu.txt", i % 97, i);
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+
+    srand(42);
+    for (size_t i = 0; i < n_reads; i++) {
+        requests[i].path    = names[rand() % n_files];
+        requests[i].offset  = (rand() % (file_size / chunk_size)) * chunk_size;
+    }
+
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    size_t  n_bytes = 0;
+    double  start   = now();
+    for (size_t i = 0; i < n_reads; i++) {
+        size_t len = chunk_size;
+        tar_read_file(archive, requests[i].path, requests[i].offset, buffers, &len);
+        n_bytes += len;
+    }
+    double elapsed = now() - start;
+    printf("bench=aio backend=sync depth=1 reads_per_sec=%.0f mb_per_sec=%.1f\n", n_reads / elapsed, n_bytes / elapsed / 1e6);
+
+    for (int flags = 0; flags <= TAR_AIO_THREADS; flags += TAR_AIO_THREADS) {
+        for (unsigned depth = 1; depth <= 64; depth *= 2) {
+            tar_aio_t   *aio;
+            int         backend = tar_aio_open(archive, depth, flags, &aio);
+            if (backend < 0) break;
+
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            n_bytes = 0;
+            start   = now();
+            for (size_t i = 0; i < n_reads; i++) {
+                requests[i].dest    = buffers + (i % depth) * chunk_size;     // reused once the read completed
+                requests[i].len     = chunk_size;
+                tar_aio_submit(aio, &requests[i], count_completion, &n_bytes);
+                if ((i + 1) % depth == 0) tar_aio_wait(aio, depth);
+            }
+            tar_aio_close(aio);
+            elapsed = now() - start;
+            printf("bench=aio backend=%s depth=%u reads_per_sec=%.0f mb_per_sec=%.1f\n",
+                   backend == TAR_AIO_URING ? "io_uring" : "threads", depth, n_reads / elapsed, n_bytes / elapsed / 1e6);
+        }
+    }
+
+    tar_close(archive);
+    free(buffers);
+    free(names);
+    free(requests);
+    close(fd);
+}
+
+/**
+ * Reads the connection whose descriptor arg points to until the peer closes it, then sets arg to the number
+ * of bytes received.
+ */
+static void *drain_socket(void *arg) {
+    int     fd          = (int) *(size_t *) arg;
+    size_t  n_bytes     = 0;
+    char    *buffer     = malloc(256 << 10);
+    ssize_t n_read;
+    while ((n_read = read(fd, buffer, 256 << 10)) > 0) n_bytes += n_read;
+    free(buffer);
+    close(fd);
+    *(size_t *) arg = n_bytes;
+    return NULL;
+}
+
+/**
+ * Measures serving n_sends files picked at random among n_files files of file_size bytes over a loopback
+ * TCP connection, read with tar_read_file() then written, and sent with tar_send_entry().
+ */
+static void bench_send(size_t n_files, uint64_t file_size, size_t n_sends) {
+    char                path[]          = "/tmp/lib_tar_bench_XXXXXX";
+    int                 fd              = make_archive(path, n_files, file_size);
+    char                (*names)[100]   = malloc(n_files * sizeof(*names));
+    uint8_t             *buffer         = malloc(file_size);
+    struct sockaddr_in  addr            = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t           addr_len        = sizeof(addr);
+    tar_archive_t       *archive;
+    unlink(path);
+
+    for (size_t i = 0; i < n_files; i++) snprintf(names[i], sizeof(names[i]), "dir%zu/caf\xc3\xa9-%zu.txt", i % 97, i);
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 1) < 0
+        || getsockname(listener, (struct sockaddr *) &addr, &addr_len) < 0) {
+        perror("listen");
+        return;
+    }
+
+    for (int zero_copy = 0; zero_copy <= 1; zero_copy++) {
+        pthread_t   reader;
+        int         out     = socket(AF_INET, SOCK_STREAM, 0);
+        if (out < 0 || connect(out, (struct sockaddr *) &addr, sizeof(addr)) < 0) break;
+        int         in      = accept(listener, NULL, NULL);
+        size_t      drained = in;
+        if (in < 0 || pthread_create(&reader, NULL, drain_socket, &drained) != 0) break;
+
+        srand(42);
+        size_t      n_bytes = 0;
+        double      start   = now();
+        for (size_t i = 0; i < n_sends; i++) {
+            const char  *name   = names[rand() % n_files];
+            size_t      len     = file_size;
+            if (zero_copy) {
+                tar_send_entry(archive, name, out, 0, &len);
+            } else {
+                tar_read_file(archive, name, 0, buffer, &len);
+                if (write_all(out, buffer, len) < 0) break;
+            }
+            n_bytes += len;
+        }
+        close(out);
+        pthread_join(reader, NULL);
+        double elapsed = now() - start;
+        printf("bench=send variant=%s files=%zu sends=%zu mb_per_sec=%.0f received=%s\n", zero_copy ? "tar_send_entry" : "read_write",
+               n_files, n_sends, n_bytes / elapsed / 1e6, drained == n_bytes ? "all" : "short");
+    }
+
+    close(listener);
+    tar_close(archive);
+    free(buffer);
+    free(names);
+    close(fd);
+}
+
+/**
+ * Measures extracting an archive of n_files files of file_size bytes with 1 to 8 threads.
+ */
+static void bench_extract(size_t n_files, uint64_t file_size) {
+    char            path[]      = "/tmp/lib_tar_bench_XXXXXX";
+    char            dest[]      = "/tmp/lib_tar_extract_XXXXXX";
+    char            command[64];
+    int             fd          = make_archive(path, n_files, file_size);
+    tar_archive_t   *archive;
+    unlink(path);
+
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+    for (unsigned n_threads = 1; n_threads <= 8; n_threads *= 2) {
+        if (mkdtemp(dest) == NULL) break;
+        sync();                                                     // do not pay for the writeback of the previous run
+        double  start   = now();
+        int     ret     = tar_extract(archive, dest, n_threads);
+        double  elapsed = now() - start;
+        printf("bench=extract threads=%u entries=%d files_per_sec=%.0f mb_per_sec=%.1f\n",
+               n_threads, ret, n_files / elapsed, n_files * file_size / elapsed / 1e6);
+
+        snprintf(command, sizeof(command), "rm -rf %s", dest);
+        if (system(command) != 0) break;
+        strcpy(dest + strlen(dest) - 6, "XXXXXX");
+    }
+    tar_close(archive);
+    close(fd);
+}
+
+/**
+ * Measures archiving a tree of n_files files of file_size bytes, to a regular file then to a pipe.
+ */
+static void bench_writer(size_t n_files, uint64_t file_size) {
+    char            path[]      = "/tmp/lib_tar_bench_XXXXXX";
+    char            tree[]      = "/tmp/lib_tar_tree_XXXXXX";
+    char            command[64];
+    int             fd          = make_archive(path, n_files, file_size);
+    tar_archive_t   *archive;
+    unlink(path);
+
+    // the tree to archive is the extracted generated archive
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+    if (mkdtemp(tree) == NULL || tar_extract(archive, tree, 0) < 0) {
+        perror("tar_extract");
+        return;
+    }
+    tar_close(archive);
+    close(fd);
+
+    for (int to_pipe = 0; to_pipe <= 1; to_pipe++) {
+        int pipe_fds[2] = {-1, -1};
+        strcpy(path + strlen(path) - 6, "XXXXXX");
+        fd = to_pipe ? (pipe(pipe_fds) == 0 ? pipe_fds[1] : -1) : mkstemp(path);
+        if (fd < 0) break;
+        if (!to_pipe) unlink(path);
+
+        // drain the pipe from another process
+        pid_t reader = to_pipe ? fork() : -1;
+        if (reader == 0) {
+            close(pipe_fds[1]);
+            while (read(pipe_fds[0], command, sizeof(command)) > 0);
+            _exit(0);
+        }
+        if (to_pipe) close(pipe_fds[0]);
+
+        tar_writer_t    *writer;
+        double          start   = now();
+        tar_writer_open(fd, &writer);
+        int             ret     = tar_writer_add_path(writer, tree, "tree");
+        tar_writer_close(writer);
+        close(fd);
+        double          elapsed = now() - start;
+        if (reader > 0) waitpid(reader, NULL, 0);
+        printf("bench=writer output=%s entries=%d files_per_sec=%.0f mb_per_sec=%.1f\n",
+               to_pipe ? "pipe" : "file", ret, n_files / elapsed, n_files * file_size / elapsed / 1e6);
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", tree);
+    if (system(command) != 0) perror(command);
+}
+
+/**
+ * Measures tar_exists() on an indexed handle, the call the counters of tar_get_stats() weigh the most on,
+ * to be compared with a build with TAR_NO_STATS.
+ */
+static void bench_stats(size_t n_headers, size_t n_calls) {
+    char            path[]  = "/tmp/lib_tar_bench_XXXXXX";
+    int             fd      = make_archive(path, n_headers, 0);
+    tar_archive_t   *archive;
+    tar_stats_t     stats;
+    char            name[64];
+    int             found   = 0;
+    unlink(path);
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+
+    double start = now();
+    for (size_t i = 0; i < n_calls; i++) {
+        snprintf(name, sizeof(name), "dir%zu/caf\xc3\xa9-%zu.txt", (i % n_headers) % 97, i % n_headers);
+        found += tar_exists(archive, name);
+    }
+    double elapsed = now() - start;
+    printf("bench=stats counters=%s calls_per_sec=%.0f found=%d\n", tar_get_stats(archive, &stats) == 0 ? "on" : "off",
+           n_calls / elapsed, found);
+
+    tar_close(archive);
+    close(fd);
+}
+
+/**
+ * Measures building and freeing the index of an archive of n_headers entries, and reports the memory it holds.
+ */
+static void bench_index(size_t n_headers) {
+    char                path[]  = "/tmp/lib_tar_bench_XXXXXX";
+    int                 fd      = make_archive(path, n_headers, 0);
+    tar_index_t         *index;
+    tar_index_memory_t  memory;
+    unlink(path);
+
+    double  start   = now();
+    int     ret     = tar_index_build(fd, &index);
+    double  build   = now() - start;
+    if (ret < 0) {
+        close(fd);
+        return;
+    }
+    tar_index_memory(index, &memory);
+
+    start = now();
+    tar_index_free(index);
+    double release = now() - start;
+    printf("bench=index entries=%d build_ms=%.3f free_ms=%.3f entry_bytes=%.1f string_bytes=%.1f tree_bytes=%.1f "
+           "resident_bytes=%.1f allocations=%lu\n", ret, build * 1e3, release * 1e3,
+           (double) memory.entry_bytes / ret, (double) memory.string_bytes / ret, (double) memory.tree_bytes / ret,
+           (double) memory.resident_bytes / ret, memory.allocations);
+    close(fd);
+}
+
+/**
+ * Measures answering n_paths exact paths, half of them in the archive, and a few patterns in a single pass over an
+ * archive of n_headers entries, scanned and indexed, against a scan of the archive by tar_exists() for each path.
+ */
+static void bench_query(size_t n_headers, size_t n_paths) {
+    char            path[]      = "/tmp/lib_tar_bench_XXXXXX";
+    int             fd          = make_archive(path, n_headers, 0);
+    const char      *patterns[] = {"dir1/*-1?.txt", "*/caf\xc3\xa9-4242.txt", "dir9?/*"};
+    char            **names     = malloc(n_paths * sizeof(char *));
+    tar_query_t     *query;
+    tar_archive_t   *archive;
+    unlink(path);
+
+    tar_query_new(&query);
+    for (size_t i = 0; i < n_paths; i++) {
+        size_t j = i * 13 % (2 * n_headers);
+        names[i] = malloc(64);
+        snprintf(names[i], 64, "dir%zu/caf\xc3\xa9-%zu.txt", j % 97, j);
+        tar_query_add_path(query, names[i]);
+    }
+    for (size_t i = 0; i < 3; i++) tar_query_add_glob(query, patterns[i]);
+
+    tar_open(fd, 0, &archive);
+    double  start       = now();
+    int     found       = tar_query_run(archive, query, NULL, NULL, NULL);
+    double  scanned     = now() - start;
+
+    // a sample of the paths is enough to know what a scan per path costs
+    size_t  n_sampled   = n_paths < 20 ? n_paths : 20;
+    start = now();
+    for (size_t i = 0; i < n_sampled; i++) tar_exists(archive, names[i * (n_paths / n_sampled)]);
+    double  per_path    = (now() - start) / n_sampled;
+    tar_close(archive);
+
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+    start = now();
+    tar_query_run(archive, query, NULL, NULL, NULL);
+    double indexed = now() - start;
+    tar_close(archive);
+
+    printf("bench=query entries=%zu paths=%zu patterns=3 found=%d scanned_ms=%.3f indexed_ms=%.3f exists_ms=%.3f speedup=%.0f\n",
+           n_headers, n_paths, found, scanned * 1e3, indexed * 1e3, per_path * n_paths * 1e3, per_path * n_paths / scanned);
+    for (size_t i = 0; i < n_paths; i++) free(names[i]);
+    free(names);
+    tar_query_free(query);
+    close(fd);
+}
+
+/**
+ * Writes to path one of the two releases bench_diff() compares, of n_files files of file_size bytes. The new
+ * release changes one byte of every 50th file, drops every 100th file and adds as many.
+ * Returns a descriptor of the archive, or -1.
+ */
+static int write_release(char *path, size_t n_files, uint64_t file_size, int is_new) {
+    int             fd      = mkstemp(path);
+    uint8_t         *data   = malloc(file_size);
+    tar_writer_t    *writer;
+    char            name[64];
+    if (fd < 0 || data == NULL || tar_writer_open(fd, &writer) < 0) {
+        free(data);
+        return -1;
+    }
+
+    uint64_t seed = 1;
+    for (size_t i = 0; i < n_files; i++) {
+        for (uint64_t j = 0; j < file_size; j++) data[j] = next_random(&seed) >> 56;
+        if (is_new && i % 50 == 0) data[file_size / 2] ^= 1;
+        snprintf(name, sizeof(name), "release/dir%zu/file%zu%s.bin", i % 64, i, is_new && i % 100 == 1 ? "-new" : "");
+        tar_writer_add_buffer(writer, name, data, file_size, 0644, 1671043200 + is_new);
+    }
+    tar_writer_close(writer);
+    free(data);
+    return fd;
+}
+
+/**
+ * Compares the files of the trees old_dir and new_dir named as the files of index, the way diffing extracted
+ * releases does. Returns the number of files which differ or are missing.
+ */
+static size_t compare_trees(const tar_index_t *index, const char *old_dir, const char *new_dir, uint64_t file_size) {
+    uint8_t *buffers[2] = {malloc(file_size), malloc(file_size)};
+    size_t  n_changes   = 0;
+    char    path[TAR_PATH_MAX];
+    for (uint32_t pos = 0; pos < index->n_entries; pos++) {
+        if (index->types[pos] != REGTYPE) continue;
+        ssize_t n_read[2] = {-1, -1};
+        for (int side = 0; side < 2; side++) {
+            snprintf(path, sizeof(path), "%s/%s", side ? new_dir : old_dir, INDEX_NAME(index, pos));
+            int fd = open(path, O_RDONLY);
+            if (fd >= 0) n_read[side] = read(fd, buffers[side], file_size);
+            if (fd >= 0) close(fd);
+        }
+        n_changes += n_read[0] != n_read[1] || memcmp(buffers[0], buffers[1], file_size) != 0;
+    }
+    free(buffers[0]);
+    free(buffers[1]);
+    return n_changes;
+}
+
+/**
+ * Measures CRC32C with each kernel, then diffing two releases of n_files files of file_size bytes: extracted and
+ * compared file by file, then with tar_diff() and 1 to 8 threads, then again with the digests of the sidecars.
+ */
+static void bench_diff(size_t n_files, uint64_t file_size) {
+    size_t  data_len    = 64 << 20;
+    uint8_t *data       = malloc(data_len);
+    uint64_t seed       = 1;
+    for (size_t i = 0; i < data_len; i++) data[i] = next_random(&seed) >> 56;
+
+    const char *kernels[] = {"scalar", "sse42"};
+    for (int k = 0; k < 2; k++) {
+        int     kernel  = k ? TAR_CHECKSUM_SSE42 : TAR_CHECKSUM_SCALAR;
+        double  start   = now();
+        uint32_t crc    = crc32c_with(0, data, data_len, kernel);
+        double  elapsed = now() - start;
+        printf("bench=diff variant=crc32c_%s gb_per_sec=%.2f crc=%08x\n", kernels[k], data_len / elapsed / 1e9, crc);
+    }
+    free(data);
+
+    char            paths[2][32]    = {"/tmp/lib_tar_bench_XXXXXX", "/tmp/lib_tar_bench_XXXXXX"};
+    char            dirs[2][32]     = {"/tmp/lib_tar_extract_XXXXXX", "/tmp/lib_tar_extract_XXXXXX"};
+    char            sidecars[2][40];
+    char            command[96];
+    int             fds[2];
+    tar_archive_t   *archives[2];
+    for (int side = 0; side < 2; side++) {
+        fds[side] = write_release(paths[side], n_files, file_size, side);
+        snprintf(sidecars[side], sizeof(sidecars[side]), "%s.idx", paths[side]);
+        unlink(paths[side]);
+        if (fds[side] < 0 || mkdtemp(dirs[side]) == NULL) return;
+    }
+
+    // extracting both releases, then comparing the files of the old one with their counterparts
+    double start = now();
+    for (int side = 0; side < 2; side++) {
+        tar_open(fds[side], TAR_OPEN_INDEX, &archives[side]);
+        tar_extract(archives[side], dirs[side], 0);
+    }
+    size_t n_changes    = compare_trees(archives[0]->index, dirs[0], dirs[1], file_size);
+    double extracted    = now() - start;
+    printf("bench=diff variant=extract changes=%zu ms=%.1f\n", n_changes, extracted * 1e3);
+    for (int side = 0; side < 2; side++) {
+        tar_close(archives[side]);
+        snprintf(command, sizeof(command), "rm -rf %s", dirs[side]);
+        if (system(command) != 0) perror(command);
+    }
+
+    for (unsigned n_threads = 1; n_threads <= 8; n_threads *= 2) {
+        for (int side = 0; side < 2; side++) tar_open(fds[side], TAR_OPEN_INDEX, &archives[side]);
+        start           = now();
+        int     ret     = tar_diff(archives[0], archives[1], n_threads, NULL, NULL);
+        double  elapsed = now() - start;
+        printf("bench=diff variant=tar_diff threads=%u changes=%d ms=%.1f mb_per_sec=%.0f speedup=%.1f\n", n_threads, ret,
+               elapsed * 1e3, 2 * n_files * file_size / elapsed / 1e6, extracted / elapsed);
+        for (int side = 0; side < 2; side++) tar_close(archives[side]);
+    }
+
+    // the first diff of handles opened on sidecars writes the digests the second one reads
+    for (int pass = 0; pass < 2; pass++) {
+        for (int side = 0; side < 2; side++) tar_open_sidecar(fds[side], sidecars[side], &archives[side]);
+        start           = now();
+        int     ret     = tar_diff(archives[0], archives[1], 0, NULL, NULL);
+        double  elapsed = now() - start;
+        printf("bench=diff variant=%s changes=%d ms=%.1f speedup=%.1f\n", pass ? "cached_digests" : "sidecar", ret,
+               elapsed * 1e3, extracted / elapsed);
+        for (int side = 0; side < 2; side++) tar_close(archives[side]);
+    }
+
+    for (int side = 0; side < 2; side++) {
+        unlink(sidecars[side]);
+        close(fds[side]);
+    }
+}
+
+/**
+ * Releases the paths of a generated archive.
+ */
+static void free_generated(generated_t *generated) {
+    for (size_t i = 0; i < generated->n_files; i++)    free(generated->files[i]);
+    for (size_t i = 0; i < generated->n_dirs; i++)     free(generated->dirs[i]);
+    for (size_t i = 0; i < generated->n_links; i++)    free(generated->links[i]);
+    free(generated->files);
+    free(generated->dirs);
+    free(generated->links);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Prints the measures of n_ops calls of op, from their latencies in seconds, which get sorted, and from the
+ * number of read system calls and of bytes read by all of them.
+ */
+static void print_ops(const char *shape, const char *op, double *latencies, size_t n_ops, uint64_t syscalls, uint64_t bytes) {
+    double total = 0;
+    for (size_t i = 0; i < n_ops; i++) total += latencies[i];
+    qsort(latencies, n_ops, sizeof(double), compare_doubles);
+    printf("bench=suite shape=%s op=%s ops=%zu ops_per_sec=%.0f p50_us=%.1f p99_us=%.1f syscalls_per_op=%.2f bytes_per_op=%.0f\n",
+           shape, op, n_ops, n_ops / total, latencies[n_ops / 2] * 1e6, latencies[n_ops * 99 / 100] * 1e6,
+           (double) syscalls / n_ops, (double) bytes / n_ops);
+}
+
+/* Operations timed by bench_suite() */
+#define SUITE_CHECK_ARCHIVE 0
+#define SUITE_EXISTS        1
+#define SUITE_IS_DIR        2
+#define SUITE_LIST          3
+#define SUITE_READ_FILE     4
+
+/**
+ * Times n_ops calls of each operation of the scanning API on archives of several shapes, each call on an
+ * entry picked at random, the same ones from one run to the next.
+ */
+static void bench_suite(size_t n_ops) {
+    static const archive_shape_t shapes[] = {
+        {"flat",    20000,  4096,       SIZES_UNIFORM,  1,  0.0},
+        {"deep",    20000,  4096,       SIZES_UNIFORM,  12, 0.05},
+        {"links",   20000,  16384,      SIZES_LOG,      4,  0.3},
+        {"large",   1000,   1 << 20,    SIZES_LOG,      3,  0.02},
+    };
+    static const char   *ops[]      = {"check_archive", "exists", "is_dir", "list", "read_file"};
+    double              *latencies  = malloc(n_ops * sizeof(double));
+    char                *entries[64];
+    for (int i = 0; i < 64; i++) entries[i] = malloc(101);
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        const archive_shape_t   *shape      = &shapes[s];
+        char                    path[]      = "/tmp/lib_tar_bench_XXXXXX";
+        generated_t             generated;
+        close(mkstemp(path));
+        int                     fd          = generate_archive(path, shape, 1, &generated);
+        uint8_t                 *buffer     = malloc(shape->max_size + 1);
+        size_t                  n_entries   = generated.n_files + generated.n_dirs + generated.n_links;
+        unlink(path);
+        if (fd < 0) {
+            perror("generate_archive");
+            continue;
+        }
+
+        for (int op = SUITE_CHECK_ARCHIVE; op <= SUITE_READ_FILE; op++) {
+            uint64_t    seed        = 2;
+            int         failed      = 0;
+            uint64_t    syscalls    = read_syscalls();
+            uint64_t    bytes       = read_bytes();
+            for (size_t i = 0; i < n_ops; i++) {
+                // the entry of the call, among all of them for exists()
+                uint64_t    pick    = next_random(&seed) % n_entries;
+                char        *file   = generated.files[pick % generated.n_files];
+                char        *dir    = generated.dirs[pick % generated.n_dirs];
+                char        *any    = pick < generated.n_files ? file
+                                      : pick < generated.n_files + generated.n_dirs ? generated.dirs[pick - generated.n_files]
+                                      : generated.links[pick - generated.n_files - generated.n_dirs];
+                size_t      len     = shape->max_size + 1;
+                size_t      n_list  = 64;
+
+                double start = now();
+                switch (op) {
+                    case SUITE_CHECK_ARCHIVE:   failed += check_archive(fd) != (int) n_entries;     break;
+                    case SUITE_EXISTS:          failed += !exists(fd, any);                         break;
+                    case SUITE_IS_DIR:          failed += !is_dir(fd, dir);                         break;
+                    case SUITE_LIST:            failed += !list(fd, dir, entries, &n_list);         break;
+                    case SUITE_READ_FILE:       failed += read_file(fd, file, 0, buffer, &len) != 0; break;
+                }
+                latencies[i] = now() - start;
+            }
+            syscalls    = read_syscalls() - syscalls;
+            bytes       = read_bytes() - bytes;
+            print_ops(shape->name, ops[op], latencies, n_ops, syscalls, bytes);
+            if (failed > 0) printf("bench=suite shape=%s op=%s failed=%d\n", shape->name, ops[op], failed);
+        }
+
+        free(buffer);
+        free_generated(&generated);
+        close(fd);
+    }
+
+    for (int i = 0; i < 64; i++) free(entries[i]);
+    free(latencies);
+}
+
+/**
+ * Writes an archive of the shape given on the command line, see archive_shape_t, to path.
+ * Returns zero on success, -1 otherwise.
+ */
+static int generate(int argc, char **argv) {
+    if (argc < 8) {
+        printf("Usage: %s generate path entries max_size fixed|uniform|log depth symlink_ratio [seed]\n", argv[0]);
+        return -1;
+    }
+    archive_shape_t shape;
+    generated_t     generated;
+    shape.name          = argv[2];
+    shape.n_entries     = strtoull(argv[3], NULL, 10);
+    shape.max_size      = strtoull(argv[4], NULL, 10);
+    shape.sizes         = strcmp(argv[5], "fixed") == 0 ? SIZES_FIXED : strcmp(argv[5], "log") == 0 ? SIZES_LOG : SIZES_UNIFORM;
+    shape.depth         = (unsigned) atoi(argv[6]);
+    shape.symlink_ratio = atof(argv[7]);
+
+    int fd = generate_archive(argv[2], &shape, argc > 8 ? strtoull(argv[8], NULL, 10) : 1, &generated);
+    if (fd < 0) {
+        perror(argv[2]);
+        return -1;
+    }
+    printf("bench=generate path=%s files=%zu dirs=%zu links=%zu bytes=%lld\n", argv[2], generated.n_files, generated.n_dirs,
+           generated.n_links, (long long) lseek(fd, 0, SEEK_END));
+    free_generated(&generated);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "all";
+    if (strcmp(name, "generate") == 0) return generate(argc, argv) < 0;
+
+    if (strcmp(name, "all") == 0 || strcmp(name, "checksum") == 0)         bench_checksum(1 << 12, 400);
+    if (strcmp(name, "all") == 0 || strcmp(name, "decode") == 0)           bench_decode(1 << 12, 400);
+    if (strcmp(name, "all") == 0 || strcmp(name, "check_archive") == 0)    bench_check_archive(1 << 17, 10);
+    if (strcmp(name, "all") == 0 || strcmp(name, "suite") == 0)            bench_suite(100);
+    if (strcmp(name, "all") == 0 || strcmp(name, "stats") == 0)            bench_stats(1 << 16, 1 << 22);
+    if (strcmp(name, "all") == 0 || strcmp(name, "index") == 0)            bench_index(1 << 20);
+    if (strcmp(name, "all") == 0 || strcmp(name, "query") == 0)            bench_query(1 << 16, 10000);
+    if (strcmp(name, "all") == 0 || strcmp(name, "diff") == 0)             bench_diff(4096, 16 << 10);
+    if (strcmp(name, "all") == 0 || strcmp(name, "threads") == 0)          bench_threads(1 << 16);
+    if (strcmp(name, "all") == 0 || strcmp(name, "sidecar") == 0)          bench_sidecar(1 << 20);
+    if (strcmp(name, "all") == 0 || strcmp(name, "append") == 0)           bench_append(1 << 20, 100);
+    if (strcmp(name, "all") == 0 || strcmp(name, "compressed") == 0)       bench_compressed(4096, 64 << 10, 1000);
+    if (strcmp(name, "all") == 0 || strcmp(name, "stream") == 0)           bench_stream(4096, 64 << 10);
+    if (strcmp(name, "all") == 0 || strcmp(name, "cache") == 0)            bench_cache(512, 200);
+    if (strcmp(name, "all") == 0 || strcmp(name, "read_many") == 0)        bench_read_many(1 << 14, 4096, 4096);
+    if (strcmp(name, "all") == 0 || strcmp(name, "aio") == 0)              bench_aio(256, 1 << 20, 64 << 10, 4096);
+    if (strcmp(name, "all") == 0 || strcmp(name, "send") == 0)             bench_send(64, 1 << 20, 2048);
+    if (strcmp(name, "all") == 0 || strcmp(name, "extract") == 0)          bench_extract(1 << 14, 4096);
+    if (strcmp(name, "all") == 0 || strcmp(name, "writer") == 0)           bench_writer(1 << 14, 4096);
+
+    return 0;
+}
@@ -1,6 +1,10 @@
 #include "lib_tar.h"
+#include "tar_internal.h"
 
-#define NEXT_HEADER_EXISTS(fd, header) (sizeof(tar_header_t) == read(fd, &header, sizeof(header)) && header.name[0] != '\0')
+#define CHECK_BATCH_SIZE 64
+
+static int      list_page_hops(int tar_fd, const char *path, size_t *cursor, char **entries, size_t *no_entries, int hops);
+static ssize_t  read_file_hops(int tar_fd, const char *path, size_t offset, uint8_t *dest, size_t *len, int hops);
 
 /**
  * INFO 1: explanation of checksum
@@ -41,22 +45,173 @@
 */
 
 /** 
- * Function sets the file offset of the open file associated with the
- * file descriptor tar_fd to the beginning of the next header.
+ * Function validates the magic value, the version value and the checksum of a single header.
+ * Returns zero if the header is valid, or the error code check_archive() reports for it.
+*/
+int check_header(tar_header_t *header) {
+    // the magic and version fields are contiguous, compare them at once in the common case
+    static const char magic_version[TMAGLEN + TVERSLEN] = {'u', 's', 't', 'a', 'r', '\0', '0', '0'};
+    if (memcmp(header->magic, magic_version, sizeof(magic_version)) != 0
+        && memcmp(header->magic, GNU_MAGIC_VERSION, TMAGLEN + TVERSLEN) != 0) {
+        if (strncmp(header->magic,   TMAGIC,     TMAGLEN) != 0)  return -1;      // magic check
+        if (strncmp(header->version, TVERSION,   TVERSLEN) != 0) return -2;      // version check
+    }
+
+    uint64_t expected_chksum = (uint64_t) header_number(header->chksum, sizeof(header->chksum));
+    if (header_checksum(header) != expected_chksum) {
+        STAT_ADD(checksum_failures, 1);
+        return -3;
+    }
+
+    // a negative base-256 size, or one whose end wraps around, would lead the scan back to this header
+    if ((header->size[0] & 0x80) && (uint64_t) header_number(header->size, sizeof(header->size)) > ENTRY_SIZE_MAX) return -3;
+    return 0;
+}
+
+/** 
+ * Function validates a batch of headers in archive order.
+ * Returns zero if they are all valid, or the error code of the first invalid one.
+ * n_valid is set to the number of headers validated before the first invalid one.
+*/
+int check_headers(tar_header_t **headers, size_t n_headers, size_t *n_valid) {
+    size_t i;
+    for (i = 0; i < n_headers; i++) {
+        int ret = check_header(headers[i]);
+        if (ret < 0) {
+            *n_valid = i;
+            return ret;
+        }
+    }
+    *n_valid = i;
+    return 0;
+}
+
+/** 
+ * Function writes to out the normalized form of the len first bytes of path: "." components and
+ * repeated '/' are dropped and ".." components remove the previous one, never going above the root.
+ * The result has no leading nor trailing '/'.
+ * Returns the length of the result, or -1 if it does not fit in out_size bytes.
 */
-void goto_next_header(int tar_fd, tar_header_t *tar_header) {
-    uint64_t size   = strtoll(tar_header->size, NULL, 8);
-    size            += (BLOCKSIZE - (size % BLOCKSIZE)) % BLOCKSIZE;
-    lseek(tar_fd, (off_t) size, SEEK_CUR);
+ssize_t normalize_path(const char *path, size_t len, char *out, size_t out_size) {
+    size_t out_len  = 0;
+    size_t i        = 0;
+
+    while (i < len) {
+        size_t start = i;
+        while (i < len && path[i] != '/') i++;
+        size_t component_len = i - start;
+        i++;                                                    // skip the '/'
+
+        if (component_len == 0 || (component_len == 1 && path[start] == '.')) continue;
+        if (component_len == 2 && path[start] == '.' && path[start + 1] == '.') {
+            while (out_len > 0 && out[out_len - 1] != '/') out_len--;
+            if (out_len > 0) out_len--;                         // the '/' before the removed component
+            continue;
+        }
+
+        if (out_len + (out_len > 0) + component_len + 1 > out_size) return -1;
+        if (out_len > 0) out[out_len++] = '/';
+        memcpy(out + out_len, path + start, component_len);
+        out_len += component_len;
+    }
+    out[out_len] = '\0';
+    return out_len;
 }
 
 /** 
- * Function resets the file offset of the open file associated with the file descriptor
- * tar_fd to the beginning of the file and returns the value return_value.
+ * Function writes to out the normalized path of the entry a link points to.
+ * The target of a symlink is relative to the directory holding the symlink, unless it starts with
+ * a '/', while the target of a hard link is always relative to the root of the archive.
+ * Returns the length of the result, or -1 if it does not fit in out_size bytes.
 */
-int reset_and_return(int tar_fd, int return_value) {
-    lseek(tar_fd, 0, SEEK_SET);
-    return return_value;
+ssize_t link_target_path(const char *name, char typeflag, const char *linkname, char *out, size_t out_size) {
+    char    joined[TAR_PATH_MAX];
+    size_t  base_len    = 0;
+    size_t  link_len    = strlen(linkname);
+
+    if (typeflag == SYMTYPE && linkname[0] != '/') {
+        // the directory of the symlink: its name without its last component
+        base_len = strlen(name);
+        while (base_len > 0 && name[base_len - 1] == '/') base_len--;
+        while (base_len > 0 && name[base_len - 1] != '/') base_len--;
+    }
+
+    if (base_len + link_len + 1 > sizeof(joined)) return -1;
+    memcpy(joined, name, base_len);
+    memcpy(joined + base_len, linkname, link_len);
+    return normalize_path(joined, base_len + link_len, out, out_size);
+}
+
+/** 
+ * Function writes to target the path the link described by entry points to.
+ * Returns the length of the path, or -1 if it is too long.
+*/
+static ssize_t header_link_target(const tar_entry_t *entry, char *target) {
+    return link_target_path(entry->name, entry->typeflag, entry->linkname, target, TAR_PATH_MAX);
+}
+
+/** 
+ * Function tells if entry is a link met along the path_len first bytes of path: a link at path itself,
+ * or one to a directory leading to the rest of it, like folder_sym for folder_sym/README.md.
+*/
+static int link_along(const tar_entry_t *entry, const char *path, size_t path_len) {
+    size_t len = strlen(entry->name);
+    return (entry->typeflag == SYMTYPE || entry->typeflag == LNKTYPE) && len > 0 && len <= path_len
+        && memcmp(entry->name, path, len) == 0 && (len == path_len || path[len] == '/');
+}
+
+/** 
+ * Function writes to out the path_len first bytes of path, with the link described by entry, met along
+ * them, replaced by its target. This is how tar_index.c resolves links too, so that both agree.
+ * Returns the length of the result, or -1 if it is too long.
+*/
+static ssize_t follow_link(const tar_entry_t *entry, const char *path, size_t path_len, char *out) {
+    ssize_t     target_len  = header_link_target(entry, out);
+    const char  *rest       = path + strlen(entry->name);
+    size_t      rest_len    = path + path_len - rest;
+    if (target_len == 0 && rest_len > 0) {
+        // a link to the root
+        rest++;
+        rest_len--;
+    }
+    if (target_len < 0 || target_len + rest_len + 1 > TAR_PATH_MAX) return -1;
+
+    memcpy(out + target_len, rest, rest_len);
+    out[target_len + rest_len] = '\0';
+    return target_len + rest_len;
+}
+
+/* Outcomes of scan_path() */
+#define PATH_FOUND  0       /* the scanner is on the entry at the path */
+#define PATH_LINK   1       /* a link at the path or along it was met */
+#define PATH_NONE   2       /* neither */
+
+/** 
+ * Function scans the archive for the entry at the path_len first bytes of path, with or without a trailing '/'.
+ * That entry comes first, the link along the path nearest the root being followed only when there is none, the
+ * way tar_index.c resolves paths, so that a symlink d does not hide a later d/f.
+ * Returns PATH_FOUND with the scanner on that entry, PATH_LINK with out, TAR_PATH_MAX bytes long, set to the
+ * path the link leads to and out_len to its length, or -1 if it is too long, or PATH_NONE.
+*/
+static int scan_path(tar_scanner_t *scanner, const char *path, size_t path_len, char *out, ssize_t *out_len) {
+    size_t along_len = 0;                   // length of the name of the link along path written to out, if any
+
+    while (scanner_next(scanner) != NULL) {
+        const tar_entry_t   *entry  = &scanner->entry;
+        size_t              len     = strlen(entry->name);
+        int                 is_link = entry->typeflag == SYMTYPE || entry->typeflag == LNKTYPE;
+
+        if (strncmp(entry->name, path, path_len) == 0 && (len == path_len || (len == path_len + 1 && entry->name[path_len] == '/'))) {
+            if (!is_link || len != path_len) return PATH_FOUND;
+            *out_len = follow_link(entry, path, path_len, out);
+            return PATH_LINK;
+        }
+        if (link_along(entry, path, path_len) && (along_len == 0 || len < along_len)) {
+            along_len   = len;
+            *out_len    = follow_link(entry, path, path_len, out);
+        }
+    }
+    return along_len > 0 ? PATH_LINK : PATH_NONE;
 }
 
 /**
@@ -66,6 +221,8 @@ int reset_and_return(int tar_fd, int return_value) {
  *  - a magic value of "ustar" and a null,
  *  - a version value of "00" and no null,
  *  - a correct checksum
+ * Headers written by GNU tar, with a magic value of "ustar " and a version value of " " and a null, are valid too.
+ * Extended headers (PAX 'x' and 'g', GNU 'L' and 'K') are validated and counted like any other header.
  *
  * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
  *
@@ -75,27 +232,23 @@ int reset_and_return(int tar_fd, int return_value) {
  *         -3 if the archive contains a header with an invalid checksum value
  */
 int check_archive(int tar_fd) {
-    tar_header_t header;
-    int n_headers = 0;
-    
-    while (NEXT_HEADER_EXISTS(tar_fd, header)) {
-        if (strncmp(header.magic,   TMAGIC,     TMAGLEN) != 0)  return reset_and_return(tar_fd, -1);      // magic check
-        if (strncmp(header.version, TVERSION,   TVERSLEN) != 0) return reset_and_return(tar_fd, -2);      // version check
-
-        uint64_t sum                = 0;
-        uint64_t expected_chksum    = strtoll(header.chksum, NULL, 8);
-        
-        int i;
-        char *header_char = (char *) &header;
-        for (i = 0; i < sizeof(header); i++)        sum += *(header_char + i);   // checksum
-        for (i = 0; i < sizeof(header.chksum); i++) sum -= ((uint8_t) header.chksum[i] - (uint8_t) ' ');
-
-        if (sum != expected_chksum) return reset_and_return(tar_fd, -3);
-        n_headers++;                                                  // number of headers
-
-        goto_next_header(tar_fd, &header);
+    tar_scanner_t   scanner;
+    tar_header_t    *batch[CHECK_BATCH_SIZE];
+    size_t          n_batch;
+    int             n_headers = 0;
+
+    // validate the headers by batches of the ones sitting in the same buffer
+    scanner_init(&scanner, tar_fd);
+    while ((n_batch = scanner_next_batch(&scanner, batch, CHECK_BATCH_SIZE)) > 0) {
+        size_t  n_valid;
+        int     ret = check_headers(batch, n_batch, &n_valid);
+        n_headers   += n_valid;                                       // number of headers
+        if (ret < 0) return scanner_return(&scanner, ret);
     }
-    return reset_and_return(tar_fd, n_headers);
+
+    // a pipe or a socket fails the very first read, it is read strictly forward instead
+    if (scanner.unseekable) return scanner_return(&scanner, stream_check(tar_fd, NULL, NULL, NULL, 1));
+    return scanner_return(&scanner, n_headers + (int) scanner.n_extensions);     // extended headers count too
 }
 
 /**
@@ -108,13 +261,14 @@ int check_archive(int tar_fd) {
  *         any other value otherwise.
  */
 int exists(int tar_fd, char *path) {
-    tar_header_t header;
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
 
-    while (NEXT_HEADER_EXISTS(tar_fd, header)) {
-        if (strcmp(header.name, path) == 0) return reset_and_return(tar_fd, 1);
-        goto_next_header(tar_fd, &header);
+    scanner_init(&scanner, tar_fd);
+    while ((header = scanner_next(&scanner)) != NULL) {
+        if (strcmp(scanner.entry.name, path) == 0) return scanner_return(&scanner, 1);
     }
-    return reset_and_return(tar_fd, 0);
+    return scanner_return(&scanner, 0);
 }
 
 /**
@@ -127,13 +281,14 @@ int exists(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_dir(int tar_fd, char *path) {
-    tar_header_t header;
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
 
-    while (NEXT_HEADER_EXISTS(tar_fd, header)) {
-        if (strcmp(header.name, path) == 0 && header.typeflag == DIRTYPE) return reset_and_return(tar_fd, 1);
-        goto_next_header(tar_fd, &header);
+    scanner_init(&scanner, tar_fd);
+    while ((header = scanner_next(&scanner)) != NULL) {
+        if (strcmp(scanner.entry.name, path) == 0 && header->typeflag == DIRTYPE) return scanner_return(&scanner, 1);
     }
-    return reset_and_return(tar_fd, 0);
+    return scanner_return(&scanner, 0);
 }
 
 /**
@@ -146,13 +301,14 @@ int is_dir(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_file(int tar_fd, char *path) {
-    tar_header_t header;
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
 
-    while (NEXT_HEADER_EXISTS(tar_fd, header)) {
-        if(strcmp(header.name, path) == 0 && (header.typeflag == REGTYPE || header.typeflag == AREGTYPE)) return reset_and_return(tar_fd, 1);
-        goto_next_header(tar_fd, &header);
+    scanner_init(&scanner, tar_fd);
+    while ((header = scanner_next(&scanner)) != NULL) {
+        if (strcmp(scanner.entry.name, path) == 0 && (header->typeflag == REGTYPE || header->typeflag == AREGTYPE)) return scanner_return(&scanner, 1);
     }
-    return reset_and_return(tar_fd, 0);
+    return scanner_return(&scanner, 0);
 }
 
 /**
@@ -164,13 +320,14 @@ int is_file(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_symlink(int tar_fd, char *path) {
-    tar_header_t header;
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
 
-    while (NEXT_HEADER_EXISTS(tar_fd, header)) {
-        if(strcmp(header.name, path) == 0 && header.typeflag == SYMTYPE) return reset_and_return(tar_fd, 1);
-        goto_next_header(tar_fd, &header);
+    scanner_init(&scanner, tar_fd);
+    while ((header = scanner_next(&scanner)) != NULL) {
+        if (strcmp(scanner.entry.name, path) == 0 && header->typeflag == SYMTYPE) return scanner_return(&scanner, 1);
     }
-    return reset_and_return(tar_fd, 0);
+    return scanner_return(&scanner, 0);
 }
 
 
@@ -187,67 +344,112 @@ int is_symlink(int tar_fd, char *path) {
  *   └── e/
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
- * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry. Symlinks to the directories leading to it are followed too.
  * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
  * @param no_entries An in-out argument.
  *                   The caller set it to the number of entries in `entries`.
  *                   The callee set it to the number of entries listed.
  *
  * @return zero if no directory at the given path exists in the archive,
+ *         -1 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles,
  *         any other value otherwise.
  */
 int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
-    char            real_path[100];
-    tar_header_t    header;
+    size_t cursor = 0;
+    return list_page(tar_fd, path, &cursor, entries, no_entries);
+}
+
+/**
+ * Lists a page of the entries at a given path in the archive.
+ * Entries are listed in archive order, starting with the one at position *cursor.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry. Symlinks to the directories leading to it are followed too.
+ * @param cursor An in-out argument.
+ *               The caller set it to zero to list the first page, or leaves the value of the previous call.
+ *               The callee advances it past the entries listed.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         1 if the last entry of the directory was listed,
+ *         2 if entries are left to be listed from the updated cursor,
+ *         -1 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles.
+ */
+int list_page(int tar_fd, char *path, size_t *cursor, char **entries, size_t *no_entries) {
+    return list_page_hops(tar_fd, path, cursor, entries, no_entries, 0);
+}
+
+/** 
+ * Function implements list_page(), hops being the number of links followed to reach path.
+*/
+static int list_page_hops(int tar_fd, const char *path, size_t *cursor, char **entries, size_t *no_entries, int hops) {
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
     int             return_value        = 0;
+    size_t          n_children          = 0;
     const size_t    expected_no_entries = *no_entries;
     *no_entries                         = 0;
     size_t          path_len            = strlen(path);
 
-    // verify if there is a '/' character at the end of the path
-    // if there is, remove it
-    strcpy(real_path, path);
-    if (real_path[path_len - 1] == '/') real_path[path_len - 1] = '\0';
-    size_t real_path_len = strlen(real_path);
-    
-    while (NEXT_HEADER_EXISTS(tar_fd, header) && *no_entries < expected_no_entries) {
-        // if the name is found and it is a symlink, resolve it
-        if (strcmp(header.name, real_path) == 0 && (header.typeflag == SYMTYPE || header.typeflag == LNKTYPE)) {
-            // reset the read pointer to the beginning of the file,
+    // verify if there are '/' characters at the end of the path
+    // if there are, ignore them
+    while (path_len > 0 && path[path_len - 1] == '/') path_len--;
+    // children of the root have no prefix, children of "dir" are prefixed by "dir/"
+    size_t prefix_len = path_len ? path_len + 1 : 0;
+
+    scanner_init(&scanner, tar_fd);
+    while ((header = scanner_next(&scanner)) != NULL) {
+        const char  *name   = scanner.entry.name;
+        size_t      len     = strlen(name);
+
+        // if the name is found and it is a symlink, or a symlink to a directory leading to it, resolve it
+        if (link_along(&scanner.entry, path, path_len)) {
             // set no_entries to its original value
             // recurse to the linked directory
-            lseek(tar_fd, 0, SEEK_SET);
+            char target[TAR_PATH_MAX];
+            if (hops == TAR_MAX_LINK_HOPS)                                      return scanner_return(&scanner, -1);
+            if (follow_link(&scanner.entry, path, path_len, target) < 0)        return scanner_return(&scanner, 0);
+            scanner_free(&scanner);
+            STAT_ADD(link_hops, 1);
             *no_entries = expected_no_entries;
-            return list(tar_fd, header.linkname, entries, no_entries);
+            return list_page_hops(tar_fd, target, cursor, entries, no_entries, hops + 1);
         }
 
-        char temp_str[100] = {0};
-        strcpy(temp_str, header.name);
-        // if the name is found
-        if (strcmp(dirname(temp_str), real_path) == 0) {
-            // if the complete path of the found name is greater than the path we are looking for
-            if (strlen(header.name) > real_path_len + 1) {
-                // add the filename to the entries array
-                memcpy(entries[*no_entries], header.name, strlen(header.name));
-                (*no_entries)++;
-            } else if (header.typeflag != DIRTYPE) {
-                return reset_and_return(tar_fd, 0);
-            } else {
-                return_value = 1;
-            }
+        if (path_len && (strncmp(name, path, path_len) != 0 || name[path_len] != '/')) continue;
+        if (len == prefix_len) {
+            // the directory itself
+            if (header->typeflag == DIRTYPE) return_value = 1;
+            continue;
         }
 
-        goto_next_header(tar_fd, &header);
+        // only direct children, which have no '/' past the prefix but a trailing one
+        const char *slash = strchr(name + prefix_len, '/');
+        if (slash != NULL && slash[1] != '\0') continue;
+
+        return_value = 1;
+        if (n_children++ < *cursor) continue;                   // listed in a previous page
+        if (*no_entries == expected_no_entries) {
+            return_value = 2;                                   // left for the next page
+            break;
+        }
+
+        // add the filename to the entries array
+        memcpy(entries[*no_entries], name, len + 1);
+        (*no_entries)++;
     }
 
-    return reset_and_return(tar_fd, return_value);
+    *cursor += *no_entries;
+    return scanner_return(&scanner, return_value);
 }
 
 /**
  * Reads a file at a given path in the archive.
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
- * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry. Symlinks to the directories leading to it are followed too.
  * @param offset An offset in the file from which to start reading from, zero indicates the start of the file.
  * @param dest A destination buffer to read the given file into.
  * @param len An in-out argument.
@@ -256,34 +458,80 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
  *
  * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
  *         -2 if the offset is outside the file total length,
+ *         -3 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles,
  *         zero if the file was read in its entirety into the destination buffer,
  *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
  *         the end of the file.
  *
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) {
-    tar_header_t header;
+    return read_file_hops(tar_fd, path, offset, dest, len, 0);
+}
 
-    if((!is_file(tar_fd, path) && !is_symlink(tar_fd, path))) return reset_and_return(tar_fd, -1);
+/**
+ * Function finds the regular file at path by scanning the archive, following links like read_file().
+ * Sets data_offset and size to the ones of its data.
+ * Returns zero on success, -1 if there is no such file, or -3 if too many links were followed.
+*/
+int find_file(int tar_fd, const char *path, uint64_t *data_offset, uint64_t *size) {
+    tar_scanner_t   scanner;
+    char            paths[2][TAR_PATH_MAX];
+    size_t          path_len = strlen(path);
+
+    for (int hops = 0; ; hops++) {
+        // the target of each hop is written in turn to one of the paths, the previous one being read
+        char    *target = paths[hops % 2];
+        ssize_t target_len;
+        scanner_init(&scanner, tar_fd);
+        int     found   = scan_path(&scanner, path, path_len, target, &target_len);
+        if (found == PATH_NONE)         return scanner_return(&scanner, -1);
+        if (found == PATH_FOUND)        break;
+
+        if (hops == TAR_MAX_LINK_HOPS)  return scanner_return(&scanner, -3);
+        if (target_len < 0)             return scanner_return(&scanner, -1);
+        scanner_free(&scanner);
+        STAT_ADD(link_hops, 1);
+        path        = target;
+        path_len    = target_len;
+    }
+    if (scanner.entry.typeflag != REGTYPE && scanner.entry.typeflag != AREGTYPE) return scanner_return(&scanner, -1);
 
-    while (NEXT_HEADER_EXISTS(tar_fd, header)) {
-        if (strcmp(header.name, path) == 0 && header.typeflag == SYMTYPE) return read_file(tar_fd, header.linkname, offset, dest, len);
+    *data_offset    = scanner.entry.data_offset;
+    *size           = scanner.entry.size;
+    return scanner_return(&scanner, 0);
+}
 
-        if(strcmp(header.name, path) == 0) {
-            uint64_t size = strtoll(header.size, NULL, 8);
-            if(offset > size) return reset_and_return(tar_fd, -2);
-            
-            // read maximum possible
-            if(*len >= size - offset) *len = size - offset; 
+/** 
+ * Function implements read_file(), hops being the number of links followed to reach path.
+*/
+static ssize_t read_file_hops(int tar_fd, const char *path, size_t offset, uint8_t *dest, size_t *len, int hops) {
+    tar_scanner_t   scanner;
+    char            target[TAR_PATH_MAX];
+    ssize_t         target_len;
+
+    scanner_init(&scanner, tar_fd);
+    int found = scan_path(&scanner, path, strlen(path), target, &target_len);
+    if (found == PATH_NONE) return scanner_return(&scanner, -1);
+
+    // resolve links to their target, relative to the symlink for symlinks, the ones to the directories
+    // leading to the file included
+    if (found == PATH_LINK) {
+        if (hops == TAR_MAX_LINK_HOPS)  return scanner_return(&scanner, -3);
+        if (target_len < 0)             return scanner_return(&scanner, -1);
+        scanner_free(&scanner);
+        STAT_ADD(link_hops, 1);
+        return read_file_hops(tar_fd, target, offset, dest, len, hops + 1);
+    }
+    if (scanner.entry.typeflag != REGTYPE && scanner.entry.typeflag != AREGTYPE) return scanner_return(&scanner, -1);
 
-            lseek(tar_fd, (off_t) offset, SEEK_CUR);
-            read(tar_fd, dest, *len);
+    uint64_t size = scanner.entry.size;
+    if(offset > size) return scanner_return(&scanner, -2);
+    
+    // read maximum possible
+    if(*len >= size - offset) *len = size - offset; 
 
-            return reset_and_return(tar_fd, size - offset - *len);
-            // return size - offset - *len;
-        }
+    *len = scanner_read(&scanner, scanner.entry.data_offset + offset, dest, *len);
 
-        goto_next_header(tar_fd, &header);
-    }
-    return reset_and_return(tar_fd, 0);
+    scanner_free(&scanner);
+    return size - offset - *len;
 }
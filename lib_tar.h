@@ -42,10 +42,157 @@ typedef struct posix_header
 #define LNKTYPE  '1'            /* link */
 #define SYMTYPE  '2'            /* reserved */
 #define DIRTYPE  '5'            /* directory */
+#define XHDTYPE  'x'            /* extended header of the next entry */
+#define XGLTYPE  'g'            /* global extended header */
+
+/* Values used in typeflag field by GNU tar.  */
+#define GNUTYPE_LONGNAME 'L'    /* long name of the next entry */
+#define GNUTYPE_LONGLINK 'K'    /* long link name of the next entry */
+
+/* Maximum number of links followed to resolve a path, past it the links are considered to form a cycle */
+#define TAR_MAX_LINK_HOPS 40
 
 /* Converts an ASCII-encoded octal-based number into a regular integer */
 #define TAR_INT(char_ptr) strtol(char_ptr, NULL, 8)
 
+/* In-memory index of the entries of an archive, see tar_index_build() */
+typedef struct tar_index tar_index_t;
+
+/* Handle on an archive shared by many threads, see tar_open() */
+typedef struct tar_archive tar_archive_t;
+
+/* Flags of tar_open() */
+#define TAR_OPEN_INDEX          1       /* index the archive when opening it */
+
+/* A read of a batch, see tar_read_many() */
+typedef struct tar_read_request
+{
+    const char  *path;          /* path of the file to read */
+    size_t      offset;         /* offset in the file of the first byte to read */
+    uint8_t     *dest;          /* destination buffer */
+    size_t      len;            /* size of the destination buffer, set to the number of bytes read */
+    ssize_t     ret;            /* set to the value read_file() would have returned */
+} tar_read_request_t;
+
+/* Asynchronous reader of an archive, see tar_aio_open() */
+typedef struct tar_aio tar_aio_t;
+
+/* Called when an asynchronous read completes, with the user_data given to tar_aio_submit() */
+typedef void (*tar_aio_callback_t)(tar_read_request_t *request, void *user_data);
+
+/* Backends of tar_aio_open(), also accepted as flags to force the thread pool */
+#define TAR_AIO_URING           1       /* io_uring */
+#define TAR_AIO_THREADS         2       /* a pool of threads performing blocking reads */
+
+/* Formats of archives, see tar_source_attach() */
+#define TAR_FORMAT_RAW          0       /* an uncompressed archive */
+#define TAR_FORMAT_GZIP         1       /* a gzip stream, of one or more members */
+#define TAR_FORMAT_ZSTD         2       /* a zstd stream, of one or more frames, if built with TAR_WITH_ZSTD */
+
+/* Writer of an archive, see tar_writer_open() */
+typedef struct tar_writer tar_writer_t;
+
+/* Counters of the cache of a handle, see tar_cache_stats() */
+typedef struct tar_cache_stats
+{
+    uint64_t hits;              /* blocks read from the cache */
+    uint64_t misses;            /* blocks read from the archive */
+    uint64_t lookup_hits;       /* paths found in the cache */
+    uint64_t lookup_misses;     /* paths looked up by scanning the archive */
+    uint64_t evictions;         /* cached blocks and paths dropped to make room for others */
+} tar_cache_stats_t;
+
+/* Most bytes an entry costs in the fixed-size arrays of an index and its hash table, see tar_index_memory() */
+#define TAR_INDEX_ENTRY_BYTES   62
+
+/* Memory held by an index, see tar_index_memory() */
+typedef struct tar_index_memory
+{
+    uint64_t n_entries;
+    uint64_t entry_bytes;       /* fixed-size fields of the entries, and their hash table */
+    uint64_t string_bytes;      /* string pool: names, link names and normalized link targets */
+    uint64_t tree_bytes;        /* directory tree */
+    uint64_t resident_bytes;    /* memory actually held, used or not, or the size of the sidecar it was loaded from */
+    uint64_t allocations;       /* allocations and mappings the index holds */
+} tar_index_memory_t;
+
+/* Functions of a handle whose latency tar_get_stats() reports */
+#define TAR_API_EXISTS          0       /* tar_exists() */
+#define TAR_API_IS_DIR          1       /* tar_is_dir() */
+#define TAR_API_IS_FILE         2       /* tar_is_file() */
+#define TAR_API_IS_SYMLINK      3       /* tar_is_symlink() */
+#define TAR_API_LIST            4       /* tar_list() and tar_list_page() */
+#define TAR_API_READ_FILE       5       /* tar_read_file() */
+#define TAR_API_READ_MANY       6       /* tar_read_many() */
+#define TAR_API_EXTRACT         7       /* tar_extract() */
+#define TAR_API_QUERY           8       /* tar_query_run() */
+#define TAR_API_DIFF            9       /* tar_diff(), counted in the statistics of the old handle */
+#define TAR_API_SEND_ENTRY      10      /* tar_send_entry() */
+#define TAR_API_COUNT           11
+
+/* Number of buckets of a latency histogram, bucket i counting the calls which took less than 2^i ns */
+#define TAR_LATENCY_BUCKETS     40
+
+/* Counters of a handle, see tar_get_stats() */
+typedef struct tar_stats
+{
+    uint64_t headers;           /* headers parsed, extended headers included */
+    uint64_t checksum_failures; /* headers with an invalid checksum */
+    uint64_t bytes_read;        /* bytes read from the archive */
+    uint64_t syscalls;          /* reads of the archive */
+    uint64_t seeks;             /* reads not starting where the previous one of the same call ended */
+    uint64_t link_hops;         /* links followed to resolve paths */
+    uint64_t cache_hits;        /* blocks and paths found in the cache of the handle */
+    uint64_t cache_misses;      /* blocks and paths the cache of the handle did not hold */
+    uint64_t latency[TAR_API_COUNT][TAR_LATENCY_BUCKETS];   /* number of calls of each function, by duration */
+} tar_stats_t;
+
+/* Iterator over the entries of an archive, see tar_iter_open() */
+typedef struct tar_iter tar_iter_t;
+
+/* An entry of an archive, with its header fields decoded */
+typedef struct tar_entry
+{
+    const char  *name;              /* null terminated path of the entry */
+    const char  *linkname;          /* null terminated target of a link, empty otherwise */
+    uint64_t    size;               /* size of the data in bytes */
+    uint64_t    mtime;              /* modification time, in seconds since the epoch */
+    uint32_t    mode;               /* permission bits */
+    char        typeflag;           /* one of the *TYPE values */
+    uint64_t    header_offset;      /* offset of the header block in the archive */
+    uint64_t    data_offset;        /* offset of the first data block in the archive */
+} tar_entry_t;
+
+/* A set of exact paths and glob patterns answered together, see tar_query_run() */
+typedef struct tar_query tar_query_t;
+
+/* Called by tar_query_run() for each query matching an entry, with the position of the query in its set */
+typedef int (*tar_query_callback_t)(size_t query, const tar_entry_t *entry, void *user_data);
+
+/* Whether query i of a set matched, given the bitmap filled by tar_query_run() */
+#define TAR_QUERY_FOUND(found, i) (((found)[(i) / 8] >> ((i) % 8)) & 1)
+
+/* Changes between two archives, see tar_diff() */
+#define TAR_DIFF_ADDED          1       /* an entry only the new archive has */
+#define TAR_DIFF_REMOVED        2       /* an entry only the old archive has */
+#define TAR_DIFF_MODIFIED       3       /* an entry whose data, link target or mode changed */
+#define TAR_DIFF_TYPE_CHANGED   4       /* an entry replaced by another kind of entry, like a file by a directory */
+
+/* Called by tar_diff() for each change, old_entry being NULL for an added entry and new_entry for a removed one */
+typedef int (*tar_diff_callback_t)(int change, const tar_entry_t *old_entry, const tar_entry_t *new_entry, void *user_data);
+
+/* Called by tar_stream_check() at the start of each entry with no data, then with each chunk of its data */
+typedef void (*tar_stream_callback_t)(const tar_entry_t *entry, const uint8_t *data, size_t len, void *user_data);
+
+/* Memory-mapped archive, see tar_open_mmap() */
+typedef struct tar_mmap tar_mmap_t;
+
+/* Values used as advice for tar_mmap_advise() */
+#define TAR_ADVICE_NORMAL       0       /* no particular access pattern */
+#define TAR_ADVICE_SEQUENTIAL   1       /* the archive is read from start to end */
+#define TAR_ADVICE_RANDOM       2       /* entries are read in no particular order */
+#define TAR_ADVICE_WILLNEED     3       /* the whole archive is going to be read soon */
+
 /**
  * Checks whether the archive is valid.
  *
@@ -53,13 +200,18 @@ typedef struct posix_header
  *  - a magic value of "ustar" and a null,
  *  - a version value of "00" and no null,
  *  - a correct checksum
+ * Headers written by GNU tar, with a magic value of "ustar " and a version value of " " and a null, are valid too.
+ * Extended headers (PAX 'x' and 'g', GNU 'L' and 'K') are validated and counted like any other header.
+ *
+ * A pipe or a socket is read strictly forward, as tar_stream_check() does.
  *
  * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
  *
  * @return a zero or positive value if the archive is valid, representing the number of non-null headers in the archive,
  *         -1 if the archive contains a header with an invalid magic value,
  *         -2 if the archive contains a header with an invalid version value,
- *         -3 if the archive contains a header with an invalid checksum value
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 or -5 if tar_fd is a pipe or a socket, with the same meaning as for tar_stream_check()
  */
 int check_archive(int tar_fd);
 
@@ -121,22 +273,45 @@ int is_symlink(int tar_fd, char *path);
  *   └── e/
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
- * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry. Symlinks to the directories leading to it are followed too.
  * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
  * @param no_entries An in-out argument.
  *                   The caller set it to the number of entries in `entries`.
  *                   The callee set it to the number of entries listed.
  *
  * @return zero if no directory at the given path exists in the archive,
+ *         -1 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles,
  *         any other value otherwise.
  */
 int list(int tar_fd, char *path, char **entries, size_t *no_entries);
 
+/**
+ * Lists a page of the entries at a given path in the archive, so that directories with more entries
+ * than `entries` can hold are listed over several calls instead of being truncated.
+ * Entries are listed in archive order, starting with the one at position *cursor.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry. Symlinks to the directories leading to it are followed too.
+ * @param cursor An in-out argument.
+ *               The caller set it to zero to list the first page, or leaves the value of the previous call.
+ *               The callee advances it past the entries listed.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         1 if the last entry of the directory was listed,
+ *         2 if entries are left to be listed from the updated cursor,
+ *         -1 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles.
+ */
+int list_page(int tar_fd, char *path, size_t *cursor, char **entries, size_t *no_entries);
+
 /**
  * Reads a file at a given path in the archive.
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
- * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry.
+ * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry. Symlinks to the directories leading to it are followed too.
  * @param offset An offset in the file from which to start reading from, zero indicates the start of the file.
  * @param dest A destination buffer to read the given file into.
  * @param len An in-out argument.
@@ -145,6 +320,7 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  *
  * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
  *         -2 if the offset is outside the file total length,
+ *         -3 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles,
  *         zero if the file was read in its entirety into the destination buffer,
  *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
  *         the end of the file.
@@ -152,4 +328,701 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
 
+/**
+ * Builds an in-memory index of the archive in a single scan.
+ *
+ * Every header is validated as check_archive() does while the index is being built, so a successful
+ * build also proves the archive valid. Once built, the tar_index_*() functions answer queries without
+ * scanning the archive again. A pipe or a socket is indexed strictly forward, see tar_stream_check().
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive.
+ * @param index An out argument, set to the built index on success. It must be released with tar_index_free().
+ *
+ * @return a zero or positive value on success, representing the number of indexed entries,
+ *         -1, -2 or -3 if the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the index could not be allocated,
+ *         -5 if tar_fd is a pipe or a socket which could not be read to the end of the archive.
+ */
+int tar_index_build(int tar_fd, tar_index_t **index);
+
+/**
+ * Releases an index built by tar_index_build().
+ *
+ * @param index The index to release, may be NULL.
+ */
+void tar_index_free(tar_index_t *index);
+
+/**
+ * Reports the memory held by an index.
+ *
+ * The fields of the entries are stored in one array per field, and every name in a single string pool,
+ * so that the memory of an index is bounded: entry_bytes is at most TAR_INDEX_ENTRY_BYTES per entry,
+ * plus 512 bytes. The arrays of an index grow in place in a single address range, reserved for the size of
+ * the archive, so that an index built in memory holds one allocation and one mapping, whatever its number
+ * of entries.
+ *
+ * @param index An index built by tar_index_build() or loaded by tar_index_load().
+ * @param memory An out argument, set to the memory held by the index.
+ */
+void tar_index_memory(const tar_index_t *index, tar_index_memory_t *memory);
+
+/**
+ * Index-backed versions of exists(), is_dir(), is_file() and is_symlink().
+ * They return the same values as their scanning counterparts, without any I/O.
+ *
+ * @param index An index built by tar_index_build().
+ * @param path A path to an entry in the archive.
+ */
+int tar_index_exists(const tar_index_t *index, const char *path);
+int tar_index_is_dir(const tar_index_t *index, const char *path);
+int tar_index_is_file(const tar_index_t *index, const char *path);
+int tar_index_is_symlink(const tar_index_t *index, const char *path);
+
+/**
+ * Index-backed versions of list() and list_page(), without any I/O.
+ * They only cost the number of entries listed, whatever the size of the archive. Directories with no
+ * header of their own, only known through the paths of their content, are listed like the others.
+ * The trailing '/' of the path is optional, and the empty path lists the root of the archive.
+ *
+ * @param index An index built by tar_index_build().
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive,
+ *         any other value otherwise, see list_page() for the values of tar_index_list_page().
+ */
+int tar_index_list(const tar_index_t *index, const char *path, char **entries, size_t *no_entries);
+int tar_index_list_page(const tar_index_t *index, const char *path, size_t *cursor, char **entries, size_t *no_entries);
+
+/**
+ * Index-backed version of read_file(): the entry is looked up in the index and its data is read
+ * with a single pread(), leaving the file offset of tar_fd untouched. Links are resolved when the
+ * index is built, so reading through a link costs the same as a direct read. Paths going through
+ * symlinked directories are resolved as read_file() resolves them.
+ *
+ * @param tar_fd A file descriptor of the archive the index was built from.
+ * @param index An index built by tar_index_build().
+ *
+ * The other arguments and the return value are the same as for read_file().
+ */
+ssize_t tar_index_read_file(int tar_fd, const tar_index_t *index, const char *path, size_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * Indexes the entries appended to an archive since its index was built or last updated, for instance with
+ * tar_writer_append(). Only the headers past the last indexed entry are read and validated.
+ *
+ * @param tar_fd A file descriptor of the archive the index was built from.
+ * @param index The index to update. An index loaded from a sidecar is copied out of it first.
+ *
+ * @return a zero or positive value on success, representing the number of indexed entries,
+ *         -1, -2 or -3 if a new header is invalid, with the same meaning as for check_archive(); the index then
+ *         holds the new entries before it,
+ *         -4 if the index could not be grown.
+ */
+int tar_index_update(int tar_fd, tar_index_t *index);
+
+/**
+ * Reads several files of an indexed archive at once, see tar_read_many().
+ *
+ * @return the same values as tar_read_many().
+ */
+int tar_index_read_many(int tar_fd, const tar_index_t *index, tar_read_request_t *requests, size_t n_requests);
+
+/**
+ * Extracts every entry of an indexed archive under a directory, see tar_extract().
+ *
+ * @return the same values as tar_extract().
+ */
+int tar_index_extract(int tar_fd, const tar_index_t *index, const char *dest_dir, unsigned n_threads);
+
+/**
+ * Writes an index to a sidecar file (e.g. "archive.tar.idx"), to be loaded by tar_index_load().
+ *
+ * The sidecar records the size and modification time of the archive and a checksum of its header
+ * region, so that a sidecar which does not match the archive anymore is detected when loaded.
+ * It is written to a temporary file first, then renamed, so that readers never see a partial sidecar.
+ *
+ * @param index An index built by tar_index_build().
+ * @param tar_fd A file descriptor of the archive the index was built from.
+ * @param path The path of the sidecar file.
+ *
+ * @return zero on success, -1 if the sidecar could not be written.
+ */
+int tar_index_save(const tar_index_t *index, int tar_fd, const char *path);
+
+/**
+ * Loads an index from a sidecar file written by tar_index_save().
+ *
+ * The sidecar is mapped in memory and the index points straight into it: loading costs a few system
+ * calls, whatever the size of the archive. The index is released with tar_index_free() as usual.
+ *
+ * @param tar_fd A file descriptor of the archive the sidecar was written for.
+ * @param path The path of the sidecar file.
+ * @param index An out argument, set to the loaded index on success.
+ *
+ * @return a zero or positive value on success, representing the number of indexed entries,
+ *         -4 if the index could not be allocated,
+ *         -5 if the sidecar is missing or is not a sidecar written by this version of the library,
+ *         -6 if the sidecar is stale: the archive changed since it was written.
+ */
+int tar_index_load(int tar_fd, const char *path, tar_index_t **index);
+
+/**
+ * Loads the index of an archive from its sidecar file, or builds it and writes the sidecar when the
+ * sidecar is missing or stale. When the archive was only appended to since the sidecar was written,
+ * only the new entries are indexed, see tar_index_update(), and the sidecar is rewritten.
+ *
+ * @return the same values as tar_index_build().
+ */
+int tar_index_open(int tar_fd, const char *path, tar_index_t **index);
+
+/**
+ * Maps an archive in memory and indexes it.
+ *
+ * The archive is mapped once and its headers are read and validated straight from the mapping. The
+ * returned handle gives zero-copy access to the data of its files through tar_file_view().
+ *
+ * @param tar_fd A file descriptor of a file supposed to contain a tar archive. It may be closed once
+ *               the archive is mapped.
+ * @param archive An out argument, set to the mapped archive on success. It must be released with tar_close_mmap().
+ *
+ * @return a zero or positive value on success, representing the number of entries in the archive,
+ *         -1, -2 or -3 if the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the handle could not be allocated,
+ *         -5 if the archive could not be mapped, is compressed or is truncated.
+ */
+int tar_open_mmap(int tar_fd, tar_mmap_t **archive);
+
+/**
+ * Unmaps an archive opened with tar_open_mmap(). Views returned by tar_file_view() become invalid.
+ *
+ * @param archive The archive to release, may be NULL.
+ */
+void tar_close_mmap(tar_mmap_t *archive);
+
+/**
+ * Returns the index of a mapped archive, to be used with the tar_index_*() functions.
+ *
+ * @param archive An archive opened with tar_open_mmap().
+ */
+const tar_index_t *tar_mmap_index(const tar_mmap_t *archive);
+
+/**
+ * Tells the kernel how a mapped archive is going to be accessed, see madvise(2).
+ *
+ * @param archive An archive opened with tar_open_mmap().
+ * @param advice One of the TAR_ADVICE_* values.
+ *
+ * @return zero on success, -1 otherwise.
+ */
+int tar_mmap_advise(const tar_mmap_t *archive, int advice);
+
+/**
+ * Gives access to the data of a file of a mapped archive, without copying it.
+ *
+ * @param archive An archive opened with tar_open_mmap().
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param data An out argument, set to the first byte of the file in the mapping.
+ * @param len An out argument, set to the size of the file.
+ *
+ * @return zero on success,
+ *         -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -3 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles.
+ */
+int tar_file_view(const tar_mmap_t *archive, const char *path, const uint8_t **data, size_t *len);
+
+/**
+ * Opens a handle on an archive, to be queried with the tar_*() functions below.
+ *
+ * Like every function of this library, the handle only reads the archive with pread() and never moves
+ * the file offset of tar_fd. A handle is never modified once opened, so any number of threads can
+ * query it at the same time without locking.
+ *
+ * @param tar_fd A file descriptor of a tar archive file. It must stay open as long as the handle is used.
+ * @param flags Zero or TAR_OPEN_INDEX to build an index of the archive, see tar_index_build().
+ * @param archive An out argument, set to the handle on success. It must be released with tar_close().
+ *
+ * @return a zero or positive value on success, representing the number of indexed entries if the archive is indexed,
+ *         -1, -2 or -3 if the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the handle could not be allocated.
+ */
+int tar_open(int tar_fd, int flags, tar_archive_t **archive);
+
+/**
+ * Opens a handle on an archive indexed by its sidecar file, see tar_index_open().
+ *
+ * @return the same values as tar_open() with TAR_OPEN_INDEX.
+ */
+int tar_open_sidecar(int tar_fd, const char *sidecar_path, tar_archive_t **archive);
+
+/**
+ * Closes a handle opened with tar_open() or tar_open_sidecar(). The file descriptor of the archive is left open.
+ *
+ * @param archive The handle to close, may be NULL.
+ */
+void tar_close(tar_archive_t *archive);
+
+/**
+ * Attaches a cache to a handle, which keeps the most recently read blocks of the archive, so that
+ * repeated small tar_read_file() calls on the same entries are served without any system call.
+ * On a handle which is not indexed, the cache also keeps the result of the last path lookups.
+ * The cache is shared by the threads querying the handle, but this function must not be called while
+ * other threads use the handle.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param capacity The size in bytes of the cached blocks, zero to remove the cache of the handle.
+ *
+ * @return zero on success,
+ *         -4 if the cache could not be allocated, in which case the handle keeps its previous cache.
+ */
+int tar_enable_cache(tar_archive_t *archive, size_t capacity);
+
+/**
+ * Gets the counters of the cache of a handle, all zero if it has none.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param stats An out argument, set to the counters since the cache was attached.
+ */
+void tar_cache_stats(const tar_archive_t *archive, tar_cache_stats_t *stats);
+
+/**
+ * Copies the counters of a handle, which count the work done by the functions taking the handle since it
+ * was opened, on the threads calling them. The counters are updated with relaxed atomic additions, so
+ * calls running at the same time may be partly counted in the copy.
+ *
+ * Built with TAR_NO_STATS, the library counts nothing and has no overhead.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param stats An out argument, set to the counters.
+ *
+ * @return zero on success,
+ *         -1 if the library was built with TAR_NO_STATS, stats being all zeros.
+ */
+int tar_get_stats(const tar_archive_t *archive, tar_stats_t *stats);
+
+/**
+ * Reentrant versions of exists(), is_dir(), is_file(), is_symlink(), list(), list_page() and read_file() taking a
+ * handle opened with tar_open(). They answer from the index when the archive is indexed, and scan the
+ * archive otherwise. Their arguments and return values are the same as for their counterparts.
+ */
+int     tar_exists(const tar_archive_t *archive, const char *path);
+int     tar_is_dir(const tar_archive_t *archive, const char *path);
+int     tar_is_file(const tar_archive_t *archive, const char *path);
+int     tar_is_symlink(const tar_archive_t *archive, const char *path);
+int     tar_list(const tar_archive_t *archive, const char *path, char **entries, size_t *no_entries);
+int     tar_list_page(const tar_archive_t *archive, const char *path, size_t *cursor, char **entries, size_t *no_entries);
+ssize_t tar_read_file(const tar_archive_t *archive, const char *path, size_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * Sends a range of a file of the archive to a socket, a pipe or a file, the data going from the archive to
+ * the output in the kernel, without being copied to a user buffer: with splice() to a pipe, with sendfile()
+ * otherwise. Compressed archives, and outputs neither supports, get the data through a buffer instead.
+ * The path is resolved as read_file() does, and the range follows the same rules.
+ *
+ * An output in non-blocking mode is sent what it takes without waiting, the return value being the number
+ * of bytes left to send from offset + *len. Sending to a socket closed by the peer raises SIGPIPE, which
+ * servers usually ignore.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param out_fd The descriptor to send the data to, written at its current offset.
+ * @param offset An offset in the file from which to start sending, zero indicates the start of the file.
+ * @param len An in-out argument.
+ *            The caller set it to the largest number of bytes to send.
+ *            The callee set it to the number of bytes sent.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         -3 if more than TAR_MAX_LINK_HOPS links had to be followed, which happens with link cycles,
+ *         -5 if the archive could not be read or the output could not be written, len being set to the
+ *            number of bytes sent before,
+ *         zero if the file was sent up to its end,
+ *         a positive value if the file was partially sent, representing the remaining bytes left to be sent to
+ *         reach the end of the file.
+ */
+ssize_t tar_send_entry(const tar_archive_t *archive, const char *path, int out_fd, size_t offset, size_t *len);
+
+/**
+ * Reads several files of an archive at once.
+ *
+ * Every path is resolved by a single scan of the archive, or by the index of the handle, then the reads are
+ * performed in the order of their data in the archive, neighbouring ones being merged into a single larger read.
+ * Each request gets the return value read_file() would have given it, and the length it would have read,
+ * which is zero for a failed request.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param requests The reads to perform, their len and ret fields are set on success.
+ * @param n_requests The number of requests.
+ *
+ * @return zero on success,
+ *         -1, -2 or -3 if the handle is not indexed and the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the batch could not be allocated.
+ */
+int tar_read_many(const tar_archive_t *archive, tar_read_request_t *requests, size_t n_requests);
+
+/**
+ * Extracts every directory, regular file, hard link and symlink of an archive under a directory, restoring
+ * their modes and modification times.
+ *
+ * Names are normalized, so that no entry is extracted outside of the destination, and symlinks are created
+ * last, so that no file is written through one of them. The regular files are extracted by a pool of threads,
+ * their data being copied by the kernel from the archive to the files.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param dest_dir The destination directory, created if it does not exist.
+ * @param n_threads The number of threads extracting files, zero for one per online CPU, at most 64.
+ *
+ * @return a zero or positive value on success, representing the number of extracted entries,
+ *         -1, -2 or -3 if the handle is not indexed and the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the extraction could not be allocated,
+ *         -7 if the destination or some of the entries could not be created; the other entries are extracted.
+ */
+int tar_extract(const tar_archive_t *archive, const char *dest_dir, unsigned n_threads);
+
+/**
+ * Creates an empty set of queries, to which exact paths and glob patterns are added, then answered all
+ * together by tar_query_run().
+ *
+ * @param query An out argument, set to the set on success. It must be released with tar_query_free().
+ *
+ * @return zero on success,
+ *         -4 if the set could not be allocated.
+ */
+int tar_query_new(tar_query_t **query);
+
+/**
+ * Releases a set of queries.
+ *
+ * @param query The set to release, may be NULL.
+ */
+void tar_query_free(tar_query_t *query);
+
+/**
+ * Adds an exact path to a set of queries. It matches the entries exists() would find.
+ *
+ * @param query The set to add the path to.
+ * @param path A path to an entry in the archive.
+ *
+ * @return the position of the query in the set, counting from zero, on success,
+ *         -4 if the set could not be grown.
+ */
+ssize_t tar_query_add_path(tar_query_t *query, const char *path);
+
+/**
+ * Adds a glob pattern to a set of queries, compiled once for every run.
+ *
+ * A pattern matches whole names: '*' matches any run of characters but '/', '?' any single character but
+ * '/', "[...]" any character of a set, like "[a-z]" or "[!0-9]", and '\' makes the next character literal.
+ * Directories match without the trailing '/' of their names. Patterns starting or ending with literal
+ * characters are the cheapest to answer, see tar_query_run().
+ *
+ * @param query The set to add the pattern to.
+ * @param pattern The glob pattern.
+ *
+ * @return the position of the query in the set, counting from zero, on success,
+ *         -1 if a '[' of the pattern is not closed,
+ *         -4 if the set could not be grown.
+ */
+ssize_t tar_query_add_glob(tar_query_t *query, const char *pattern);
+
+/**
+ * Answers every query of a set in a single pass over the entries of an archive, with the index of the handle
+ * or by scanning the archive once.
+ *
+ * Each entry is only compared with the queries sharing a hash with its name, its first or its last characters,
+ * so a pass costs the number of entries plus the number of queries rather than their product, patterns
+ * with a wildcard at both ends aside. An indexed handle answers a set of paths only, without callback,
+ * without going through the entries at all.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar().
+ * @param query The set of queries, which may be run any number of times, from any number of threads.
+ * @param found NULL, or a bitmap of one bit per query of the set, see TAR_QUERY_FOUND(), set to the queries
+ *              matching at least one entry.
+ * @param callback NULL, or a function called for every query matching every entry, in archive order.
+ *                 The entry is only valid during the call. Returning a non-zero value stops the pass.
+ * @param user_data Passed to the callback.
+ *
+ * @return a zero or positive value on success, representing the number of queries matching at least one entry,
+ *         -1, -2 or -3 if the handle is not indexed and the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the pass could not be allocated.
+ */
+int tar_query_run(const tar_archive_t *archive, const tar_query_t *query, uint8_t *found, tar_query_callback_t callback, void *user_data);
+
+/**
+ * Compares two archives entry by entry, without extracting them, and reports the entries added, removed,
+ * modified or replaced by another kind of entry.
+ *
+ * Entries are matched by name, ignoring a trailing '/'. Their headers are compared first, then the data of the regular files of the same
+ * size, through CRC32C digests computed by a pool of threads straight from the archives. Modification times are
+ * not compared. A handle opened with tar_open_sidecar() keeps the digests computed for its archive in its sidecar,
+ * so that diffing the archive again, once reopened, does not read its data.
+ *
+ * @param old_archive A handle opened with tar_open() or tar_open_sidecar() on the old archive.
+ * @param new_archive A handle opened with tar_open() or tar_open_sidecar() on the new archive.
+ *                    Handles which are not indexed are indexed for the call.
+ * @param n_threads The number of threads digesting data, zero for one per online CPU, at most 64.
+ * @param callback NULL, or a function called for every change: the entries of the old archive first, in archive
+ *                 order, then the entries added by the new archive, in its order. The entries are only valid
+ *                 during the call. Returning a non-zero value stops the diff.
+ * @param user_data Passed to the callback.
+ *
+ * @return a zero or positive value on success, representing the number of changes reported,
+ *         -1, -2 or -3 if a handle is not indexed and its archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the diff could not be allocated,
+ *         -5 if the data of a file could not be read.
+ */
+int tar_diff(const tar_archive_t *old_archive, const tar_archive_t *new_archive, unsigned n_threads,
+             tar_diff_callback_t callback, void *user_data);
+
+/**
+ * Creates an asynchronous reader of the archive of a handle, which keeps up to queue_depth reads in flight.
+ *
+ * Reads are performed with io_uring when the kernel supports it, and by a pool of threads otherwise.
+ * Paths are resolved when reads are submitted, so the handle should be indexed. The synchronous
+ * tar_read_file() keeps the same contract and remains the cheapest way to perform a single read.
+ *
+ * @param archive A handle opened with tar_open() or tar_open_sidecar(). It must outlive the reader.
+ * @param queue_depth The largest number of reads in flight.
+ * @param flags Zero, or TAR_AIO_THREADS to use the pool of threads even when io_uring is available.
+ * @param aio An out argument, set to the reader on success. It must be released with tar_aio_close().
+ *
+ * @return TAR_AIO_URING or TAR_AIO_THREADS on success, depending on the backend in use,
+ *         -4 if the reader could not be allocated.
+ */
+int tar_aio_open(const tar_archive_t *archive, unsigned queue_depth, int flags, tar_aio_t **aio);
+
+/**
+ * Submits the read of a file. The read may only start on the next call to tar_aio_wait(), which submits
+ * the queued reads at once. When queue_depth reads are already in flight, waits for one of them first.
+ *
+ * @param aio The reader.
+ * @param request The read to perform. It must stay valid until its completion, at which its len and ret
+ *                fields are set as for tar_read_many(), ret being -5 if its data could not be read.
+ * @param callback Called on completion, from tar_aio_submit() or tar_aio_wait(), may be NULL.
+ * @param user_data Passed to the callback.
+ *
+ * @return zero on success, -1 if the backend failed.
+ */
+int tar_aio_submit(tar_aio_t *aio, tar_read_request_t *request, tar_aio_callback_t callback, void *user_data);
+
+/**
+ * Submits the queued reads and waits for at least min_completions of the reads in flight to complete, calling
+ * their callbacks.
+ *
+ * @return the number of completed reads, or -1 if the backend failed.
+ */
+int tar_aio_wait(tar_aio_t *aio, unsigned min_completions);
+
+/**
+ * Waits for every read in flight, then releases an asynchronous reader.
+ *
+ * @param aio The reader to release, may be NULL.
+ */
+void tar_aio_close(tar_aio_t *aio);
+
+/**
+ * Creates a writer of a ustar archive.
+ *
+ * @param out_fd A file descriptor the archive is written to, at its current offset. It may be a regular file,
+ *               a pipe or a socket, and must stay open until tar_writer_close().
+ * @param writer An out argument, set to the writer on success.
+ *
+ * @return zero on success,
+ *         -4 if the writer could not be allocated.
+ */
+int tar_writer_open(int out_fd, tar_writer_t **writer);
+
+/**
+ * Creates a writer appending entries to an existing archive, overwriting the blocks which mark its end.
+ *
+ * @param tar_fd A file descriptor of the archive, opened for reading and writing, without O_APPEND.
+ * @param index An up to date index of the archive, which gives its end at once, or NULL to scan the archive
+ *              for it. The index can then be brought up to date with tar_index_update().
+ * @param writer An out argument, set to the writer on success.
+ *
+ * @return zero on success,
+ *         -1 if the archive could not be positioned, is compressed, or has an invalid header,
+ *         -4 if the writer could not be allocated.
+ */
+int tar_writer_append(int tar_fd, const tar_index_t *index, tar_writer_t **writer);
+
+/**
+ * Adds a file, a symlink or a whole directory tree to the archive.
+ *
+ * The headers of the entries of a tree are built by a pool of threads, and written in the order of a walk which
+ * sorts the children of each directory by name. The data of files is copied by the kernel from the files to the
+ * archive. Entries which are neither regular files, directories nor symlinks are skipped.
+ *
+ * @param writer The writer.
+ * @param path The path of the file, symlink or directory on disk.
+ * @param name The name of the entry in the archive, NULL for path. Leading '/' are removed.
+ *
+ * @return a zero or positive value on success, representing the number of added entries,
+ *         -1 if the archive could not be written, which leaves it unusable,
+ *         -4 if the walk could not be allocated, in which case nothing was added,
+ *         -7 if some entries were skipped because they could not be read or their name does not fit in a ustar
+ *         header; the archive stays valid.
+ */
+int tar_writer_add_path(tar_writer_t *writer, const char *path, const char *name);
+
+/**
+ * Adds a regular file to the archive, with its data taken from a buffer.
+ *
+ * @param writer The writer.
+ * @param name The name of the file in the archive.
+ * @param data The data of the file.
+ * @param len The size of the data in bytes.
+ * @param mode The permission bits of the file.
+ * @param mtime The modification time of the file, in seconds since the epoch.
+ *
+ * @return zero on success,
+ *         -1 if the archive could not be written, which leaves it unusable,
+ *         -8 if the name or the mtime does not fit in a ustar header; sizes past 8 GiB are written in base-256.
+ */
+int tar_writer_add_buffer(tar_writer_t *writer, const char *name, const uint8_t *data, size_t len, uint32_t mode, int64_t mtime);
+
+/**
+ * Ends the archive with two zero blocks and releases the writer. The file descriptor is left open.
+ *
+ * @param writer The writer to release, may be NULL.
+ *
+ * @return zero on success, -1 if the archive could not be written.
+ */
+int tar_writer_close(tar_writer_t *writer);
+
+/**
+ * Starts iterating over the entries of an archive, in a single sequential pass.
+ *
+ * @param tar_fd A file descriptor of a tar archive file. It must stay open as long as the iterator is used.
+ * @param iter An out argument, set to the iterator on success. It must be released with tar_iter_close().
+ *
+ * @return zero on success,
+ *         -4 if the iterator could not be allocated.
+ */
+int tar_iter_open(int tar_fd, tar_iter_t **iter);
+
+/**
+ * Starts iterating over the entries of an archive read strictly forward, with read() only, from a pipe
+ * or a socket. tar_iter_open() does the same on such descriptors, this function avoids its failed first
+ * pread(). The offsets of the entries are offsets from the first byte read.
+ *
+ * @param fd A file descriptor positioned at the start of a tar archive. The iterator reads ahead of the
+ *           entry it is at, up to 2 MiB.
+ * @param iter An out argument, set to the iterator on success. It must be released with tar_iter_close().
+ *
+ * @return zero on success,
+ *         -4 if the iterator could not be allocated.
+ */
+int tar_iter_open_stream(int fd, tar_iter_t **iter);
+
+/**
+ * Moves to the next entry of the archive. Whatever was not read of the data of the current entry
+ * is skipped. No memory is allocated, except by the first call on a pipe or a socket given to
+ * tar_iter_open(), which switches to reading it strictly forward: the strings of the entry point into
+ * the iterator and stay valid until the next call.
+ *
+ * @param iter An iterator opened with tar_iter_open().
+ * @param entry An out argument, set to the decoded next entry.
+ *
+ * @return 1 if an entry was decoded,
+ *         zero if the end of the archive is reached,
+ *         -1, -2 or -3 if the header of the next entry is invalid, with the same meaning as for
+ *         check_archive(). The iteration cannot go on past an invalid header,
+ *         -4 if the iterator could not switch to reading a pipe or a socket forward.
+ */
+int tar_iter_next(tar_iter_t *iter, tar_entry_t *entry);
+
+/**
+ * Reads the data of the current entry of an iterator, continuing where the previous call stopped.
+ *
+ * @param iter An iterator opened with tar_iter_open().
+ * @param dest A destination buffer to read the data into.
+ * @param len The size of dest.
+ *
+ * @return the number of bytes written to dest, zero once the whole data of the entry was read,
+ *         -1 if the archive could not be read.
+ */
+ssize_t tar_iter_read(tar_iter_t *iter, uint8_t *dest, size_t len);
+
+/**
+ * Releases an iterator opened with tar_iter_open().
+ *
+ * @param iter The iterator to release, may be NULL.
+ */
+void tar_iter_close(tar_iter_t *iter);
+
+/**
+ * Validates an archive read strictly forward, with read() only, from a pipe or a socket, in a single pass
+ * which never holds more than two buffers of the archive. The data of the entries is skipped, or handed
+ * to a callback, so that the same pass can index the archive and hash or store the data.
+ *
+ * Every header is validated as check_archive() does. The archive is read ahead by a thread while it is
+ * validated, so that waiting for the input overlaps with processing the data.
+ *
+ * @param fd A file descriptor positioned at the start of a tar archive. Up to 2 MiB past the end of the
+ *           archive may be consumed.
+ * @param index An out argument, set on success to an index of the archive, whose offsets are offsets from
+ *              the first byte read, or NULL not to index the archive.
+ * @param callback Called for each entry, then for each chunk of its data, or NULL. The entry and the data
+ *                 are only valid during the call.
+ * @param user_data Passed as is to callback.
+ *
+ * @return a zero or positive value if the archive is valid, representing the number of entries in the archive,
+ *         -1, -2 or -3 if the archive is invalid, with the same meaning as for check_archive(),
+ *         -4 if the buffers or the index could not be allocated,
+ *         -5 if the stream could not be read, or ended inside an entry.
+ */
+int tar_stream_check(int fd, tar_index_t **index, tar_stream_callback_t callback, void *user_data);
+
+/**
+ * Makes every function of this library read a compressed archive through its file descriptor as if it
+ * were not compressed, offsets being offsets in the decompressed archive.
+ *
+ * Scans decompress the archive sequentially. For random access, a checkpoint is recorded about every
+ * span bytes of decompressed archive the first time they are decoded, from which decoding can restart:
+ * reading an entry then only decompresses the archive from the last checkpoint before it. Once the whole
+ * archive was decoded, the checkpoints are written to checkpoint_path, and later attaches of the same
+ * archive load them. A zstd archive gets a checkpoint at frame boundaries only, so a single-frame one
+ * is only read sequentially.
+ * Reads of a compressed archive are serialized, and the in-kernel copies of tar_extract() and the
+ * io_uring backend of tar_aio_open() fall back to reading through the library. A compressed archive
+ * can neither be mapped with tar_open_mmap() nor appended to.
+ *
+ * @param tar_fd A file descriptor of a file which may contain a compressed tar archive. It must not be closed
+ *               before the source is detached.
+ * @param checkpoint_path The path of the checkpoint file (e.g. "archive.tar.gz.ckpt"), or NULL to keep
+ *                        the checkpoints in memory only.
+ * @param span The distance in bytes of decompressed archive between checkpoints, zero for 4 MiB.
+ *
+ * @return one of the TAR_FORMAT_* values on success, nothing being attached to an uncompressed archive,
+ *         -1 if the archive is compressed with zstd and the library was built without it, or too many
+ *            sources are attached, or one already is to tar_fd,
+ *         -4 if the source could not be allocated,
+ *         -5 if the file could not be read.
+ */
+int tar_source_attach(int tar_fd, const char *checkpoint_path, size_t span);
+
+/**
+ * Detaches the source attached to a file descriptor by tar_source_attach(). It must not be called while
+ * other threads use the descriptor.
+ *
+ * @param tar_fd A file descriptor given to tar_source_attach(). Nothing happens if no source is attached to it.
+ */
+void tar_source_detach(int tar_fd);
+
+/**
+ * Gets the size of a decompressed archive and its number of checkpoints.
+ *
+ * @param tar_fd A file descriptor given to tar_source_attach().
+ * @param size An out argument, set to the size of the decompressed archive once it was entirely decoded, zero before.
+ * @param n_checkpoints An out argument, set to the number of checkpoints recorded so far.
+ *
+ * @return 1 if the whole archive was decoded, zero if not yet,
+ *         -1 if no source is attached to tar_fd.
+ */
+int tar_source_info(int tar_fd, uint64_t *size, uint32_t *n_checkpoints);
+
 #endif
@@ -0,0 +1,420 @@
+#include <pthread.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+/**
+ * INFO 1: asynchronous reads
+ * Reads are submitted to one of two backends, which both keep up to
+ * queue_depth reads in flight:
+ *  - io_uring, driven through its system calls directly: reads are queued in
+ *    the submission ring, and submitted all at once with their completions
+ *    waited for by a single io_uring_enter() call,
+ *  - a pool of threads each performing blocking pread() calls, when io_uring
+ *    is not available or not wanted, or the archive is compressed.
+ * Paths are resolved when a read is submitted, so the handle should be
+ * indexed: resolving a path of a handle which is not scans the archive.
+ * Completion callbacks always run in the thread calling tar_aio_submit() or
+ * tar_aio_wait(), whatever the backend.
+*/
+
+/* Largest number of threads of the fallback backend */
+#ifndef TAR_AIO_MAX_THREADS
+#define TAR_AIO_MAX_THREADS 16
+#endif
+
+typedef struct aio_op
+{
+    tar_read_request_t  *request;
+    tar_aio_callback_t  callback;
+    void                *user_data;
+    uint64_t            offset;         /* archive offset of the first byte to read */
+    size_t              done;           /* bytes read so far */
+    ssize_t             result;         /* for the thread pool, bytes read or -errno */
+} aio_op_t;
+
+struct tar_aio
+{
+    const tar_archive_t *archive;
+    int                 backend;
+    unsigned            depth;
+    aio_op_t            *ops;           /* one per read in flight */
+    uint32_t            *free_ops;      /* stack of the unused ops */
+    unsigned            n_free;
+
+#ifdef HAVE_IO_URING
+    int                 ring_fd;
+    void                *sq_ring;
+    void                *cq_ring;
+    size_t              sq_ring_size;
+    size_t              cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t              sqes_size;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned            n_queued;       /* reads in the submission ring, not submitted yet */
+#endif
+
+    pthread_t           *threads;
+    unsigned            n_threads;
+    pthread_mutex_t     lock;
+    pthread_cond_t      pending_cond;   /* signalled when a read is pending or the pool stops */
+    pthread_cond_t      done_cond;      /* signalled when a read completes */
+    uint32_t            *pending;       /* ring of the ops waiting for a thread */
+    unsigned            pending_head;
+    unsigned            n_pending;
+    uint32_t            *done;          /* ops completed by a thread, not delivered yet */
+    unsigned            n_done;
+    int                 stopping;
+};
+
+/**
+ * Function delivers the completion of an op: sets the length and return value of its request, releases
+ * the op and calls the callback.
+ * A read which failed, or which ended before the requested bytes, completes with -5 as for tar_send_entry().
+*/
+static void complete_op(tar_aio_t *aio, uint32_t slot, int failed) {
+    aio_op_t            *op         = &aio->ops[slot];
+    tar_read_request_t  *request    = op->request;
+    tar_aio_callback_t  callback    = op->callback;
+    void                *user_data  = op->user_data;
+
+    // the return value was already set to the bytes left past the requested ones
+    if (failed || op->done < request->len) {
+        request->ret = -5;
+        request->len = 0;
+    }
+
+    aio->free_ops[aio->n_free++] = slot;
+    if (callback != NULL) callback(request, user_data);
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Function sets up the io_uring backend.
+ * Returns zero on success, -1 if io_uring is not available.
+*/
+static int uring_init(tar_aio_t *aio) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    aio->ring_fd = syscall(__NR_io_uring_setup, aio->depth, &params);
+    if (aio->ring_fd < 0) return -1;
+
+    aio->sq_ring_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aio->cq_ring_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    aio->sqes_size      = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_ring_size > aio->sq_ring_size) aio->sq_ring_size = aio->cq_ring_size;
+        aio->cq_ring_size = aio->sq_ring_size;
+    }
+
+    aio->sq_ring = mmap(NULL, aio->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQ_RING);
+    aio->cq_ring = aio->sq_ring;
+    if (aio->sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        aio->cq_ring = mmap(NULL, aio->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_CQ_RING);
+    }
+    aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQES);
+    if (aio->sq_ring == MAP_FAILED || aio->cq_ring == MAP_FAILED || aio->sqes == MAP_FAILED) {
+        if (aio->sqes != MAP_FAILED)                                    munmap(aio->sqes, aio->sqes_size);
+        if (aio->cq_ring != MAP_FAILED && aio->cq_ring != aio->sq_ring) munmap(aio->cq_ring, aio->cq_ring_size);
+        if (aio->sq_ring != MAP_FAILED)                                 munmap(aio->sq_ring, aio->sq_ring_size);
+        close(aio->ring_fd);
+        return -1;
+    }
+
+    uint8_t *sq = aio->sq_ring;
+    uint8_t *cq = aio->cq_ring;
+    aio->sq_tail    = (unsigned *) (sq + params.sq_off.tail);
+    aio->sq_mask    = (unsigned *) (sq + params.sq_off.ring_mask);
+    aio->sq_array   = (unsigned *) (sq + params.sq_off.array);
+    aio->cq_head    = (unsigned *) (cq + params.cq_off.head);
+    aio->cq_tail    = (unsigned *) (cq + params.cq_off.tail);
+    aio->cq_mask    = (unsigned *) (cq + params.cq_off.ring_mask);
+    aio->cqes       = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_free(tar_aio_t *aio) {
+    munmap(aio->sqes, aio->sqes_size);
+    if (aio->cq_ring != aio->sq_ring) munmap(aio->cq_ring, aio->cq_ring_size);
+    munmap(aio->sq_ring, aio->sq_ring_size);
+    close(aio->ring_fd);
+}
+
+/**
+ * Function queues the read of what is left of an op in the submission ring.
+*/
+static void uring_queue(tar_aio_t *aio, uint32_t slot) {
+    aio_op_t            *op     = &aio->ops[slot];
+    unsigned            tail    = *aio->sq_tail;
+    unsigned            index   = tail & *aio->sq_mask;
+    struct io_uring_sqe *sqe    = &aio->sqes[index];
+    size_t              left    = op->request->len - op->done;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode     = IORING_OP_READ;
+    sqe->fd         = aio->archive->fd;
+    sqe->addr       = (uint64_t) (uintptr_t) (op->request->dest + op->done);
+    sqe->len        = left > (1U << 30) ? (1U << 30) : (unsigned) left;
+    sqe->off        = op->offset + op->done;
+    sqe->user_data  = slot;
+    aio->sq_array[index] = index;
+
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    aio->n_queued++;
+}
+
+/**
+ * Function submits the queued reads and waits for at least min_completions of them, then delivers
+ * every available completion.
+ * Returns the number of delivered completions, or -1 if io_uring failed.
+*/
+static int uring_wait(tar_aio_t *aio, unsigned min_completions) {
+    int n_completed = 0;
+    do {
+        unsigned available = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE) - *aio->cq_head;
+        if (aio->n_queued > 0 || available < min_completions) {
+            unsigned    wait    = available < min_completions ? min_completions - available : 0;
+            int         ret     = syscall(__NR_io_uring_enter, aio->ring_fd, aio->n_queued, wait,
+                                          wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+            if (ret < 0 && errno != EINTR) return -1;
+            if (ret > 0) aio->n_queued -= ret;
+        }
+
+        unsigned head = *aio->cq_head;
+        unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe    = &aio->cqes[head & *aio->cq_mask];
+            uint32_t            slot    = (uint32_t) cqe->user_data;
+            aio_op_t            *op     = &aio->ops[slot];
+            __atomic_store_n(aio->cq_head, head + 1, __ATOMIC_RELEASE);
+
+            // a short read of a regular file only happens at its end, resubmit the rest anyway
+            if (cqe->res > 0) op->done += cqe->res;
+            if (cqe->res > 0 && op->done < op->request->len) {
+                uring_queue(aio, slot);
+                continue;
+            }
+            complete_op(aio, slot, cqe->res < 0);
+            n_completed++;
+            if (min_completions > 0) min_completions--;
+        }
+    } while (min_completions > 0 || aio->n_queued > 0);
+    return n_completed;
+}
+#endif
+
+/**
+ * Function runs a thread of the fallback backend: performs the pending reads until the pool stops.
+*/
+static void *pool_thread(void *arg) {
+    tar_aio_t *aio = arg;
+
+    pthread_mutex_lock(&aio->lock);
+    while (1) {
+        while (aio->n_pending == 0 && !aio->stopping) pthread_cond_wait(&aio->pending_cond, &aio->lock);
+        if (aio->n_pending == 0) break;
+
+        uint32_t slot = aio->pending[aio->pending_head];
+        aio->pending_head = (aio->pending_head + 1) % aio->depth;
+        aio->n_pending--;
+        pthread_mutex_unlock(&aio->lock);
+
+        aio_op_t *op = &aio->ops[slot];
+        op->result = 0;
+        while (op->done < op->request->len) {
+            ssize_t n_read = archive_pread(aio->archive->fd, op->request->dest + op->done, op->request->len - op->done,
+                                           op->offset + op->done);
+            if (n_read < 0 && errno == EINTR) continue;
+            if (n_read < 0) op->result = -errno;
+            if (n_read <= 0) break;
+            op->done += n_read;
+        }
+
+        pthread_mutex_lock(&aio->lock);
+        aio->done[aio->n_done++] = slot;
+        pthread_cond_signal(&aio->done_cond);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+/**
+ * Function waits for at least min_completions reads of the thread pool, then delivers every available
+ * completion.
+ * Returns the number of delivered completions.
+*/
+static int pool_wait(tar_aio_t *aio, unsigned min_completions) {
+    int n_completed = 0;
+
+    pthread_mutex_lock(&aio->lock);
+    while (min_completions > 0 || aio->n_done > 0) {
+        // the callbacks of a nested wait may have delivered the completions waited for
+        while (aio->n_done == 0 && aio->n_free < aio->depth) pthread_cond_wait(&aio->done_cond, &aio->lock);
+        if (aio->n_done == 0) break;
+        uint32_t slot = aio->done[--aio->n_done];
+        pthread_mutex_unlock(&aio->lock);
+
+        // callbacks run unlocked, they may submit other reads, and wait for them
+        complete_op(aio, slot, aio->ops[slot].result < 0);
+        n_completed++;
+        if (min_completions > 0) min_completions--;
+        pthread_mutex_lock(&aio->lock);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return n_completed;
+}
+
+static int backend_wait(tar_aio_t *aio, unsigned min_completions) {
+    unsigned in_flight = aio->depth - aio->n_free;
+    if (min_completions > in_flight) min_completions = in_flight;
+#ifdef HAVE_IO_URING
+    if (aio->backend == TAR_AIO_URING) return uring_wait(aio, min_completions);
+#endif
+    return pool_wait(aio, min_completions);
+}
+
+/**
+ * Function starts the threads of the fallback backend.
+ * Returns zero on success, -1 if they could not be started.
+*/
+static int pool_init(tar_aio_t *aio) {
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->pending_cond, NULL);
+    pthread_cond_init(&aio->done_cond, NULL);
+
+    unsigned n_threads  = aio->depth < TAR_AIO_MAX_THREADS ? aio->depth : TAR_AIO_MAX_THREADS;
+    aio->threads        = malloc(n_threads * sizeof(pthread_t));
+    aio->pending        = malloc(aio->depth * sizeof(uint32_t));
+    aio->done           = malloc(aio->depth * sizeof(uint32_t));
+    if (aio->threads == NULL || aio->pending == NULL || aio->done == NULL) return -1;
+
+    // only the threads started are joined by pool_free()
+    for (; aio->n_threads < n_threads; aio->n_threads++) {
+        if (pthread_create(&aio->threads[aio->n_threads], NULL, pool_thread, aio) != 0) return -1;
+    }
+    return 0;
+}
+
+static void pool_free(tar_aio_t *aio) {
+    pthread_mutex_lock(&aio->lock);
+    aio->stopping = 1;
+    pthread_cond_broadcast(&aio->pending_cond);
+    pthread_mutex_unlock(&aio->lock);
+    for (unsigned i = 0; i < aio->n_threads; i++) pthread_join(aio->threads[i], NULL);
+    pthread_mutex_destroy(&aio->lock);
+    pthread_cond_destroy(&aio->pending_cond);
+    pthread_cond_destroy(&aio->done_cond);
+
+    free(aio->threads);
+    free(aio->pending);
+    free(aio->done);
+}
+
+/**
+ * Creates an asynchronous reader of the archive of a handle.
+ */
+int tar_aio_open(const tar_archive_t *archive, unsigned queue_depth, int flags, tar_aio_t **aio) {
+    tar_aio_t *a = calloc(1, sizeof(tar_aio_t));
+    if (a == NULL) return -4;
+    a->archive  = archive;
+    a->depth    = queue_depth > 0 ? queue_depth : 1;
+    a->ops      = calloc(a->depth, sizeof(aio_op_t));
+    a->free_ops = malloc(a->depth * sizeof(uint32_t));
+    if (a->ops == NULL || a->free_ops == NULL) {
+        tar_aio_close(a);
+        return -4;
+    }
+    for (unsigned i = 0; i < a->depth; i++) a->free_ops[a->n_free++] = a->depth - 1 - i;
+
+#ifdef HAVE_IO_URING
+    if (!(flags & TAR_AIO_THREADS) && source_of(archive->fd) == NULL && uring_init(a) == 0) a->backend = TAR_AIO_URING;
+#endif
+    if (a->backend == 0) {
+        a->backend = TAR_AIO_THREADS;
+        if (pool_init(a) < 0) {
+            tar_aio_close(a);
+            return -4;
+        }
+    }
+
+    *aio = a;
+    return a->backend;
+}
+
+/**
+ * Submits the read of a file.
+ */
+int tar_aio_submit(tar_aio_t *aio, tar_read_request_t *request, tar_aio_callback_t callback, void *user_data) {
+    uint64_t    data_offset;
+    uint64_t    size;
+
+    // resolve the path with the same semantics as tar_read_file(), errors complete at once
+    request->ret = archive_find_file(aio->archive, request->path, &data_offset, &size);
+    if (request->ret == 0 && request->offset > size) request->ret = -2;
+    if (request->ret == 0 && request->len >= size - request->offset) request->len = size - request->offset;
+    if (request->ret == 0) request->ret = size - request->offset - request->len;
+    if (request->ret < 0 || request->len == 0) {
+        if (request->ret < 0) request->len = 0;
+        if (callback != NULL) callback(request, user_data);
+        return 0;
+    }
+
+    if (aio->n_free == 0 && backend_wait(aio, 1) < 0) return -1;
+
+    uint32_t    slot    = aio->free_ops[--aio->n_free];
+    aio_op_t    *op     = &aio->ops[slot];
+    op->request     = request;
+    op->callback    = callback;
+    op->user_data   = user_data;
+    op->offset      = data_offset + request->offset;
+    op->done        = 0;
+
+#ifdef HAVE_IO_URING
+    if (aio->backend == TAR_AIO_URING) {
+        uring_queue(aio, slot);
+        return 0;
+    }
+#endif
+    pthread_mutex_lock(&aio->lock);
+    aio->pending[(aio->pending_head + aio->n_pending++) % aio->depth] = slot;
+    pthread_cond_signal(&aio->pending_cond);
+    pthread_mutex_unlock(&aio->lock);
+    return 0;
+}
+
+/**
+ * Waits for submitted reads to complete.
+ */
+int tar_aio_wait(tar_aio_t *aio, unsigned min_completions) {
+    return backend_wait(aio, min_completions);
+}
+
+/**
+ * Waits for every submitted read, then releases an asynchronous reader.
+ */
+void tar_aio_close(tar_aio_t *aio) {
+    if (aio == NULL) return;
+    if (aio->backend != 0) backend_wait(aio, aio->depth);
+#ifdef HAVE_IO_URING
+    if (aio->backend == TAR_AIO_URING) uring_free(aio);
+#endif
+    if (aio->backend == TAR_AIO_THREADS) pool_free(aio);
+    free(aio->ops);
+    free(aio->free_ops);
+    free(aio);
+}
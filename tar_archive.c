@@ -0,0 +1,134 @@
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: sharing an archive between threads
+ * A handle never changes once opened: queries only read the index, and the
+ * archive itself is only read with pread(), so the file offset of the
+ * descriptor is never used. Any number of threads can therefore query the
+ * same handle at the same time, without any lock.
+*/
+
+/**
+ * Opens a handle on an archive, optionally indexing it.
+ */
+int tar_open(int tar_fd, int flags, tar_archive_t **archive) {
+    tar_archive_t *handle = calloc(1, sizeof(tar_archive_t));
+    if (handle == NULL) return -4;
+    handle->fd = tar_fd;
+
+    int ret = 0;
+    if (flags & TAR_OPEN_INDEX) ret = tar_index_build(tar_fd, &handle->index);
+    if (ret < 0) {
+        free(handle);
+        return ret;
+    }
+
+    *archive = handle;
+    return ret;
+}
+
+/**
+ * Opens a handle on an archive indexed by a sidecar file.
+ */
+int tar_open_sidecar(int tar_fd, const char *sidecar_path, tar_archive_t **archive) {
+    tar_archive_t *handle = calloc(1, sizeof(tar_archive_t));
+    if (handle == NULL) return -4;
+    handle->fd = tar_fd;
+
+    int ret = tar_index_open(tar_fd, sidecar_path, &handle->index);
+    if (ret >= 0 && (handle->sidecar_path = strdup(sidecar_path)) == NULL) {
+        tar_index_free(handle->index);
+        ret = -4;
+    }
+    if (ret < 0) {
+        free(handle);
+        return ret;
+    }
+
+    *archive = handle;
+    return ret;
+}
+
+/**
+ * Function sets data_offset and size to the ones of the data of the regular file at path, following links,
+ * with the index of the handle or by scanning the archive.
+ * Returns zero on success, or the error code of read_file().
+*/
+int archive_find_file(const tar_archive_t *archive, const char *path, uint64_t *data_offset, uint64_t *size) {
+    if (archive->index == NULL) return find_file(archive->fd, path, data_offset, size);
+
+    uint32_t    pos;
+    int         ret = tar_index_find_file(archive->index, path, &pos);
+    if (ret < 0) return ret;
+    *data_offset    = archive->index->data_offsets[pos];
+    *size           = archive->index->sizes[pos];
+    return 0;
+}
+
+/**
+ * Closes a handle opened with tar_open().
+ */
+void tar_close(tar_archive_t *archive) {
+    if (archive == NULL) return;
+    tar_index_free(archive->index);
+    cache_free(archive->cache);
+    free(archive->sidecar_path);
+    free(archive);
+}
+
+int tar_exists(const tar_archive_t *archive, const char *path) {
+    STATS_ENTER(archive);
+    int ret = archive->index != NULL ? tar_index_exists(archive->index, path) : exists(archive->fd, (char *) path);
+    STATS_LEAVE(TAR_API_EXISTS);
+    return ret;
+}
+
+int tar_is_dir(const tar_archive_t *archive, const char *path) {
+    STATS_ENTER(archive);
+    int ret = archive->index != NULL ? tar_index_is_dir(archive->index, path) : is_dir(archive->fd, (char *) path);
+    STATS_LEAVE(TAR_API_IS_DIR);
+    return ret;
+}
+
+int tar_is_file(const tar_archive_t *archive, const char *path) {
+    STATS_ENTER(archive);
+    int ret = archive->index != NULL ? tar_index_is_file(archive->index, path) : is_file(archive->fd, (char *) path);
+    STATS_LEAVE(TAR_API_IS_FILE);
+    return ret;
+}
+
+int tar_is_symlink(const tar_archive_t *archive, const char *path) {
+    STATS_ENTER(archive);
+    int ret = archive->index != NULL ? tar_index_is_symlink(archive->index, path) : is_symlink(archive->fd, (char *) path);
+    STATS_LEAVE(TAR_API_IS_SYMLINK);
+    return ret;
+}
+
+int tar_list(const tar_archive_t *archive, const char *path, char **entries, size_t *no_entries) {
+    STATS_ENTER(archive);
+    int ret;
+    if (archive->index != NULL) ret = tar_index_list(archive->index, path, entries, no_entries);
+    else                        ret = list(archive->fd, (char *) path, entries, no_entries);
+    STATS_LEAVE(TAR_API_LIST);
+    return ret;
+}
+
+int tar_list_page(const tar_archive_t *archive, const char *path, size_t *cursor, char **entries, size_t *no_entries) {
+    STATS_ENTER(archive);
+    int ret;
+    if (archive->index != NULL) ret = tar_index_list_page(archive->index, path, cursor, entries, no_entries);
+    else                        ret = list_page(archive->fd, (char *) path, cursor, entries, no_entries);
+    STATS_LEAVE(TAR_API_LIST);
+    return ret;
+}
+
+ssize_t tar_read_file(const tar_archive_t *archive, const char *path, size_t offset, uint8_t *dest, size_t *len) {
+    STATS_ENTER(archive);
+    ssize_t ret;
+    if (archive->cache != NULL)         ret = cache_read_file(archive->cache, archive, path, offset, dest, len);
+    else if (archive->index != NULL)    ret = tar_index_read_file(archive->fd, archive->index, path, offset, dest, len);
+    else                                ret = read_file(archive->fd, (char *) path, offset, dest, len);
+    STATS_LEAVE(TAR_API_READ_FILE);
+    return ret;
+}
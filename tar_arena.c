@@ -0,0 +1,112 @@
+#include <sys/mman.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: growing in place
+ * The arrays of an index grow while the archive is scanned, up to sizes only
+ * known at the end. Rather than reallocating them, which copies them each
+ * time and leaves holes in the heap, an arena reserves a single address range
+ * large enough for every array at its largest, split in regions, one per
+ * array. The range is mapped without access, which the kernel neither backs
+ * with memory nor charges to the commit limit, and growing an array only
+ * makes more pages of its region usable, twice as many each time. An array
+ * therefore never moves, and building and freeing an index is one mmap() and
+ * one munmap(), plus a few mprotect() calls, whatever its size.
+*/
+
+/**
+ * INFO 2: limited address spaces
+ * When the range cannot be reserved, like under a limit on the address space
+ * of the process, every region is halved until the reservation succeeds. The
+ * arrays then hit the end of their region sooner, and growing them past it
+ * fails as an allocation failure would.
+*/
+
+/* Smallest range tried before giving up, see INFO 2 */
+#define ARENA_MIN_SIZE (1 << 20)
+
+/**
+ * Function returns len rounded up to a whole number of pages.
+*/
+static size_t page_align(size_t len) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return (len + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Function reserves the range of an arena of n_regions regions, region i being able to grow up to
+ * capacities[i] bytes, see INFO 1. Every region is empty.
+ * Returns zero on success, -1 if not even a range of ARENA_MIN_SIZE bytes could be reserved.
+*/
+int arena_init(tar_arena_t *arena, unsigned n_regions, const uint64_t *capacities) {
+    memset(arena, 0, sizeof(tar_arena_t));
+    arena->n_regions = n_regions;
+
+    for (unsigned shift = 0; shift < 64; shift++) {
+        size_t size = 0;
+        for (unsigned i = 0; i < n_regions; i++) {
+            arena->offsets[i]       = size;
+            arena->capacities[i]    = page_align(capacities[i] >> shift);
+            size                   += arena->capacities[i];
+        }
+        if (size < ARENA_MIN_SIZE && shift > 0) break;
+
+        void *base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base != MAP_FAILED) {
+            arena->base = base;
+            arena->size = size;
+            arena->n_mappings++;
+            return 0;
+        }
+    }
+    memset(arena, 0, sizeof(tar_arena_t));
+    return -1;
+}
+
+/**
+ * Function implements arena_commit() when the region has to grow, see INFO 1.
+ * Returns zero on success, -1 if len is past the end of the region or the pages could not be made usable.
+*/
+int arena_grow(tar_arena_t *arena, unsigned region, size_t len) {
+    size_t committed    = arena->committed[region];
+    size_t new_len      = committed ? committed * 2 : page_align(1);
+    if (len > arena->capacities[region]) return -1;
+    while (new_len < len) new_len *= 2;
+    if (new_len > arena->capacities[region]) new_len = arena->capacities[region];
+
+    uint8_t *start = arena->base + arena->offsets[region];
+    if (mprotect(start + committed, new_len - committed, PROT_READ | PROT_WRITE) < 0) return -1;
+    arena->committed[region] = new_len;
+    return 0;
+}
+
+/**
+ * Function gives the usable pages of a region back to the kernel, leaving it empty but still reserved.
+*/
+void arena_decommit(tar_arena_t *arena, unsigned region) {
+    if (arena->committed[region] == 0) return;
+
+    // mapping the pages again drops them, and their charge to the commit limit
+    uint8_t *start = arena->base + arena->offsets[region];
+    if (mmap(start, arena->committed[region], PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) return;
+    arena->committed[region] = 0;
+}
+
+/**
+ * Function returns the number of usable bytes of every region of an arena.
+*/
+size_t arena_committed(const tar_arena_t *arena) {
+    size_t committed = 0;
+    for (unsigned i = 0; i < arena->n_regions; i++) committed += arena->committed[i];
+    return committed;
+}
+
+/**
+ * Function releases the range of an arena, and resets it.
+*/
+void arena_free(tar_arena_t *arena) {
+    if (arena->base != NULL) munmap(arena->base, arena->size);
+    memset(arena, 0, sizeof(tar_arena_t));
+}
@@ -0,0 +1,141 @@
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: batched reads
+ * The requests of a batch are resolved against an index, then their ranges
+ * of the archive are sorted by offset. Ranges closer than TAR_READ_GAP bytes
+ * are merged into a single pread() of at most TAR_READ_MAX_MERGE bytes, the
+ * gaps between them being read and dropped: reading a few blocks too many
+ * costs less than a seek on a spinning disk or a round trip to a network
+ * block device. The archive is thus read once, from its start to its end.
+*/
+
+/* Largest gap between two ranges merged into a single read */
+#ifndef TAR_READ_GAP
+#define TAR_READ_GAP (64 << 10)
+#endif
+
+/* Largest single read of merged ranges */
+#ifndef TAR_READ_MAX_MERGE
+#define TAR_READ_MAX_MERGE (4 << 20)
+#endif
+
+typedef struct read_range
+{
+    uint64_t    start;          /* archive offset of the first byte to read */
+    uint64_t    end;            /* archive offset past the last byte to read */
+    size_t      request;        /* position of the request in the batch */
+} read_range_t;
+
+static int compare_ranges(const void *a, const void *b) {
+    const read_range_t *ra = a;
+    const read_range_t *rb = b;
+    if (ra->start != rb->start) return ra->start < rb->start ? -1 : 1;
+    return ra->end < rb->end ? -1 : ra->end > rb->end;
+}
+
+/**
+ * Function reads the ranges [first, last) of ranges with a single pread(), through buffer when there
+ * are several of them, then sets the length and return value of their requests.
+*/
+static void read_merged(int tar_fd, tar_read_request_t *requests, const read_range_t *first, const read_range_t *last,
+                        uint64_t end, uint8_t *buffer) {
+    uint64_t    start   = first->start;
+    ssize_t     n_read;
+
+    if (last - first == 1) n_read = archive_pread(tar_fd, requests[first->request].dest, end - start, start);
+    else                   n_read = archive_pread(tar_fd, buffer, end - start, start);
+    uint64_t read_end = start + (n_read < 0 ? 0 : n_read);
+
+    for (const read_range_t *range = first; range < last; range++) {
+        tar_read_request_t  *request    = &requests[range->request];
+        size_t              len         = read_end > range->start ? (read_end < range->end ? read_end : range->end) - range->start : 0;
+        if (last - first > 1) memcpy(request->dest, buffer + (range->start - start), len);
+
+        // the return value was set to the bytes left past the requested ones, add those which could not be read
+        request->ret += request->len - len;
+        request->len  = len;
+    }
+}
+
+/**
+ * Reads several files of an indexed archive at once, in the order of their data in the archive.
+ */
+int tar_index_read_many(int tar_fd, const tar_index_t *index, tar_read_request_t *requests, size_t n_requests) {
+    read_range_t    *ranges     = malloc(n_requests * sizeof(read_range_t));
+    uint8_t         *buffer     = NULL;
+    size_t          n_ranges    = 0;
+    if (ranges == NULL && n_requests > 0) return -4;
+
+    // resolve every path, with the same semantics as tar_index_read_file()
+    for (size_t i = 0; i < n_requests; i++) {
+        tar_read_request_t  *request = &requests[i];
+        uint32_t            pos;
+
+        request->ret = tar_index_find_file(index, request->path, &pos);
+        uint64_t size = request->ret == 0 ? index->sizes[pos] : 0;
+        if (request->ret == 0 && request->offset > size) request->ret = -2;
+        if (request->ret < 0) {
+            request->len = 0;
+            continue;
+        }
+
+        if (request->len >= size - request->offset) request->len = size - request->offset;
+        request->ret = size - request->offset - request->len;
+        if (request->len == 0) continue;
+
+        ranges[n_ranges].start      = index->data_offsets[pos] + request->offset;
+        ranges[n_ranges].end        = ranges[n_ranges].start + request->len;
+        ranges[n_ranges].request    = i;
+        n_ranges++;
+    }
+    qsort(ranges, n_ranges, sizeof(read_range_t), compare_ranges);
+
+    // merge neighbouring ranges, see INFO 1
+    size_t first = 0;
+    while (first < n_ranges) {
+        uint64_t    end     = ranges[first].end;
+        size_t      last    = first + 1;
+        while (last < n_ranges && ranges[last].start <= end + TAR_READ_GAP
+               && (ranges[last].end > end ? ranges[last].end : end) - ranges[first].start <= TAR_READ_MAX_MERGE) {
+            if (ranges[last].end > end) end = ranges[last].end;
+            last++;
+        }
+
+        if (last - first > 1 && buffer == NULL) buffer = malloc(TAR_READ_MAX_MERGE);
+        if (last - first > 1 && buffer == NULL) last = first + 1;          // read them one by one
+        read_merged(tar_fd, requests, &ranges[first], &ranges[last], last - first > 1 ? end : ranges[first].end, buffer);
+        first = last;
+    }
+
+    free(buffer);
+    free(ranges);
+    return 0;
+}
+
+/**
+ * Function implements tar_read_many().
+*/
+static int read_many(const tar_archive_t *archive, tar_read_request_t *requests, size_t n_requests) {
+    if (archive->index != NULL) return tar_index_read_many(archive->fd, archive->index, requests, n_requests);
+
+    // a single scan resolves every path of the batch
+    tar_index_t *index;
+    int         ret = tar_index_build(archive->fd, &index);
+    if (ret < 0) return ret;
+
+    ret = tar_index_read_many(archive->fd, index, requests, n_requests);
+    tar_index_free(index);
+    return ret;
+}
+
+/**
+ * Reads several files of the archive of a handle at once.
+ */
+int tar_read_many(const tar_archive_t *archive, tar_read_request_t *requests, size_t n_requests) {
+    STATS_ENTER(archive);
+    int ret = read_many(archive, requests, n_requests);
+    STATS_LEAVE(TAR_API_READ_MANY);
+    return ret;
+}
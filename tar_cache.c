@@ -0,0 +1,388 @@
+#include <pthread.h>
+#include <errno.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: block cache
+ * The cache keeps the most recently used blocks of TAR_CACHE_BLOCK_SIZE bytes
+ * of the archive, aligned on their size, so that a reader paging through an
+ * entry in small chunks reads each block from the kernel once. When the
+ * handle is not indexed, it also keeps the result of the last lookups of
+ * paths, each of which would otherwise scan the archive.
+ * Both are bounded tables of slots, chained in a list from the most to the
+ * least recently used one: a miss reuses the least recently used slot.
+*/
+
+/**
+ * INFO 2: locking
+ * A cache is shared by every thread querying the handle, and protected by a
+ * single mutex. The mutex is released while a path is looked up by scanning
+ * the archive, and while a missing block is read, so that a slow lookup or
+ * a disk read does not hold back the readers of hot blocks. The slot of a
+ * block being read is claimed beforehand, and marked so that the threads
+ * needing the same block wait for the read instead of repeating it.
+*/
+
+/* Size of the cached blocks of the archive */
+#ifndef TAR_CACHE_BLOCK_SIZE
+#define TAR_CACHE_BLOCK_SIZE (16 << 10)
+#endif
+
+/* Number of path lookups kept by the cache of a handle which is not indexed */
+#ifndef TAR_CACHE_LOOKUPS
+#define TAR_CACHE_LOOKUPS 256
+#endif
+
+#define NO_SLOT UINT32_MAX
+
+/* Length of a block slot being read, see INFO 2 */
+#define BLOCK_LOADING UINT32_MAX
+
+typedef struct cache_slot
+{
+    uint64_t    key;
+    uint32_t    prev;           /* more recently used slot, NO_SLOT for the most recently used one */
+    uint32_t    next;           /* less recently used slot, NO_SLOT for the least recently used one */
+    uint32_t    chain;          /* next slot of the same bucket */
+    int         used;
+} cache_slot_t;
+
+typedef struct lru
+{
+    cache_slot_t    *slots;
+    uint32_t        n_slots;
+    uint32_t        *buckets;   /* first slot of each bucket, NO_SLOT when empty */
+    uint32_t        mask;       /* number of buckets minus one */
+    uint32_t        head;       /* most recently used slot */
+    uint32_t        tail;       /* least recently used slot */
+} lru_t;
+
+typedef struct cache_lookup
+{
+    char        *path;
+    uint64_t    data_offset;
+    uint64_t    size;
+    int         ret;            /* return value of the lookup, the other fields are only set when it is zero */
+} cache_lookup_t;
+
+struct tar_cache
+{
+    pthread_mutex_t     lock;
+    pthread_cond_t      loaded;         /* signalled when the read of a block completes */
+    lru_t               blocks;
+    uint8_t             *data;          /* TAR_CACHE_BLOCK_SIZE bytes per block slot */
+    uint32_t            *block_len;     /* bytes of each block slot read from the archive */
+    lru_t               lookups;
+    cache_lookup_t      *found;         /* one per lookup slot */
+    tar_cache_stats_t   stats;
+};
+
+/**
+ * Function allocates a table of n_slots slots, all unused.
+ * Returns zero on success, -1 if it could not be allocated.
+*/
+static int lru_init(lru_t *lru, uint32_t n_slots) {
+    uint32_t n_buckets = 1;
+    while (n_buckets < n_slots) n_buckets <<= 1;
+
+    lru->slots      = calloc(n_slots, sizeof(cache_slot_t));
+    lru->buckets    = malloc(n_buckets * sizeof(uint32_t));
+    lru->n_slots    = n_slots;
+    lru->mask       = n_buckets - 1;
+    lru->head       = 0;
+    lru->tail       = n_slots - 1;
+    if (lru->slots == NULL || lru->buckets == NULL) return -1;
+
+    memset(lru->buckets, 0xff, n_buckets * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n_slots; i++) {
+        lru->slots[i].prev = i == 0 ? NO_SLOT : i - 1;
+        lru->slots[i].next = i == n_slots - 1 ? NO_SLOT : i + 1;
+    }
+    return 0;
+}
+
+static void lru_free(lru_t *lru) {
+    free(lru->slots);
+    free(lru->buckets);
+}
+
+/**
+ * Function returns the slot holding key, or NO_SLOT if there is none.
+*/
+static uint32_t lru_find(const lru_t *lru, uint64_t key) {
+    uint32_t slot = lru->buckets[key & lru->mask];
+    while (slot != NO_SLOT && lru->slots[slot].key != key) slot = lru->slots[slot].chain;
+    return slot;
+}
+
+/**
+ * Function moves a slot to the front of the list, as the most recently used one.
+*/
+static void lru_touch(lru_t *lru, uint32_t slot) {
+    cache_slot_t *s = &lru->slots[slot];
+    if (lru->head == slot) return;
+
+    // unlink it, it has a previous slot since it is not the head
+    lru->slots[s->prev].next = s->next;
+    if (s->next != NO_SLOT) lru->slots[s->next].prev = s->prev;
+    else                    lru->tail = s->prev;
+
+    s->prev = NO_SLOT;
+    s->next = lru->head;
+    lru->slots[lru->head].prev = slot;
+    lru->head = slot;
+}
+
+/**
+ * Function removes a used slot from its bucket.
+*/
+static void lru_unchain(lru_t *lru, uint32_t slot) {
+    cache_slot_t    *s      = &lru->slots[slot];
+    uint32_t        *link   = &lru->buckets[s->key & lru->mask];
+    while (*link != slot) link = &lru->slots[*link].chain;
+    *link   = s->chain;
+    s->used = 0;
+}
+
+/**
+ * Function reuses the least recently used slot for key, and moves it to the front of the list.
+ * Returns the slot, the payload of which is left to the caller.
+*/
+static uint32_t lru_claim(lru_t *lru, uint64_t key, uint64_t *evictions) {
+    uint32_t        slot    = lru->tail;
+    cache_slot_t    *s      = &lru->slots[slot];
+
+    if (s->used) {
+        lru_unchain(lru, slot);
+        (*evictions)++;
+    }
+
+    s->key      = key;
+    s->used     = 1;
+    s->chain    = lru->buckets[key & lru->mask];
+    lru->buckets[key & lru->mask] = slot;
+    lru_touch(lru, slot);
+    return slot;
+}
+
+/**
+ * Function empties a used slot, and moves it to the back of the list, as the next one to reuse.
+*/
+static void lru_drop(lru_t *lru, uint32_t slot) {
+    cache_slot_t *s = &lru->slots[slot];
+    lru_unchain(lru, slot);
+    if (lru->tail == slot) return;
+
+    // unlink it, it has a next slot since it is not the tail
+    if (s->prev != NO_SLOT) lru->slots[s->prev].next = s->next;
+    else                    lru->head = s->next;
+    lru->slots[s->next].prev = s->prev;
+
+    s->next = NO_SLOT;
+    s->prev = lru->tail;
+    lru->slots[lru->tail].next = slot;
+    lru->tail = slot;
+}
+
+/**
+ * Function allocates a cache of about capacity bytes of blocks.
+ * Returns the cache, or NULL if it could not be allocated.
+*/
+tar_cache_t *cache_new(size_t capacity) {
+    tar_cache_t *cache      = calloc(1, sizeof(tar_cache_t));
+    uint32_t    n_blocks    = capacity / TAR_CACHE_BLOCK_SIZE > 0 ? capacity / TAR_CACHE_BLOCK_SIZE : 1;
+    if (cache == NULL) return NULL;
+
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    int ret = lru_init(&cache->blocks, n_blocks);
+    if (ret == 0) ret = lru_init(&cache->lookups, TAR_CACHE_LOOKUPS);
+    cache->data         = malloc((size_t) n_blocks * TAR_CACHE_BLOCK_SIZE);
+    cache->block_len    = calloc(n_blocks, sizeof(uint32_t));
+    cache->found        = calloc(TAR_CACHE_LOOKUPS, sizeof(cache_lookup_t));
+    if (ret < 0 || cache->data == NULL || cache->block_len == NULL || cache->found == NULL) {
+        cache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/**
+ * Function releases a cache, which may be NULL.
+*/
+void cache_free(tar_cache_t *cache) {
+    if (cache == NULL) return;
+    if (cache->found != NULL) {
+        for (uint32_t i = 0; i < TAR_CACHE_LOOKUPS; i++) free(cache->found[i].path);
+    }
+    lru_free(&cache->blocks);
+    lru_free(&cache->lookups);
+    free(cache->data);
+    free(cache->block_len);
+    free(cache->found);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->loaded);
+    free(cache);
+}
+
+/**
+ * Function sets data_offset and size to the ones of the data of the regular file at path, following
+ * links. The cache is locked by the caller, but unlocked while the archive is scanned.
+ * Returns zero on success, or the error code of read_file().
+*/
+static int cache_find_file(tar_cache_t *cache, const tar_archive_t *archive, const char *path, uint64_t *data_offset, uint64_t *size) {
+    if (archive->index != NULL) return archive_find_file(archive, path, data_offset, size);
+
+    uint64_t        key     = hash_name(path, strlen(path));
+    uint32_t        slot    = lru_find(&cache->lookups, key);
+    cache_lookup_t  *found;
+
+    if (slot != NO_SLOT && strcmp(cache->found[slot].path, path) == 0) {
+        cache->stats.lookup_hits++;
+        STAT_ADD(cache_hits, 1);
+        lru_touch(&cache->lookups, slot);
+    } else {
+        cache->stats.lookup_misses++;
+        STAT_ADD(cache_misses, 1);
+        cache_lookup_t  lookup  = {0};
+        char            *copy   = strdup(path);
+
+        pthread_mutex_unlock(&cache->lock);
+        lookup.ret = find_file(archive->fd, path, &lookup.data_offset, &lookup.size);
+        pthread_mutex_lock(&cache->lock);
+
+        // the slot may have been taken while the cache was unlocked, by another path of the same hash too
+        if (copy == NULL) {
+            *data_offset    = lookup.data_offset;
+            *size           = lookup.size;
+            return lookup.ret;
+        }
+        slot = lru_find(&cache->lookups, key);
+        if (slot == NO_SLOT) slot = lru_claim(&cache->lookups, key, &cache->stats.evictions);
+        else                 lru_touch(&cache->lookups, slot);
+        free(cache->found[slot].path);
+        lookup.path         = copy;
+        cache->found[slot]  = lookup;
+    }
+
+    found           = &cache->found[slot];
+    *data_offset    = found->data_offset;
+    *size           = found->size;
+    return found->ret;
+}
+
+/**
+ * Function returns the slot holding a block of the archive, reading it on a miss, see INFO 2.
+ * The cache is locked by the caller, but unlocked while the block is read.
+ * Returns NO_SLOT if the block could not be read, in which case it is not cached.
+*/
+static uint32_t cache_block(tar_cache_t *cache, int tar_fd, uint64_t block) {
+    uint32_t slot;
+    while (1) {
+        slot = lru_find(&cache->blocks, block);
+        if (slot != NO_SLOT && cache->block_len[slot] != BLOCK_LOADING) {
+            cache->stats.hits++;
+            STAT_ADD(cache_hits, 1);
+            lru_touch(&cache->blocks, slot);
+            return slot;
+        }
+        // a block being read is waited for, as is the slot to reuse when it is being read too
+        if (slot == NO_SLOT && cache->block_len[cache->blocks.tail] != BLOCK_LOADING) break;
+        pthread_cond_wait(&cache->loaded, &cache->lock);
+    }
+
+    cache->stats.misses++;
+    STAT_ADD(cache_misses, 1);
+    slot = lru_claim(&cache->blocks, block, &cache->stats.evictions);
+    cache->block_len[slot] = BLOCK_LOADING;
+    pthread_mutex_unlock(&cache->lock);
+
+    ssize_t n_read;
+    do {
+        n_read = archive_pread(tar_fd, cache->data + (size_t) slot * TAR_CACHE_BLOCK_SIZE, TAR_CACHE_BLOCK_SIZE,
+                               block * TAR_CACHE_BLOCK_SIZE);
+    } while (n_read < 0 && errno == EINTR);
+
+    pthread_mutex_lock(&cache->lock);
+    pthread_cond_broadcast(&cache->loaded);
+    if (n_read < 0) {
+        // not kept, the next read of the block tries again
+        cache->block_len[slot] = 0;
+        lru_drop(&cache->blocks, slot);
+        return NO_SLOT;
+    }
+    cache->block_len[slot] = (uint32_t) n_read;
+    return slot;
+}
+
+/**
+ * Function reads a file of the archive of a handle through its cache, like read_file().
+ * Reads larger than half of the cache bypass it, not to evict every cached block.
+*/
+ssize_t cache_read_file(tar_cache_t *cache, const tar_archive_t *archive, const char *path, size_t offset, uint8_t *dest, size_t *len) {
+    uint64_t    data_offset;
+    uint64_t    size;
+
+    pthread_mutex_lock(&cache->lock);
+    int ret = cache_find_file(cache, archive, path, &data_offset, &size);
+    if (ret < 0 || offset > size) {
+        pthread_mutex_unlock(&cache->lock);
+        return ret < 0 ? ret : -2;
+    }
+
+    // read maximum possible
+    if (*len >= size - offset) *len = size - offset;
+
+    if (*len > (size_t) cache->blocks.n_slots * TAR_CACHE_BLOCK_SIZE / 2) {
+        pthread_mutex_unlock(&cache->lock);
+        ssize_t n_read = archive_pread(archive->fd, dest, *len, data_offset + offset);
+        *len = n_read < 0 ? 0 : (size_t) n_read;
+        return size - offset - *len;
+    }
+
+    uint64_t    pos     = data_offset + offset;
+    uint64_t    end     = pos + *len;
+    size_t      copied  = 0;
+    while (pos < end) {
+        uint64_t    block   = pos / TAR_CACHE_BLOCK_SIZE;
+        uint32_t    slot    = cache_block(cache, archive->fd, block);
+        size_t      start   = pos - block * TAR_CACHE_BLOCK_SIZE;
+        if (slot == NO_SLOT || start >= cache->block_len[slot]) break;      // the read failed, or the archive is truncated
+
+        size_t n = cache->block_len[slot] - start;
+        if (n > end - pos) n = end - pos;
+        memcpy(dest + copied, cache->data + (size_t) slot * TAR_CACHE_BLOCK_SIZE + start, n);
+        copied  += n;
+        pos     += n;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    *len = copied;
+    return size - offset - copied;
+}
+
+/**
+ * Attaches a cache of about capacity bytes to a handle.
+ */
+int tar_enable_cache(tar_archive_t *archive, size_t capacity) {
+    tar_cache_t *cache = NULL;
+    if (capacity > 0 && (cache = cache_new(capacity)) == NULL) return -4;
+
+    cache_free(archive->cache);
+    archive->cache = cache;
+    return 0;
+}
+
+/**
+ * Gets the counters of the cache of a handle.
+ */
+void tar_cache_stats(const tar_archive_t *archive, tar_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(tar_cache_stats_t));
+    if (archive->cache == NULL) return;
+
+    pthread_mutex_lock(&archive->cache->lock);
+    *stats = archive->cache->stats;
+    pthread_mutex_unlock(&archive->cache->lock);
+}
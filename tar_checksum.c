@@ -0,0 +1,203 @@
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * INFO 1: checksum kernels
+ * The checksum is the unsigned sum of the 512 bytes of the header, the chksum
+ * field being counted as eight blanks. Every kernel sums the whole block, then
+ * replaces the contribution of the chksum field by the one of the blanks.
+ * On x86-64, the block is summed with psadbw (sum of absolute differences
+ * against zero), which adds up 8 unsigned bytes per 64-bit lane in a single
+ * instruction. The kernel is selected once, when the library is loaded,
+ * depending on the instruction sets the CPU supports.
+*/
+
+/**
+ * INFO 2: data digests
+ * The data of entries is digested with CRC32C (the Castagnoli polynomial),
+ * which SSE4.2 computes 8 bytes at a time with the crc32 instruction. Without
+ * it, the scalar kernel goes through 8 bytes at a time too, looking them up
+ * in 8 tables of 256 values (slicing-by-8) built when the library is loaded.
+*/
+
+#define CHKSUM_OFFSET   148
+#define CHKSUM_LEN      8
+
+/* CRC32C polynomial, bits reversed */
+#define CRC32C_POLY     0x82f63b78
+
+typedef uint32_t (*checksum_fn)(const uint8_t *block);
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *data, size_t len);
+
+static uint32_t crc32c_tables[8][256];
+
+/**
+ * Function returns the unsigned sum of the 512 bytes of block, one byte at a time.
+*/
+static uint32_t block_sum_scalar(const uint8_t *block) {
+    uint32_t sum = 0;
+    for (int i = 0; i < BLOCKSIZE; i++) sum += block[i];
+    return sum;
+}
+
+#if defined(__x86_64__)
+/**
+ * Function returns the unsigned sum of the 512 bytes of block, 16 bytes at a time.
+*/
+__attribute__((target("sse2")))
+static uint32_t block_sum_sse2(const uint8_t *block) {
+    const __m128i   zero    = _mm_setzero_si128();
+    __m128i         acc0    = zero;
+    __m128i         acc1    = zero;
+
+    for (int i = 0; i < BLOCKSIZE; i += 32) {
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (block + i)),      zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (block + i + 16)), zero));
+    }
+    acc0 = _mm_add_epi64(acc0, acc1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi64(acc0, acc0));
+    return (uint32_t) _mm_cvtsi128_si32(acc0);
+}
+
+/**
+ * Function returns the unsigned sum of the 512 bytes of block, 32 bytes at a time.
+*/
+__attribute__((target("avx2")))
+static uint32_t block_sum_avx2(const uint8_t *block) {
+    const __m256i   zero    = _mm256_setzero_si256();
+    __m256i         acc0    = zero;
+    __m256i         acc1    = zero;
+
+    for (int i = 0; i < BLOCKSIZE; i += 64) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (block + i)),      zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (block + i + 32)), zero));
+    }
+    acc0 = _mm256_add_epi64(acc0, acc1);
+
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return (uint32_t) _mm_cvtsi128_si32(acc);
+}
+#endif
+
+/**
+ * Function returns the CRC32C of len bytes of data, without the inversions around it, 8 bytes at a time, see INFO 2.
+*/
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *data, size_t len) {
+    const uint32_t (*t)[256] = (const uint32_t (*)[256]) crc32c_tables;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff]         ^ t[6][(word >> 8) & 0xff]  ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff]
+            ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    }
+#endif
+    for (; len > 0; len--) crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * Function returns the CRC32C of len bytes of data, without the inversions around it, with the crc32 instruction.
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; len > 0; len--) crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+static checksum_fn  block_sum       = block_sum_scalar;
+static crc32c_fn    crc32c_kernel   = crc32c_scalar;
+
+/**
+ * Function builds the tables of the scalar CRC32C kernel, see INFO 2.
+*/
+static void build_crc32c_tables(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        crc32c_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) crc32c_tables[k][i] = (crc32c_tables[k - 1][i] >> 8) ^ crc32c_tables[0][crc32c_tables[k - 1][i] & 0xff];
+    }
+}
+
+/**
+ * Function selects the fastest kernel the CPU supports, when the library is loaded.
+*/
+__attribute__((constructor))
+static void select_checksum_kernel(void) {
+    build_crc32c_tables();
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))         block_sum = block_sum_avx2;
+    else if (__builtin_cpu_supports("sse2"))    block_sum = block_sum_sse2;
+    if (__builtin_cpu_supports("sse4.2"))       crc32c_kernel = crc32c_sse42;
+#endif
+}
+
+/**
+ * Function replaces the contribution of the chksum field in sum by the one of eight blanks.
+*/
+static inline uint32_t blank_chksum(const uint8_t *block, uint32_t sum) {
+    for (int i = 0; i < CHKSUM_LEN; i++) sum -= block[CHKSUM_OFFSET + i];
+    return sum + CHKSUM_LEN * ' ';
+}
+
+/**
+ * Function returns the checksum of a header, computed with the kernel selected for the CPU.
+*/
+uint32_t header_checksum(const tar_header_t *header) {
+    const uint8_t *block = (const uint8_t *) header;
+    return blank_chksum(block, block_sum(block));
+}
+
+/**
+ * Function returns the checksum of a header computed with the given kernel,
+ * which is one of the TAR_CHECKSUM_* values. Falls back to the scalar kernel
+ * when the CPU does not support the requested one.
+*/
+uint32_t header_checksum_with(const tar_header_t *header, int kernel) {
+    const uint8_t   *block  = (const uint8_t *) header;
+    checksum_fn     fn      = block_sum_scalar;
+#if defined(__x86_64__)
+    if (kernel == TAR_CHECKSUM_SSE2 && __builtin_cpu_supports("sse2")) fn = block_sum_sse2;
+    if (kernel == TAR_CHECKSUM_AVX2 && __builtin_cpu_supports("avx2")) fn = block_sum_avx2;
+#endif
+    return blank_chksum(block, fn(block));
+}
+
+/**
+ * Function returns the CRC32C of len bytes of data following the ones whose CRC32C is crc, zero for none,
+ * computed with the kernel selected for the CPU, see INFO 2.
+*/
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    return ~crc32c_kernel(~crc, data, len);
+}
+
+/**
+ * Function returns the same value as crc32c(), computed with the given kernel, TAR_CHECKSUM_SCALAR or
+ * TAR_CHECKSUM_SSE42. Falls back to the scalar kernel when the CPU does not support the requested one.
+*/
+uint32_t crc32c_with(uint32_t crc, const void *data, size_t len, int kernel) {
+    crc32c_fn fn = crc32c_scalar;
+#if defined(__x86_64__)
+    if (kernel == TAR_CHECKSUM_SSE42 && __builtin_cpu_supports("sse4.2")) fn = crc32c_sse42;
+#endif
+    return ~fn(~crc, data, len);
+}
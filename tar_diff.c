@@ -0,0 +1,333 @@
+#include <pthread.h>
+#include <errno.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: comparing entries
+ * Entries are matched by name, without its trailing '/', so that a file
+ * replaced by a directory of the same name is a change of type, a name
+ * appearing more than once in an archive standing for its first occurrence,
+ * as for every lookup, see INFO 1 of tar_index.c. Two entries of the same name differ in type when they are not
+ * the same kind of entry, regular files with a '0' or a null typeflag being
+ * the same kind. Otherwise their headers are compared first: a different mode,
+ * link target or size is a modification, without reading any data. Only the
+ * regular files of the same size are left to compare, through digests of
+ * their data, see INFO 2. Modification times are not compared, since
+ * rebuilding a release changes all of them.
+*/
+
+/**
+ * INFO 2: digests
+ * The data of the files left to compare is digested with CRC32C, see INFO 2
+ * of tar_checksum.c, straight from its offset in the archive, by a pool of
+ * threads each taking the next file, in archive order. Both archives share
+ * the pool, so that the larger does not wait for the smaller.
+ * The digests of an index are kept in its digests array, and tar_diff()
+ * writes the ones it computed, along with the ones already known, to the
+ * sidecar of a handle opened with tar_open_sidecar(): diffing the archive
+ * again once reopened reads the digests, not the data. Two different files of
+ * the same size are taken for the same one when their digests collide, which
+ * happens once in 2^32 pairs.
+*/
+
+/* Size of the buffer of a thread digesting data */
+#define DIFF_BUFFER_SIZE (256 << 10)
+
+/* Largest number of threads digesting data */
+#ifndef TAR_DIFF_MAX_THREADS
+#define TAR_DIFF_MAX_THREADS 64
+#endif
+
+/* Changes of the entries of the old archive other than the TAR_DIFF_* values */
+#define DIFF_SAME       0       /* unchanged */
+#define DIFF_PENDING    5       /* decided by the digests of their data */
+#define DIFF_DUPLICATE  6       /* not the first occurrence of its name, see INFO 1 */
+
+/**
+ * One of the archives of a diff.
+ */
+typedef struct diff_side
+{
+    const tar_archive_t *archive;
+    const tar_index_t   *index;         /* index of the handle, or the one built for the diff */
+    tar_index_t         *built;         /* NULL when the handle is indexed */
+    uint64_t            *digests;       /* DIGEST_KNOWN and the CRC32C of the data of each entry, zero when unknown */
+    size_t              n_computed;     /* digests computed by the diff */
+} diff_side_t;
+
+/**
+ * The data of a file to digest.
+ */
+typedef struct digest_job
+{
+    uint32_t    side;                   /* 0 for the old archive, 1 for the new one */
+    uint32_t    pos;                    /* position of the file in the index of its archive */
+} digest_job_t;
+
+typedef struct differ
+{
+    diff_side_t     sides[2];           /* the old archive, then the new one */
+    uint8_t         *changes;           /* TAR_DIFF_* or DIFF_* value of each entry of the old archive */
+    uint32_t        *matches;           /* position in the new index of the entry of the same name, if any */
+    digest_job_t    *jobs;
+    size_t          n_jobs;
+    size_t          next_job;           /* next file to digest, taken atomically */
+    int             failed;             /* set when the data of a file could not be read */
+} differ_t;
+
+static int compare_jobs(const void *a, const void *b) {
+    const digest_job_t *x = a, *y = b;
+    if (x->side != y->side) return x->side < y->side ? -1 : 1;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/**
+ * Function returns the kind of an entry of the given typeflag, the same for both typeflags of regular files.
+*/
+static char entry_kind(char typeflag) {
+    return typeflag == AREGTYPE ? REGTYPE : typeflag;
+}
+
+/**
+ * Function returns the entry at position pos of an index.
+*/
+static tar_entry_t index_entry(const tar_index_t *index, uint32_t pos) {
+    return (tar_entry_t) {INDEX_NAME(index, pos), INDEX_LINKNAME(index, pos), index->sizes[pos], (uint64_t) index->mtimes[pos],
+                          index->modes[pos], index->types[pos], index->data_offsets[pos] - BLOCKSIZE, index->data_offsets[pos]};
+}
+
+/**
+ * Function returns the position of the first entry named path, with or without a trailing '/', or -1 if
+ * there is none.
+*/
+static int64_t find_entry(const tar_index_t *index, const char *path, size_t len) {
+    char with_slash[TAR_PATH_MAX];
+    if (len > 0 && path[len - 1] == '/') len--;
+
+    int64_t pos = tar_index_find(index, path, len);
+    if (len + 1 >= sizeof(with_slash)) return pos;
+    memcpy(with_slash, path, len);
+    with_slash[len] = '/';
+    int64_t dir     = tar_index_find(index, with_slash, len + 1);
+    return pos < 0 || (dir >= 0 && dir < pos) ? dir : pos;
+}
+
+/**
+ * Function compares the entry at position pos of the old archive with the one of the same name in the new
+ * archive, from their headers only, see INFO 1, and sets its match.
+ * Returns its change, a TAR_DIFF_* or DIFF_* value.
+*/
+static int compare_entry(differ_t *d, uint32_t pos) {
+    const tar_index_t   *old    = d->sides[0].index;
+    const tar_index_t   *new    = d->sides[1].index;
+    const char          *name   = INDEX_NAME(old, pos);
+    size_t              len     = strlen(name);
+    if (find_entry(old, name, len) != (int64_t) pos) return DIFF_DUPLICATE;
+
+    int64_t other = find_entry(new, name, len);
+    if (other < 0) return TAR_DIFF_REMOVED;
+    d->matches[pos] = (uint32_t) other;
+
+    char kind = entry_kind(old->types[pos]);
+    if (kind != entry_kind(new->types[other]))                                  return TAR_DIFF_TYPE_CHANGED;
+    if (old->modes[pos] != new->modes[other])                                   return TAR_DIFF_MODIFIED;
+    if (INDEX_IS_LINK(old, pos))    return strcmp(INDEX_LINKNAME(old, pos), INDEX_LINKNAME(new, other)) != 0 ? TAR_DIFF_MODIFIED : DIFF_SAME;
+    if (kind != REGTYPE)                                                        return DIFF_SAME;
+    if (old->sizes[pos] != new->sizes[other])                                   return TAR_DIFF_MODIFIED;
+    return old->sizes[pos] == 0 ? DIFF_SAME : DIFF_PENDING;
+}
+
+/**
+ * Function allocates the digests of a side, starting from the ones its index already knows.
+ * Returns zero on success, -1 otherwise.
+*/
+static int init_digests(diff_side_t *side) {
+    const tar_index_t *index = side->index;
+    side->digests = calloc(index->n_entries, sizeof(uint64_t));
+    if (side->digests == NULL) return -1;
+    if (index->n_digests > 0) memcpy(side->digests, index->digests, index->n_digests * sizeof(uint64_t));
+    return 0;
+}
+
+/**
+ * Function queues the data of the file at position pos of a side, unless its digest is known.
+*/
+static void queue_digest(differ_t *d, uint32_t side, uint32_t pos) {
+    if (d->sides[side].digests[pos] & DIGEST_KNOWN) return;
+    d->jobs[d->n_jobs++] = (digest_job_t) {side, pos};
+    d->sides[side].n_computed++;
+}
+
+/**
+ * Function digests the data of a file.
+ * Returns zero on success, -1 otherwise.
+*/
+static int digest_file(differ_t *d, const digest_job_t *job, uint8_t **buffer) {
+    diff_side_t         *side   = &d->sides[job->side];
+    const tar_index_t   *index  = side->index;
+    uint64_t            offset  = index->data_offsets[job->pos];
+    uint64_t            len     = index->sizes[job->pos];
+    uint32_t            crc     = 0;
+    if (*buffer == NULL && (*buffer = malloc(DIFF_BUFFER_SIZE)) == NULL) return -1;
+
+    while (len > 0) {
+        ssize_t n_read = archive_pread(side->archive->fd, *buffer, len < DIFF_BUFFER_SIZE ? len : DIFF_BUFFER_SIZE, offset);
+        if (n_read < 0 && errno == EINTR) continue;
+        if (n_read <= 0) return -1;             // an error, or an archive shorter than its headers say
+        crc     = crc32c(crc, *buffer, n_read);
+        offset += n_read;
+        len    -= n_read;
+    }
+    side->digests[job->pos] = DIGEST_KNOWN | crc;
+    return 0;
+}
+
+/**
+ * Function runs a thread of the pool: digests the next file until there is none left.
+*/
+static void *digest_thread(void *arg) {
+    differ_t    *d      = arg;
+    uint8_t     *buffer = NULL;
+
+    size_t i;
+    while ((i = __atomic_fetch_add(&d->next_job, 1, __ATOMIC_RELAXED)) < d->n_jobs) {
+        if (digest_file(d, &d->jobs[i], &buffer) < 0) __atomic_store_n(&d->failed, 1, __ATOMIC_RELAXED);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Function digests the queued files with n_threads threads, zero for one per online CPU.
+*/
+static void run_jobs(differ_t *d, unsigned n_threads) {
+    qsort(d->jobs, d->n_jobs, sizeof(digest_job_t), compare_jobs);
+    if (n_threads == 0) n_threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (n_threads > TAR_DIFF_MAX_THREADS) n_threads = TAR_DIFF_MAX_THREADS;
+    if (n_threads > d->n_jobs) n_threads = d->n_jobs > 0 ? d->n_jobs : 1;
+
+    pthread_t threads[n_threads];
+    unsigned  n_started = 0;
+    while (n_started + 1 < n_threads && pthread_create(&threads[n_started], NULL, digest_thread, d) == 0) n_started++;
+    digest_thread(d);
+    for (unsigned i = 0; i < n_started; i++) pthread_join(threads[i], NULL);
+}
+
+/**
+ * Function writes the digests of a side to the sidecar of its handle, if it has one and the diff computed some.
+*/
+static void save_digests(const diff_side_t *side) {
+    if (side->archive->sidecar_path == NULL || side->built != NULL || side->n_computed == 0) return;
+
+    // a shallow copy of the index, sharing all of its arrays but the digests
+    tar_index_t copy    = *side->index;
+    copy.digests        = side->digests;
+    copy.n_digests      = copy.n_entries;
+    tar_index_save(&copy, side->archive->fd, side->archive->sidecar_path);     // a sidecar which cannot be written only costs the next diff
+}
+
+/**
+ * Function reports the changes found by a diff, see tar_diff().
+ * Returns the number of changes reported.
+*/
+static int report(differ_t *d, tar_diff_callback_t callback, void *user_data) {
+    const tar_index_t   *old        = d->sides[0].index;
+    const tar_index_t   *new        = d->sides[1].index;
+    int                 n_changes   = 0;
+
+    for (uint32_t pos = 0; pos < old->n_entries; pos++) {
+        int change = d->changes[pos];
+        if (change == DIFF_PENDING) {
+            change = d->sides[0].digests[pos] != d->sides[1].digests[d->matches[pos]] ? TAR_DIFF_MODIFIED : DIFF_SAME;
+        }
+        if (change == DIFF_SAME || change == DIFF_DUPLICATE) continue;
+
+        n_changes++;
+        if (callback == NULL) continue;
+        tar_entry_t old_entry = index_entry(old, pos);
+        tar_entry_t new_entry;
+        if (change != TAR_DIFF_REMOVED) new_entry = index_entry(new, d->matches[pos]);
+        if (callback(change, &old_entry, change != TAR_DIFF_REMOVED ? &new_entry : NULL, user_data) != 0) return n_changes;
+    }
+
+    for (uint32_t pos = 0; pos < new->n_entries; pos++) {
+        const char  *name   = INDEX_NAME(new, pos);
+        size_t      len     = strlen(name);
+        if (find_entry(old, name, len) >= 0 || find_entry(new, name, len) != (int64_t) pos) continue;
+
+        n_changes++;
+        if (callback == NULL) continue;
+        tar_entry_t new_entry = index_entry(new, pos);
+        if (callback(TAR_DIFF_ADDED, NULL, &new_entry, user_data) != 0) return n_changes;
+    }
+    return n_changes;
+}
+
+/**
+ * Function implements tar_diff().
+*/
+static int diff(const tar_archive_t *old_archive, const tar_archive_t *new_archive, unsigned n_threads,
+                tar_diff_callback_t callback, void *user_data) {
+    differ_t    d   = {{{old_archive, old_archive->index}, {new_archive, new_archive->index}}};
+    int         ret = 0;
+    for (int s = 0; s < 2 && ret >= 0; s++) {
+        if (d.sides[s].index != NULL) continue;
+        ret = tar_index_build(d.sides[s].archive->fd, &d.sides[s].built);
+        d.sides[s].index = d.sides[s].built;
+    }
+
+    // headers first, see INFO 1
+    uint32_t n_old = ret >= 0 ? d.sides[0].index->n_entries : 0;
+    if (ret >= 0) {
+        d.changes   = malloc(n_old + 1);
+        d.matches   = malloc((n_old + 1) * sizeof(uint32_t));
+        if (d.changes == NULL || d.matches == NULL) ret = -4;
+    }
+    size_t n_pending = 0;
+    for (uint32_t pos = 0; pos < n_old && ret >= 0; pos++) {
+        d.changes[pos]  = compare_entry(&d, pos);
+        n_pending      += d.changes[pos] == DIFF_PENDING;
+    }
+
+    // then the data of the files left, see INFO 2
+    if (ret >= 0 && n_pending > 0) {
+        d.jobs = malloc(2 * n_pending * sizeof(digest_job_t));
+        if (d.jobs == NULL || init_digests(&d.sides[0]) < 0 || init_digests(&d.sides[1]) < 0) ret = -4;
+    }
+    if (ret >= 0 && n_pending > 0) {
+        for (uint32_t pos = 0; pos < n_old; pos++) {
+            if (d.changes[pos] != DIFF_PENDING) continue;
+            queue_digest(&d, 0, pos);
+            queue_digest(&d, 1, d.matches[pos]);
+        }
+        run_jobs(&d, n_threads);
+        if (d.failed) ret = -5;
+    }
+    if (ret >= 0 && n_pending > 0) {
+        save_digests(&d.sides[0]);
+        save_digests(&d.sides[1]);
+    }
+
+    if (ret >= 0) ret = report(&d, callback, user_data);
+    for (int s = 0; s < 2; s++) {
+        tar_index_free(d.sides[s].built);
+        free(d.sides[s].digests);
+    }
+    free(d.changes);
+    free(d.matches);
+    free(d.jobs);
+    return ret;
+}
+
+/**
+ * Compares two archives entry by entry.
+ */
+int tar_diff(const tar_archive_t *old_archive, const tar_archive_t *new_archive, unsigned n_threads,
+             tar_diff_callback_t callback, void *user_data) {
+    STATS_ENTER(old_archive);
+    int ret = diff(old_archive, new_archive, n_threads, callback, user_data);
+    STATS_LEAVE(TAR_API_DIFF);
+    return ret;
+}
@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: extraction order
+ * Entries are extracted relative to a descriptor of the destination, with
+ * normalized names, so that no name escapes it:
+ *  1. directories, grouped by name so that parents come before their children,
+ *  2. regular files, by a pool of threads, each one taking the next file in
+ *     archive order, so that the archive is read sequentially,
+ *  3. hard links, to the files extracted in 2,
+ *  4. symlinks, last, so that no file is ever written through one of them,
+ *  5. the modes and modification times of directories, children first, since
+ *     creating their children updated them and a read-only mode would have
+ *     prevented it.
+*/
+
+/**
+ * INFO 2: moving data
+ * The data of a file is copied from the archive to the file in the kernel by
+ * copy_file_range(), without going through a user buffer, after the file was
+ * preallocated with fallocate() to avoid fragmenting it. When the filesystems
+ * do not support it, or the archive is compressed, the data is copied with
+ * pread() and write().
+*/
+
+/**
+ * INFO 3: names met more than once
+ * Only the last entry of each normalized name is extracted, as tar would leave
+ * it, so that no two threads ever write the same file. Links are created in
+ * their parent directory opened component by component with O_NOFOLLOW: an
+ * archive holding d -> /elsewhere and then d/x would otherwise create x
+ * outside of the destination through the first symlink.
+*/
+
+/* Size of the buffer of a thread copying data without copy_file_range() */
+#define EXTRACT_BUFFER_SIZE (256 << 10)
+
+/* Largest number of threads extracting files */
+#ifndef TAR_EXTRACT_MAX_THREADS
+#define TAR_EXTRACT_MAX_THREADS 64
+#endif
+
+typedef struct extract_entry
+{
+    uint32_t    pos;                        /* position of the entry in the index */
+    char        *path;                      /* normalized name, relative to the destination */
+} extract_entry_t;
+
+typedef struct extractor
+{
+    int                 tar_fd;
+    int                 dir_fd;             /* destination directory */
+    const tar_index_t   *index;
+    extract_entry_t     *files;
+    size_t              n_files;
+    size_t              next_file;          /* next file to extract, taken atomically */
+    int                 failed;             /* set when an entry could not be extracted */
+} extractor_t;
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((const extract_entry_t *) a)->path, ((const extract_entry_t *) b)->path);
+}
+
+static int compare_occurrences(const void *a, const void *b) {
+    const extract_entry_t   *x  = a;
+    const extract_entry_t   *y  = b;
+    int                     ret = strcmp(x->path, y->path);
+    return ret != 0 ? ret : (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+static int compare_positions(const void *a, const void *b) {
+    const extract_entry_t *x = a, *y = b;
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+/**
+ * Function keeps the last occurrence of each path of entries, which are then in archive order, see INFO 3.
+ * Returns the number of entries kept.
+*/
+static size_t keep_last_occurrences(extract_entry_t *entries, size_t n_entries) {
+    size_t n_kept = 0;
+    qsort(entries, n_entries, sizeof(extract_entry_t), compare_occurrences);
+    for (size_t i = 0; i < n_entries; i++) {
+        if (i + 1 < n_entries && strcmp(entries[i].path, entries[i + 1].path) == 0) continue;
+        entries[n_kept++] = entries[i];
+    }
+    qsort(entries, n_kept, sizeof(extract_entry_t), compare_positions);
+    return n_kept;
+}
+
+/**
+ * Function opens the directory holding path, relative to dir_fd, one component at a time without following
+ * symlinks, so that no link extracted before leads out of the destination, see INFO 3. name is set to the
+ * last component of path.
+ * Returns the descriptor of the directory, or -1 if a component is missing, is not a directory, or is a symlink.
+*/
+static int open_parent(int dir_fd, const char *path, const char **name) {
+    char        component[TAR_PATH_MAX];
+    const char  *start  = path;
+    const char  *slash;
+    int         fd      = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    while (fd >= 0 && (slash = strchr(start, '/')) != NULL) {
+        memcpy(component, start, slash - start);
+        component[slash - start] = '\0';
+        int next = openat(fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(fd);
+        fd      = next;
+        start   = slash + 1;
+    }
+    *name = start;
+    return fd;
+}
+
+/**
+ * Function creates the missing parent directories of path, relative to dir_fd.
+ * Returns zero on success, -1 otherwise.
+*/
+static int make_parents(int dir_fd, const char *path) {
+    char parent[TAR_PATH_MAX];
+    for (const char *slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        memcpy(parent, path, slash - path);
+        parent[slash - path] = '\0';
+        if (mkdirat(dir_fd, parent, 0755) < 0 && errno != EEXIST) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function copies len bytes of the archive from offset to the start of out_fd.
+ * Returns zero on success, -1 otherwise.
+*/
+static int copy_data(int tar_fd, uint64_t offset, int out_fd, uint64_t len, uint8_t **buffer) {
+    loff_t  in_offset   = offset;
+    int     use_copy    = source_of(tar_fd) == NULL;
+
+    while (len > 0) {
+        ssize_t n_copied = -1;
+        if (use_copy) {
+            n_copied = copy_file_range(tar_fd, &in_offset, out_fd, NULL, len, 0);
+            if (n_copied < 0 && errno == EINTR) continue;
+            if (n_copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) use_copy = 0;
+        }
+        if (!use_copy) {
+            if (*buffer == NULL && (*buffer = malloc(EXTRACT_BUFFER_SIZE)) == NULL) return -1;
+            ssize_t n_read = archive_pread(tar_fd, *buffer, len < EXTRACT_BUFFER_SIZE ? len : EXTRACT_BUFFER_SIZE, in_offset);
+            if (n_read < 0 && errno == EINTR) continue;
+            if (n_read <= 0) return -1;
+            for (ssize_t done = 0; done < n_read; ) {
+                ssize_t n_written = write(out_fd, *buffer + done, n_read - done);
+                if (n_written < 0 && errno == EINTR) continue;
+                if (n_written <= 0) return -1;
+                done += n_written;
+            }
+            n_copied     = n_read;
+            in_offset   += n_read;
+        }
+        if (n_copied <= 0) return -1;           // an error, or an archive shorter than its headers say
+        len -= n_copied;
+    }
+    return 0;
+}
+
+/**
+ * Function extracts a regular file.
+ * Returns zero on success, -1 otherwise.
+*/
+static int extract_file(extractor_t *ex, const extract_entry_t *file, uint8_t **buffer) {
+    const tar_index_t   *index  = ex->index;
+    uint32_t            pos     = file->pos;
+    int                 fd      = openat(ex->dir_fd, file->path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == ENOENT && make_parents(ex->dir_fd, file->path) == 0) {
+        fd = openat(ex->dir_fd, file->path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    }
+    if (fd < 0) return -1;
+
+    // preallocation is only a hint, filesystems which do not support it are fine
+    if (index->sizes[pos] > 0) fallocate(fd, 0, 0, (off_t) index->sizes[pos]);
+
+    int                     ret         = copy_data(ex->tar_fd, index->data_offsets[pos], fd, index->sizes[pos], buffer);
+    const struct timespec   times[2]    = {{0, UTIME_OMIT}, {index->mtimes[pos], 0}};
+    if (ret == 0 && fchmod(fd, index->modes[pos]) < 0)  ret = -1;
+    if (ret == 0 && futimens(fd, times) < 0)            ret = -1;
+    if (close(fd) < 0)                                  ret = -1;
+    return ret;
+}
+
+/**
+ * Function runs a thread of the pool: extracts the next file until there is none left.
+*/
+static void *extract_thread(void *arg) {
+    extractor_t *ex     = arg;
+    uint8_t     *buffer = NULL;
+
+    size_t i;
+    while ((i = __atomic_fetch_add(&ex->next_file, 1, __ATOMIC_RELAXED)) < ex->n_files) {
+        if (extract_file(ex, &ex->files[i], &buffer) < 0) __atomic_store_n(&ex->failed, 1, __ATOMIC_RELAXED);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Extracts every entry of an indexed archive under a directory.
+ */
+int tar_index_extract(int tar_fd, const tar_index_t *index, const char *dest_dir, unsigned n_threads) {
+    extractor_t     ex          = {tar_fd, -1, index, NULL, 0, 0, 0};
+    extract_entry_t *entries    = malloc(index->n_entries * sizeof(extract_entry_t));
+    char            *paths      = malloc(index->strings_len + 1);     // normalized names are never longer than raw ones
+    size_t          n_entries   = 0;
+    size_t          paths_len   = 0;
+    int             ret         = 0;
+    if ((entries == NULL && index->n_entries > 0) || paths == NULL) {
+        free(entries);
+        free(paths);
+        return -4;
+    }
+
+    for (uint32_t i = 0; i < index->n_entries; i++) {
+        const char  *name       = INDEX_NAME(index, i);
+        char        typeflag    = index->types[i];
+        if (typeflag != REGTYPE && typeflag != AREGTYPE && typeflag != DIRTYPE && !INDEX_IS_LINK(index, i)) continue;
+
+        ssize_t len = normalize_path(name, strlen(name), paths + paths_len, strlen(name) + 1);
+        if (len <= 0) continue;                                     // the root of the destination itself
+        entries[n_entries].pos      = i;
+        entries[n_entries].path     = paths + paths_len;
+        n_entries++;
+        paths_len += len + 1;
+    }
+    n_entries = keep_last_occurrences(entries, n_entries);
+
+    ex.dir_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (ex.dir_fd < 0 && errno == ENOENT && mkdir(dest_dir, 0755) == 0) ex.dir_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (ex.dir_fd < 0) {
+        free(entries);
+        free(paths);
+        return -7;
+    }
+
+    // group the entries by kind, in archive order, see INFO 1
+    extract_entry_t *grouped = malloc(n_entries * sizeof(extract_entry_t));
+    if (grouped == NULL && n_entries > 0) {
+        close(ex.dir_fd);
+        free(entries);
+        free(paths);
+        return -4;
+    }
+    size_t n_dirs = 0, n_files = 0, n_hard = 0;
+    for (size_t i = 0; i < n_entries; i++) {
+        char typeflag = index->types[entries[i].pos];
+        if (typeflag == DIRTYPE) n_dirs++;
+        else if (typeflag == LNKTYPE) n_hard++;
+        else if (typeflag != SYMTYPE) n_files++;
+    }
+    size_t next[4] = {0, n_dirs, n_dirs + n_files, n_dirs + n_files + n_hard};
+    for (size_t i = 0; i < n_entries; i++) {
+        char typeflag = index->types[entries[i].pos];
+        int  kind     = typeflag == DIRTYPE ? 0 : typeflag == LNKTYPE ? 2 : typeflag == SYMTYPE ? 3 : 1;
+        grouped[next[kind]++] = entries[i];
+    }
+    free(entries);
+    qsort(grouped, n_dirs, sizeof(extract_entry_t), compare_paths);
+
+    // 1. directories, writable until step 5
+    for (size_t i = 0; i < n_dirs; i++) {
+        if (mkdirat(ex.dir_fd, grouped[i].path, 0700) < 0 && errno != EEXIST
+            && (errno != ENOENT || make_parents(ex.dir_fd, grouped[i].path) < 0 || mkdirat(ex.dir_fd, grouped[i].path, 0700) < 0)) ex.failed = 1;
+    }
+
+    // 2. regular files
+    if (n_threads == 0) n_threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (n_threads > TAR_EXTRACT_MAX_THREADS) n_threads = TAR_EXTRACT_MAX_THREADS;
+    if (n_threads > n_files) n_threads = n_files > 0 ? n_files : 1;
+    pthread_t threads[n_threads];
+    unsigned  n_started = 0;
+    ex.files    = grouped + n_dirs;
+    ex.n_files  = n_files;
+    while (n_started + 1 < n_threads && pthread_create(&threads[n_started], NULL, extract_thread, &ex) == 0) n_started++;
+    extract_thread(&ex);
+    for (unsigned i = 0; i < n_started; i++) pthread_join(threads[i], NULL);
+
+    // 3. and 4. links, in directories reached without following the symlinks extracted before
+    char target[TAR_PATH_MAX];
+    for (size_t i = n_dirs + n_files; i < n_entries; i++) {
+        uint32_t    pos         = grouped[i].pos;
+        const char  *linkname   = INDEX_LINKNAME(index, pos);
+        const char  *name, *target_name;
+        int         parent_fd   = open_parent(ex.dir_fd, grouped[i].path, &name);
+        int         target_fd   = -1;
+        int         done        = parent_fd >= 0;
+
+        if (done) unlinkat(parent_fd, name, 0);
+        if (done && index->types[pos] == LNKTYPE) {
+            done = normalize_path(linkname, strlen(linkname), target, sizeof(target)) > 0
+                   && (target_fd = open_parent(ex.dir_fd, target, &target_name)) >= 0
+                   && linkat(target_fd, target_name, parent_fd, name, 0) == 0;
+        } else if (done) {
+            const struct timespec times[2] = {{0, UTIME_OMIT}, {index->mtimes[pos], 0}};
+            done = symlinkat(linkname, parent_fd, name) == 0
+                   && utimensat(parent_fd, name, times, AT_SYMLINK_NOFOLLOW) == 0;
+        }
+        if (target_fd >= 0) close(target_fd);
+        if (parent_fd >= 0) close(parent_fd);
+        if (!done) ex.failed = 1;
+    }
+
+    // 5. directories, children first
+    for (size_t i = n_dirs; i > 0; i--) {
+        uint32_t                pos         = grouped[i - 1].pos;
+        const struct timespec   times[2]    = {{0, UTIME_OMIT}, {index->mtimes[pos], 0}};
+        if (fchmodat(ex.dir_fd, grouped[i - 1].path, index->modes[pos], 0) < 0
+            || utimensat(ex.dir_fd, grouped[i - 1].path, times, 0) < 0) ex.failed = 1;
+    }
+
+    ret = ex.failed ? -7 : (int) n_entries;
+    close(ex.dir_fd);
+    free(grouped);
+    free(paths);
+    return ret;
+}
+
+/**
+ * Function implements tar_extract().
+*/
+static int extract(const tar_archive_t *archive, const char *dest_dir, unsigned n_threads) {
+    if (archive->index != NULL) return tar_index_extract(archive->fd, archive->index, dest_dir, n_threads);
+
+    tar_index_t *index;
+    int         ret = tar_index_build(archive->fd, &index);
+    if (ret < 0) return ret;
+
+    ret = tar_index_extract(archive->fd, index, dest_dir, n_threads);
+    tar_index_free(index);
+    return ret;
+}
+
+/**
+ * Extracts every entry of the archive of a handle under a directory.
+ */
+int tar_extract(const tar_archive_t *archive, const char *dest_dir, unsigned n_threads) {
+    STATS_ENTER(archive);
+    int ret = extract(archive, dest_dir, n_threads);
+    STATS_LEAVE(TAR_API_EXTRACT);
+    return ret;
+}
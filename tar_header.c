@@ -0,0 +1,232 @@
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: extended headers
+ * A ustar header holds a path of at most 100 bytes, or 256 bytes split
+ * between the prefix and name fields, and a size of at most 8 GiB. Longer
+ * values are stored by an extended header written just before the entry
+ * header, with the value as data:
+ *  - a POSIX.1-2001 'x' header holds records "<length> <key>=<value>\n" for
+ *    the next entry, and a 'g' header holds records for every following one,
+ *  - a GNU 'L' or 'K' header holds the name or the link name of the next entry.
+ * Extended headers are consumed while moving to the next entry, so that the
+ * consumers of a scan only ever see entries, with the values of their
+ * extended headers.
+*/
+
+/**
+ * INFO 2: decoding headers
+ * Numeric fields are octal, or base-256 when the high bit of their first byte
+ * is set (a GNU extension, for sizes past 8 GiB). A size past ENTRY_SIZE_MAX,
+ * negative in base-256 or too large in a PAX record, is rejected: the offset
+ * of the next header would wrap around. Headers of the common case
+ * (no extended header, null terminated name and link name, no prefix, octal
+ * size) are decoded inline by header_decode(), and the entry points into the
+ * header itself. Every other header goes through header_decode_ext(), which
+ * builds the full paths in the buffers of the extension state.
+*/
+
+/**
+ * INFO 3: decoding numbers
+ * Octal fields of 8 and 12 bytes, every one but the devices, are decoded 8
+ * bytes at a time by header_number(): the bytes are loaded as a word, the
+ * digits the field starts with are found with a single mask (a byte is a
+ * digit when its five high bits are those of '0'), and their values are
+ * combined in place, 2 digits per 16 bits, then 4 per 32 bits, then 8,
+ * with shifts and adds, whatever the number of digits and the terminator,
+ * null or space, ending them. The spaces some writers pad fields with are
+ * turned into leading zeros first, with another mask. A 12-byte field takes
+ * a second word when its first 8 bytes are all digits.
+*/
+
+/* Size past which the data of an extended header is ignored rather than read */
+#define EXT_MAX_SIZE (1 << 24)
+
+/**
+ * Function releases the buffers of an extension state and resets it.
+*/
+void ext_free(tar_ext_t *ext) {
+    free(ext->name);
+    free(ext->linkname);
+    free(ext->data);
+    memset(ext, 0, sizeof(tar_ext_t));
+}
+
+/**
+ * Function makes buffer, of capacity cap, large enough for len bytes.
+ * Returns zero on success, -1 if it could not be grown.
+*/
+static int reserve(char **buffer, size_t *cap, size_t len) {
+    if (len <= *cap) return 0;
+    size_t  new_cap     = *cap ? *cap : 256;
+    while (new_cap < len) new_cap *= 2;
+    char    *new_buffer = realloc(*buffer, new_cap);
+    if (new_buffer == NULL) return -1;
+    *buffer = new_buffer;
+    *cap    = new_cap;
+    return 0;
+}
+
+/**
+ * Function returns a buffer of the extension state of at least len bytes to read the data of an
+ * extended header into, or NULL if it could not be allocated or len is too large to be read.
+*/
+char *ext_buffer(tar_ext_t *ext, uint64_t len) {
+    if (len > EXT_MAX_SIZE || reserve(&ext->data, &ext->data_cap, len) < 0) return NULL;
+    return ext->data;
+}
+
+/**
+ * Function copies the len bytes of str, and a null, into buffer.
+ * Returns zero on success, -1 if the buffer could not be grown.
+*/
+static int set_string(char **buffer, size_t *cap, const char *str, size_t len) {
+    if (reserve(buffer, cap, len + 1) < 0) return -1;
+    memcpy(*buffer, str, len);
+    (*buffer)[len] = '\0';
+    return 0;
+}
+
+/**
+ * Function decodes a decimal number of a PAX record, ignoring a fractional part.
+*/
+static int64_t pax_number(const char *value, size_t len) {
+    size_t      i           = 0;
+    int         negative    = len > 0 && value[0] == '-';
+    uint64_t    number      = 0;
+    for (i = negative; i < len && value[i] >= '0' && value[i] <= '9'; i++) {
+        if (number > (INT64_MAX - 9) / 10) return negative ? -INT64_MAX : INT64_MAX;       // saturated
+        number = number * 10 + (value[i] - '0');
+    }
+    return negative ? -(int64_t) number : (int64_t) number;
+}
+
+/**
+ * Function applies a "key=value" record of a PAX extended header, see INFO 1.
+ * Returns zero on success, -1 if a value could not be stored.
+*/
+static int pax_record(tar_ext_t *ext, int global, const char *key, size_t key_len, const char *value, size_t value_len) {
+    if (key_len == 5 && memcmp(key, "mtime", 5) == 0) {
+        if (global) {
+            ext->global_mtime   = pax_number(value, value_len);
+            ext->global         |= EXT_MTIME;
+        } else {
+            ext->mtime          = pax_number(value, value_len);
+            ext->pending        |= EXT_MTIME;
+        }
+        return 0;
+    }
+    if (global) return 0;                       // a global path or size makes no sense
+
+    if (key_len == 4 && memcmp(key, "path", 4) == 0) {
+        if (set_string(&ext->name, &ext->name_cap, value, value_len) < 0) return -1;
+        ext->pending |= EXT_NAME;
+    } else if (key_len == 8 && memcmp(key, "linkpath", 8) == 0) {
+        if (set_string(&ext->linkname, &ext->linkname_cap, value, value_len) < 0) return -1;
+        ext->pending |= EXT_LINKNAME;
+    } else if (key_len == 4 && memcmp(key, "size", 4) == 0) {
+        int64_t size = pax_number(value, value_len);
+        if (size < 0 || (uint64_t) size > ENTRY_SIZE_MAX) return 0;      // ignored, see INFO 2
+        ext->size       = (uint64_t) size;
+        ext->pending    |= EXT_SIZE;
+    }
+    return 0;
+}
+
+/**
+ * Function records the values held by the len bytes of data of an extended header of type typeflag,
+ * so that they apply to the next decoded header, see INFO 1. Malformed records are ignored.
+ * Returns zero on success, -4 if a value could not be stored.
+*/
+int ext_parse(tar_ext_t *ext, char typeflag, const char *data, uint64_t len) {
+    if (len > EXT_MAX_SIZE) return 0;
+
+    if (typeflag == GNUTYPE_LONGNAME || typeflag == GNUTYPE_LONGLINK) {
+        // the data is the string, null terminated
+        int is_name = typeflag == GNUTYPE_LONGNAME;
+        len         = strnlen(data, len);
+        if (is_name && set_string(&ext->name, &ext->name_cap, data, len) < 0)              return -4;
+        if (!is_name && set_string(&ext->linkname, &ext->linkname_cap, data, len) < 0)     return -4;
+        ext->pending |= is_name ? EXT_NAME : EXT_LINKNAME;
+        return 0;
+    }
+
+    size_t pos = 0;
+    while (pos < len) {
+        // each record starts with its own length in decimal, and ends with a newline
+        size_t i            = pos;
+        size_t record_len   = 0;
+        while (i < len && data[i] >= '0' && data[i] <= '9' && record_len < len) record_len = record_len * 10 + (data[i++] - '0');
+        if (i == len || data[i] != ' ' || record_len <= i - pos || record_len > len - pos) break;
+        const char *end = data + pos + record_len - 1;
+        if (*end != '\n') break;
+
+        const char *key     = data + i + 1;
+        const char *equal   = memchr(key, '=', end - key);
+        if (equal != NULL && pax_record(ext, typeflag == XGLTYPE, key, equal - key, equal + 1, end - equal - 1) < 0) return -4;
+        pos += record_len;
+    }
+    return 0;
+}
+
+/**
+ * Function implements header_decode() for the headers not taking its fast path, see INFO 2.
+*/
+void header_decode_ext(tar_ext_t *ext, const tar_header_t *header, tar_entry_t *entry) {
+    ext->current = ext->pending;
+    ext->pending = 0;
+
+    if (ext->current & EXT_NAME) {
+        entry->name = ext->name;
+    } else {
+        size_t name_len     = strnlen(header->name, sizeof(header->name));
+        size_t prefix_len   = 0;
+        // GNU tar stores times in the prefix field of its own format
+        if (memcmp(header->magic, GNU_MAGIC_VERSION, TMAGLEN + TVERSLEN) != 0) {
+            prefix_len = strnlen(header->prefix, sizeof(header->prefix));
+        }
+        // the path is the prefix, a '/' and the name
+        char *path = ext->joined_name;
+        if (prefix_len > 0) {
+            memcpy(path, header->prefix, prefix_len);
+            path[prefix_len++] = '/';
+        }
+        memcpy(path + prefix_len, header->name, name_len);
+        path[prefix_len + name_len] = '\0';
+        entry->name = path;
+    }
+
+    if (ext->current & EXT_LINKNAME) {
+        entry->linkname = ext->linkname;
+    } else {
+        size_t linkname_len = strnlen(header->linkname, sizeof(header->linkname));
+        memcpy(ext->joined_linkname, header->linkname, linkname_len);
+        ext->joined_linkname[linkname_len]  = '\0';
+        entry->linkname                     = ext->joined_linkname;
+    }
+
+    if (ext->current & EXT_SIZE)    entry->size = ext->size;
+    else                            entry->size = (uint64_t) header_number(header->size, sizeof(header->size));
+}
+
+/**
+ * Function decodes the fields of a header which header_decode() leaves out: its mode and its mtime.
+*/
+void header_decode_rest(const tar_ext_t *ext, const tar_header_t *header, tar_entry_t *entry) {
+    if (ext->current & EXT_MTIME)       entry->mtime = (uint64_t) ext->mtime;
+    else if (ext->global & EXT_MTIME)   entry->mtime = (uint64_t) ext->global_mtime;
+    else                                entry->mtime = (uint64_t) header_number(header->mtime, sizeof(header->mtime));
+    entry->mode = (uint32_t) header_number(header->mode, sizeof(header->mode));
+}
+
+/**
+ * Function writes value into a numeric field of len bytes in base-256, see INFO 2.
+*/
+void header_set_base256(char *field, size_t len, uint64_t value) {
+    for (size_t i = len - 1; i > 0; i--) {
+        field[i]    = (char) (value & 0xff);
+        value       >>= 8;
+    }
+    field[0] = (char) 0x80;
+}
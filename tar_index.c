@@ -0,0 +1,792 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+#define INDEX_INITIAL_ENTRIES   64
+#define INDEX_INITIAL_BUCKETS   128
+
+/**
+ * INFO 1: index layout
+ * Entries are stored in archive order, one array per field (the hash of the
+ * name, the data offset, the size, the type...), so that going through one
+ * field of every entry only touches that field. Names and link names are
+ * appended to a single string pool. Lookups go through an open addressing
+ * hash table (linear probing) holding entry positions, and compare the 64-bit
+ * hashes of the names before the names themselves, so finding an entry by
+ * name seldom reads more than one name, and never touches the archive.
+ * When a name appears more than once in the archive, the table points to the
+ * first occurrence, as the scanning functions of lib_tar.c do.
+*/
+
+/**
+ * INFO 2: directory tree
+ * Once every entry is indexed, tar_index_finish() groups the names of the
+ * children of each directory in a single array, so that listing a directory
+ * only touches its children. Directories only known through the path of
+ * their content (no header of their own) get a node too, and are listed
+ * in their parent. Directory paths and child names are never copied: they
+ * are prefixes of the names already in the string pool.
+*/
+
+/**
+ * INFO 3: link resolution
+ * Every link is resolved once, when the index is finished: its target is made
+ * relative to the root, "." and ".." are resolved, and links met along the
+ * way, in the target itself or in the directories leading to it, are followed
+ * up to TAR_MAX_LINK_HOPS times, as read_file() and list() follow them. The
+ * position of the final entry and its path are kept with the link, so going
+ * through a link later on costs a single array access, and resolving another
+ * path through it a single hop.
+ * An entry at a path comes before the links along it, as for read_file(): a
+ * symlink d does not hide a later d/f.
+*/
+
+/**
+ * INFO 4: memory
+ * Every array is a region of the arena of the index, see tar_arena.c, so that
+ * it grows in place and building or freeing an index takes a single mapping,
+ * whatever its size. An entry costs 51 bytes in the arrays of its fields, at
+ * most 11 more in the hash table, which has fewer than 8/3 buckets of 4 bytes
+ * per entry, and its names in the string pool, the directory tree adding 16
+ * bytes per directory and 8 bytes per child: see tar_index_memory(). The
+ * digests tar_diff() caches in a sidecar add 8 bytes per entry to the index
+ * loaded from it, counted in its resident bytes only.
+ * The arena is reserved for the largest index the archive can hold, an entry
+ * taking a header block at least, and for INDEX_MAX_ENTRIES entries when the
+ * size of the archive is not known, like for a pipe or a compressed archive.
+ * An archive which grew past it moves the arrays to a larger arena.
+*/
+
+/* Size of the elements of each region of the arena of an index */
+static const size_t element_sizes[INDEX_REGIONS] = {
+    [INDEX_HASHES]          = sizeof(uint64_t),
+    [INDEX_DATA_OFFSETS]    = sizeof(uint64_t),
+    [INDEX_SIZES]           = sizeof(uint64_t),
+    [INDEX_MTIMES]          = sizeof(int64_t),
+    [INDEX_MODES]           = sizeof(uint16_t),
+    [INDEX_NAMES]           = sizeof(uint32_t),
+    [INDEX_LINKNAMES]       = sizeof(uint32_t),
+    [INDEX_TARGETS]         = sizeof(uint32_t),
+    [INDEX_TARGET_PATHS]    = sizeof(uint32_t),
+    [INDEX_TYPES]           = sizeof(char),
+    [INDEX_BUCKETS]         = sizeof(uint32_t),
+    [INDEX_STRINGS]         = sizeof(char),
+    [INDEX_DIRS]            = sizeof(tar_index_dir_t),
+    [INDEX_DIR_BUCKETS]     = sizeof(uint32_t),
+    [INDEX_CHILDREN]        = sizeof(tar_index_child_t),
+    [INDEX_DIGESTS]         = sizeof(uint64_t),
+    [INDEX_PENDING_PARENTS] = sizeof(uint32_t),
+    [INDEX_PENDING_NAMES]   = sizeof(tar_index_child_t),
+    [INDEX_GROUPED]         = sizeof(tar_index_child_t),
+    [INDEX_DIR_COUNTS]      = sizeof(uint32_t),
+};
+
+/**
+ * Function returns the 64-bit FNV-1a hash of the len first bytes of str.
+*/
+uint64_t hash_name(const char *str, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) str[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Function sets arrays to the addresses of the pointers to the arrays of an index, and sizes to their sizes
+ * in bytes, in the order of the INDEX_* values, see INFO 1.
+*/
+void index_arrays(tar_index_t *index, void **arrays[INDEX_ARRAYS], uint64_t sizes[INDEX_ARRAYS]) {
+    void        **pointers[INDEX_ARRAYS] = {
+        (void **) &index->hashes, (void **) &index->data_offsets, (void **) &index->sizes, (void **) &index->mtimes,
+        (void **) &index->modes, (void **) &index->names, (void **) &index->linknames, (void **) &index->targets,
+        (void **) &index->target_paths, (void **) &index->types, (void **) &index->buckets, (void **) &index->strings,
+        (void **) &index->dirs, (void **) &index->dir_buckets, (void **) &index->children, (void **) &index->digests,
+    };
+    uint64_t    lengths[INDEX_ARRAYS - INDEX_TYPES - 1] = {
+        index->n_buckets, index->strings_len, index->n_dirs, index->n_dir_buckets, index->n_children, index->n_digests,
+    };
+
+    for (int i = 0; i < INDEX_ARRAYS; i++) {
+        arrays[i]   = pointers[i];
+        sizes[i]    = (i <= INDEX_TYPES ? index->n_entries : lengths[i - INDEX_TYPES - 1]) * element_sizes[i];
+    }
+}
+
+/**
+ * Function returns the size of the archive of tar_fd, or zero when it is not known, see INFO 4.
+*/
+static uint64_t archive_size_of(int tar_fd) {
+    struct stat st;
+    if (source_of(tar_fd) != NULL || fstat(tar_fd, &st) < 0 || !S_ISREG(st.st_mode)) return 0;
+    return st.st_size;
+}
+
+static uint64_t at_most(uint64_t value, uint64_t max) {
+    return value < max ? value : max;
+}
+
+/**
+ * Function reserves the arena of an index, large enough for the largest index of an archive of
+ * index->archive_size bytes, and points the arrays of the index to their regions, see INFO 4.
+ * Returns zero on success, -1 if the arena could not be reserved.
+*/
+static int reserve_arena(tar_index_t *index) {
+    tar_index_t largest = {
+        .n_entries  = INDEX_MAX_ENTRIES,    .n_buckets      = 2 * INDEX_MAX_ENTRIES,    .strings_len    = UINT32_MAX,
+        .n_dirs     = INDEX_MAX_ENTRIES,    .n_dir_buckets  = 2 * INDEX_MAX_ENTRIES,    .n_children     = 2 * INDEX_MAX_ENTRIES,
+        .n_digests  = INDEX_MAX_ENTRIES,
+    };
+    uint64_t n_entries = index->archive_size / BLOCKSIZE;
+    if (index->archive_size != 0 && n_entries < INDEX_MAX_ENTRIES) {
+        // the arrays double from at most n_entries entries, the hash tables are at least 3/8 full, the names
+        // come from the headers or from their extensions, the pool adds the target paths of the links, every
+        // directory without a header is a prefix of a name ending before a '/', and every entry and
+        // directory is at most a child
+        uint64_t names_len      = index->archive_size + n_entries * BLOCKSIZE;
+        uint64_t n_strings      = names_len + n_entries * (TAR_PATH_MAX + 3);
+        uint64_t n_dirs         = 1 + n_entries + names_len / 2;
+        largest.n_entries       = 2 * (n_entries > INDEX_INITIAL_ENTRIES ? n_entries : INDEX_INITIAL_ENTRIES);
+        largest.n_buckets       = at_most(4 * (n_entries > INDEX_INITIAL_BUCKETS ? n_entries : INDEX_INITIAL_BUCKETS), largest.n_buckets);
+        largest.strings_len     = at_most(n_strings, largest.strings_len);
+        largest.n_dirs          = at_most(n_dirs, largest.n_dirs);
+        largest.n_dir_buckets   = at_most(4 * (n_dirs > INDEX_INITIAL_BUCKETS ? n_dirs : INDEX_INITIAL_BUCKETS), largest.n_dir_buckets);
+        largest.n_children      = at_most((uint64_t) largest.n_entries + n_dirs, largest.n_children);
+        largest.n_digests       = largest.n_entries;
+    }
+    void        **arrays[INDEX_ARRAYS];
+    uint64_t    capacities[INDEX_REGIONS];
+    index_arrays(&largest, arrays, capacities);
+    capacities[INDEX_PENDING_PARENTS]   = (uint64_t) largest.n_children * element_sizes[INDEX_PENDING_PARENTS];
+    capacities[INDEX_PENDING_NAMES]     = (uint64_t) largest.n_children * element_sizes[INDEX_PENDING_NAMES];
+    capacities[INDEX_GROUPED]           = (uint64_t) largest.n_children * element_sizes[INDEX_GROUPED];
+    capacities[INDEX_DIR_COUNTS]        = (uint64_t) largest.n_dirs     * element_sizes[INDEX_DIR_COUNTS];
+    if (arena_init(&index->arena, INDEX_REGIONS, capacities) < 0) return -1;
+
+    index_arrays(index, arrays, capacities);
+    for (int i = 0; i < INDEX_ARRAYS; i++) *arrays[i] = ARENA_REGION(&index->arena, i);
+    return 0;
+}
+
+/**
+ * Function appends the len first bytes of str and a null character to the string pool.
+ * Returns the offset of the string in the pool, or -1 if the pool could not be grown.
+*/
+static int64_t add_string(tar_index_t *index, const char *str, size_t len) {
+    if (arena_commit(&index->arena, INDEX_STRINGS, index->strings_len + len + 1) < 0) return -1;
+
+    int64_t offset = index->strings_len;
+    memcpy(index->strings + offset, str, len);
+    index->strings[offset + len]    = '\0';
+    index->strings_len              += len + 1;
+    return offset;
+}
+
+/**
+ * Function inserts the entry at position pos in the hash table, unless an entry with
+ * the same name is already there.
+*/
+static void insert_bucket(tar_index_t *index, uint32_t pos) {
+    const char  *name   = INDEX_NAME(index, pos);
+    uint64_t    hash    = index->hashes[pos];
+    uint32_t    mask    = index->n_buckets - 1;
+    uint32_t    bucket  = hash & mask;
+
+    while (index->buckets[bucket] != 0) {
+        uint32_t other = index->buckets[bucket] - 1;
+        if (index->hashes[other] == hash && strcmp(INDEX_NAME(index, other), name) == 0) return;
+        bucket = (bucket + 1) & mask;
+    }
+    index->buckets[bucket] = pos + 1;
+}
+
+/**
+ * Function doubles the size of the hash table, in place, and reinserts every entry.
+ * Returns zero on success, -1 if the table could not be grown.
+*/
+static int grow_buckets(tar_index_t *index) {
+    uint32_t n_buckets = index->n_buckets ? index->n_buckets * 2 : INDEX_INITIAL_BUCKETS;
+    if (arena_commit(&index->arena, INDEX_BUCKETS, (size_t) n_buckets * sizeof(uint32_t)) < 0) return -1;
+
+    memset(index->buckets, 0, (size_t) n_buckets * sizeof(uint32_t));
+    index->n_buckets = n_buckets;
+    for (uint32_t i = 0; i < index->n_entries; i++) insert_bucket(index, i);
+    return 0;
+}
+
+/**
+ * Function doubles the number of entries the arrays of the fields of the entries can hold.
+ * Returns zero on success, -1 if they could not be grown.
+*/
+static int grow_entries(tar_index_t *index) {
+    uint32_t new_cap = index->entries_cap ? index->entries_cap * 2 : INDEX_INITIAL_ENTRIES;
+    for (int i = 0; i <= INDEX_TYPES; i++) {
+        if (arena_commit(&index->arena, i, (size_t) new_cap * element_sizes[i]) < 0) return -1;
+    }
+    index->entries_cap = new_cap;
+    return 0;
+}
+
+/**
+ * Function adds a decoded entry to the index, see scanner_entry().
+ * Returns zero on success, -1 if the index could not be grown.
+*/
+int tar_index_add(tar_index_t *index, const tar_entry_t *entry) {
+    if (index->arena.base == NULL && reserve_arena(index) < 0) return -1;
+    if (index->n_entries == index->entries_cap && grow_entries(index) < 0) return -1;
+    // keep the load factor of the hash table under 3/4
+    if ((uint64_t) (index->n_entries + 1) * 4 > (uint64_t) index->n_buckets * 3 && grow_buckets(index) < 0) return -1;
+
+    size_t  name_len    = strlen(entry->name);
+    int64_t name        = add_string(index, entry->name,     name_len);
+    int64_t linkname    = add_string(index, entry->linkname, strlen(entry->linkname));
+    if (name < 0 || linkname < 0) return -1;
+
+    uint32_t pos                = index->n_entries++;
+    index->hashes[pos]          = hash_name(entry->name, name_len);
+    index->data_offsets[pos]    = entry->data_offset;
+    index->sizes[pos]           = entry->size;
+    index->mtimes[pos]          = (int64_t) entry->mtime;
+    index->modes[pos]           = entry->mode & 07777;
+    index->names[pos]           = (uint32_t) name;
+    index->linknames[pos]       = (uint32_t) linkname;
+    index->targets[pos]         = IS_LINK(entry) ? LINK_PENDING : LINK_NONE;
+    index->target_paths[pos]    = 0;
+    index->types[pos]           = entry->typeflag;
+
+    insert_bucket(index, pos);
+    index->end_offset = entry->data_offset + BLOCK_ALIGN(entry->size);
+    return 0;
+}
+
+/**
+ * Function returns the position of the indexed entry whose name is made of the path_len first bytes of path,
+ * or -1 if there is no such entry.
+*/
+int64_t tar_index_find(const tar_index_t *index, const char *path, size_t path_len) {
+    if (index->n_buckets == 0) return -1;
+
+    uint64_t hash   = hash_name(path, path_len);
+    uint32_t mask   = index->n_buckets - 1;
+    uint32_t bucket = hash & mask;
+
+    while (index->buckets[bucket] != 0) {
+        uint32_t pos = index->buckets[bucket] - 1;
+        if (index->hashes[pos] == hash) {
+            const char *name = INDEX_NAME(index, pos);
+            if (strncmp(name, path, path_len) == 0 && name[path_len] == '\0') return pos;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    return -1;
+}
+
+/**
+ * Function returns the position of the directory whose path is made of the len first bytes
+ * of path, or -1 if there is no such directory.
+*/
+static int64_t find_dir(const tar_index_t *index, const char *path, size_t len) {
+    if (index->n_dir_buckets == 0) return -1;
+
+    uint32_t mask   = index->n_dir_buckets - 1;
+    uint32_t bucket = hash_name(path, len) & mask;
+
+    while (index->dir_buckets[bucket] != 0) {
+        uint32_t        pos = index->dir_buckets[bucket] - 1;
+        tar_index_dir_t *dir = &index->dirs[pos];
+        if (dir->key_len == len && memcmp(index->strings + dir->key, path, len) == 0) return pos;
+        bucket = (bucket + 1) & mask;
+    }
+    return -1;
+}
+
+/**
+ * Function inserts the directory at position pos in the directory hash table.
+*/
+static void insert_dir_bucket(tar_index_t *index, uint32_t pos) {
+    tar_index_dir_t *dir    = &index->dirs[pos];
+    uint32_t        mask    = index->n_dir_buckets - 1;
+    uint32_t        bucket  = hash_name(index->strings + dir->key, dir->key_len) & mask;
+
+    while (index->dir_buckets[bucket] != 0) bucket = (bucket + 1) & mask;
+    index->dir_buckets[bucket] = pos + 1;
+}
+
+/**
+ * Pending (directory, child name) pairs, gathered before being grouped by directory.
+*/
+typedef struct tree_builder
+{
+    tar_arena_t         *arena;
+    uint32_t            *parents;       /* the INDEX_PENDING_PARENTS region of the arena */
+    tar_index_child_t   *names;         /* the INDEX_PENDING_NAMES region of the arena */
+    uint32_t            n_children;
+} tree_builder_t;
+
+/**
+ * Function records that the len first bytes of the pooled string at name are the name of a child of parent.
+ * Returns zero on success, -1 if the pending pairs could not be grown.
+*/
+static int add_child(tree_builder_t *builder, uint32_t parent, uint32_t name, uint32_t len) {
+    size_t n_children = (size_t) builder->n_children + 1;
+    if (arena_commit(builder->arena, INDEX_PENDING_PARENTS, n_children * sizeof(uint32_t)) < 0
+        || arena_commit(builder->arena, INDEX_PENDING_NAMES, n_children * sizeof(tar_index_child_t)) < 0) return -1;
+
+    builder->parents[builder->n_children]   = parent;
+    builder->names[builder->n_children]     = (tar_index_child_t) {name, len};
+    builder->n_children++;
+    return 0;
+}
+
+/**
+ * Function returns the position of the directory whose path is made of the len first bytes of
+ * the pooled string at name, creating it and its missing ancestors when needed.
+ * Returns -1 if the directory could not be created.
+*/
+static int64_t ensure_dir(tar_index_t *index, tree_builder_t *builder, uint32_t name, uint32_t len) {
+    const char  *path   = index->strings + name;
+    int64_t     pos     = find_dir(index, path, len);
+    if (pos >= 0) return pos;
+
+    // the parent first, so that it is listed before its own children
+    int64_t parent = -1;
+    if (len > 0) {
+        uint32_t parent_len = len;
+        while (parent_len > 0 && path[parent_len - 1] != '/') parent_len--;
+        while (parent_len > 0 && path[parent_len - 1] == '/') parent_len--;
+        if ((parent = ensure_dir(index, builder, name, parent_len)) < 0) return -1;
+    }
+
+    if (arena_commit(&index->arena, INDEX_DIRS, ((size_t) index->n_dirs + 1) * sizeof(tar_index_dir_t)) < 0) return -1;
+    if ((uint64_t) (index->n_dirs + 1) * 4 > (uint64_t) index->n_dir_buckets * 3) {
+        // grown in place, the directories being reinserted from their array
+        uint32_t n_buckets = index->n_dir_buckets ? index->n_dir_buckets * 2 : INDEX_INITIAL_BUCKETS;
+        if (arena_commit(&index->arena, INDEX_DIR_BUCKETS, (size_t) n_buckets * sizeof(uint32_t)) < 0) return -1;
+        memset(index->dir_buckets, 0, (size_t) n_buckets * sizeof(uint32_t));
+        index->n_dir_buckets    = n_buckets;
+        for (uint32_t i = 0; i < index->n_dirs; i++) insert_dir_bucket(index, i);
+    }
+
+    pos = index->n_dirs++;
+    index->dirs[pos] = (tar_index_dir_t) {name, len, 0, 0};
+    insert_dir_bucket(index, pos);
+
+    // listed with its trailing '/', which follows the path in the pooled string
+    if (parent >= 0 && add_child(builder, parent, name, len + (path[len] == '/')) < 0) return -1;
+    return pos;
+}
+
+/**
+ * Function returns the position of the entry whose name is made of the len first bytes of path, with or
+ * without a trailing '/', or -1 if there is none. path must have room for one more byte, which is restored
+ * before returning.
+*/
+static int64_t find_any(const tar_index_t *index, char *path, size_t len) {
+    int64_t pos = tar_index_find(index, path, len);
+    if (pos >= 0) return pos;
+
+    char saved  = path[len];
+    path[len]   = '/';
+    pos         = tar_index_find(index, path, len + 1);
+    path[len]   = saved;
+    return pos;
+}
+
+/**
+ * Function resolves every link along the len first bytes of path, the last component included, the
+ * way the archive scans of lib_tar.c do: the entry at the path comes first, then the link along it
+ * nearest the root, each link followed counting as a hop and the path reached being resolved again.
+ * A link already resolved is replaced by the path it was resolved to, see INFO 3.
+ * out, TAR_PATH_MAX bytes long, is set to the path reached.
+ * Returns the position of the entry reached, LINK_DIR if it is a directory without a header of
+ * its own, LINK_NONE if nothing exists at that path, or LINK_LOOP if too many links were followed.
+*/
+static uint32_t resolve_path(const tar_index_t *index, const char *path, size_t len, char *out) {
+    char    work[TAR_PATH_MAX + 1];
+    size_t  work_len    = len;
+    int     hops        = 0;
+    if (len >= TAR_PATH_MAX) return LINK_NONE;
+    memcpy(work, path, len);
+    work[len] = '\0';
+
+    for (;;) {
+        size_t  end = work_len;
+        int64_t pos = find_any(index, work, end);
+        if (pos >= 0 && !INDEX_IS_LINK(index, pos)) break;
+        if (pos < 0) {
+            // no entry at the path, the first link along it
+            for (end = 1; end < work_len; end++) {
+                if (work[end] != '/') continue;
+                pos = find_any(index, work, end);
+                if (pos >= 0 && INDEX_IS_LINK(index, pos)) break;
+            }
+            if (end >= work_len) break;
+        }
+        if (hops++ == TAR_MAX_LINK_HOPS) return LINK_LOOP;
+
+        // replace the components up to the link by the path it was resolved to, or else its target, then start over
+        char        buffer[TAR_PATH_MAX];
+        const char  *target     = buffer;
+        ssize_t     target_len;
+        uint32_t    resolved    = index->targets[pos];
+        if (resolved == LINK_LOOP) return LINK_LOOP;
+        if (resolved != LINK_PENDING) {
+            target      = index->strings + index->target_paths[pos];
+            target_len  = strlen(target);
+        } else {
+            target_len  = link_target_path(INDEX_NAME(index, pos), index->types[pos], INDEX_LINKNAME(index, pos), buffer, sizeof(buffer));
+        }
+        size_t  rest_len    = work_len - end;
+        if (target_len < 0 || target_len + rest_len + 1 > TAR_PATH_MAX) return LINK_NONE;
+        memmove(work + target_len, work + end, rest_len);
+        memcpy(work, target, target_len);
+        work_len = target_len + rest_len;
+        if (target_len == 0 && rest_len > 0) {
+            // a link to the root
+            memmove(work, work + 1, --work_len);
+        }
+        work[work_len] = '\0';
+    }
+
+    memcpy(out, work, work_len + 1);
+    int64_t pos = find_any(index, work, work_len);
+    if (pos >= 0)                               return (uint32_t) pos;
+    if (find_dir(index, work, work_len) >= 0)   return LINK_DIR;
+    return LINK_NONE;
+}
+
+/**
+ * Function resolves every link of the index, see INFO 3.
+ * Returns zero on success, -1 if the target paths could not be pooled.
+*/
+static int resolve_links(tar_index_t *index) {
+    char target[TAR_PATH_MAX];
+
+    for (uint32_t i = 0; i < index->n_entries; i++) {
+        if (index->targets[i] != LINK_PENDING) continue;
+
+        const char  *name   = INDEX_NAME(index, i);
+        uint32_t    resolved = resolve_path(index, name, strlen(name), target);
+        int64_t     pooled  = add_string(index, target, strlen(target));
+        if (pooled < 0) return -1;
+
+        index->targets[i]       = resolved;
+        index->target_paths[i]  = (uint32_t) pooled;
+    }
+    return 0;
+}
+
+/**
+ * Function sets pos to the position of the regular file at path, following links as read_file() does, the
+ * ones of the directories leading to it included.
+ * Returns zero on success, -1 if there is no such file, or -3 if too many links were followed.
+*/
+int tar_index_find_file(const tar_index_t *index, const char *path, uint32_t *pos) {
+    int64_t     found = tar_index_find(index, path, strlen(path));
+    uint32_t    resolved;
+    char        target[TAR_PATH_MAX];
+
+    if (found >= 0 && !INDEX_IS_LINK(index, found))     resolved = (uint32_t) found;
+    else if (found >= 0)                                resolved = index->targets[found];
+    else                                                resolved = resolve_path(index, path, strlen(path), target);
+    if (found >= 0 && INDEX_IS_LINK(index, found)) STAT_ADD(link_hops, 1);      // resolved when indexing
+
+    if (resolved == LINK_LOOP) return -3;
+    if (resolved >= LINK_PENDING) return -1;
+
+    if (index->types[resolved] != REGTYPE && index->types[resolved] != AREGTYPE) return -1;
+    *pos = resolved;
+    return 0;
+}
+
+/**
+ * Builds the directory tree of an index once all its entries were added, or adds the entries added since
+ * the previous call to the tree.
+ * Returns zero on success, -1 if the tree could not be allocated.
+ */
+int tar_index_finish(tar_index_t *index) {
+    tar_arena_t     *arena  = &index->arena;
+    tree_builder_t  builder = {arena, ARENA_REGION(arena, INDEX_PENDING_PARENTS), ARENA_REGION(arena, INDEX_PENDING_NAMES), 0};
+    int             ret     = 0;
+
+    for (uint32_t i = index->n_finished; i < index->n_entries && ret == 0; i++) {
+        uint32_t    name    = index->names[i];
+        const char  *path   = index->strings + name;
+        uint32_t    len     = strlen(path);
+        uint32_t    key_len = len;
+        while (key_len > 0 && path[key_len - 1] == '/') key_len--;
+
+        if (index->types[i] == DIRTYPE) {
+            // a directory is listed in its parent when it is created
+            if (ensure_dir(index, &builder, name, key_len) < 0) ret = -1;
+            continue;
+        }
+
+        uint32_t parent_len = key_len;
+        while (parent_len > 0 && path[parent_len - 1] != '/') parent_len--;
+        while (parent_len > 0 && path[parent_len - 1] == '/') parent_len--;
+
+        int64_t parent = ensure_dir(index, &builder, name, parent_len);
+        if (parent < 0 || add_child(&builder, parent, name, len) < 0) ret = -1;
+    }
+
+    // group the children by directory, after the ones already in the tree, keeping archive order within each directory
+    size_t n_children = (size_t) index->n_children + builder.n_children;
+    if (ret == 0 && builder.n_children > 0
+        && (arena_commit(arena, INDEX_GROUPED, n_children * sizeof(tar_index_child_t)) < 0
+            || arena_commit(arena, INDEX_DIR_COUNTS, (size_t) index->n_dirs * sizeof(uint32_t)) < 0
+            || arena_commit(arena, INDEX_CHILDREN, n_children * sizeof(tar_index_child_t)) < 0)) ret = -1;
+    if (ret == 0 && builder.n_children > 0) {
+        tar_index_child_t   *grouped    = ARENA_REGION(arena, INDEX_GROUPED);
+        uint32_t            *n_new      = ARENA_REGION(arena, INDEX_DIR_COUNTS);
+        memset(n_new, 0, (size_t) index->n_dirs * sizeof(uint32_t));
+        for (uint32_t i = 0; i < builder.n_children; i++) n_new[builder.parents[i]]++;
+
+        uint32_t first = 0;
+        for (uint32_t d = 0; d < index->n_dirs; d++) {
+            tar_index_dir_t *dir = &index->dirs[d];
+            memcpy(grouped + first, index->children + dir->first_child, dir->n_children * sizeof(tar_index_child_t));
+            dir->first_child    = first;
+            first              += dir->n_children + n_new[d];
+        }
+        for (uint32_t i = 0; i < builder.n_children; i++) {
+            tar_index_dir_t *dir = &index->dirs[builder.parents[i]];
+            grouped[dir->first_child + dir->n_children++] = builder.names[i];
+        }
+        memcpy(index->children, grouped, n_children * sizeof(tar_index_child_t));
+        index->n_children = n_children;
+    }
+
+    // the regions only used while building the tree are given back
+    for (int i = INDEX_ARRAYS; i < INDEX_REGIONS; i++) arena_decommit(arena, i);
+    if (ret == 0) ret = resolve_links(index);
+    if (ret == 0) index->n_finished = index->n_entries;
+    return ret;
+}
+
+/**
+ * Function copies the arrays of an index out of the mapping of the sidecar it was loaded from, or out of an
+ * arena reserved for a smaller archive, into an arena reserved for an archive of archive_size bytes, so that
+ * they can grow, see INFO 4.
+ * Returns zero on success, -1 if they could not be allocated.
+*/
+static int move_arrays(tar_index_t *index, uint64_t archive_size) {
+    void        **arrays[INDEX_ARRAYS];
+    void        *previous[INDEX_ARRAYS];
+    uint64_t    sizes[INDEX_ARRAYS];
+    tar_arena_t arena       = index->arena;
+    uint64_t    known_size  = index->archive_size;
+    index_arrays(index, arrays, sizes);
+    for (int i = 0; i < INDEX_ARRAYS; i++) previous[i] = *arrays[i];
+
+    index->archive_size = archive_size;
+    int ret = reserve_arena(index);
+    for (int i = 0; i < INDEX_ARRAYS && ret == 0; i++) {
+        if (arena_commit(&index->arena, i, sizes[i]) < 0) ret = -1;
+        else memcpy(*arrays[i], previous[i], sizes[i]);
+    }
+    if (ret < 0) {
+        arena_free(&index->arena);
+        index->arena        = arena;
+        index->archive_size = known_size;
+        for (int i = 0; i < INDEX_ARRAYS; i++) *arrays[i] = previous[i];
+        return -1;
+    }
+
+    if (index->mapping != NULL) munmap(index->mapping, index->mapping_size);
+    else arena_free(&arena);
+    index->mapping      = NULL;
+    index->entries_cap  = index->n_entries;
+    return 0;
+}
+
+/**
+ * Indexes the entries appended to an archive since its index was built.
+ */
+int tar_index_update(int tar_fd, tar_index_t *index) {
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
+    uint32_t        n_known = index->n_entries;
+    uint64_t        size    = archive_size_of(tar_fd);
+    int             ret     = 0;
+    int             moved   = index->mapping != NULL || (index->archive_size != 0 && (size == 0 || size > index->archive_size));
+    if (moved && move_arrays(index, size) < 0) return -4;
+
+    // only the headers past the last known entry are read
+    scanner_init(&scanner, tar_fd);
+    scanner_seek(&scanner, index->end_offset);
+    while (ret == 0 && (header = scanner_next(&scanner)) != NULL) {
+        ret = check_header(header);
+        if (ret == 0 && tar_index_add(index, scanner_entry(&scanner)) < 0) ret = -4;
+    }
+    scanner_free(&scanner);
+
+    // the targets of dangling links and links to directories without a header may have been appended
+    for (uint32_t i = 0; i < n_known; i++) {
+        if (INDEX_IS_LINK(index, i) && (index->targets[i] == LINK_NONE || index->targets[i] == LINK_DIR)) index->targets[i] = LINK_PENDING;
+    }
+
+    // the valid entries are indexed even when a later header is not
+    if (tar_index_finish(index) < 0) return -4;
+    return ret < 0 ? ret : (int) index->n_entries;
+}
+
+/**
+ * Builds an in-memory index of the archive in a single scan, validating every header on the way.
+ */
+int tar_index_build(int tar_fd, tar_index_t **index) {
+    tar_scanner_t   scanner;
+    tar_header_t    *header;
+    tar_index_t     *idx = calloc(1, sizeof(tar_index_t));
+    if (idx == NULL) return -4;
+    idx->archive_size = archive_size_of(tar_fd);
+
+    scanner_init(&scanner, tar_fd);
+    while ((header = scanner_next(&scanner)) != NULL) {
+        int ret = check_header(header);
+        if (ret == 0 && tar_index_add(idx, scanner_entry(&scanner)) < 0) ret = -4;
+        if (ret < 0) {
+            tar_index_free(idx);
+            return scanner_return(&scanner, ret);
+        }
+    }
+
+    if (scanner.unseekable) {
+        tar_index_free(idx);
+        return scanner_return(&scanner, tar_stream_check(tar_fd, index, NULL, NULL));
+    }
+    if (tar_index_finish(idx) < 0) {
+        tar_index_free(idx);
+        return scanner_return(&scanner, -4);
+    }
+
+    *index = idx;
+    return scanner_return(&scanner, (int) idx->n_entries);
+}
+
+/**
+ * Releases every resource held by an index.
+ */
+void tar_index_free(tar_index_t *index) {
+    if (index == NULL) return;
+    if (index->mapping != NULL) {
+        // loaded from a sidecar, every array points into the mapping
+        munmap(index->mapping, index->mapping_size);
+        free(index);
+        return;
+    }
+    arena_free(&index->arena);
+    free(index);
+}
+
+/**
+ * Reports the memory held by an index.
+ */
+void tar_index_memory(const tar_index_t *index, tar_index_memory_t *memory) {
+    void        **arrays[INDEX_ARRAYS];
+    uint64_t    sizes[INDEX_ARRAYS];
+    index_arrays((tar_index_t *) index, arrays, sizes);
+    memset(memory, 0, sizeof(tar_index_memory_t));
+
+    memory->n_entries = index->n_entries;
+    for (int i = 0; i <= INDEX_BUCKETS; i++) memory->entry_bytes += sizes[i];
+    memory->string_bytes    = sizes[INDEX_STRINGS];
+    memory->tree_bytes      = sizes[INDEX_DIRS] + sizes[INDEX_DIR_BUCKETS] + sizes[INDEX_CHILDREN];
+
+    // the structure itself, and either the mapping of the sidecar or the range of the arena
+    memory->allocations     = 1 + (index->mapping != NULL ? 1 : index->arena.n_mappings);
+    memory->resident_bytes  = sizeof(tar_index_t) + (index->mapping != NULL ? index->mapping_size : arena_committed(&index->arena));
+}
+
+/**
+ * Checks whether an entry exists in the indexed archive.
+ */
+int tar_index_exists(const tar_index_t *index, const char *path) {
+    return tar_index_find(index, path, strlen(path)) >= 0;
+}
+
+/**
+ * Checks whether an entry exists in the indexed archive and is a directory.
+ */
+int tar_index_is_dir(const tar_index_t *index, const char *path) {
+    int64_t pos = tar_index_find(index, path, strlen(path));
+    return pos >= 0 && index->types[pos] == DIRTYPE;
+}
+
+/**
+ * Checks whether an entry exists in the indexed archive and is a file.
+ */
+int tar_index_is_file(const tar_index_t *index, const char *path) {
+    int64_t pos = tar_index_find(index, path, strlen(path));
+    return pos >= 0 && (index->types[pos] == REGTYPE || index->types[pos] == AREGTYPE);
+}
+
+/**
+ * Checks whether an entry exists in the indexed archive and is a symlink.
+ */
+int tar_index_is_symlink(const tar_index_t *index, const char *path) {
+    int64_t pos = tar_index_find(index, path, strlen(path));
+    return pos >= 0 && index->types[pos] == SYMTYPE;
+}
+
+/**
+ * Lists the entries at a given path in the indexed archive.
+ */
+int tar_index_list(const tar_index_t *index, const char *path, char **entries, size_t *no_entries) {
+    size_t cursor = 0;
+    return tar_index_list_page(index, path, &cursor, entries, no_entries);
+}
+
+/**
+ * Lists a page of the entries at a given path in the indexed archive, starting at a cursor.
+ */
+int tar_index_list_page(const tar_index_t *index, const char *path, size_t *cursor, char **entries, size_t *no_entries) {
+    const size_t    expected_no_entries = *no_entries;
+    size_t          path_len            = strlen(path);
+    *no_entries                         = 0;
+
+    // the trailing '/' of the path is optional
+    while (path_len > 0 && path[path_len - 1] == '/') path_len--;
+
+    // if the path goes through links, list the linked-to directory instead
+    int64_t pos = find_dir(index, path, path_len);
+    if (pos < 0) {
+        char        target[TAR_PATH_MAX];
+        uint32_t    resolved = resolve_path(index, path, path_len, target);
+        if (resolved == LINK_LOOP) return -1;
+        pos = find_dir(index, target, strlen(target));
+    }
+    if (pos < 0) return 0;
+
+    const tar_index_dir_t *dir = &index->dirs[pos];
+    while (*cursor < dir->n_children && *no_entries < expected_no_entries) {
+        const tar_index_child_t *child = &index->children[dir->first_child + *cursor];
+        memcpy(entries[*no_entries], index->strings + child->name, child->len);
+        entries[*no_entries][child->len] = '\0';
+        (*no_entries)++;
+        (*cursor)++;
+    }
+    return *cursor < dir->n_children ? 2 : 1;
+}
+
+/**
+ * Reads a file at a given path in the indexed archive.
+ */
+ssize_t tar_index_read_file(int tar_fd, const tar_index_t *index, const char *path, size_t offset, uint8_t *dest, size_t *len) {
+    uint32_t    pos;
+    int         ret = tar_index_find_file(index, path, &pos);
+    if (ret < 0) return ret;
+    uint64_t    size = index->sizes[pos];
+    if (offset > size) return -2;
+
+    // read maximum possible
+    if (*len >= size - offset) *len = size - offset;
+
+    ssize_t n_read = archive_pread(tar_fd, dest, *len, index->data_offsets[pos] + offset);
+    *len = n_read < 0 ? 0 : (size_t) n_read;
+
+    return size - offset - *len;
+}
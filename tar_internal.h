@@ -0,0 +1,443 @@
+#ifndef TAR_INTERNAL_H
+#define TAR_INTERNAL_H
+
+#include "lib_tar.h"
+
+/* Size of the chunks the archive is read in while scanning headers */
+#ifndef TAR_SCAN_BUFFER_SIZE
+#define TAR_SCAN_BUFFER_SIZE (1 << 20)
+#endif
+
+/* Size of the buffers holding a path being resolved */
+#define TAR_PATH_MAX 4096
+
+/* Rounds a number of bytes up to a whole number of blocks */
+#define BLOCK_ALIGN(size) ((size) + (BLOCKSIZE - ((size) % BLOCKSIZE)) % BLOCKSIZE)
+
+/* Largest size of the data of an entry, past which the offset of the next header could wrap around */
+#define ENTRY_SIZE_MAX ((uint64_t) INT64_MAX - BLOCKSIZE)
+
+/* Values of the target of an indexed entry which are not entry positions */
+#define LINK_NONE       UINT32_MAX          /* not a link, or a link to nothing */
+#define LINK_LOOP       (UINT32_MAX - 1)    /* a link going through more than TAR_MAX_LINK_HOPS links */
+#define LINK_DIR        (UINT32_MAX - 2)    /* a link to a directory without a header of its own */
+#define LINK_PENDING    (UINT32_MAX - 3)    /* a link not resolved yet */
+
+#define IS_LINK(entry) ((entry)->typeflag == SYMTYPE || (entry)->typeflag == LNKTYPE)
+
+/* Magic and version fields of the headers GNU tar writes in its own format, with the null ending the version */
+#define GNU_MAGIC_VERSION "ustar  "
+
+/* Extended headers, holding values of the entries following them, see tar_header.c */
+#define IS_EXTENSION(typeflag) ((typeflag) == XHDTYPE || (typeflag) == XGLTYPE \
+                                || (typeflag) == GNUTYPE_LONGNAME || (typeflag) == GNUTYPE_LONGLINK)
+
+/* Values of an entry given by extended headers */
+#define EXT_NAME        1
+#define EXT_LINKNAME    2
+#define EXT_SIZE        4
+#define EXT_MTIME       8
+
+/**
+ * The values read from the extended headers of a scan, and the storage of the decoded paths which
+ * are not in a header, see tar_header.c. A zeroed structure is a valid empty state.
+*/
+typedef struct tar_ext
+{
+    unsigned    pending;            /* EXT_* values read for the next entry */
+    unsigned    current;            /* EXT_* values of the last decoded entry */
+    unsigned    global;             /* EXT_* values of every following entry */
+
+    char        *name;
+    size_t      name_cap;
+    char        *linkname;
+    size_t      linkname_cap;
+    uint64_t    size;
+    int64_t     mtime;
+    int64_t     global_mtime;
+
+    char        *data;              /* data of an extended header which had to be copied */
+    size_t      data_cap;
+
+    char        joined_name[sizeof(((tar_header_t *) 0)->prefix) + sizeof(((tar_header_t *) 0)->name) + 2];
+    char        joined_linkname[sizeof(((tar_header_t *) 0)->linkname) + 1];
+} tar_ext_t;
+
+/**
+ * A sequential scan of the headers of an archive, see tar_scanner.c.
+ */
+typedef struct tar_scanner
+{
+    int             fd;
+    uint8_t         *buffer;
+    size_t          buffer_size;
+    uint64_t        buffer_offset;      /* archive offset of the first byte of the buffer */
+    size_t          buffer_len;         /* number of valid bytes in the buffer */
+    size_t          read_size;          /* number of bytes the next refill asks for */
+    unsigned        n_refills;
+    unsigned        headers_in_buffer;  /* headers served since the last refill */
+    int             done;               /* set once the end of the archive is reached */
+    uint64_t        start_offset;       /* archive offset of the first header, see scanner_seek() */
+    int             unseekable;         /* set when the archive cannot be read with pread(), like a pipe */
+    unsigned        n_extensions;       /* extended headers consumed so far */
+
+    tar_header_t    *header;            /* current header, points into the buffer */
+    tar_entry_t     entry;              /* current entry, without its mode and mtime, see scanner_entry() */
+    tar_ext_t       ext;                /* extended headers read so far */
+
+    uint8_t         block[BLOCKSIZE];   /* fallback buffer when the real one cannot be allocated */
+} tar_scanner_t;
+
+/**
+ * A directory of the index, explicit or only known through the paths of its content.
+ * Its path is a prefix of a string of the pool, without the trailing '/'.
+ */
+typedef struct tar_index_dir
+{
+    uint32_t key;               /* offset of the path in the string pool */
+    uint32_t key_len;           /* length of the path, zero for the root */
+    uint32_t first_child;       /* position of the first child in the children array */
+    uint32_t n_children;
+} tar_index_dir_t;
+
+/**
+ * The name of a child of a directory, a prefix of a string of the pool.
+ */
+typedef struct tar_index_child
+{
+    uint32_t name;              /* offset of the name in the string pool */
+    uint32_t len;               /* length of the name */
+} tar_index_child_t;
+
+/* Most regions of an arena */
+#define ARENA_MAX_REGIONS 20
+
+/**
+ * A reserved address range split in regions, each one holding an array which grows in place, see tar_arena.c.
+ * A zeroed structure is an arena without any range.
+ */
+typedef struct tar_arena
+{
+    uint8_t     *base;                              /* NULL when no range is reserved */
+    size_t      size;
+    unsigned    n_regions;
+    unsigned    n_mappings;                         /* ranges mapped for the arena */
+    size_t      offsets[ARENA_MAX_REGIONS];         /* offset of each region in the range */
+    size_t      capacities[ARENA_MAX_REGIONS];      /* size each region can grow to */
+    size_t      committed[ARENA_MAX_REGIONS];       /* usable bytes at the start of each region */
+} tar_arena_t;
+
+/* Arrays of an index, in the order of the regions of its arena and of the arrays of a sidecar, see index_arrays() */
+#define INDEX_HASHES            0
+#define INDEX_DATA_OFFSETS      1
+#define INDEX_SIZES             2
+#define INDEX_MTIMES            3
+#define INDEX_MODES             4
+#define INDEX_NAMES             5
+#define INDEX_LINKNAMES         6
+#define INDEX_TARGETS           7
+#define INDEX_TARGET_PATHS      8
+#define INDEX_TYPES             9       /* the last array holding one element per entry */
+#define INDEX_BUCKETS           10
+#define INDEX_STRINGS           11
+#define INDEX_DIRS              12
+#define INDEX_DIR_BUCKETS       13
+#define INDEX_CHILDREN          14
+#define INDEX_DIGESTS           15
+#define INDEX_ARRAYS            16
+
+/* Regions of the arena of an index only used while building its directory tree */
+#define INDEX_PENDING_PARENTS   16
+#define INDEX_PENDING_NAMES     17
+#define INDEX_GROUPED           18
+#define INDEX_DIR_COUNTS        19
+#define INDEX_REGIONS           20
+
+/* Most entries of an index, which its arena is sized for */
+#define INDEX_MAX_ENTRIES       (1U << 27)
+
+/* Marks the digests of an index which were computed, see tar_diff.c */
+#define DIGEST_KNOWN            ((uint64_t) 1 << 32)
+
+/**
+ * An index, one array per field of the entries, indexed by their position in archive order.
+ * Names and link names are stored as offsets into the string pool.
+ */
+struct tar_index
+{
+    uint64_t            *hashes;        /* hash_name() of the name */
+    uint64_t            *data_offsets;  /* offset of the first data block in the archive, the header being the block before */
+    uint64_t            *sizes;         /* size of the entry data in bytes */
+    int64_t             *mtimes;        /* modification time, in seconds since the epoch */
+    uint16_t            *modes;         /* permission bits */
+    uint32_t            *names;         /* offset of the name in the string pool */
+    uint32_t            *linknames;     /* offset of the link name in the string pool */
+    uint32_t            *targets;       /* for links, position of the entry the link resolves to, or a LINK_* value */
+    uint32_t            *target_paths;  /* for resolved links, offset of the normalized target path in the string pool */
+    char                *types;         /* typeflag of the header */
+    uint32_t            n_entries;
+    uint32_t            entries_cap;
+
+    uint32_t            *buckets;       /* open addressing, entry index + 1, zero when empty */
+    uint32_t            n_buckets;      /* always a power of two */
+
+    char                *strings;       /* string pool, every string is null terminated */
+    size_t              strings_len;
+
+    tar_index_dir_t     *dirs;
+    uint32_t            n_dirs;
+    uint32_t            *dir_buckets;   /* open addressing, directory index + 1, zero when empty */
+    uint32_t            n_dir_buckets;  /* always a power of two */
+
+    tar_index_child_t   *children;      /* children names, grouped by directory */
+    uint32_t            n_children;
+    uint32_t            n_finished;     /* entries already in the directory tree */
+
+    uint64_t            *digests;       /* DIGEST_KNOWN and the CRC32C of the data of the first n_digests entries, or zero */
+    uint32_t            n_digests;      /* zero unless the index was loaded from a sidecar tar_diff() wrote digests to */
+
+    uint64_t            end_offset;     /* offset just past the data of the last entry */
+
+    tar_arena_t         arena;          /* holds the arrays, see tar_arena.c */
+    uint64_t            archive_size;   /* size of the archive the arena is reserved for, zero when not known */
+    void                *mapping;       /* sidecar file the arrays point into, NULL when they are in the arena */
+    size_t              mapping_size;
+};
+
+/* Kernels of header_checksum_with() */
+#define TAR_CHECKSUM_SCALAR 0
+#define TAR_CHECKSUM_SSE2   1
+#define TAR_CHECKSUM_AVX2   2
+#define TAR_CHECKSUM_SSE42  3           /* CRC32C only, see crc32c_with() */
+
+/* Strictly forward reader of a pipe or a socket, see tar_stream.c */
+typedef struct tar_stream tar_stream_t;
+
+/* Decompressing source attached to the descriptor of a compressed archive, see tar_source_attach() */
+typedef struct tar_source tar_source_t;
+
+/* Block cache of a handle, see tar_enable_cache() */
+typedef struct tar_cache tar_cache_t;
+
+struct tar_archive
+{
+    int             fd;
+    tar_index_t     *index;         /* NULL when every query scans the archive */
+    tar_cache_t     *cache;         /* NULL when read_file() is not cached */
+    char            *sidecar_path;  /* sidecar of the index, NULL unless opened with tar_open_sidecar() */
+    tar_stats_t     stats;          /* only changed with atomic additions, see tar_stats.c */
+};
+
+/**
+ * A call of a function taking a handle, whose work is counted in the statistics of the handle, see tar_stats.c.
+ */
+typedef struct stats_scope
+{
+    tar_stats_t         *stats;
+    struct stats_scope  *previous;      /* scope of the calling function, if any */
+    uint64_t            next_offset;    /* offset following the last read of the archive */
+    uint64_t            start;          /* start of the call, in nanoseconds */
+} stats_scope_t;
+
+#ifndef TAR_NO_STATS
+extern __thread stats_scope_t *current_scope;
+
+void    stats_enter(stats_scope_t *scope, const tar_archive_t *archive);
+void    stats_leave(stats_scope_t *scope, int api);
+void    stats_read(uint64_t offset, ssize_t n_read);
+
+/* Opens a scope for a call of a function taking the handle archive, and closes it for api */
+#define STATS_ENTER(archive)    stats_scope_t stats_scope; stats_enter(&stats_scope, (archive))
+#define STATS_LEAVE(api)        stats_leave(&stats_scope, (api))
+
+/* Adds n to a counter of the handle of the current scope */
+#define STAT_ADD(counter, n)    do { stats_scope_t *scope_ = current_scope; \
+                                     if (scope_ != NULL) __atomic_fetch_add(&scope_->stats->counter, (n), __ATOMIC_RELAXED); } while (0)
+
+/* Counts a read of the archive */
+#define STAT_READ(offset, n)    do { if (current_scope != NULL) stats_read((offset), (n)); } while (0)
+#else
+#define STATS_ENTER(archive)    ((void) 0)
+#define STATS_LEAVE(api)        ((void) 0)
+#define STAT_ADD(counter, n)    ((void) 0)
+#define STAT_READ(offset, n)    ((void) 0)
+#endif
+
+int         check_header(tar_header_t *header);
+int         check_headers(tar_header_t **headers, size_t n_headers, size_t *n_valid);
+uint32_t    header_checksum(const tar_header_t *header);
+uint32_t    header_checksum_with(const tar_header_t *header, int kernel);
+uint32_t    crc32c(uint32_t crc, const void *data, size_t len);
+uint32_t    crc32c_with(uint32_t crc, const void *data, size_t len, int kernel);
+
+void        ext_free(tar_ext_t *ext);
+char        *ext_buffer(tar_ext_t *ext, uint64_t len);
+int         ext_parse(tar_ext_t *ext, char typeflag, const char *data, uint64_t len);
+void        header_decode_ext(tar_ext_t *ext, const tar_header_t *header, tar_entry_t *entry);
+void        header_decode_rest(const tar_ext_t *ext, const tar_header_t *header, tar_entry_t *entry);
+void        header_set_base256(char *field, size_t len, uint64_t value);
+
+/* Word of 8 bytes of the given value */
+#define SWAR_BYTES(byte) (0x0101010101010101ULL * (uint8_t) (byte))
+
+/**
+ * Function decodes an octal field of len bytes one digit at a time, from its first digit, leading spaces
+ * skipped, up to the first byte which is not a digit.
+*/
+static inline uint64_t octal_scalar(const char *field, size_t len) {
+    const uint8_t   *bytes  = (const uint8_t *) field;
+    uint64_t        value   = 0;
+    size_t          i       = 0;
+    while (i < len && bytes[i] == ' ') i++;
+    for (; i < len && bytes[i] >= '0' && bytes[i] <= '7'; i++) value = value << 3 | (bytes[i] - '0');
+    return value;
+}
+
+/**
+ * Function returns the number of octal digits the 8 bytes of word start with, in memory order, see INFO 3 of tar_header.c.
+*/
+static inline unsigned octal_run(uint64_t word) {
+    uint64_t other = (word & SWAR_BYTES(0xf8)) ^ SWAR_BYTES('0');                          // zero for digits
+    uint64_t found = (((other & SWAR_BYTES(0x7f)) + SWAR_BYTES(0x7f)) | other) & SWAR_BYTES(0x80);
+    return found != 0 ? (unsigned) __builtin_ctzll(found) / 8 : 8;
+}
+
+/**
+ * Function returns word with the spaces it starts with replaced by '0', which count as leading zeros.
+*/
+static inline uint64_t octal_pad(uint64_t word) {
+    uint64_t other  = word ^ SWAR_BYTES(' ');                                               // zero for spaces
+    uint64_t found  = (((other & SWAR_BYTES(0x7f)) + SWAR_BYTES(0x7f)) | other) & SWAR_BYTES(0x80);
+    uint64_t spaces = found != 0 ? ((found & -found) >> 7) - 1 : ~(uint64_t) 0;             // bytes before the first other one
+    return word + (spaces & SWAR_BYTES('0' - ' '));
+}
+
+/**
+ * Function returns the value of the first n_digits bytes of word, octal digits in memory order, see INFO 3 of tar_header.c.
+*/
+static inline uint64_t octal_word(uint64_t word, unsigned n_digits) {
+    if (n_digits == 0) return 0;
+    // the digits moved to the last bytes, the first ones acting as leading zeros
+    uint64_t value = ((word - SWAR_BYTES('0')) & SWAR_BYTES(0x07)) << (8 * (8 - n_digits));
+    value = ((value << 3)  + (value >> 8))  & 0x00ff00ff00ff00ffULL;        // 2 digits per 16 bits
+    value = ((value << 6)  + (value >> 16)) & 0x0000ffff0000ffffULL;        // 4 digits per 32 bits
+    return  ((value << 12) + (value >> 32)) & 0xffffffffULL;                // 8 digits
+}
+
+/**
+ * Function decodes a numeric header field of len bytes, octal or base-256, see tar_header.c.
+*/
+static inline int64_t header_number(const char *field, size_t len) {
+    const uint8_t   *bytes  = (const uint8_t *) field;
+    uint64_t        value   = 0;
+    if (bytes[0] & 0x80) {
+        // base-256, two's complement, the first byte without its marker bit
+        value = (bytes[0] & 0x40) ? ~(uint64_t) 0x3f : 0;
+        value |= bytes[0] & 0x3f;
+        for (size_t i = 1; i < len; i++) value = value << 8 | bytes[i];
+        return (int64_t) value;
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (len == 8 || len == 12) {
+        // a word at a time, see INFO 3 of tar_header.c
+        uint64_t    low;
+        uint32_t    high    = 0;
+        memcpy(&low, field, sizeof(low));
+        if (len == 12) memcpy(&high, field + 8, sizeof(high));
+        if (len == 12 && low == SWAR_BYTES(' ')) high = (uint32_t) octal_pad(high);
+        low = octal_pad(low);
+
+        unsigned    n_digits        = octal_run(low);
+        if (len == 8) return (int64_t) octal_word(low, n_digits);
+
+        // both words decoded at once, the second one only counting when the first one is all digits
+        unsigned    n_high_digits   = n_digits == 8 ? octal_run(high) : 0;
+        return (int64_t) ((octal_word(low, n_digits) << (3 * n_high_digits)) + octal_word(high, n_high_digits));
+    }
+#endif
+    return (int64_t) octal_scalar(field, len);
+}
+
+/**
+ * Function decodes the name, link name, size, type and offsets of the header at header_offset into
+ * entry, with the values of the extended headers read before it. The strings of the entry point
+ * into the header or into ext, and stay valid until either changes.
+*/
+static inline void header_decode(tar_ext_t *ext, const tar_header_t *header, uint64_t header_offset, tar_entry_t *entry) {
+    entry->typeflag         = header->typeflag;
+    entry->header_offset    = header_offset;
+    entry->data_offset      = header_offset + BLOCKSIZE;
+    if (ext->pending == 0 && header->name[sizeof(header->name) - 1] == '\0' && header->prefix[0] == '\0'
+        && header->linkname[sizeof(header->linkname) - 1] == '\0' && !(header->size[0] & 0x80)) {
+        // plain ustar header, see INFO 2 of tar_header.c
+        ext->current    = 0;
+        entry->name     = header->name;
+        entry->linkname = header->linkname;
+        entry->size     = (uint64_t) header_number(header->size, sizeof(header->size));
+        return;
+    }
+    header_decode_ext(ext, header, entry);
+}
+
+void            scanner_init(tar_scanner_t *scanner, int tar_fd);
+void            scanner_free(tar_scanner_t *scanner);
+int             scanner_return(tar_scanner_t *scanner, int return_value);
+void            scanner_seek(tar_scanner_t *scanner, uint64_t offset);
+tar_header_t    *scanner_next(tar_scanner_t *scanner);
+size_t          scanner_next_batch(tar_scanner_t *scanner, tar_header_t **headers, size_t max_headers);
+size_t          scanner_read(tar_scanner_t *scanner, uint64_t offset, void *dest, size_t len);
+const tar_entry_t *scanner_entry(tar_scanner_t *scanner);
+
+int     arena_init(tar_arena_t *arena, unsigned n_regions, const uint64_t *capacities);
+int     arena_grow(tar_arena_t *arena, unsigned region, size_t len);
+void    arena_decommit(tar_arena_t *arena, unsigned region);
+size_t  arena_committed(const tar_arena_t *arena);
+void    arena_free(tar_arena_t *arena);
+
+/**
+ * Function makes the first len bytes of a region of an arena usable, see tar_arena.c.
+ * Returns zero on success, -1 if the region cannot grow that much.
+*/
+static inline int arena_commit(tar_arena_t *arena, unsigned region, size_t len) {
+    return len <= arena->committed[region] ? 0 : arena_grow(arena, region, len);
+}
+
+/* Address of the first byte of a region of an arena */
+#define ARENA_REGION(arena, region) ((void *) ((arena)->base + (arena)->offsets[region]))
+
+uint64_t    hash_name(const char *str, size_t len);
+void        index_arrays(tar_index_t *index, void **arrays[INDEX_ARRAYS], uint64_t sizes[INDEX_ARRAYS]);
+int         tar_index_finish(tar_index_t *index);
+int         tar_index_add(tar_index_t *index, const tar_entry_t *entry);
+int64_t     tar_index_find(const tar_index_t *index, const char *path, size_t path_len);
+int         tar_index_find_file(const tar_index_t *index, const char *path, uint32_t *pos);
+
+tar_source_t    *source_of(int tar_fd);
+ssize_t         archive_pread(int tar_fd, void *dest, size_t len, uint64_t offset);
+int             write_all(int fd, const void *data, size_t len);
+
+int         stream_open(int fd, tar_stream_t **stream);
+void        stream_close(tar_stream_t *stream);
+size_t      stream_chunk(tar_stream_t *stream, size_t max_len, const uint8_t **data);
+size_t      stream_read(tar_stream_t *stream, uint8_t *dest, size_t len);
+int         stream_skip(tar_stream_t *stream, uint64_t len);
+uint64_t    stream_offset(const tar_stream_t *stream);
+int         stream_failed(tar_stream_t *stream);
+int         stream_next_header(tar_stream_t *stream, tar_ext_t *ext, tar_header_t **header, tar_entry_t *entry);
+int         stream_check(int fd, tar_index_t **index, tar_stream_callback_t callback, void *user_data, int extensions);
+
+int     find_file(int tar_fd, const char *path, uint64_t *data_offset, uint64_t *size);
+ssize_t normalize_path(const char *path, size_t len, char *out, size_t out_size);
+ssize_t link_target_path(const char *name, char typeflag, const char *linkname, char *out, size_t out_size);
+
+int         archive_find_file(const tar_archive_t *archive, const char *path, uint64_t *data_offset, uint64_t *size);
+
+tar_cache_t *cache_new(size_t capacity);
+void        cache_free(tar_cache_t *cache);
+ssize_t     cache_read_file(tar_cache_t *cache, const tar_archive_t *archive, const char *path, size_t offset, uint8_t *dest, size_t *len);
+
+#define INDEX_NAME(index, pos)      ((index)->strings + (index)->names[pos])
+#define INDEX_LINKNAME(index, pos)  ((index)->strings + (index)->linknames[pos])
+#define INDEX_IS_LINK(index, pos)   ((index)->types[pos] == SYMTYPE || (index)->types[pos] == LNKTYPE)
+
+#endif
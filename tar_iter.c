@@ -0,0 +1,139 @@
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+struct tar_iter
+{
+    tar_scanner_t   scanner;
+    tar_stream_t    *stream;                        /* set when the archive is read strictly forward */
+    uint64_t        data_offset;                    /* archive offset of the data of the current entry */
+    uint64_t        size;                           /* size of the data of the current entry */
+    uint64_t        read_pos;                       /* bytes of the current entry read so far */
+    char            name[sizeof(((tar_header_t *) 0)->name) + 1];
+    char            linkname[sizeof(((tar_header_t *) 0)->linkname) + 1];
+};
+
+/**
+ * INFO 1: no allocation per entry
+ * The iterator owns a single scanner buffer and the storage of the names of
+ * the current entry, which the decoded entries point to. Nothing is allocated
+ * past tar_iter_open(), however many entries the archive holds, but for the
+ * buffers of the names longer than a ustar header holds, see tar_header.c,
+ * which are reused from one entry to the next.
+*/
+
+/**
+ * INFO 2: streams
+ * An iterator opened with tar_iter_open_stream(), or on a descriptor which
+ * cannot be read with pread(), consumes its archive with read() only, see
+ * tar_stream.c: moving to the next entry consumes whatever was not read of
+ * the data of the current one.
+*/
+
+/**
+ * Function copies a header string field of size len into dest, which is len + 1 bytes long,
+ * so that it is always null terminated.
+*/
+static void copy_field(char *dest, const char *field, size_t len) {
+    size_t n = strnlen(field, len);
+    memcpy(dest, field, n);
+    dest[n] = '\0';
+}
+
+/**
+ * Starts iterating over the entries of an archive.
+ */
+int tar_iter_open(int tar_fd, tar_iter_t **iter) {
+    tar_iter_t *it = malloc(sizeof(tar_iter_t));
+    if (it == NULL) return -4;
+
+    scanner_init(&it->scanner, tar_fd);
+    it->stream      = NULL;
+    it->data_offset = 0;
+    it->size        = 0;
+    it->read_pos    = 0;
+    *iter = it;
+    return 0;
+}
+
+/**
+ * Starts iterating over the entries of an archive read strictly forward, from a pipe or a socket.
+ */
+int tar_iter_open_stream(int fd, tar_iter_t **iter) {
+    tar_iter_t *it = calloc(1, sizeof(tar_iter_t));
+    if (it == NULL) return -4;
+    if (stream_open(fd, &it->stream) < 0) {
+        free(it);
+        return -4;
+    }
+    *iter = it;
+    return 0;
+}
+
+/**
+ * Function consumes what is left of the current entry of a stream, with its padding, then its next header,
+ * decoded into entry with the extension state of the scanner.
+ * Returns the header, valid until the next call, or NULL at the end of the archive.
+*/
+static tar_header_t *next_stream_header(tar_iter_t *iter, tar_entry_t *entry) {
+    tar_header_t *header;
+    if (stream_skip(iter->stream, BLOCK_ALIGN(iter->size) - iter->read_pos) < 0)        return NULL;
+    if (stream_next_header(iter->stream, &iter->scanner.ext, &header, entry) <= 0)      return NULL;
+    return header;
+}
+
+/**
+ * Moves to the next entry of the archive, skipping whatever is left of the data of the current one.
+ */
+int tar_iter_next(tar_iter_t *iter, tar_entry_t *entry) {
+    tar_header_t *header = iter->stream != NULL ? next_stream_header(iter, entry) : scanner_next(&iter->scanner);
+    if (header == NULL && iter->scanner.unseekable && iter->stream == NULL) {
+        // a pipe or a socket fails the very first read, it is read strictly forward instead
+        if (stream_open(iter->scanner.fd, &iter->stream) < 0) return -4;
+        header = next_stream_header(iter, entry);
+    }
+    if (header == NULL) return 0;
+    if (iter->stream == NULL) *entry = iter->scanner.entry;
+
+    int ret = check_header(header);
+    if (ret < 0) return ret;
+    header_decode_rest(&iter->scanner.ext, header, entry);
+
+    // names decoded in place are copied, the header is overwritten by the next call or by reading a stream
+    if (entry->name == header->name) {
+        copy_field(iter->name, header->name, sizeof(header->name));
+        entry->name = iter->name;
+    }
+    if (entry->linkname == header->linkname) {
+        copy_field(iter->linkname, header->linkname, sizeof(header->linkname));
+        entry->linkname = iter->linkname;
+    }
+    iter->data_offset   = entry->data_offset;
+    iter->size          = entry->size;
+    iter->read_pos      = 0;
+    return 1;
+}
+
+/**
+ * Reads the data of the current entry, continuing where the previous call stopped.
+ */
+ssize_t tar_iter_read(tar_iter_t *iter, uint8_t *dest, size_t len) {
+    if (len > iter->size - iter->read_pos) len = iter->size - iter->read_pos;
+    if (len == 0) return 0;
+
+    size_t n_read;
+    if (iter->stream != NULL)   n_read = stream_read(iter->stream, dest, len);
+    else                        n_read = scanner_read(&iter->scanner, iter->data_offset + iter->read_pos, dest, len);
+    if (n_read == 0) return -1;
+    iter->read_pos += n_read;
+    return n_read;
+}
+
+/**
+ * Stops iterating and releases the iterator.
+ */
+void tar_iter_close(tar_iter_t *iter) {
+    if (iter == NULL) return;
+    scanner_free(&iter->scanner);
+    stream_close(iter->stream);
+    free(iter);
+}
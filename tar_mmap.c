@@ -0,0 +1,148 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+struct tar_mmap
+{
+    const uint8_t   *data;      /* the mapped archive, NULL for an empty file */
+    size_t          size;       /* size of the mapping in bytes */
+    tar_index_t     *index;
+};
+
+/**
+ * INFO 1: building the index from the mapping
+ * Once the archive is mapped, headers are read straight from the mapping, so
+ * opening the archive costs no read() nor lseek() at all. A header or data
+ * block running past the end of the mapping makes the archive invalid, as
+ * it could not be viewed later on.
+*/
+
+/**
+ * Function builds the index of the mapped archive, validating every header.
+ * Returns the number of entries, or the same error codes as tar_index_build().
+*/
+static int build_index(tar_mmap_t *archive) {
+    tar_index_t *index = calloc(1, sizeof(tar_index_t));
+    if (index == NULL) return -4;
+    index->archive_size = archive->size;
+
+    tar_ext_t   ext     = {0};
+    tar_entry_t entry;
+    uint64_t    offset  = 0;
+    int         ret     = 0;
+    while (ret == 0 && offset + BLOCKSIZE <= archive->size) {
+        tar_header_t *header = (tar_header_t *) (archive->data + offset);
+        if (header->name[0] == '\0') break;
+
+        ret = check_header(header);
+        if (ret == 0 && IS_EXTENSION(header->typeflag)) {
+            // extended headers are parsed in place, see tar_header.c
+            uint64_t size = (uint64_t) header_number(header->size, sizeof(header->size));
+            if (size > archive->size - offset - BLOCKSIZE) ret = -5;
+            else if (ext_parse(&ext, header->typeflag, (const char *) header + BLOCKSIZE, size) < 0) ret = -4;
+            offset += BLOCKSIZE + BLOCK_ALIGN(size);
+            continue;
+        }
+
+        header_decode(&ext, header, offset, &entry);
+        if (ret == 0 && entry.size > archive->size - offset - BLOCKSIZE) ret = -5;      // truncated data
+        if (ret < 0) break;
+
+        header_decode_rest(&ext, header, &entry);
+        if (tar_index_add(index, &entry) < 0) ret = -4;
+        offset += BLOCKSIZE + BLOCK_ALIGN(entry.size);
+    }
+    ext_free(&ext);
+    if (ret < 0) {
+        tar_index_free(index);
+        return ret;
+    }
+
+    if (tar_index_finish(index) < 0) {
+        tar_index_free(index);
+        return -4;
+    }
+
+    archive->index = index;
+    return (int) index->n_entries;
+}
+
+/**
+ * Maps an archive in memory and indexes it.
+ */
+int tar_open_mmap(int tar_fd, tar_mmap_t **archive) {
+    struct stat st;
+    if (fstat(tar_fd, &st) < 0 || source_of(tar_fd) != NULL) return -5;
+
+    tar_mmap_t *handle = calloc(1, sizeof(tar_mmap_t));
+    if (handle == NULL) return -4;
+
+    handle->size = (size_t) st.st_size;
+    if (handle->size > 0) {
+        void *data = mmap(NULL, handle->size, PROT_READ, MAP_SHARED, tar_fd, 0);
+        if (data == MAP_FAILED) {
+            free(handle);
+            return -5;
+        }
+        handle->data = data;
+    }
+
+    int ret = build_index(handle);
+    if (ret < 0) {
+        if (handle->data != NULL) munmap((void *) handle->data, handle->size);
+        free(handle);
+        return ret;
+    }
+
+    *archive = handle;
+    return ret;
+}
+
+/**
+ * Unmaps an archive opened with tar_open_mmap().
+ */
+void tar_close_mmap(tar_mmap_t *archive) {
+    if (archive == NULL) return;
+    if (archive->data != NULL) munmap((void *) archive->data, archive->size);
+    tar_index_free(archive->index);
+    free(archive);
+}
+
+/**
+ * Returns the index of an archive opened with tar_open_mmap().
+ */
+const tar_index_t *tar_mmap_index(const tar_mmap_t *archive) {
+    return archive->index;
+}
+
+/**
+ * Tells the kernel how the mapping is going to be accessed.
+ */
+int tar_mmap_advise(const tar_mmap_t *archive, int advice) {
+    int kernel_advice;
+    switch (advice) {
+        case TAR_ADVICE_NORMAL:     kernel_advice = MADV_NORMAL;        break;
+        case TAR_ADVICE_SEQUENTIAL: kernel_advice = MADV_SEQUENTIAL;    break;
+        case TAR_ADVICE_RANDOM:     kernel_advice = MADV_RANDOM;        break;
+        case TAR_ADVICE_WILLNEED:   kernel_advice = MADV_WILLNEED;      break;
+        default:                    return -1;
+    }
+
+    if (archive->data == NULL) return 0;
+    return madvise((void *) archive->data, archive->size, kernel_advice);
+}
+
+/**
+ * Returns a pointer to the data of a file straight into the mapping.
+ */
+int tar_file_view(const tar_mmap_t *archive, const char *path, const uint8_t **data, size_t *len) {
+    uint32_t    pos;
+    int         ret = tar_index_find_file(archive->index, path, &pos);
+    if (ret < 0) return ret;
+
+    *data   = archive->data + archive->index->data_offsets[pos];
+    *len    = archive->index->sizes[pos];
+    return 0;
+}
@@ -0,0 +1,434 @@
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: answering every query in a single pass
+ * Each query of a set has a 64-bit key, and the set is a hash table of its
+ * queries by key. The key of an exact path is the hash_name() of the path,
+ * the one of a glob pattern is the hash of the literal bytes it starts or
+ * ends with, whichever run is longer, QUERY_KEY_MAX bytes at most. Each entry
+ * of the archive is then only compared with the queries sharing one of its
+ * keys: the hash of its name, which an index already holds, and the hashes of
+ * its first and last bytes, for the few key lengths the patterns of the set
+ * use. A pass thus costs the number of entries plus the number of queries,
+ * whatever their product, except for the patterns without any literal end,
+ * like "*log*", which are matched against every entry.
+*/
+
+/**
+ * INFO 2: patterns
+ * '*' matches any run of characters but '/', '?' any character but '/',
+ * "[...]" any character of a set, like "[a-z]" or "[!0-9]", but '/', and
+ * '\' makes the next character literal. A pattern matches a whole name, the
+ * trailing '/' of the name of a directory aside: "app/log?" matches the
+ * directory "app/logs/".
+*/
+
+#define QUERY_INITIAL_ITEMS     64
+#define QUERY_INITIAL_BUCKETS   128
+#define QUERY_INITIAL_STRINGS   4096
+
+/* Most literal bytes a pattern is keyed by, see INFO 1 */
+#define QUERY_KEY_MAX           8
+
+/* Kinds of queries */
+#define QUERY_PATH              0       /* an exact path */
+#define QUERY_HEAD              1       /* a pattern keyed by the bytes it starts with */
+#define QUERY_TAIL              2       /* a pattern keyed by the bytes it ends with */
+#define QUERY_ANY               3       /* a pattern without any literal end, matched against every entry */
+
+typedef struct query_item
+{
+    uint64_t    key;
+    uint32_t    text;           /* offset of the path or pattern in the string pool */
+    uint32_t    next;           /* position of the next query with the same key plus one, zero for none */
+    uint8_t     kind;           /* one of the QUERY_* values */
+} query_item_t;
+
+struct tar_query
+{
+    query_item_t    *items;
+    uint32_t        n_items;
+    uint32_t        items_cap;
+    uint32_t        n_paths;
+
+    uint32_t        *buckets;               /* open addressing, position of the first query of a key plus one */
+    uint32_t        n_buckets;              /* always a power of two */
+    uint32_t        n_keys;
+    uint32_t        any;                    /* position of the first QUERY_ANY pattern plus one */
+    uint32_t        key_lengths[QUERY_TAIL + 1];    /* for patterns, bit n set when a pattern is keyed by n bytes */
+
+    char            *strings;               /* string pool, every string is null terminated */
+    size_t          strings_len;
+    size_t          strings_cap;
+};
+
+/**
+ * The state of a pass over the entries of an archive, see tar_query_run().
+ */
+typedef struct query_pass
+{
+    const tar_query_t       *query;
+    uint8_t                 *found;
+    tar_query_callback_t    callback;
+    void                    *user_data;
+    int                     n_found;
+    int                     stopped;        /* set once the callback returned a non-zero value */
+
+    tar_scanner_t           *scanner;       /* the current entry, when the archive is scanned */
+    const tar_index_t       *index;         /* or the index of the archive and the position of the entry */
+    uint32_t                pos;
+    const tar_entry_t       *entry;         /* the current entry, decoded the first time it matches */
+    tar_entry_t             decoded;
+} query_pass_t;
+
+/**
+ * Function returns the key of the len bytes of str for a query of the given kind.
+*/
+static uint64_t key_of(int kind, const char *str, size_t len) {
+    return hash_name(str, len) + (uint64_t) kind * 0x9e3779b97f4a7c15ULL;
+}
+
+/**
+ * Function inserts the query at position pos in the hash table, at the head of the queries with the same key.
+*/
+static void insert_item(tar_query_t *query, uint32_t pos) {
+    query_item_t    *item   = &query->items[pos];
+    uint32_t        mask    = query->n_buckets - 1;
+    uint32_t        bucket  = item->key & mask;
+
+    while (query->buckets[bucket] != 0 && query->items[query->buckets[bucket] - 1].key != item->key) bucket = (bucket + 1) & mask;
+    if (query->buckets[bucket] == 0) query->n_keys++;
+    item->next              = query->buckets[bucket];
+    query->buckets[bucket]  = pos + 1;
+}
+
+/**
+ * Function doubles the size of the hash table and reinserts every keyed query.
+ * Returns zero on success, -1 if the table could not be allocated.
+*/
+static int grow_buckets(tar_query_t *query) {
+    uint32_t n_buckets  = query->n_buckets ? query->n_buckets * 2 : QUERY_INITIAL_BUCKETS;
+    uint32_t *buckets   = calloc(n_buckets, sizeof(uint32_t));
+    if (buckets == NULL) return -1;
+
+    free(query->buckets);
+    query->buckets      = buckets;
+    query->n_buckets    = n_buckets;
+    query->n_keys       = 0;
+    for (uint32_t i = 0; i < query->n_items; i++) {
+        if (query->items[i].kind != QUERY_ANY) insert_item(query, i);
+    }
+    return 0;
+}
+
+/**
+ * Function adds a query of the given kind and key for the len bytes of text.
+ * Returns the position of the query, or -4 if the set could not be grown.
+*/
+static ssize_t add_item(tar_query_t *query, int kind, uint64_t key, const char *text, size_t len) {
+    if (query->n_items == query->items_cap) {
+        uint32_t        new_cap     = query->items_cap ? query->items_cap * 2 : QUERY_INITIAL_ITEMS;
+        query_item_t    *new_items  = realloc(query->items, new_cap * sizeof(query_item_t));
+        if (new_items == NULL) return -4;
+        query->items        = new_items;
+        query->items_cap    = new_cap;
+    }
+    if (query->strings_len + len + 1 > query->strings_cap) {
+        size_t new_cap = query->strings_cap ? query->strings_cap : QUERY_INITIAL_STRINGS;
+        while (query->strings_len + len + 1 > new_cap) new_cap *= 2;
+        char *new_strings = realloc(query->strings, new_cap);
+        if (new_strings == NULL) return -4;
+        query->strings      = new_strings;
+        query->strings_cap  = new_cap;
+    }
+    // keep the load factor of the hash table under 3/4
+    if (kind != QUERY_ANY && (uint64_t) (query->n_keys + 1) * 4 > (uint64_t) query->n_buckets * 3 && grow_buckets(query) < 0) return -4;
+
+    uint32_t        pos     = query->n_items++;
+    query_item_t    *item   = &query->items[pos];
+    item->key               = key;
+    item->text              = (uint32_t) query->strings_len;
+    item->kind              = kind;
+    memcpy(query->strings + query->strings_len, text, len);
+    query->strings[query->strings_len + len]    = '\0';
+    query->strings_len                         += len + 1;
+
+    if (kind == QUERY_ANY) {
+        item->next  = query->any;
+        query->any  = pos + 1;
+    } else {
+        insert_item(query, pos);
+    }
+    return pos;
+}
+
+/**
+ * Creates an empty set of queries.
+ */
+int tar_query_new(tar_query_t **query) {
+    *query = calloc(1, sizeof(tar_query_t));
+    return *query == NULL ? -4 : 0;
+}
+
+/**
+ * Releases a set of queries.
+ */
+void tar_query_free(tar_query_t *query) {
+    if (query == NULL) return;
+    free(query->items);
+    free(query->buckets);
+    free(query->strings);
+    free(query);
+}
+
+/**
+ * Adds an exact path to a set of queries.
+ */
+ssize_t tar_query_add_path(tar_query_t *query, const char *path) {
+    size_t  len = strlen(path);
+    ssize_t pos = add_item(query, QUERY_PATH, hash_name(path, len), path, len);
+    if (pos >= 0) query->n_paths++;
+    return pos;
+}
+
+/**
+ * Function returns the length of the element of a pattern starting at pattern: a character, an escaped
+ * character or a set, or zero if it is a set without its closing ']'.
+*/
+static size_t element_len(const char *pattern) {
+    if (pattern[0] == '\\' && pattern[1] != '\0') return 2;
+    if (pattern[0] != '[') return 1;
+
+    size_t i = 1;
+    if (pattern[i] == '!' || pattern[i] == '^') i++;
+    if (pattern[i] == ']') i++;                 // a leading ']' is part of the set
+    while (pattern[i] != '\0' && pattern[i] != ']') i++;
+    return pattern[i] == ']' ? i + 1 : 0;
+}
+
+/**
+ * Adds a glob pattern to a set of queries.
+ */
+ssize_t tar_query_add_glob(tar_query_t *query, const char *pattern) {
+    size_t len = strlen(pattern);
+    while (len > 0 && pattern[len - 1] == '/') len--;       // matched against names without their trailing '/'
+
+    // the literal runs at both ends, see INFO 1
+    size_t head = 0, tail = 0, last_special = 0;
+    int    special = 0;
+    for (size_t i = 0; i < len;) {
+        size_t element = element_len(pattern + i);
+        if (element == 0) return -1;
+        if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[' || pattern[i] == '\\') {
+            if (!special) head = i;
+            special         = 1;
+            last_special    = i + element;
+        }
+        i += element;
+    }
+    if (!special) head = len;
+    tail = special ? len - last_special : len;
+
+    int kind;
+    if (head == 0 && tail == 0)     kind = QUERY_ANY;
+    else if (head > tail)           kind = QUERY_HEAD;
+    else                            kind = QUERY_TAIL;
+    size_t      key_len = kind == QUERY_HEAD ? head : tail;
+    if (key_len > QUERY_KEY_MAX) key_len = QUERY_KEY_MAX;
+    const char  *key    = kind == QUERY_HEAD ? pattern : pattern + len - key_len;
+
+    ssize_t pos = add_item(query, kind, kind == QUERY_ANY ? 0 : key_of(kind, key, key_len), pattern, len);
+    if (pos >= 0 && kind != QUERY_ANY) query->key_lengths[kind] |= 1U << key_len;
+    return pos;
+}
+
+/**
+ * Function returns the element of a pattern following the one at pattern if it matches c, or NULL, see INFO 2.
+*/
+static const char *match_element(const char *pattern, char c) {
+    size_t len = element_len(pattern);
+    if (pattern[0] == '?')  return c != '/' ? pattern + 1 : NULL;
+    if (pattern[0] == '\\') return pattern[len - 1] == c ? pattern + len : NULL;
+    if (pattern[0] != '[')  return pattern[0] == c ? pattern + 1 : NULL;
+    if (c == '/')           return NULL;
+
+    size_t  i       = 1;
+    int     negated = pattern[i] == '!' || pattern[i] == '^';
+    int     in_set  = 0;
+    if (negated) i++;
+    do {
+        // a range, or a single character
+        if (pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+            if ((uint8_t) c >= (uint8_t) pattern[i] && (uint8_t) c <= (uint8_t) pattern[i + 2]) in_set = 1;
+            i += 3;
+        } else {
+            if (pattern[i] == c) in_set = 1;
+            i++;
+        }
+    } while (i < len - 1);
+    return in_set != negated ? pattern + len : NULL;
+}
+
+/**
+ * Function checks whether the len first bytes of name match a pattern, see INFO 2.
+*/
+static int glob_match(const char *pattern, const char *name, size_t len) {
+    const char  *star   = NULL;         // the pattern following the last '*'
+    size_t      star_n  = 0;            // the bytes of name the last '*' matched up to
+    size_t      n       = 0;
+
+    while (n < len) {
+        if (*pattern == '*') {
+            star    = ++pattern;
+            star_n  = n;
+            continue;
+        }
+        const char *next = *pattern != '\0' ? match_element(pattern, name[n]) : NULL;
+        if (next != NULL) {
+            pattern = next;
+            n++;
+            continue;
+        }
+        // let the last '*' match one more byte, which cannot be a '/'; earlier ones cannot reach past it either
+        if (star == NULL || name[star_n] == '/') return 0;
+        pattern = star;
+        n       = ++star_n;
+    }
+    while (*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+/**
+ * Function records that the query at position pos matches the current entry of a pass.
+*/
+static void report(query_pass_t *pass, uint32_t pos) {
+    if ((pass->found[pos / 8] & (1 << (pos % 8))) == 0) {
+        pass->found[pos / 8] |= 1 << (pos % 8);
+        pass->n_found++;
+    }
+    if (pass->callback == NULL) return;
+
+    if (pass->entry == NULL && pass->scanner != NULL) {
+        pass->entry = scanner_entry(pass->scanner);
+    } else if (pass->entry == NULL) {
+        const tar_index_t   *index  = pass->index;
+        uint32_t            i       = pass->pos;
+        pass->decoded = (tar_entry_t) {INDEX_NAME(index, i), INDEX_LINKNAME(index, i), index->sizes[i], (uint64_t) index->mtimes[i],
+                                       index->modes[i], index->types[i], index->data_offsets[i] - BLOCKSIZE, index->data_offsets[i]};
+        pass->entry = &pass->decoded;
+    }
+    if (pass->callback(pos, pass->entry, pass->user_data) != 0) pass->stopped = 1;
+}
+
+/**
+ * Function matches the len first bytes of name against the queries of the given kind and key.
+*/
+static void match_key(query_pass_t *pass, int kind, uint64_t key, const char *name, size_t len) {
+    const tar_query_t   *query  = pass->query;
+    uint32_t            mask    = query->n_buckets - 1;
+    uint32_t            bucket  = key & mask;
+
+    while (query->buckets[bucket] != 0 && query->items[query->buckets[bucket] - 1].key != key) bucket = (bucket + 1) & mask;
+    for (uint32_t i = query->buckets[bucket]; i != 0 && !pass->stopped; i = query->items[i - 1].next) {
+        const query_item_t  *item   = &query->items[i - 1];
+        const char          *text   = query->strings + item->text;
+        if (item->kind != kind) continue;
+        if (kind == QUERY_PATH ? strcmp(text, name) == 0 : glob_match(text, name, len)) report(pass, i - 1);
+    }
+}
+
+/**
+ * Function matches the current entry of a pass, of the given name, against every query, see INFO 1.
+ * hash is the hash_name() of the name, only used when the set holds exact paths.
+*/
+static void match_entry(query_pass_t *pass, const char *name, uint64_t hash) {
+    const tar_query_t   *query  = pass->query;
+    size_t              len     = strlen(name);
+    pass->entry                 = NULL;
+    if (query->n_buckets == 0 && query->any == 0) return;
+
+    if (query->n_paths > 0) match_key(pass, QUERY_PATH, hash, name, len);
+
+    // patterns are matched against the name without its trailing '/'
+    while (len > 0 && name[len - 1] == '/') len--;
+    for (int kind = QUERY_HEAD; kind <= QUERY_TAIL; kind++) {
+        for (uint32_t lengths = query->key_lengths[kind]; lengths != 0 && !pass->stopped; lengths &= lengths - 1) {
+            size_t key_len = __builtin_ctz(lengths);
+            if (key_len > len) break;
+            const char *key = kind == QUERY_HEAD ? name : name + len - key_len;
+            match_key(pass, kind, key_of(kind, key, key_len), name, len);
+        }
+    }
+    for (uint32_t i = query->any; i != 0 && !pass->stopped; i = query->items[i - 1].next) {
+        if (glob_match(query->strings + query->items[i - 1].text, name, len)) report(pass, i - 1);
+    }
+}
+
+/**
+ * Function answers a set of queries with an index, see tar_query_run().
+*/
+static void run_indexed(query_pass_t *pass, const tar_index_t *index) {
+    const tar_query_t *query = pass->query;
+    pass->index = index;
+
+    // without patterns nor callback, looking every path up is enough
+    if (pass->callback == NULL && query->n_paths == query->n_items) {
+        for (uint32_t i = 0; i < query->n_items; i++) {
+            const char *path = query->strings + query->items[i].text;
+            if (tar_index_find(index, path, strlen(path)) >= 0) report(pass, i);
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < index->n_entries && !pass->stopped; i++) {
+        pass->pos = i;
+        match_entry(pass, INDEX_NAME(index, i), index->hashes[i]);
+    }
+}
+
+/**
+ * Function implements tar_query_run().
+*/
+static int run(const tar_archive_t *archive, const tar_query_t *query, uint8_t *found, tar_query_callback_t callback, void *user_data) {
+    query_pass_t pass = {query, found, callback, user_data};
+    if (found == NULL && (pass.found = malloc((query->n_items + 7) / 8 + 1)) == NULL) return -4;
+    memset(pass.found, 0, (query->n_items + 7) / 8);
+
+    int ret = 0;
+    if (archive->index != NULL) {
+        run_indexed(&pass, archive->index);
+    } else {
+        tar_scanner_t   scanner;
+        tar_header_t    *header;
+        pass.scanner = &scanner;
+        scanner_init(&scanner, archive->fd);
+        while (ret == 0 && !pass.stopped && (header = scanner_next(&scanner)) != NULL) {
+            ret = check_header(header);
+            if (ret == 0) match_entry(&pass, scanner.entry.name, query->n_paths > 0 ? hash_name(scanner.entry.name, strlen(scanner.entry.name)) : 0);
+        }
+        int unseekable = scanner.unseekable;
+        scanner_free(&scanner);
+
+        // a pipe or a socket is indexed strictly forward first
+        tar_index_t *index;
+        if (ret == 0 && unseekable && (ret = tar_index_build(archive->fd, &index)) >= 0) {
+            pass.scanner    = NULL;
+            ret             = 0;
+            run_indexed(&pass, index);
+            tar_index_free(index);
+        }
+    }
+
+    if (found == NULL) free(pass.found);
+    return ret < 0 ? ret : pass.n_found;
+}
+
+/**
+ * Answers a set of queries in a single pass over the entries of an archive.
+ */
+int tar_query_run(const tar_archive_t *archive, const tar_query_t *query, uint8_t *found, tar_query_callback_t callback, void *user_data) {
+    STATS_ENTER(archive);
+    int ret = run(archive, query, found, callback, user_data);
+    STATS_LEAVE(TAR_API_QUERY);
+    return ret;
+}
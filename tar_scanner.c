@@ -0,0 +1,213 @@
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: bulk scanning
+ * Reading the archive one header at a time costs a read() per header and an
+ * lseek() per entry. The scanner reads the archive in large chunks instead,
+ * walks the headers inside its buffer and skips data blocks in memory when the
+ * next header is already buffered. Reads use pread(), so the file offset of
+ * the archive is never moved.
+*/
+
+/**
+ * INFO 2: adaptive read size
+ * When entries are large, most of a chunk is data the scan skips anyway. A
+ * refill which only served the header it was made for halves the next read
+ * (down to SCAN_MIN_READ), while a refill serving several headers doubles it
+ * back (up to the buffer size).
+ * Once a scan needs a second refill, it is a long sequential pass, and the
+ * kernel is asked for an aggressive readahead.
+*/
+
+#define SCAN_MIN_READ (16 * BLOCKSIZE)
+
+/**
+ * Function prepares a scan of the archive starting at its first header.
+ * If the buffer cannot be allocated, the scanner falls back to reading a single block at a time.
+*/
+void scanner_init(tar_scanner_t *scanner, int tar_fd) {
+    memset(scanner, 0, sizeof(tar_scanner_t));
+    scanner->fd             = tar_fd;
+    scanner->buffer         = malloc(TAR_SCAN_BUFFER_SIZE);
+    scanner->buffer_size    = TAR_SCAN_BUFFER_SIZE;
+    if (scanner->buffer == NULL) {
+        scanner->buffer         = scanner->block;
+        scanner->buffer_size    = BLOCKSIZE;
+    }
+    scanner->read_size      = scanner->buffer_size;
+}
+
+/**
+ * Function releases the buffers of a scanner.
+*/
+void scanner_free(tar_scanner_t *scanner) {
+    if (scanner->buffer != scanner->block) free(scanner->buffer);
+    scanner->buffer = NULL;
+    ext_free(&scanner->ext);
+}
+
+/**
+ * Function releases the buffer of a scanner and returns the value return_value.
+*/
+int scanner_return(tar_scanner_t *scanner, int return_value) {
+    scanner_free(scanner);
+    return return_value;
+}
+
+/**
+ * Function refills the buffer of the scanner starting at the given archive offset.
+ * Returns the number of bytes available in the buffer from that offset.
+*/
+static size_t refill(tar_scanner_t *scanner, uint64_t offset) {
+    if (scanner->n_refills == 1) posix_fadvise(scanner->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // adapt the size of the read to the number of headers the previous one served
+    if (scanner->n_refills > 0) {
+        if (scanner->headers_in_buffer <= 1 && scanner->read_size / 2 >= SCAN_MIN_READ) scanner->read_size /= 2;
+        else if (scanner->headers_in_buffer > 1 && scanner->read_size * 2 <= scanner->buffer_size) scanner->read_size *= 2;
+    }
+    scanner->n_refills++;
+    scanner->headers_in_buffer = 0;
+
+    ssize_t n_read = archive_pread(scanner->fd, scanner->buffer, scanner->read_size, offset);
+    if (n_read < 0 && errno == ESPIPE) scanner->unseekable = 1;
+    scanner->buffer_offset  = offset;
+    scanner->buffer_len     = n_read < 0 ? 0 : (size_t) n_read;
+    return scanner->buffer_len;
+}
+
+/**
+ * Function marks the end of the archive as reached and returns NULL.
+*/
+static tar_header_t *scanner_end(tar_scanner_t *scanner) {
+    scanner->done   = 1;
+    scanner->header = NULL;
+    return NULL;
+}
+
+/**
+ * Function makes the next call to scanner_next() return the header at offset, which must be the
+ * offset of a header or of the end of the archive.
+*/
+void scanner_seek(tar_scanner_t *scanner, uint64_t offset) {
+    scanner->start_offset   = offset;
+    scanner->header         = NULL;
+    scanner->done           = 0;
+}
+
+/**
+ * Function returns the header at offset, refilling the buffer if it is not entirely in it,
+ * or NULL if the archive ends there.
+*/
+static tar_header_t *header_at(tar_scanner_t *scanner, uint64_t offset) {
+    if (offset < scanner->buffer_offset || offset + BLOCKSIZE > scanner->buffer_offset + scanner->buffer_len) {
+        if (refill(scanner, offset) < BLOCKSIZE) return NULL;
+    }
+
+    tar_header_t *header = (tar_header_t *) (scanner->buffer + (offset - scanner->buffer_offset));
+    return header->name[0] != '\0' ? header : NULL;
+}
+
+/**
+ * Function records the values of the extended header at offset, whose data is size bytes long,
+ * see tar_header.c. Data which cannot be read is ignored.
+*/
+static void read_extension(tar_scanner_t *scanner, tar_header_t *header, uint64_t offset, uint64_t size) {
+    uint64_t    data_offset = offset + BLOCKSIZE;
+    const char  *data       = NULL;
+    char        *copy;
+    if (data_offset + size <= scanner->buffer_offset + scanner->buffer_len) {
+        data = (const char *) scanner->buffer + (data_offset - scanner->buffer_offset);
+    } else if ((copy = ext_buffer(&scanner->ext, size)) != NULL && scanner_read(scanner, data_offset, copy, size) == size) {
+        data = copy;
+    }
+    if (data != NULL) ext_parse(&scanner->ext, header->typeflag, data, size);
+}
+
+/**
+ * Function moves the scanner past the current entry and returns the next header, or NULL if the end
+ * of the archive is reached. Extended headers are consumed on the way, an invalid one is returned
+ * like any other header so that it fails validation.
+ * The returned header stays valid until the next call, and is decoded in the entry of the scanner.
+*/
+tar_header_t *scanner_next(tar_scanner_t *scanner) {
+    if (scanner->done) return NULL;
+    uint64_t offset = scanner->header != NULL ? scanner->entry.data_offset + BLOCK_ALIGN(scanner->entry.size) : scanner->start_offset;
+
+    tar_header_t *header;
+    while ((header = header_at(scanner, offset)) != NULL && IS_EXTENSION(header->typeflag) && check_header(header) == 0) {
+        uint64_t size = (uint64_t) header_number(header->size, sizeof(header->size));
+        STAT_ADD(headers, 1);
+        scanner->n_extensions++;
+        read_extension(scanner, header, offset, size);
+        offset += BLOCKSIZE + BLOCK_ALIGN(size);
+    }
+    if (header == NULL) return scanner_end(scanner);
+
+    STAT_ADD(headers, 1);
+    scanner->headers_in_buffer++;
+    scanner->header = header;
+    header_decode(&scanner->ext, header, offset, &scanner->entry);
+
+    // a size check_header() rejects would wrap the offset of the next header, the scan ends with this one
+    if (scanner->entry.size > ENTRY_SIZE_MAX) scanner->done = 1;
+    return header;
+}
+
+/**
+ * Function returns the entry of the current header, with every field decoded.
+ * It stays valid until the next call to scanner_next().
+*/
+const tar_entry_t *scanner_entry(tar_scanner_t *scanner) {
+    header_decode_rest(&scanner->ext, scanner->header, &scanner->entry);
+    return &scanner->entry;
+}
+
+/**
+ * Function fills headers with up to max_headers next headers of the archive, all sitting in the
+ * buffer of the scanner at the same time, so they can be processed together.
+ * Only the first header of a batch may cause a refill.
+ * Returns the number of headers in the batch, zero if the end of the archive is reached.
+*/
+size_t scanner_next_batch(tar_scanner_t *scanner, tar_header_t **headers, size_t max_headers) {
+    size_t n_headers = 0;
+
+    while (n_headers < max_headers) {
+        if (n_headers > 0) {
+            // consuming extended headers may refill the buffer, they start the next batch
+            if (scanner->done) break;
+            uint64_t next = scanner->entry.data_offset + BLOCK_ALIGN(scanner->entry.size);
+            if (next + BLOCKSIZE > scanner->buffer_offset + scanner->buffer_len) break;
+            if (IS_EXTENSION(((tar_header_t *) (scanner->buffer + (next - scanner->buffer_offset)))->typeflag)) break;
+        }
+        if ((headers[n_headers] = scanner_next(scanner)) == NULL) break;
+        n_headers++;
+    }
+    return n_headers;
+}
+
+/**
+ * Function copies len bytes of the archive starting at offset into dest, from the buffer
+ * when they are already there or with pread() otherwise, which may take several calls
+ * for reads larger than what a single one returns.
+ * Returns the number of bytes copied.
+*/
+size_t scanner_read(tar_scanner_t *scanner, uint64_t offset, void *dest, size_t len) {
+    if (offset >= scanner->buffer_offset && offset + len <= scanner->buffer_offset + scanner->buffer_len) {
+        memcpy(dest, scanner->buffer + (offset - scanner->buffer_offset), len);
+        return len;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n_read = archive_pread(scanner->fd, (uint8_t *) dest + done, len - done, offset + done);
+        if (n_read < 0 && errno == EINTR) continue;
+        if (n_read <= 0) break;
+        done += n_read;
+    }
+    return done;
+}
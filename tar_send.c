@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: moving data
+ * The data of an entry goes from the archive to the output in the kernel,
+ * without ever being copied to a user buffer: spliced into a pipe, which only
+ * hands it references to the pages of the archive in the page cache, and sent
+ * with sendfile() to a socket or a file. When neither works, like for a
+ * compressed archive or an output opened with O_APPEND, the data is copied
+ * through a buffer with pread() and write(), which is what reading the entry
+ * with tar_read_file() then writing it would cost.
+*/
+
+/**
+ * INFO 2: non-blocking outputs
+ * An output in non-blocking mode, like the socket of an event-driven server,
+ * takes what it can without waiting. The call then returns, as read_file()
+ * does with a buffer too small, the number of bytes left to send: the caller
+ * sends them, once the output is writable again, from the offset following
+ * the bytes sent.
+*/
+
+/* Size of the buffer data is copied through when it cannot be moved in the kernel */
+#define SEND_BUFFER_SIZE (64 << 10)
+
+/* Ways of moving data to the output, see INFO 1 */
+#define SEND_SPLICE     0
+#define SEND_SENDFILE   1
+#define SEND_COPY       2
+
+/**
+ * Function returns the way of moving data from the archive to out_fd, one of the SEND_* values.
+*/
+static int send_method(int tar_fd, int out_fd) {
+    struct stat st;
+    if (source_of(tar_fd) != NULL)                       return SEND_COPY;
+    if (fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode)) return SEND_SPLICE;
+    return SEND_SENDFILE;
+}
+
+/**
+ * Function copies up to len bytes of the archive at offset to out_fd through a buffer, see INFO 1.
+ * Returns the number of bytes written, zero if the archive ends before them, or -1 with errno set.
+*/
+static ssize_t copy_chunk(int tar_fd, uint64_t offset, int out_fd, size_t len, uint8_t **buffer) {
+    if (*buffer == NULL && (*buffer = malloc(SEND_BUFFER_SIZE)) == NULL) return -1;
+
+    ssize_t n_read = archive_pread(tar_fd, *buffer, len < SEND_BUFFER_SIZE ? len : SEND_BUFFER_SIZE, offset);
+    if (n_read <= 0) return n_read;
+
+    // a short write leaves the rest of the chunk to the next one, which reads it again
+    return write(out_fd, *buffer, n_read);
+}
+
+/**
+ * Function implements tar_send_entry().
+*/
+static ssize_t send_entry(const tar_archive_t *archive, const char *path, int out_fd, size_t offset, size_t *len) {
+    uint64_t    data_offset, size;
+    int         ret = archive_find_file(archive, path, &data_offset, &size);
+    if (ret < 0 || offset > size) {
+        *len = 0;
+        return ret < 0 ? ret : -2;
+    }
+
+    size_t      to_send = *len < size - offset ? *len : size - offset;
+    size_t      sent    = 0;
+    int         method  = send_method(archive->fd, out_fd);
+    uint8_t     *buffer = NULL;
+    while (sent < to_send && ret == 0) {
+        uint64_t    in_offset   = data_offset + offset + sent;
+        loff_t      off         = in_offset;
+        ssize_t     n_sent;
+        if (method == SEND_SPLICE)          n_sent = splice(archive->fd, &off, out_fd, NULL, to_send - sent, SPLICE_F_MOVE);
+        else if (method == SEND_SENDFILE)   n_sent = sendfile(out_fd, archive->fd, &off, to_send - sent);
+        else                                n_sent = copy_chunk(archive->fd, in_offset, out_fd, to_send - sent, &buffer);
+
+        if (n_sent < 0 && errno == EINTR) continue;
+        if (n_sent < 0 && method != SEND_COPY && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            method = SEND_COPY;
+            continue;
+        }
+        if (n_sent < 0 && errno == EAGAIN) break;     // see INFO 2
+        if (n_sent <= 0) {
+            ret = -5;                       // an error, or an archive shorter than its headers say
+            break;
+        }
+        if (method != SEND_COPY) STAT_READ(in_offset, n_sent);
+        sent += n_sent;
+    }
+    free(buffer);
+
+    *len = sent;
+    return ret < 0 ? ret : (ssize_t) (size - offset - sent);
+}
+
+/**
+ * Sends a range of a file of the archive of a handle to a descriptor, without copying it to user space.
+ */
+ssize_t tar_send_entry(const tar_archive_t *archive, const char *path, int out_fd, size_t offset, size_t *len) {
+    STATS_ENTER(archive);
+    ssize_t ret = send_entry(archive, path, out_fd, offset, len);
+    STATS_LEAVE(TAR_API_SEND_ENTRY);
+    return ret;
+}
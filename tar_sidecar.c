@@ -0,0 +1,340 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: sidecar layout
+ * A sidecar is the arrays of an index written one after the other, each one
+ * aligned on 8 bytes, behind a fixed header describing them. Loading it maps
+ * the file and points the index straight into the mapping: nothing is parsed
+ * nor copied, whatever the number of entries. The offsets and positions the
+ * arrays hold are only checked against the counts, in one pass, so that a
+ * damaged sidecar cannot make a lookup read past an array or probe forever.
+ * The arrays are written in the layout of the running library, so the
+ * header records the byte order and the number of arrays, and a sidecar
+ * written by another build is considered stale.
+ * The last array holds the digests of the data of the entries, empty until
+ * tar_diff() computes some and writes them to the sidecar of its handle.
+*/
+
+/**
+ * INFO 2: invalidation
+ * A sidecar belongs to an archive of a given size and modification time.
+ * Since both can be preserved by a rewrite, it also records a checksum of
+ * the header region: up to SIDECAR_SAMPLES headers spread over the archive,
+ * plus the two blocks marking its end. Checking it costs a few pread()
+ * calls, instead of a scan of every header.
+ * An archive which grew while its sampled headers did not was appended to:
+ * tar_index_open() then only indexes the entries past the known ones.
+*/
+
+#define SIDECAR_MAGIC   "TARIDX\0\0"
+#define SIDECAR_VERSION 5
+#define SIDECAR_ENDIAN  0x01020304
+#define SIDECAR_SAMPLES 64
+
+typedef struct sidecar_header
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    endian;
+    uint32_t    n_arrays;               /* INDEX_ARRAYS of the writer */
+    uint32_t    n_entries;
+    uint32_t    n_buckets;
+    uint32_t    n_dirs;
+    uint32_t    n_dir_buckets;
+    uint32_t    n_children;
+    uint32_t    n_digests;
+    uint32_t    reserved;
+    uint64_t    strings_len;
+    uint64_t    end_offset;
+
+    uint64_t    archive_size;
+    int64_t     archive_mtime_sec;
+    int64_t     archive_mtime_nsec;
+    uint64_t    samples_checksum;
+    uint64_t    end_checksum;
+
+    uint64_t    offsets[INDEX_ARRAYS];  /* offsets of the arrays in the file, see index_arrays() */
+} sidecar_header_t;
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t) 7)
+
+/**
+ * Function returns the checksum of the sampled headers of the indexed archive, see INFO 2.
+*/
+static uint64_t samples_checksum(const tar_index_t *index, int tar_fd) {
+    uint8_t     block[BLOCKSIZE];
+    uint64_t    hash        = 0;
+    uint32_t    n_samples   = index->n_entries < SIDECAR_SAMPLES ? index->n_entries : SIDECAR_SAMPLES;
+
+    for (uint32_t s = 0; s < n_samples; s++) {
+        uint32_t i = n_samples > 1 ? (uint32_t) ((uint64_t) s * (index->n_entries - 1) / (n_samples - 1)) : 0;
+        memset(block, 0, BLOCKSIZE);
+        if (archive_pread(tar_fd, block, BLOCKSIZE, (off_t) (index->data_offsets[i] - BLOCKSIZE)) < 0) return 0;
+        hash = hash * 31 + hash_name((const char *) block, BLOCKSIZE);
+    }
+    return hash;
+}
+
+/**
+ * Function returns the checksum of the two blocks marking the end of the indexed archive.
+*/
+static uint64_t end_checksum(const tar_index_t *index, int tar_fd) {
+    uint8_t block[2 * BLOCKSIZE] = {0};
+    if (archive_pread(tar_fd, block, sizeof(block), (off_t) index->end_offset) < 0) return 0;
+    return hash_name((const char *) block, sizeof(block));
+}
+
+/**
+ * Function writes len bytes of data to fd, retrying on short writes.
+ * Returns zero on success, -1 otherwise.
+*/
+int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while (len > 0) {
+        ssize_t n_written = write(fd, bytes, len);
+        if (n_written < 0 && errno == EINTR) continue;
+        if (n_written <= 0) return -1;
+        bytes   += n_written;
+        len     -= n_written;
+    }
+    return 0;
+}
+
+/**
+ * Writes an index to a sidecar file.
+ */
+int tar_index_save(const tar_index_t *index, int tar_fd, const char *path) {
+    struct stat st;
+    if (fstat(tar_fd, &st) < 0) return -1;
+
+    sidecar_header_t header = {0};
+    memcpy(header.magic, SIDECAR_MAGIC, sizeof(header.magic));
+    header.version              = SIDECAR_VERSION;
+    header.endian               = SIDECAR_ENDIAN;
+    header.n_arrays             = INDEX_ARRAYS;
+    header.n_entries            = index->n_entries;
+    header.n_buckets            = index->n_buckets;
+    header.n_dirs               = index->n_dirs;
+    header.n_dir_buckets        = index->n_dir_buckets;
+    header.n_children           = index->n_children;
+    header.n_digests            = index->n_digests;
+    header.strings_len          = index->strings_len;
+    header.end_offset           = index->end_offset;
+    header.archive_size         = st.st_size;
+    header.archive_mtime_sec    = st.st_mtim.tv_sec;
+    header.archive_mtime_nsec   = st.st_mtim.tv_nsec;
+    header.samples_checksum     = samples_checksum(index, tar_fd);
+    header.end_checksum         = end_checksum(index, tar_fd);
+
+    // the arrays, in file order
+    void        **arrays[INDEX_ARRAYS];
+    uint64_t    sizes[INDEX_ARRAYS];
+    index_arrays((tar_index_t *) index, arrays, sizes);
+
+    uint64_t offset = ALIGN8(sizeof(header));
+    for (int i = 0; i < INDEX_ARRAYS; i++) {
+        header.offsets[i]   = offset;
+        offset              = ALIGN8(offset + sizes[i]);
+    }
+
+    // write to a temporary file renamed over the sidecar, so that readers never see half of it, unique so
+    // that two writers of the same sidecar do not write it together
+    char tmp_path[TAR_PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int) sizeof(tmp_path)) return -1;
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) return -1;
+    if (fchmod(fd, st.st_mode & 0666) < 0) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    static const uint8_t padding[8] = {0};
+    int ret = write_all(fd, &header, sizeof(header));
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < INDEX_ARRAYS && ret == 0; i++) {
+        ret = write_all(fd, padding, header.offsets[i] - written);
+        if (ret == 0 && sizes[i] > 0) ret = write_all(fd, *arrays[i], sizes[i]);
+        written = header.offsets[i] + sizes[i];
+    }
+
+    if (close(fd) < 0) ret = -1;
+    if (ret == 0 && rename(tmp_path, path) < 0) ret = -1;
+    if (ret < 0) unlink(tmp_path);
+    return ret;
+}
+
+/**
+ * Function sets the counts of index to the ones recorded in the header of a sidecar.
+*/
+static void set_counts(tar_index_t *index, const sidecar_header_t *header) {
+    index->n_entries        = header->n_entries;
+    index->n_buckets        = header->n_buckets;
+    index->strings_len      = header->strings_len;
+    index->n_dirs           = header->n_dirs;
+    index->n_dir_buckets    = header->n_dir_buckets;
+    index->n_children       = header->n_children;
+    index->n_digests        = header->n_digests;
+    index->n_finished       = header->n_entries;
+    index->end_offset       = header->end_offset;
+}
+
+/**
+ * Function checks that a mapped sidecar is well formed: every array lies within the file.
+ * Returns zero if it is, -1 otherwise.
+*/
+static int check_layout(const sidecar_header_t *header, size_t file_size) {
+    if (memcmp(header->magic, SIDECAR_MAGIC, sizeof(header->magic)) != 0)   return -1;
+    if (header->version != SIDECAR_VERSION || header->endian != SIDECAR_ENDIAN) return -1;
+    if (header->n_arrays != INDEX_ARRAYS)                                   return -1;
+    if ((header->n_buckets & (header->n_buckets - 1)) != 0)                 return -1;
+    if ((header->n_dir_buckets & (header->n_dir_buckets - 1)) != 0)         return -1;
+    if (header->strings_len > UINT32_MAX)                                   return -1;
+    if (header->n_digests > header->n_entries)                              return -1;
+
+    tar_index_t counts = {0};
+    void        **arrays[INDEX_ARRAYS];
+    uint64_t    sizes[INDEX_ARRAYS];
+    set_counts(&counts, header);
+    index_arrays(&counts, arrays, sizes);
+    for (int i = 0; i < INDEX_ARRAYS; i++) {
+        uint64_t offset = header->offsets[i];
+        if (offset % 8 != 0 || offset > file_size || sizes[i] > file_size - offset) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function checks that the arrays of an index loaded from a sidecar only hold offsets within its string pool
+ * and positions within its arrays, and that its hash tables have an empty bucket ending every probe, see INFO 1.
+ * Returns zero if they do, -1 otherwise.
+*/
+static int check_arrays(const tar_index_t *index) {
+    uint64_t    n_strings   = index->strings_len;
+    uint32_t    n_empty     = 0;
+    if (n_strings > 0 && index->strings[n_strings - 1] != '\0')                return -1;
+    if (n_strings == 0 && (index->n_entries > 0 || index->n_dirs > 0))         return -1;
+
+    for (uint32_t i = 0; i < index->n_entries; i++) {
+        uint32_t target = index->targets[i];
+        if (index->names[i] >= n_strings || index->linknames[i] >= n_strings)  return -1;
+        if (index->target_paths[i] >= n_strings)                                return -1;
+        if (target >= index->n_entries && target < LINK_PENDING)               return -1;
+    }
+    for (uint32_t i = 0; i < index->n_buckets; i++) {
+        if (index->buckets[i] > index->n_entries) return -1;
+        n_empty += index->buckets[i] == 0;
+    }
+    if (index->n_buckets > 0 && n_empty == 0) return -1;
+
+    for (uint32_t i = 0; i < index->n_dirs; i++) {
+        const tar_index_dir_t *dir = &index->dirs[i];
+        if ((uint64_t) dir->key + dir->key_len >= n_strings)                              return -1;
+        if ((uint64_t) dir->first_child + dir->n_children > index->n_children)          return -1;
+    }
+    n_empty = 0;
+    for (uint32_t i = 0; i < index->n_dir_buckets; i++) {
+        if (index->dir_buckets[i] > index->n_dirs) return -1;
+        n_empty += index->dir_buckets[i] == 0;
+    }
+    if (index->n_dir_buckets > 0 && n_empty == 0) return -1;
+
+    for (uint32_t i = 0; i < index->n_children; i++) {
+        if ((uint64_t) index->children[i].name + index->children[i].len >= n_strings) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function loads an index from a sidecar file, without copying it. When appended is not NULL, the sidecar
+ * of an archive which was appended to since is loaded too, and appended is set.
+ * Returns the same values as tar_index_load().
+*/
+static int load_sidecar(int tar_fd, const char *path, tar_index_t **index, int *appended) {
+    struct stat archive_st, st;
+    if (fstat(tar_fd, &archive_st) < 0) return -5;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -5;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(sidecar_header_t)) {
+        close(fd);
+        return -5;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return -5;
+
+    const sidecar_header_t  *header = mapping;
+    uint8_t                 *base   = mapping;
+    if (check_layout(header, st.st_size) < 0) {
+        munmap(mapping, st.st_size);
+        return -5;
+    }
+    int unchanged = header->archive_size        == (uint64_t) archive_st.st_size
+                    && header->archive_mtime_sec  == archive_st.st_mtim.tv_sec
+                    && header->archive_mtime_nsec == archive_st.st_mtim.tv_nsec;
+    if (!unchanged && (appended == NULL || (uint64_t) archive_st.st_size <= header->archive_size)) {
+        munmap(mapping, st.st_size);
+        return -6;
+    }
+
+    tar_index_t *idx = calloc(1, sizeof(tar_index_t));
+    if (idx == NULL) {
+        munmap(mapping, st.st_size);
+        return -4;
+    }
+    void        **arrays[INDEX_ARRAYS];
+    uint64_t    sizes[INDEX_ARRAYS];
+    idx->mapping        = mapping;
+    idx->mapping_size   = st.st_size;
+    set_counts(idx, header);
+    index_arrays(idx, arrays, sizes);
+    for (int i = 0; i < INDEX_ARRAYS; i++) *arrays[i] = base + header->offsets[i];
+    if (check_arrays(idx) < 0) {
+        tar_index_free(idx);
+        return -5;
+    }
+
+    // the end of an archive which was appended to is overwritten by the first new entry
+    if (samples_checksum(idx, tar_fd) != header->samples_checksum
+        || (unchanged && end_checksum(idx, tar_fd) != header->end_checksum)) {
+        tar_index_free(idx);
+        return -6;
+    }
+
+    if (appended != NULL) *appended = !unchanged;
+    *index = idx;
+    return (int) idx->n_entries;
+}
+
+/**
+ * Loads an index from a sidecar file, without copying it.
+ */
+int tar_index_load(int tar_fd, const char *path, tar_index_t **index) {
+    return load_sidecar(tar_fd, path, index, NULL);
+}
+
+/**
+ * Loads the sidecar of an archive, or builds the index and writes the sidecar when it is missing or stale.
+ * The sidecar of an archive which was appended to is updated with the new entries only.
+ */
+int tar_index_open(int tar_fd, const char *path, tar_index_t **index) {
+    int appended    = 0;
+    int ret         = load_sidecar(tar_fd, path, index, &appended);
+    if (ret >= 0 && !appended) return ret;
+
+    if (ret >= 0) {
+        ret = tar_index_update(tar_fd, *index);
+        if (ret < 0) tar_index_free(*index);
+    }
+    if (ret == -5 || ret == -6) ret = tar_index_build(tar_fd, index);
+    if (ret >= 0) tar_index_save(*index, tar_fd, path);    // a sidecar which cannot be written only costs the next open
+    return ret;
+}
@@ -0,0 +1,589 @@
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef TAR_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: transparent decompression
+ * A compressed archive is attached to its file descriptor. Every read of the
+ * library goes through archive_pread(), which decompresses the reads of an
+ * attached descriptor, so that every function taking that descriptor reads
+ * the archive as if it were not compressed, at offsets of the decompressed
+ * archive. Reads of a descriptor nothing is attached to cost a single load
+ * before their pread().
+*/
+
+/**
+ * INFO 2: checkpoints
+ * A compressed stream can only be decoded from its start. While decoding, the
+ * source records a checkpoint about every span bytes of output, from which
+ * decoding can restart:
+ *  - gzip: the boundary of a deflate block, along with the 32 KiB of output
+ *    before it which the next blocks may refer to, stored compressed,
+ *  - zstd: the boundary of a frame, which needs nothing else. An archive made
+ *    of a single frame can only be read sequentially, seekable archives are
+ *    made of many small frames.
+ * A read restarts from the last checkpoint before its offset, unless the
+ * decoder is already closer, so reading an entry decodes at most span bytes
+ * it does not need. Checkpoints are recorded the first time a region of the
+ * archive is decoded, typically by the first scan, and written to the
+ * checkpoint file once the whole archive was decoded, so that other processes
+ * get random access right away.
+*/
+
+/**
+ * INFO 3: one decoder per source
+ * Decoding is sequential, so the reads of an attached descriptor are
+ * serialized by a lock. The decoder writes into a ring holding its last
+ * SOURCE_RING_SIZE bytes of output, which serves the reads slightly behind it,
+ * like the ones of a scanner refilling from a header which straddled the end
+ * of its previous buffer.
+*/
+
+#ifndef TAR_CHECKPOINT_SPAN
+#define TAR_CHECKPOINT_SPAN (4 << 20)
+#endif
+#define SOURCE_MIN_SPAN     (64 << 10)
+#define SOURCE_SLOTS        64
+#define SOURCE_IN_SIZE      (64 << 10)
+#define SOURCE_RING_SIZE    (128 << 10)
+#define GZIP_WINDOW         (32 << 10)
+#define GZIP_TRAILER        8
+
+#define CHECKPOINT_MAGIC    "TARCKPT\0"
+#define CHECKPOINT_VERSION  1
+
+typedef struct checkpoint
+{
+    uint64_t in;                /* offset in the compressed file of the first byte to decode */
+    uint64_t out;               /* offset in the archive of the first byte decoded from there */
+    uint64_t window;            /* offset of the compressed window in the windows of the source */
+    uint32_t window_len;        /* length of the compressed window, zero when there is none */
+    uint32_t bits;              /* gzip, number of bits of the byte before in which belong to the next block */
+} checkpoint_t;
+
+typedef struct checkpoint_header
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    format;
+    uint64_t    archive_size;           /* size and modification time of the compressed file */
+    int64_t     archive_mtime_sec;
+    int64_t     archive_mtime_nsec;
+    uint64_t    size;                   /* size of the decompressed archive */
+    uint64_t    n_points;
+    uint64_t    windows_len;
+} checkpoint_header_t;
+
+struct tar_source
+{
+    int             fd;
+    int             format;
+    uint64_t        span;
+    char            *checkpoint_path;   /* NULL when the checkpoints are not written */
+    pthread_mutex_t lock;
+
+    checkpoint_t    *points;            /* sorted by out */
+    uint32_t        n_points;
+    uint32_t        points_cap;
+    uint8_t         *windows;
+    size_t          windows_len;
+    size_t          windows_cap;
+    uint64_t        frontier;           /* every byte of the archive before it was decoded at least once */
+    int             complete;           /* set once the whole archive was decoded */
+    uint64_t        size;               /* size of the decompressed archive, once complete */
+
+    z_stream        zs;
+    int             raw;                /* set when decoding restarted inside a gzip member */
+    size_t          skip;               /* bytes of a gzip trailer left to skip */
+#ifdef TAR_WITH_ZSTD
+    ZSTD_DStream    *zds;
+#endif
+    int             at_boundary;        /* set when the last output ended a gzip member or a zstd frame */
+    int             state;              /* zero while decoding, 1 at the end of the stream, -1 after an error */
+    uint64_t        in_next;            /* offset in the compressed file of the next byte to read */
+    size_t          in_pos;
+    size_t          in_len;
+    uint64_t        out;                /* offset in the archive of the next byte decoded */
+    uint64_t        ring_start;         /* offset in the archive of the oldest byte of the ring */
+    uint8_t         in[SOURCE_IN_SIZE];
+    uint8_t         ring[SOURCE_RING_SIZE];
+};
+
+static tar_source_t *sources[SOURCE_SLOTS];
+static unsigned     n_sources;
+
+/**
+ * Function returns the source attached to tar_fd, or NULL if there is none.
+*/
+tar_source_t *source_of(int tar_fd) {
+    if (__atomic_load_n(&n_sources, __ATOMIC_ACQUIRE) == 0) return NULL;
+    for (int i = 0; i < SOURCE_SLOTS; i++) {
+        tar_source_t *source = __atomic_load_n(&sources[i], __ATOMIC_ACQUIRE);
+        if (source != NULL && source->fd == tar_fd) return source;
+    }
+    return NULL;
+}
+
+/**
+ * Function reads exactly len bytes of fd at offset into dest.
+ * Returns zero on success, -1 otherwise.
+*/
+static int read_exact(int fd, void *dest, size_t len, uint64_t offset) {
+    uint8_t *bytes = dest;
+    while (len > 0) {
+        ssize_t n_read = pread(fd, bytes, len, (off_t) offset);
+        if (n_read < 0 && errno == EINTR) continue;
+        if (n_read <= 0) return -1;
+        bytes   += n_read;
+        offset  += n_read;
+        len     -= n_read;
+    }
+    return 0;
+}
+
+/**
+ * Function makes sure the input buffer of the decoder holds unread compressed bytes.
+ * Returns 1 if it does, zero at the end of the file, -1 on error.
+*/
+static int fill_input(tar_source_t *source) {
+    if (source->in_pos < source->in_len) return 1;
+
+    ssize_t n_read;
+    do n_read = pread(source->fd, source->in, sizeof(source->in), (off_t) source->in_next);
+    while (n_read < 0 && errno == EINTR);
+    if (n_read < 0) return -1;
+
+    source->in_pos      = 0;
+    source->in_len      = n_read;
+    source->in_next    += n_read;
+    return n_read > 0;
+}
+
+/**
+ * Function returns the offset in the compressed file of the next byte the decoder consumes.
+*/
+static inline uint64_t consumed(const tar_source_t *source) {
+    return source->in_next - (source->in_len - source->in_pos);
+}
+
+/**
+ * Function runs the gzip decoder once, up to the end of the ring or of the current deflate block.
+ * Returns 1 on progress, zero at the end of the stream, -1 if the stream is invalid or truncated.
+*/
+static int gzip_step(tar_source_t *source) {
+    int ret = fill_input(source);
+    if (ret <= 0) return ret == 0 && source->at_boundary ? 0 : -1;
+
+    if (source->skip > 0) {
+        size_t n = source->in_len - source->in_pos < source->skip ? source->in_len - source->in_pos : source->skip;
+        source->in_pos  += n;
+        source->skip    -= n;
+        return 1;
+    }
+
+    size_t pos = source->out % SOURCE_RING_SIZE;
+    source->zs.next_in      = source->in + source->in_pos;
+    source->zs.avail_in     = source->in_len - source->in_pos;
+    source->zs.next_out     = source->ring + pos;
+    source->zs.avail_out    = SOURCE_RING_SIZE - pos;
+    ret = inflate(&source->zs, Z_BLOCK);
+
+    size_t n_consumed = (source->in_len - source->in_pos) - source->zs.avail_in;
+    source->in_pos  += n_consumed;
+    source->out     += (SOURCE_RING_SIZE - pos) - source->zs.avail_out;
+
+    if (ret == Z_STREAM_END) {
+        // another member may follow, its header is only parsed by a gzip decoder
+        if (source->raw) {
+            source->skip    = GZIP_TRAILER;
+            source->raw     = 0;
+            inflateReset2(&source->zs, 15 + 16);
+        } else {
+            inflateReset(&source->zs);
+        }
+        source->at_boundary = 1;
+        return 1;
+    }
+    // garbage after the last member, like the zeros some tools pad with, ends the archive
+    if (ret != Z_OK) return source->at_boundary ? 0 : -1;
+    if (n_consumed > 0) source->at_boundary = 0;
+    return 1;
+}
+
+#ifdef TAR_WITH_ZSTD
+/**
+ * Function runs the zstd decoder once, up to the end of the ring.
+ * Returns 1 on progress, zero at the end of the stream, -1 if the stream is invalid or truncated.
+*/
+static int zstd_step(tar_source_t *source) {
+    int ret = fill_input(source);
+    if (ret <= 0) return ret == 0 && source->at_boundary ? 0 : -1;
+
+    size_t          pos     = source->out % SOURCE_RING_SIZE;
+    ZSTD_inBuffer   input   = {source->in, source->in_len, source->in_pos};
+    ZSTD_outBuffer  output  = {source->ring, SOURCE_RING_SIZE, pos};
+    size_t          hint    = ZSTD_decompressStream(source->zds, &output, &input);
+    if (ZSTD_isError(hint)) return source->at_boundary ? 0 : -1;
+
+    source->in_pos      = input.pos;
+    source->out        += output.pos - pos;
+    source->at_boundary = hint == 0;
+    return 1;
+}
+#endif
+
+/**
+ * Function records a checkpoint at the current position of the decoder when it is at a boundary it can
+ * restart from, at least span bytes past the previous checkpoint.
+ * Checkpoints only save decoding work, one which cannot be allocated is skipped.
+*/
+static void maybe_checkpoint(tar_source_t *source) {
+    uint64_t last = source->n_points > 0 ? source->points[source->n_points - 1].out : 0;
+    if (source->out - last < source->span) return;
+
+    checkpoint_t point = {consumed(source), source->out, source->windows_len, 0, 0};
+    if (source->format == TAR_FORMAT_GZIP) {
+        int type = source->zs.data_type;
+        if (source->skip > 0 || !(type & 128) || (type & 64) || source->out - source->ring_start < GZIP_WINDOW) return;
+
+        // the window ends at the current position of the ring, which it may wrap around
+        uint8_t window[GZIP_WINDOW];
+        size_t  end     = source->out % SOURCE_RING_SIZE;
+        size_t  tail    = end < GZIP_WINDOW ? GZIP_WINDOW - end : 0;
+        memcpy(window, source->ring + SOURCE_RING_SIZE - tail, tail);
+        memcpy(window + tail, source->ring + end - (GZIP_WINDOW - tail), GZIP_WINDOW - tail);
+
+        uLongf bound = compressBound(GZIP_WINDOW);
+        if (source->windows_len + bound > source->windows_cap) {
+            size_t  cap         = source->windows_cap > 0 ? source->windows_cap * 2 : 64 * bound;
+            uint8_t *windows    = realloc(source->windows, cap);
+            if (windows == NULL) return;
+            source->windows     = windows;
+            source->windows_cap = cap;
+        }
+        if (compress2(source->windows + source->windows_len, &bound, window, GZIP_WINDOW, Z_BEST_SPEED) != Z_OK) return;
+        point.window_len    = bound;
+        point.bits          = type & 7;
+    } else if (!source->at_boundary) {
+        return;
+    }
+
+    if (source->n_points == source->points_cap) {
+        uint32_t        cap     = source->points_cap > 0 ? source->points_cap * 2 : 64;
+        checkpoint_t    *points = realloc(source->points, cap * sizeof(checkpoint_t));
+        if (points == NULL) return;
+        source->points      = points;
+        source->points_cap  = cap;
+    }
+    source->points[source->n_points++]  = point;
+    source->windows_len                += point.window_len;
+}
+
+/**
+ * Function writes the checkpoints of a completely decoded archive to the checkpoint file of the source.
+ * A file which cannot be written only costs the next attach its random access.
+*/
+static void save_checkpoints(const tar_source_t *source) {
+    struct stat st;
+    if (fstat(source->fd, &st) < 0) return;
+
+    checkpoint_header_t header = {0};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version              = CHECKPOINT_VERSION;
+    header.format               = source->format;
+    header.archive_size         = st.st_size;
+    header.archive_mtime_sec    = st.st_mtim.tv_sec;
+    header.archive_mtime_nsec   = st.st_mtim.tv_nsec;
+    header.size                 = source->size;
+    header.n_points             = source->n_points;
+    header.windows_len          = source->windows_len;
+
+    char tmp_path[TAR_PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", source->checkpoint_path) >= (int) sizeof(tmp_path)) return;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+
+    int ret = write_all(fd, &header, sizeof(header));
+    if (ret == 0) ret = write_all(fd, source->points, source->n_points * sizeof(checkpoint_t));
+    if (ret == 0) ret = write_all(fd, source->windows, source->windows_len);
+    if (close(fd) < 0) ret = -1;
+    if (ret == 0 && rename(tmp_path, source->checkpoint_path) < 0) ret = -1;
+    if (ret < 0) unlink(tmp_path);
+}
+
+/**
+ * Function loads the checkpoints of the source from its checkpoint file, if it was written for the
+ * compressed file as it is now.
+ * Returns zero if they were loaded, -1 otherwise.
+*/
+static int load_checkpoints(tar_source_t *source) {
+    struct stat archive_st;
+    if (fstat(source->fd, &archive_st) < 0) return -1;
+    int fd = open(source->checkpoint_path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    checkpoint_header_t header;
+    int ret = read_exact(fd, &header, sizeof(header), 0);
+    if (ret == 0 && (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+                     || header.version              != CHECKPOINT_VERSION
+                     || header.format               != (uint32_t) source->format
+                     || header.archive_size         != (uint64_t) archive_st.st_size
+                     || header.archive_mtime_sec    != archive_st.st_mtim.tv_sec
+                     || header.archive_mtime_nsec   != archive_st.st_mtim.tv_nsec
+                     || header.n_points             >  UINT32_MAX
+                     || header.windows_len          >  (uint64_t) archive_st.st_size * 2 + (1 << 20))) ret = -1;
+
+    checkpoint_t    *points     = NULL;
+    uint8_t         *windows    = NULL;
+    if (ret == 0) {
+        points  = malloc(header.n_points * sizeof(checkpoint_t) + 1);
+        windows = malloc(header.windows_len + 1);
+        if (points == NULL || windows == NULL) ret = -1;
+    }
+    if (ret == 0) ret = read_exact(fd, points, header.n_points * sizeof(checkpoint_t), sizeof(header));
+    if (ret == 0) ret = read_exact(fd, windows, header.windows_len, sizeof(header) + header.n_points * sizeof(checkpoint_t));
+    for (uint64_t i = 0; ret == 0 && i < header.n_points; i++) {
+        if (points[i].window + points[i].window_len > header.windows_len || points[i].out > header.size
+            || (i > 0 && points[i].out <= points[i - 1].out)) ret = -1;
+    }
+    close(fd);
+    if (ret < 0) {
+        free(points);
+        free(windows);
+        return -1;
+    }
+
+    source->points      = points;
+    source->n_points    = header.n_points;
+    source->points_cap  = header.n_points;
+    source->windows     = windows;
+    source->windows_len = header.windows_len;
+    source->windows_cap = header.windows_len;
+    source->size        = header.size;
+    source->frontier    = header.size;
+    source->complete    = 1;
+    return 0;
+}
+
+/**
+ * Function restarts the decoder at a checkpoint, or at the start of the stream when point is NULL.
+ * Returns zero on success, -1 otherwise.
+*/
+static int restart(tar_source_t *source, const checkpoint_t *point) {
+    source->in_next     = point != NULL ? point->in : 0;
+    source->in_pos      = 0;
+    source->in_len      = 0;
+    source->out         = point != NULL ? point->out : 0;
+    source->ring_start  = source->out;
+    source->skip        = 0;
+    source->state       = 0;
+    source->at_boundary = point == NULL || point->window_len == 0;
+
+#ifdef TAR_WITH_ZSTD
+    if (source->format == TAR_FORMAT_ZSTD) {
+        return ZSTD_isError(ZSTD_DCtx_reset(source->zds, ZSTD_reset_session_only)) ? -1 : 0;
+    }
+#endif
+    source->raw = point != NULL;
+    if (point == NULL) return inflateReset2(&source->zs, 15 + 16) == Z_OK ? 0 : -1;
+
+    uint8_t window[GZIP_WINDOW];
+    uLongf  window_len = GZIP_WINDOW;
+    if (inflateReset2(&source->zs, -15) != Z_OK) return -1;
+    if (uncompress(window, &window_len, source->windows + point->window, point->window_len) != Z_OK) return -1;
+    if (point->bits > 0) {
+        uint8_t byte;
+        if (read_exact(source->fd, &byte, 1, point->in - 1) < 0) return -1;
+        inflatePrime(&source->zs, point->bits, byte >> (8 - point->bits));
+    }
+    return inflateSetDictionary(&source->zs, window, window_len) == Z_OK ? 0 : -1;
+}
+
+/**
+ * Function returns the last checkpoint at or before offset, or NULL if there is none.
+*/
+static const checkpoint_t *find_checkpoint(const tar_source_t *source, uint64_t offset) {
+    uint32_t low = 0, high = source->n_points;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (source->points[mid].out <= offset) low = mid + 1;
+        else high = mid;
+    }
+    return low > 0 ? &source->points[low - 1] : NULL;
+}
+
+/**
+ * Function reads up to len bytes of the decompressed archive at offset into dest, see INFO 2 and 3.
+ * Returns the number of bytes read, zero past the end of the archive, -1 with errno set on error.
+*/
+static ssize_t source_read(tar_source_t *source, uint8_t *dest, size_t len, uint64_t offset) {
+    pthread_mutex_lock(&source->lock);
+
+    // restart from the closest checkpoint, unless the decoder already is closer
+    const checkpoint_t  *point  = find_checkpoint(source, offset);
+    int                 ret     = 0;
+    if (source->state < 0 || offset < source->ring_start || source->out < (point != NULL ? point->out : 0)) {
+        ret = restart(source, point);
+    }
+
+    size_t done = 0;
+    while (ret == 0 && done < len) {
+        uint64_t pos = offset + done;
+        if (pos < source->out) {
+            size_t ring_pos = pos % SOURCE_RING_SIZE;
+            size_t n        = source->out - pos < len - done ? source->out - pos : len - done;
+            if (n > SOURCE_RING_SIZE - ring_pos) n = SOURCE_RING_SIZE - ring_pos;
+            memcpy(dest + done, source->ring + ring_pos, n);
+            done += n;
+            continue;
+        }
+        if (source->state > 0) break;
+
+#ifdef TAR_WITH_ZSTD
+        int step = source->format == TAR_FORMAT_ZSTD ? zstd_step(source) : gzip_step(source);
+#else
+        int step = gzip_step(source);
+#endif
+        if (step < 0) {
+            source->state   = -1;
+            ret             = -1;
+            break;
+        }
+        if (step == 0) {
+            source->state = 1;
+            if (!source->complete) {
+                source->complete    = 1;
+                source->size        = source->out;
+                if (source->checkpoint_path != NULL) save_checkpoints(source);
+            }
+            break;
+        }
+        if (source->out - source->ring_start > SOURCE_RING_SIZE) source->ring_start = source->out - SOURCE_RING_SIZE;
+        if (!source->complete && source->out >= source->frontier) {
+            source->frontier = source->out;
+            maybe_checkpoint(source);
+        }
+    }
+
+    pthread_mutex_unlock(&source->lock);
+    if (ret < 0 && done == 0) {
+        errno = EIO;
+        return -1;
+    }
+    return done;
+}
+
+/**
+ * Function reads like pread() from the archive of tar_fd, decompressing it when a source is attached to it.
+*/
+ssize_t archive_pread(int tar_fd, void *dest, size_t len, uint64_t offset) {
+    tar_source_t *source = source_of(tar_fd);
+    ssize_t n_read = source == NULL ? pread(tar_fd, dest, len, (off_t) offset) : source_read(source, dest, len, offset);
+    STAT_READ(offset, n_read);
+    return n_read;
+}
+
+/**
+ * Function releases a source, which is not attached anymore.
+*/
+static void source_free(tar_source_t *source) {
+    if (source->format == TAR_FORMAT_GZIP) inflateEnd(&source->zs);
+#ifdef TAR_WITH_ZSTD
+    if (source->zds != NULL) ZSTD_freeDStream(source->zds);
+#endif
+    pthread_mutex_destroy(&source->lock);
+    free(source->checkpoint_path);
+    free(source->points);
+    free(source->windows);
+    free(source);
+}
+
+/**
+ * Attaches a decompressing source to the descriptor of a compressed archive.
+ */
+int tar_source_attach(int tar_fd, const char *checkpoint_path, size_t span) {
+    uint8_t magic[4] = {0};
+    if (pread(tar_fd, magic, sizeof(magic), 0) < 0) return -5;
+
+    int format = TAR_FORMAT_RAW;
+    if (magic[0] == 0x1f && magic[1] == 0x8b)                                             format = TAR_FORMAT_GZIP;
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)    format = TAR_FORMAT_ZSTD;
+    if (format == TAR_FORMAT_RAW) return format;
+#ifndef TAR_WITH_ZSTD
+    if (format == TAR_FORMAT_ZSTD) return -1;
+#endif
+    if (source_of(tar_fd) != NULL) return -1;
+
+    tar_source_t *source = calloc(1, sizeof(tar_source_t));
+    if (source == NULL) return -4;
+    source->fd          = tar_fd;
+    source->format      = format;
+    source->span        = span == 0 ? TAR_CHECKPOINT_SPAN : span < SOURCE_MIN_SPAN ? SOURCE_MIN_SPAN : span;
+    source->at_boundary = 1;
+    pthread_mutex_init(&source->lock, NULL);
+
+    int ret = 0;
+    if (format == TAR_FORMAT_GZIP && inflateInit2(&source->zs, 15 + 16) != Z_OK) {
+        free(source);
+        return -4;
+    }
+#ifdef TAR_WITH_ZSTD
+    if (format == TAR_FORMAT_ZSTD && (source->zds = ZSTD_createDStream()) == NULL) ret = -4;
+#endif
+    if (ret == 0 && checkpoint_path != NULL && (source->checkpoint_path = strdup(checkpoint_path)) == NULL) ret = -4;
+    if (ret == 0 && source->checkpoint_path != NULL) load_checkpoints(source);
+
+    // claim a free slot
+    for (int i = 0; ret == 0; i++) {
+        if (i == SOURCE_SLOTS) {
+            ret = -1;
+            break;
+        }
+        tar_source_t *expected = NULL;
+        if (__atomic_compare_exchange_n(&sources[i], &expected, source, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) break;
+    }
+    if (ret < 0) {
+        source_free(source);
+        return ret;
+    }
+    __atomic_fetch_add(&n_sources, 1, __ATOMIC_RELEASE);
+    return format;
+}
+
+/**
+ * Detaches the source attached to the descriptor of a compressed archive.
+ */
+void tar_source_detach(int tar_fd) {
+    for (int i = 0; i < SOURCE_SLOTS; i++) {
+        tar_source_t *source = __atomic_load_n(&sources[i], __ATOMIC_ACQUIRE);
+        if (source == NULL || source->fd != tar_fd) continue;
+
+        __atomic_store_n(&sources[i], NULL, __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&n_sources, 1, __ATOMIC_RELEASE);
+        source_free(source);
+        return;
+    }
+}
+
+/**
+ * Gets the size of the decompressed archive and the number of checkpoints of a source.
+ */
+int tar_source_info(int tar_fd, uint64_t *size, uint32_t *n_checkpoints) {
+    tar_source_t *source = source_of(tar_fd);
+    if (source == NULL) return -1;
+
+    pthread_mutex_lock(&source->lock);
+    *size           = source->complete ? source->size : 0;
+    *n_checkpoints  = source->n_points;
+    int complete    = source->complete;
+    pthread_mutex_unlock(&source->lock);
+    return complete;
+}
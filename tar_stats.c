@@ -0,0 +1,90 @@
+#include <time.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: counting without passing a handle around
+ * The scanner, the reads of the archive and the cache only know the
+ * descriptor of the archive, which several handles may share. A function
+ * taking a handle opens a scope instead, see STATS_ENTER(): the scope is
+ * made current for the calling thread, and the code it runs adds to the
+ * counters of the handle of the current scope, if any, with relaxed atomic
+ * additions so that the threads sharing a handle never wait for each other.
+ * Work done by other threads, like the workers of tar_extract(), is not
+ * counted.
+*/
+
+/**
+ * INFO 2: compiling the counters out
+ * Built with TAR_NO_STATS (make NO_STATS=1), the STAT_* and STATS_* macros
+ * expand to nothing, so neither the scopes nor the counters cost anything,
+ * and tar_get_stats() reports zeros.
+*/
+
+#ifndef TAR_NO_STATS
+
+__thread stats_scope_t *current_scope = NULL;
+
+/**
+ * Function returns the current time of the monotonic clock, in nanoseconds.
+*/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Function opens a scope counting into the statistics of archive, see INFO 1.
+*/
+void stats_enter(stats_scope_t *scope, const tar_archive_t *archive) {
+    // the counters of a handle only ever change through atomic additions
+    scope->stats        = (tar_stats_t *) &archive->stats;
+    scope->previous     = current_scope;
+    scope->next_offset  = 0;
+    scope->start        = now_ns();
+    current_scope       = scope;
+}
+
+/**
+ * Function closes a scope, adding its duration to the latency histogram of api, one of the TAR_API_* values.
+*/
+void stats_leave(stats_scope_t *scope, int api) {
+    uint64_t    elapsed = now_ns() - scope->start;
+    unsigned    bucket  = elapsed > 0 ? 64 - __builtin_clzll(elapsed) : 0;
+    if (bucket >= TAR_LATENCY_BUCKETS) bucket = TAR_LATENCY_BUCKETS - 1;
+    __atomic_fetch_add(&scope->stats->latency[api][bucket], 1, __ATOMIC_RELAXED);
+    current_scope = scope->previous;
+}
+
+/**
+ * Function counts a read of the archive of n_read bytes at offset, see archive_pread().
+*/
+void stats_read(uint64_t offset, ssize_t n_read) {
+    stats_scope_t *scope = current_scope;
+    __atomic_fetch_add(&scope->stats->syscalls, 1, __ATOMIC_RELAXED);
+    if (offset != scope->next_offset) __atomic_fetch_add(&scope->stats->seeks, 1, __ATOMIC_RELAXED);
+    if (n_read <= 0) return;
+    __atomic_fetch_add(&scope->stats->bytes_read, (uint64_t) n_read, __ATOMIC_RELAXED);
+    scope->next_offset = offset + n_read;
+}
+
+#endif
+
+/**
+ * Copies the counters of a handle.
+ */
+int tar_get_stats(const tar_archive_t *archive, tar_stats_t *stats) {
+    memset(stats, 0, sizeof(tar_stats_t));
+#ifdef TAR_NO_STATS
+    (void) archive;
+    return -1;
+#else
+    // a snapshot counter by counter, each of them being read atomically
+    const uint64_t  *from   = (const uint64_t *) &archive->stats;
+    uint64_t        *to     = (uint64_t *) stats;
+    for (size_t i = 0; i < sizeof(tar_stats_t) / sizeof(uint64_t); i++) to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    return 0;
+#endif
+}
@@ -0,0 +1,352 @@
+#include <pthread.h>
+#include <errno.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: strictly forward reads
+ * A pipe or a socket can neither be positioned nor read with pread(), so a
+ * stream is consumed with read() only, in order. Data which is not wanted is
+ * skipped by consuming it from the buffers like any other data, and headers
+ * are only ever looked at once.
+*/
+
+/**
+ * INFO 2: double buffering
+ * A stream owns two buffers. A reader thread fills one of them while the
+ * other is consumed, so that parsing headers and processing data overlap with
+ * waiting for the input. Every buffer but the last one is filled completely,
+ * and its size is a multiple of BLOCKSIZE, so a header never straddles two
+ * buffers and is always handed out in place. When the thread cannot be
+ * started, the buffers are filled by the consumer when it needs them.
+*/
+
+/* Size of each of the two buffers of a stream, a multiple of BLOCKSIZE */
+#ifndef TAR_STREAM_BUFFER_SIZE
+#define TAR_STREAM_BUFFER_SIZE (1 << 20)
+#endif
+
+struct tar_stream
+{
+    int             fd;
+    uint8_t         *buffers[2];
+    size_t          lens[2];            /* number of bytes read into each buffer */
+    int             full[2];            /* set when a buffer was filled and is not consumed yet */
+    int             last;               /* set once the buffer ending the stream was filled */
+    int             error;              /* set when a read failed */
+
+    pthread_t       thread;
+    int             threaded;
+    int             stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    unsigned        current;            /* buffer being consumed */
+    int             taken;              /* set once the consumer took a first buffer */
+    size_t          len;                /* number of bytes in the current buffer */
+    size_t          pos;                /* position of the next byte to consume in the current buffer */
+    uint64_t        offset;             /* offset in the stream of the next byte to consume */
+    unsigned        n_extensions;       /* extended headers consumed by stream_next_header() */
+};
+
+/**
+ * Function reads into buffer until it is full or the stream ends.
+ * Returns the number of bytes read, and sets error if a read failed.
+*/
+static size_t fill(int fd, uint8_t *buffer, int *error) {
+    size_t len = 0;
+    while (len < TAR_STREAM_BUFFER_SIZE) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ssize_t n_read = read(fd, buffer + len, TAR_STREAM_BUFFER_SIZE - len);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (n_read < 0 && errno == EINTR) continue;
+        if (n_read < 0) *error = 1;
+        if (n_read <= 0) break;
+        len += n_read;
+    }
+    return len;
+}
+
+/**
+ * Function runs the reader thread of a stream: fills each buffer in turn, as soon as it was consumed.
+ * Cancellation is only enabled during read(), which may block forever on a stream closed early.
+*/
+static void *reader_thread(void *arg) {
+    tar_stream_t    *stream = arg;
+    unsigned        buffer  = 0;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    while (1) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->full[buffer] && !stream->stopping) pthread_cond_wait(&stream->cond, &stream->lock);
+        int stopping = stream->stopping;
+        pthread_mutex_unlock(&stream->lock);
+        if (stopping) break;
+
+        int     error   = 0;
+        size_t  len     = fill(stream->fd, stream->buffers[buffer], &error);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->lens[buffer]    = len;
+        stream->full[buffer]    = 1;
+        stream->error           = error;
+        stream->last            = len < TAR_STREAM_BUFFER_SIZE;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        if (len < TAR_STREAM_BUFFER_SIZE) break;
+        buffer ^= 1;
+    }
+    return NULL;
+}
+
+/**
+ * Function starts reading a stream, see INFO 2.
+ * Returns zero on success, -4 if the stream could not be allocated.
+*/
+int stream_open(int fd, tar_stream_t **stream) {
+    tar_stream_t *s = calloc(1, sizeof(tar_stream_t));
+    if (s == NULL) return -4;
+    s->fd           = fd;
+    s->buffers[0]   = malloc(TAR_STREAM_BUFFER_SIZE);
+    s->buffers[1]   = malloc(TAR_STREAM_BUFFER_SIZE);
+    if (s->buffers[0] == NULL || s->buffers[1] == NULL) {
+        free(s->buffers[0]);
+        free(s->buffers[1]);
+        free(s);
+        return -4;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    s->threaded = pthread_create(&s->thread, NULL, reader_thread, s) == 0;
+    *stream = s;
+    return 0;
+}
+
+/**
+ * Function stops reading a stream and releases it.
+*/
+void stream_close(tar_stream_t *stream) {
+    if (stream == NULL) return;
+    if (stream->threaded) {
+        pthread_mutex_lock(&stream->lock);
+        stream->stopping = 1;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        pthread_cancel(stream->thread);
+        pthread_join(stream->thread, NULL);
+    }
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->cond);
+    free(stream->buffers[0]);
+    free(stream->buffers[1]);
+    free(stream);
+}
+
+/**
+ * Function makes sure the current buffer of the stream holds bytes to consume, moving to the next one
+ * when it was entirely consumed.
+ * Returns zero if it does, -1 at the end of the stream.
+*/
+static int next_bytes(tar_stream_t *stream) {
+    if (stream->pos < stream->len) return 0;
+
+    unsigned next = stream->current ^ stream->taken;
+    if (!stream->threaded) {
+        if (stream->taken && stream->last) return -1;
+        stream->len     = fill(stream->fd, stream->buffers[next], &stream->error);
+        stream->last    = stream->len < TAR_STREAM_BUFFER_SIZE;
+    } else {
+        pthread_mutex_lock(&stream->lock);
+        if (stream->taken) {
+            // hand the consumed buffer back to the reader
+            stream->full[stream->current] = 0;
+            pthread_cond_broadcast(&stream->cond);
+        }
+        while (!stream->full[next] && !stream->last) pthread_cond_wait(&stream->cond, &stream->lock);
+        stream->len = stream->full[next] ? stream->lens[next] : 0;
+        pthread_mutex_unlock(&stream->lock);
+    }
+    stream->current = next;
+    stream->taken   = 1;
+    stream->pos     = 0;
+    return stream->len > 0 ? 0 : -1;
+}
+
+/**
+ * Function consumes up to max_len next bytes of the stream, which stay in place: data is set to the
+ * first of them, valid until the next call. Fewer bytes are consumed at the end of a buffer, but a
+ * block at an offset multiple of BLOCKSIZE is always consumed whole, see INFO 2.
+ * Returns the number of bytes consumed, zero at the end of the stream.
+*/
+size_t stream_chunk(tar_stream_t *stream, size_t max_len, const uint8_t **data) {
+    if (max_len == 0 || next_bytes(stream) < 0) return 0;
+
+    size_t available = stream->len - stream->pos;
+    size_t len       = max_len < available ? max_len : available;
+    *data            = stream->buffers[stream->current] + stream->pos;
+    stream->pos     += len;
+    stream->offset  += len;
+    return len;
+}
+
+/**
+ * Function copies up to len next bytes of the stream into dest.
+ * Returns the number of bytes copied, fewer than len only at the end of the stream.
+*/
+size_t stream_read(tar_stream_t *stream, uint8_t *dest, size_t len) {
+    size_t          done = 0;
+    const uint8_t   *data;
+    while (done < len) {
+        size_t n = stream_chunk(stream, len - done, &data);
+        if (n == 0) break;
+        memcpy(dest + done, data, n);
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * Function consumes the len next bytes of the stream without looking at them.
+ * Returns zero on success, -1 if the stream ended before.
+*/
+int stream_skip(tar_stream_t *stream, uint64_t len) {
+    const uint8_t *data;
+    while (len > 0) {
+        size_t n = stream_chunk(stream, len < SIZE_MAX ? (size_t) len : SIZE_MAX, &data);
+        if (n == 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Function returns the offset in the stream of the next byte to consume.
+*/
+uint64_t stream_offset(const tar_stream_t *stream) {
+    return stream->offset;
+}
+
+/**
+ * Function returns whether a read of the stream failed, rather than the stream ending.
+*/
+int stream_failed(tar_stream_t *stream) {
+    pthread_mutex_lock(&stream->lock);
+    int error = stream->error;
+    pthread_mutex_unlock(&stream->lock);
+    return error;
+}
+
+/**
+ * Function consumes the next header of a stream, with the extended headers before it, see tar_header.c,
+ * and decodes it into entry, except for its mode and mtime. An invalid extended header is returned like
+ * any other header so that it fails validation.
+ * Sets header to the header, valid until the stream is consumed further, but the strings of the entry
+ * only point into it for plain ustar headers.
+ * Returns 1 on success, zero at the end of the archive, -5 if the stream ended within an extended header.
+*/
+int stream_next_header(tar_stream_t *stream, tar_ext_t *ext, tar_header_t **header, tar_entry_t *entry) {
+    const uint8_t *block;
+    while (1) {
+        uint64_t header_offset = stream_offset(stream);
+        if (stream_chunk(stream, BLOCKSIZE, &block) < BLOCKSIZE || block[0] == '\0') return 0;
+
+        tar_header_t *h = (tar_header_t *) block;
+        if (!IS_EXTENSION(h->typeflag) || check_header(h) < 0) {
+            header_decode(ext, h, header_offset, entry);
+            *header = h;
+            return 1;
+        }
+
+        // the data of an extended header is copied, the header block may be consumed by reading it
+        stream->n_extensions++;
+        char        typeflag    = h->typeflag;
+        uint64_t    size        = (uint64_t) header_number(h->size, sizeof(h->size));
+        char        *data       = ext_buffer(ext, size);
+        uint64_t    skipped     = BLOCK_ALIGN(size);
+        if (data != NULL) {
+            if (stream_read(stream, (uint8_t *) data, size) < size) return -5;
+            ext_parse(ext, typeflag, data, size);
+            skipped -= size;
+        }
+        if (stream_skip(stream, skipped) < 0) return -5;
+    }
+}
+
+/**
+ * Function implements tar_stream_check(), and check_archive() for a pipe or a socket when extensions is set,
+ * the extended headers then counting in the returned number of headers.
+*/
+int stream_check(int fd, tar_index_t **index, tar_stream_callback_t callback, void *user_data, int extensions) {
+    tar_stream_t    *stream;
+    tar_index_t     *idx = NULL;
+    if (index != NULL && (idx = calloc(1, sizeof(tar_index_t))) == NULL) return -4;
+    if (stream_open(fd, &stream) < 0) {
+        free(idx);
+        return -4;
+    }
+
+    int             ret         = 0;
+    int             n_headers   = 0;
+    tar_ext_t       ext         = {0};
+    tar_header_t    *header;
+    tar_entry_t     entry;
+    char            name[sizeof(header->name) + 1];
+    char            linkname[sizeof(header->linkname) + 1];
+    const uint8_t   *block;
+    while (ret == 0 && (ret = stream_next_header(stream, &ext, &header, &entry)) > 0) {
+        uint64_t size = entry.size;
+        if ((ret = check_header(header)) < 0) break;
+        header_decode_rest(&ext, header, &entry);
+        if (idx != NULL && tar_index_add(idx, &entry) < 0) {
+            ret = -4;
+            break;
+        }
+        n_headers++;
+
+        if (callback != NULL) {
+            // the header is consumed with its data, the entry keeps copies of the strings it points to
+            if (entry.name == header->name) {
+                memcpy(name, header->name, sizeof(header->name));
+                name[sizeof(name) - 1]  = '\0';
+                entry.name              = name;
+            }
+            if (entry.linkname == header->linkname) {
+                memcpy(linkname, header->linkname, sizeof(header->linkname));
+                linkname[sizeof(linkname) - 1]  = '\0';
+                entry.linkname                  = linkname;
+            }
+            callback(&entry, NULL, 0, user_data);
+
+            uint64_t    left = size;
+            size_t      n;
+            while (left > 0 && (n = stream_chunk(stream, left < SIZE_MAX ? (size_t) left : SIZE_MAX, &block)) > 0) {
+                callback(&entry, block, n, user_data);
+                left -= n;
+            }
+            if (left > 0 || stream_skip(stream, BLOCK_ALIGN(size) - size) < 0) ret = -5;
+        } else if (stream_skip(stream, BLOCK_ALIGN(size)) < 0) {
+            ret = -5;
+        }
+    }
+    if (ret == 0 && stream_failed(stream)) ret = -5;
+    if (extensions) n_headers += stream->n_extensions;
+    stream_close(stream);
+    ext_free(&ext);
+
+    if (idx != NULL && ret == 0 && tar_index_finish(idx) < 0) ret = -4;
+    if (ret < 0) {
+        tar_index_free(idx);
+        return ret;
+    }
+    if (idx != NULL) *index = idx;
+    return n_headers;
+}
+
+/**
+ * Validates, and optionally indexes, an archive read strictly forward from a pipe or a socket.
+ */
+int tar_stream_check(int fd, tar_index_t **index, tar_stream_callback_t callback, void *user_data) {
+    return stream_check(fd, index, callback, user_data, 0);
+}
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "lib_tar.h"
+#include "tar_internal.h"
+
+/**
+ * INFO 1: writing an archive
+ * Entries are written one after the other: a header, then the data padded to
+ * a whole number of blocks. Headers and padding go through a buffer of the
+ * writer, while the data of files is copied by the kernel from the file to
+ * the archive with copy_file_range(), or sendfile() when the archive is not
+ * a regular file (a pipe or a socket), and read() and write() as a last
+ * resort.
+*/
+
+/**
+ * INFO 2: adding directories
+ * tar_writer_add_path() walks a directory tree, then builds the headers of
+ * its entries by batches of TAR_WRITER_BATCH, with a pool of threads: each
+ * thread calls lstat() on the next entry of the batch and formats its header.
+ * The entries of a batch are then written in the order of the walk, which
+ * sorts the children of each directory by name so that archives of the same
+ * tree are identical.
+*/
+
+/* Number of entries of a walk whose headers are built at once */
+#ifndef TAR_WRITER_BATCH
+#define TAR_WRITER_BATCH 1024
+#endif
+
+/* Size of the buffer of the headers and padding not written yet */
+#define WRITER_BUFFER_SIZE (64 << 10)
+
+/* Ways of copying the data of a file into the archive, from the fastest one */
+#define COPY_FILE_RANGE 0
+#define COPY_SENDFILE   1
+#define COPY_READ_WRITE 2
+
+struct tar_writer
+{
+    int         fd;
+    int         copy;                               /* fastest way of copying data which worked, a COPY_* value */
+    size_t      buffer_len;
+    uint8_t     buffer[WRITER_BUFFER_SIZE];
+};
+
+typedef struct writer_entry
+{
+    char            *path;          /* path on disk */
+    char            *name;          /* name in the archive */
+    tar_header_t    header;
+    uint64_t        size;           /* bytes of data, for regular files */
+    int             ret;            /* zero if the header was built, -7 if the entry is skipped */
+} writer_entry_t;
+
+/**
+ * Function writes the content of the buffer of the writer to the archive.
+ * Returns zero on success, -1 otherwise.
+*/
+static int flush_buffer(tar_writer_t *writer) {
+    size_t done = 0;
+    while (done < writer->buffer_len) {
+        ssize_t n_written = write(writer->fd, writer->buffer + done, writer->buffer_len - done);
+        if (n_written < 0 && errno == EINTR) continue;
+        if (n_written <= 0) return -1;
+        done += n_written;
+    }
+    writer->buffer_len = 0;
+    return 0;
+}
+
+/**
+ * Function appends len bytes of data to the archive, zeros when data is NULL.
+ * Returns zero on success, -1 otherwise.
+*/
+static int write_bytes(tar_writer_t *writer, const void *data, size_t len) {
+    while (len > 0) {
+        if (writer->buffer_len == WRITER_BUFFER_SIZE && flush_buffer(writer) < 0) return -1;
+        size_t n = WRITER_BUFFER_SIZE - writer->buffer_len;
+        if (n > len) n = len;
+        if (data != NULL)   memcpy(writer->buffer + writer->buffer_len, data, n);
+        else                memset(writer->buffer + writer->buffer_len, 0, n);
+        writer->buffer_len += n;
+        len                -= n;
+        if (data != NULL) data = (const uint8_t *) data + n;
+    }
+    return 0;
+}
+
+/**
+ * Function writes name to the name and prefix fields of header, splitting it on a '/' if needed.
+ * Returns zero on success, -8 if it does not fit.
+*/
+static int set_name(tar_header_t *header, const char *name) {
+    size_t len = strlen(name);
+    if (len <= sizeof(header->name)) {
+        memcpy(header->name, name, len);
+        return 0;
+    }
+
+    // the prefix is the part before a '/', the name the part after it
+    for (size_t split = len - sizeof(header->name) - 1; split < len && split <= sizeof(header->prefix); split++) {
+        if (name[split] != '/' || split == 0) continue;
+        memcpy(header->prefix, name, split);
+        memcpy(header->name, name + split + 1, len - split - 1);
+        return 0;
+    }
+    return -8;
+}
+
+/**
+ * Function formats a ustar header.
+ * Returns zero on success, -8 if a field does not fit in the header.
+*/
+static int format_header(tar_header_t *header, const char *name, char typeflag, uint32_t mode, uint64_t size,
+                         int64_t mtime, uint32_t uid, uint32_t gid, const char *linkname) {
+    memset(header, 0, sizeof(tar_header_t));
+    if (set_name(header, name) < 0)                                         return -8;
+    if (linkname != NULL && strlen(linkname) > sizeof(header->linkname))   return -8;
+    if (mtime < 0 || mtime > 077777777777LL)                                return -8;
+
+    snprintf(header->mode,  sizeof(header->mode),  "%07o", mode & 07777);
+    if (uid <= 07777777)            snprintf(header->uid, sizeof(header->uid), "%07o", uid);
+    else                            header_set_base256(header->uid, sizeof(header->uid), uid);
+    if (gid <= 07777777)            snprintf(header->gid, sizeof(header->gid), "%07o", gid);
+    else                            header_set_base256(header->gid, sizeof(header->gid), gid);
+    if (size <= 077777777777ULL)    snprintf(header->size, sizeof(header->size), "%011llo", (unsigned long long) size);
+    else                            header_set_base256(header->size, sizeof(header->size), size);     // past 8 GiB
+    snprintf(header->mtime, sizeof(header->mtime), "%011llo", (unsigned long long) mtime);
+    header->typeflag = typeflag;
+    if (linkname != NULL) memcpy(header->linkname, linkname, strlen(linkname));
+    memcpy(header->magic,   TMAGIC,     TMAGLEN);
+    memcpy(header->version, TVERSION,   TVERSLEN);
+
+    snprintf(header->chksum, sizeof(header->chksum), "%06o", header_checksum(header));
+    header->chksum[7] = ' ';
+    return 0;
+}
+
+/**
+ * Function copies len bytes of in_fd from its start to the archive, see INFO 1. When the file is shorter
+ * than len, the rest is filled with zeros so that the archive stays consistent with the header.
+ * Returns zero on success, -1 otherwise.
+*/
+static int copy_file(tar_writer_t *writer, int in_fd, uint64_t len) {
+    loff_t offset = 0;
+    if (flush_buffer(writer) < 0) return -1;
+
+    while (offset < (loff_t) len) {
+        size_t  left        = len - offset;
+        ssize_t n_copied    = -1;
+        if (writer->copy == COPY_FILE_RANGE) {
+            n_copied = copy_file_range(in_fd, &offset, writer->fd, NULL, left, 0);
+            if (n_copied < 0 && errno != EINTR) writer->copy = COPY_SENDFILE;
+        } else if (writer->copy == COPY_SENDFILE) {
+            n_copied = sendfile(writer->fd, in_fd, &offset, left);
+            if (n_copied < 0 && errno != EINTR) writer->copy = COPY_READ_WRITE;
+        } else {
+            uint8_t buffer[WRITER_BUFFER_SIZE];
+            n_copied = pread(in_fd, buffer, left < sizeof(buffer) ? left : sizeof(buffer), offset);
+            if (n_copied > 0 && write_bytes(writer, buffer, n_copied) < 0)   return -1;
+            if (n_copied > 0 && flush_buffer(writer) < 0)                   return -1;
+            if (n_copied > 0) offset += n_copied;
+            if (n_copied < 0 && errno != EINTR)                             return -1;
+        }
+        if (n_copied == 0) break;                       // the file shrank since its size was read
+    }
+    return write_bytes(writer, NULL, len - offset);
+}
+
+/**
+ * Creates a writer of an archive.
+ */
+int tar_writer_open(int out_fd, tar_writer_t **writer) {
+    tar_writer_t *w = malloc(sizeof(tar_writer_t));
+    if (w == NULL) return -4;
+    w->fd           = out_fd;
+    w->copy         = COPY_FILE_RANGE;
+    w->buffer_len   = 0;
+    *writer = w;
+    return 0;
+}
+
+/**
+ * Creates a writer appending entries to an existing archive.
+ */
+int tar_writer_append(int tar_fd, const tar_index_t *index, tar_writer_t **writer) {
+    uint64_t end = 0;
+    if (source_of(tar_fd) != NULL) return -1;
+    if (index != NULL) {
+        end = index->end_offset;
+    } else {
+        // the end of the archive is past the data of its last entry, which could not be found past an invalid header
+        tar_scanner_t   scanner;
+        tar_header_t    *header;
+        int             ret = 0;
+        scanner_init(&scanner, tar_fd);
+        while (ret == 0 && (header = scanner_next(&scanner)) != NULL) {
+            ret = check_header(header);
+            end = scanner.entry.data_offset + BLOCK_ALIGN(scanner.entry.size);
+        }
+        scanner_free(&scanner);
+        if (ret < 0) return -1;
+    }
+
+    // the new entries overwrite the blocks marking the end of the archive
+    if (lseek(tar_fd, (off_t) end, SEEK_SET) < 0) return -1;
+    return tar_writer_open(tar_fd, writer);
+}
+
+/**
+ * Adds a file to the archive, with its data taken from a buffer.
+ */
+int tar_writer_add_buffer(tar_writer_t *writer, const char *name, const uint8_t *data, size_t len, uint32_t mode, int64_t mtime) {
+    tar_header_t    header;
+    int             ret = format_header(&header, name, REGTYPE, mode, len, mtime, getuid(), getgid(), NULL);
+    if (ret < 0) return ret;
+
+    if (write_bytes(writer, &header, sizeof(header)) < 0)   return -1;
+    if (write_bytes(writer, data, len) < 0)                 return -1;
+    if (write_bytes(writer, NULL, BLOCK_ALIGN(len) - len) < 0) return -1;
+    return 0;
+}
+
+/**
+ * Function builds the header of a walked entry, see INFO 2. Entries which are neither regular files,
+ * directories nor symlinks are skipped.
+*/
+static void build_entry(writer_entry_t *entry) {
+    struct stat st;
+    char        linkname[sizeof(((tar_header_t *) 0)->linkname) + 1];
+    ssize_t     linkname_len    = 0;
+    char        typeflag;
+
+    entry->ret  = -7;
+    entry->size = 0;
+    if (lstat(entry->path, &st) < 0) return;
+
+    if (S_ISREG(st.st_mode))        typeflag = REGTYPE;
+    else if (S_ISDIR(st.st_mode))   typeflag = DIRTYPE;
+    else if (S_ISLNK(st.st_mode))   typeflag = SYMTYPE;
+    else                            return;
+
+    if (typeflag == REGTYPE) entry->size = st.st_size;
+    if (typeflag == SYMTYPE) {
+        linkname_len = readlink(entry->path, linkname, sizeof(linkname));
+        if (linkname_len < 0 || linkname_len == (ssize_t) sizeof(linkname)) return;
+        linkname[linkname_len] = '\0';
+    }
+    if (format_header(&entry->header, entry->name, typeflag, st.st_mode, entry->size, st.st_mtim.tv_sec,
+                      st.st_uid, st.st_gid, typeflag == SYMTYPE ? linkname : NULL) == 0) entry->ret = 0;
+}
+
+typedef struct writer_batch
+{
+    writer_entry_t  *entries;
+    size_t          n_entries;
+    size_t          next;           /* next entry to build, taken atomically */
+} writer_batch_t;
+
+static void *build_thread(void *arg) {
+    writer_batch_t  *batch = arg;
+    size_t          i;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->n_entries) build_entry(&batch->entries[i]);
+    return NULL;
+}
+
+/* Walk of a directory tree, see INFO 2 */
+typedef struct writer_walk
+{
+    writer_entry_t  *entries;
+    size_t          n_entries;
+    size_t          cap;
+    int             skipped;                /* set when an entry is skipped, its path being too long */
+    char            path[TAR_PATH_MAX];     /* path on disk of the entry walked, shared by every level */
+    char            name[TAR_PATH_MAX];     /* its name in the archive */
+} writer_walk_t;
+
+/**
+ * Function appends the entry walked, whose path and name are path_len and name_len bytes long, to the array of a walk.
+ * Returns zero on success, -1 if it could not be allocated.
+*/
+static int add_walked(writer_walk_t *w, size_t path_len, size_t name_len, int is_dir) {
+    if (w->n_entries == w->cap) {
+        size_t          new_cap     = w->cap ? w->cap * 2 : 256;
+        writer_entry_t  *new_entries = realloc(w->entries, new_cap * sizeof(writer_entry_t));
+        if (new_entries == NULL) return -1;
+        w->entries  = new_entries;
+        w->cap      = new_cap;
+    }
+    if (name_len == 0) return 0;                    // the root of the archive itself
+
+    char    *strings    = malloc(path_len + name_len + 3);
+    if (strings == NULL) return -1;
+    memcpy(strings, w->path, path_len + 1);
+    memcpy(strings + path_len + 1, w->name, name_len);
+    strcpy(strings + path_len + 1 + name_len, is_dir && w->name[name_len - 1] != '/' ? "/" : "");
+
+    w->entries[w->n_entries].path = strings;
+    w->entries[w->n_entries].name = strings + path_len + 1;
+    w->n_entries++;
+    return 0;
+}
+
+static int compare_names(const struct dirent **a, const struct dirent **b) {
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/**
+ * Function walks the tree at the path of the walk, path_len bytes long, named by the name_len first bytes of
+ * its name in the archive, appending its entries to its array. The path and name of each child are written
+ * after the ones of its parent, so that a level of the walk costs no buffer of its own.
+ * Returns zero on success, -1 if the array could not be allocated. Directories which cannot be listed
+ * are added without their children, and children whose path does not fit are skipped.
+*/
+static int walk(writer_walk_t *w, size_t path_len, size_t name_len) {
+    struct stat     st;
+    struct dirent   **children;
+    int             is_dir      = lstat(w->path, &st) == 0 && S_ISDIR(st.st_mode);
+    if (add_walked(w, path_len, name_len, is_dir) < 0) return -1;
+    if (!is_dir) return 0;
+
+    int     n_children  = scandir(w->path, &children, NULL, compare_names);
+    int     ret         = 0;
+    size_t  prefix_len  = name_len + (name_len > 0 && w->name[name_len - 1] != '/');     // the name and a '/'
+    w->path[path_len]   = '/';
+    w->name[name_len]   = '/';
+    for (int i = 0; i < n_children; i++) {
+        const char  *child      = children[i]->d_name;
+        size_t      child_len   = strlen(child);
+        if (ret == 0 && strcmp(child, ".") != 0 && strcmp(child, "..") != 0) {
+            if (path_len + 1 + child_len < sizeof(w->path) && prefix_len + child_len < sizeof(w->name)) {
+                memcpy(w->path + path_len + 1, child, child_len + 1);
+                memcpy(w->name + prefix_len, child, child_len + 1);
+                ret = walk(w, path_len + 1 + child_len, prefix_len + child_len);
+            } else {
+                w->skipped = 1;                     // a truncated path would name another file
+            }
+        }
+        free(children[i]);
+    }
+    if (n_children >= 0) free(children);
+    w->path[path_len] = '\0';
+    w->name[name_len] = '\0';
+    return ret;
+}
+
+/**
+ * Function writes a walked entry to the archive.
+ * Returns zero on success, -1 if the archive could not be written, or -7 if the entry was skipped or its data
+ * could not be read, in which case it is written as zeros.
+*/
+static int write_entry(tar_writer_t *writer, const writer_entry_t *entry) {
+    if (entry->ret < 0) return entry->ret;
+    if (write_bytes(writer, &entry->header, sizeof(tar_header_t)) < 0) return -1;
+    if (entry->size == 0) return 0;
+
+    int fd  = open(entry->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    int ret = fd < 0 ? write_bytes(writer, NULL, entry->size) : copy_file(writer, fd, entry->size);
+    if (fd >= 0) close(fd);
+    if (ret < 0) return -1;
+
+    if (write_bytes(writer, NULL, BLOCK_ALIGN(entry->size) - entry->size) < 0) return -1;
+    return fd < 0 ? -7 : 0;
+}
+
+/**
+ * Adds a file, a symlink or a directory tree to the archive.
+ */
+int tar_writer_add_path(tar_writer_t *writer, const char *path, const char *name) {
+    writer_walk_t   *w          = calloc(1, sizeof(writer_walk_t));
+    int             n_added     = 0;
+    int             ret;
+    if (w == NULL) return -4;
+
+    // names in the archive are relative
+    if (name == NULL) name = path;
+    while (name[0] == '/') name++;
+    size_t path_len = strlen(path);
+    size_t name_len = strlen(name);
+    if (path_len < sizeof(w->path) && name_len < sizeof(w->name)) {
+        memcpy(w->path, path, path_len + 1);
+        memcpy(w->name, name, name_len + 1);
+        ret = walk(w, path_len, name_len) < 0 ? -4 : 0;
+    } else {
+        w->skipped  = 1;
+        ret         = 0;
+    }
+    writer_entry_t  *entries    = w->entries;
+    size_t          n_entries   = w->n_entries;
+    int             skipped     = w->skipped;
+    free(w);
+
+    long        n_cpus      = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned    n_threads   = n_cpus > 1 ? (unsigned) n_cpus : 1;
+    for (size_t first = 0; first < n_entries && ret == 0; first += TAR_WRITER_BATCH) {
+        writer_batch_t  batch       = {entries + first, n_entries - first < TAR_WRITER_BATCH ? n_entries - first : TAR_WRITER_BATCH, 0};
+        unsigned        n_started   = 0;
+        pthread_t       threads[n_threads];
+
+        // build the headers of the batch in parallel, then write them in order
+        while (n_started + 1 < n_threads && n_started + 1 < batch.n_entries
+               && pthread_create(&threads[n_started], NULL, build_thread, &batch) == 0) n_started++;
+        build_thread(&batch);
+        for (unsigned i = 0; i < n_started; i++) pthread_join(threads[i], NULL);
+
+        for (size_t i = 0; i < batch.n_entries && ret == 0; i++) {
+            int entry_ret = write_entry(writer, &batch.entries[i]);
+            if (entry_ret == -1)    ret = -1;
+            if (entry_ret == -7)    skipped = 1;
+            if (entry_ret == 0)     n_added++;
+        }
+    }
+
+    for (size_t i = 0; i < n_entries; i++) free(entries[i].path);
+    free(entries);
+    if (ret < 0) return ret;
+    return skipped ? -7 : n_added;
+}
+
+/**
+ * Ends the archive and releases the writer.
+ */
+int tar_writer_close(tar_writer_t *writer) {
+    if (writer == NULL) return 0;
+    int ret = write_bytes(writer, NULL, 2 * BLOCKSIZE);
+    if (ret == 0) ret = flush_buffer(writer);
+    free(writer);
+    return ret;
+}
@@ -2,6 +2,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
 #include "lib_tar.h"
 
@@ -179,6 +181,1052 @@ void test_list() {
     // for (int i = 0; i < no_entries; i++) free(string_array[i]);
 }
 
+void test_index() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_index_t *index;
+    int ret = tar_index_build(fd, &index);
+    printf("tar_index_build returned %d, check_archive returned %d\n", ret, check_archive(fd));
+    if (ret < 0) return;
+
+    char *paths[] = {"lib_tar.c", "folder2/", "folder2", "folder_sym", "folder2/Makefile", "missing"};
+    for (int i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        printf("%-18s exists %d/%d is_dir %d/%d is_file %d/%d is_symlink %d/%d\n", paths[i],
+               tar_index_exists(index, paths[i]),   exists(fd, paths[i]),
+               tar_index_is_dir(index, paths[i]),   is_dir(fd, paths[i]),
+               tar_index_is_file(index, paths[i]),  is_file(fd, paths[i]),
+               tar_index_is_symlink(index, paths[i]), is_symlink(fd, paths[i]));
+    }
+
+    uint8_t buffer[64];
+    size_t  len     = sizeof(buffer);
+    ssize_t left    = tar_index_read_file(fd, index, "folder2/README.md", 10, buffer, &len);
+    printf("tar_index_read_file returned %ld, read %ld bytes\n", left, len);
+
+    char    names[8][100];
+    char    *entries[8];
+    size_t  no_entries = 8;
+    for (int i = 0; i < 8; i++) entries[i] = names[i];
+    printf("tar_index_list returned %d\n", tar_index_list(index, "folder_sym/", entries, &no_entries));
+    for (int i = 0; i < no_entries; i++) printf("%s\n", entries[i]);
+
+    // the symlinked directories leading to a path are followed the same with and without the index
+    char *through[] = {"folder_sym/lib_tar.c", "folder_sym/folder1/", "folder_sym/folder1", "folder_sym/missing"};
+    for (int i = 0; i < sizeof(through) / sizeof(through[0]); i++) {
+        size_t  index_len   = sizeof(buffer), scan_len = sizeof(buffer), index_no = 8, scan_no = 8;
+        ssize_t index_ret   = tar_index_read_file(fd, index, through[i], 0, buffer, &index_len);
+        ssize_t scan_ret    = read_file(fd, through[i], 0, buffer, &scan_len);
+        int     index_list  = tar_index_list(index, through[i], entries, &index_no);
+        int     scan_list   = list(fd, through[i], entries, &scan_no);
+        printf("%-20s read_file %ld/%ld len %zu/%zu list %d/%d entries %zu/%zu\n", through[i],
+               index_ret, scan_ret, index_len, scan_len, index_list, scan_list, index_no, scan_no);
+    }
+
+    tar_index_free(index);
+    printf("\n");
+}
+
+void test_index_shadowed() {
+    char            path[]  = "/tmp/lib_tar_shadowed_XXXXXX";
+    char            link[]  = "/tmp/lib_tar_shadowed_link_XXXXXX";
+    int             fd      = mkstemp(path);
+    tar_writer_t    *writer;
+    tar_index_t     *index;
+    if (fd == -1 || mkstemp(link) == -1) {
+        perror("mkstemp");
+        return;
+    }
+    unlink(path);
+    unlink(link);
+
+    // a symlink d, then a literal d/f: the entry at the path comes first, with and without the index
+    tar_writer_open(fd, &writer);
+    if (symlink("e", link) == 0) tar_writer_add_path(writer, link, "d");
+    unlink(link);
+    tar_writer_add_buffer(writer, "e/f", (const uint8_t *) "linked\n", 7, 0644, 1671043200);
+    tar_writer_add_buffer(writer, "d/f", (const uint8_t *) "literal\n", 8, 0644, 1671043200);
+    tar_writer_close(writer);
+
+    uint8_t index_buffer[16], scan_buffer[16];
+    size_t  index_len   = sizeof(index_buffer), scan_len = sizeof(scan_buffer);
+    tar_index_build(fd, &index);
+    ssize_t index_ret   = tar_index_read_file(fd, index, "d/f", 0, index_buffer, &index_len);
+    ssize_t scan_ret    = read_file(fd, "d/f", 0, scan_buffer, &scan_len);
+    printf("d/f behind symlink d: read_file %ld/%ld, %.*s/%.*s", index_ret, scan_ret,
+           (int) index_len - 1, index_buffer, (int) scan_len, scan_buffer);
+    tar_index_free(index);
+    close(fd);
+    printf("\n");
+}
+
+void test_mmap() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_mmap_t *archive;
+    int ret = tar_open_mmap(fd, &archive);
+    close(fd);
+    printf("tar_open_mmap returned %d\n", ret);
+    if (ret < 0) return;
+
+    tar_mmap_advise(archive, TAR_ADVICE_RANDOM);
+
+    const uint8_t   *data;
+    size_t          len;
+    ret = tar_file_view(archive, "folder2/README.md", &data, &len);
+    printf("tar_file_view returned %d, %ld bytes\n", ret, len);
+    if (ret == 0) debug_dump(data, len);
+
+    tar_close_mmap(archive);
+    printf("\n");
+}
+
+void test_list_page() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    char    names[3][100];
+    char    *entries[3];
+    for (int i = 0; i < 3; i++) entries[i] = names[i];
+
+    for (int flags = 0; flags <= TAR_OPEN_INDEX; flags += TAR_OPEN_INDEX) {
+        tar_archive_t *archive;
+        if (tar_open(fd, flags, &archive) < 0) return;
+
+        // list the root, three entries at a time
+        size_t  cursor  = 0;
+        int     ret;
+        do {
+            size_t no_entries = 3;
+            ret = tar_list_page(archive, "", &cursor, entries, &no_entries);
+            printf("%s tar_list_page returned %d, cursor %ld:", flags ? "indexed" : "scanned", ret, cursor);
+            for (int i = 0; i < no_entries; i++) printf(" %s", entries[i]);
+            printf("\n");
+        } while (ret == 2);
+        tar_close(archive);
+    }
+    printf("\n");
+}
+
+void test_sidecar() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_index_t *index;
+    char        sidecar[] = "/tmp/archive.tar.idx";
+    unlink(sidecar);
+    printf("tar_index_load returned %d before the sidecar is written\n", tar_index_load(fd, sidecar, &index));
+    printf("tar_index_open returned %d\n", tar_index_open(fd, sidecar, &index));
+    tar_index_free(index);
+
+    int ret = tar_index_load(fd, sidecar, &index);
+    printf("tar_index_load returned %d\n", ret);
+    if (ret >= 0) {
+        uint8_t buffer[64];
+        size_t  len = sizeof(buffer);
+        printf("loaded index: is_dir(folder2/) %d, tar_index_read_file(folder_sym/README.md) %ld\n",
+               tar_index_is_dir(index, "folder2/"), tar_index_read_file(fd, index, "folder_sym/README.md", 0, buffer, &len));
+        tar_index_free(index);
+    }
+
+    // a damaged sidecar is rejected, not followed
+    struct stat st;
+    int         sidecar_fd = open(sidecar, O_WRONLY);
+    if (sidecar_fd >= 0 && fstat(sidecar_fd, &st) == 0) {
+        uint8_t garbage[4096];
+        size_t  len = st.st_size - st.st_size / 2;
+        memset(garbage, 0xff, sizeof(garbage));
+        if (pwrite(sidecar_fd, garbage, len < sizeof(garbage) ? len : sizeof(garbage), st.st_size / 2) < 0) perror("pwrite");
+        close(sidecar_fd);
+        printf("tar_index_load returned %d for a damaged sidecar\n", tar_index_load(fd, sidecar, &index));
+    }
+    unlink(sidecar);
+    printf("\n");
+}
+
+void test_cache() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    // page through a file in chunks smaller than a block, twice, and compare with an uncached read
+    tar_archive_t   *archive;
+    uint8_t         expected[16384];
+    uint8_t         actual[16384];
+    size_t          expected_len    = sizeof(expected);
+    int             mismatches      = 0;
+    tar_open(fd, 0, &archive);
+    tar_read_file(archive, "folder2/lib_tar.c", 0, expected, &expected_len);
+    tar_enable_cache(archive, 64 << 10);
+
+    for (int round = 0; round < 2; round++) {
+        for (size_t offset = 0; offset < expected_len; offset += 700) {
+            size_t len = 700;
+            tar_read_file(archive, "folder2/lib_tar.c", offset, actual + offset, &len);
+        }
+        mismatches += memcmp(expected, actual, expected_len) != 0;
+    }
+
+    tar_cache_stats_t stats;
+    tar_cache_stats(archive, &stats);
+    printf("cached reads of %zu bytes: %d mismatches, %lu block hits, %lu block misses, %lu lookup hits, %lu lookup misses\n",
+           expected_len, mismatches, stats.hits, stats.misses, stats.lookup_hits, stats.lookup_misses);
+    tar_close(archive);
+    printf("\n");
+}
+
+void test_read_many() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_archive_t       *archive;
+    uint8_t             buffers[5][64];
+    tar_read_request_t  requests[5] = {
+        {"folder2/lib_tar.c",       100,    buffers[0], 64},
+        {"folder2/README.md",       0,      buffers[1], 64},
+        {"folder_sym/README.md",    80,     buffers[2], 64},
+        {"folder2/missing",         0,      buffers[3], 64},
+        {"lib_tar.h",               7000,   buffers[4], 64},
+    };
+    tar_open(fd, 0, &archive);
+    printf("tar_read_many returned %d\n", tar_read_many(archive, requests, 5));
+    for (int i = 0; i < 5; i++) {
+        uint8_t expected[64];
+        size_t  len = 64;
+        ssize_t ret = read_file(fd, (char *) requests[i].path, requests[i].offset, expected, &len);
+        // read_file() leaves len alone when it fails, tar_read_many() sets it to zero
+        int     same = requests[i].ret == ret && (ret < 0 ? requests[i].len == 0 : requests[i].len == len && memcmp(expected, requests[i].dest, len) == 0);
+        printf("%s: ret %ld len %zu, read_file ret %ld len %zu, %s\n", requests[i].path, requests[i].ret, requests[i].len,
+               ret, len, same ? "same result" : "different result");
+    }
+    tar_close(archive);
+    printf("\n");
+}
+
+static void count_completion(tar_read_request_t *request, void *user_data) {
+    (*(int *) user_data)++;
+}
+
+void test_aio() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_archive_t *archive;
+    tar_open(fd, TAR_OPEN_INDEX, &archive);
+    for (int flags = 0; flags <= TAR_AIO_THREADS; flags += TAR_AIO_THREADS) {
+        // more reads than the queue depth, so that submitting waits for completions
+        uint8_t             buffers[8][256];
+        tar_read_request_t  requests[8];
+        const char          *paths[] = {"folder2/lib_tar.c", "folder_sym/Makefile", "folder2/missing", "lib_tar.h"};
+        tar_aio_t           *aio;
+        int                 n_completed = 0;
+        int                 backend     = tar_aio_open(archive, 2, flags, &aio);
+        for (int i = 0; i < 8; i++) {
+            requests[i] = (tar_read_request_t) {paths[i % 4], i * 40, buffers[i], sizeof(buffers[i])};
+            tar_aio_submit(aio, &requests[i], count_completion, &n_completed);
+        }
+        tar_aio_close(aio);
+
+        int mismatches = 0;
+        for (int i = 0; i < 8; i++) {
+            uint8_t expected[256];
+            size_t  len = sizeof(expected);
+            ssize_t ret = tar_read_file(archive, requests[i].path, requests[i].offset, expected, &len);
+            if (ret < 0) len = 0;
+            mismatches += ret != requests[i].ret || len != requests[i].len || memcmp(expected, buffers[i], len) != 0;
+        }
+        printf("aio backend %s: %d completions, %d mismatches with tar_read_file\n",
+               backend == TAR_AIO_URING ? "io_uring" : "threads", n_completed, mismatches);
+    }
+    tar_close(archive);
+    printf("\n");
+}
+
+void test_extract() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_archive_t   *archive;
+    char            dest[]      = "/tmp/lib_tar_extract_XXXXXX";
+    char            path[64];
+    char            command[64];
+    struct stat     st;
+    if (mkdtemp(dest) == NULL) {
+        perror("mkdtemp");
+        return;
+    }
+    tar_open(fd, 0, &archive);
+    printf("tar_extract returned %d\n", tar_extract(archive, dest, 4));
+
+    snprintf(path, sizeof(path), "%s/folder_sym", dest);
+    printf("folder_sym is a symlink: %d\n", lstat(path, &st) == 0 && S_ISLNK(st.st_mode));
+    snprintf(path, sizeof(path), "%s/folder2/lib_tar.c", dest);
+    if (stat(path, &st) == 0) printf("folder2/lib_tar.c: size %ld, mode %o, mtime %ld\n", st.st_size, st.st_mode & 07777, st.st_mtime);
+
+    snprintf(command, sizeof(command), "rm -rf %s", dest);
+    if (system(command) != 0) printf("could not remove %s\n", dest);
+    tar_close(archive);
+    printf("\n");
+}
+
+void test_extract_repeated() {
+    char            dir[]   = "/tmp/lib_tar_repeated_XXXXXX";
+    char            path[96], outside[64], dest[64], command[96];
+    int             fd      = -1;
+    size_t          big_len = 4 << 20;
+    uint8_t         *big    = calloc(big_len, 1);
+    tar_writer_t    *writer;
+    tar_archive_t   *archive;
+    struct stat     st;
+    if (big == NULL || mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        free(big);
+        return;
+    }
+
+    // d -> outside, then d/x through it, and a large f replaced by a small one
+    snprintf(outside, sizeof(outside), "%s/outside", dir);
+    snprintf(dest, sizeof(dest), "%s/dest", dir);
+    mkdir(outside, 0755);
+    mkdir(dest, 0755);
+    snprintf(path, sizeof(path), "%s/d", dir);
+    if (symlink(outside, path) < 0) perror("symlink");
+    snprintf(path, sizeof(path), "%s/x", dir);
+    if (symlink("pwned", path) < 0) perror("symlink");
+    snprintf(path, sizeof(path), "%s/archive.tar", dir);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    tar_writer_open(fd, &writer);
+    snprintf(path, sizeof(path), "%s/d", dir);
+    tar_writer_add_path(writer, path, "d");
+    snprintf(path, sizeof(path), "%s/x", dir);
+    tar_writer_add_path(writer, path, "d/x");
+    tar_writer_add_buffer(writer, "f", big, big_len, 0644, 1671043200);
+    tar_writer_add_buffer(writer, "f", (const uint8_t *) "last\n", 5, 0644, 1671043200);
+    tar_writer_close(writer);
+    free(big);
+
+    tar_open(fd, 0, &archive);
+    printf("tar_extract of repeated names returned %d\n", tar_extract(archive, dest, 4));
+    snprintf(path, sizeof(path), "%s/x", outside);
+    printf("link created outside of the destination: %d\n", lstat(path, &st) == 0);
+    snprintf(path, sizeof(path), "%s/f", dest);
+    printf("f has the size of its last entry: %d\n", stat(path, &st) == 0 && st.st_size == 5);
+    tar_close(archive);
+    close(fd);
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0) printf("could not remove %s\n", dir);
+    printf("\n");
+}
+
+void test_writer() {
+    char            path[]  = "/tmp/lib_tar_writer_XXXXXX";
+    int             fd      = mkstemp(path);
+    tar_writer_t    *writer;
+    if (fd == -1) {
+        perror("mkstemp");
+        return;
+    }
+    unlink(path);
+
+    tar_writer_open(fd, &writer);
+    printf("tar_writer_add_path returned %d\n", tar_writer_add_path(writer, "lib_tar.h", "include/lib_tar.h"));
+    printf("tar_writer_add_buffer returned %d\n", tar_writer_add_buffer(writer, "hello.txt", (const uint8_t *) "hello\n", 6, 0644, 1671043200));
+    printf("tar_writer_close returned %d\n", tar_writer_close(writer));
+
+    uint8_t buffer[16];
+    size_t  len = sizeof(buffer);
+    printf("check_archive returned %d\n", check_archive(fd));
+    ssize_t ret = read_file(fd, "hello.txt", 0, buffer, &len);
+    printf("read_file(hello.txt) returned %ld, read %zu bytes: %.*s", ret, len, (int) len, buffer);
+    close(fd);
+    printf("\n");
+}
+
+void test_append() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    // work on a copy of the archive
+    char    path[]      = "/tmp/lib_tar_append_XXXXXX";
+    char    sidecar[64];
+    int     copy        = mkstemp(path);
+    uint8_t buffer[4096];
+    ssize_t n_read;
+    snprintf(sidecar, sizeof(sidecar), "%s.idx", path);
+    while ((n_read = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (write(copy, buffer, n_read) != n_read) perror("write");
+    }
+    close(fd);
+
+    tar_index_t     *index;
+    tar_writer_t    *writer;
+    printf("tar_index_open returned %d\n", tar_index_open(copy, sidecar, &index));
+    tar_writer_append(copy, index, &writer);
+    tar_writer_add_buffer(writer, "folder2/appended.txt", (const uint8_t *) "appended\n", 9, 0644, 1671043200);
+    tar_writer_add_buffer(writer, "new_folder/file.txt", (const uint8_t *) "new\n", 4, 0644, 1671043200);
+    tar_writer_close(writer);
+
+    printf("tar_index_update returned %d\n", tar_index_update(copy, index));
+    printf("check_archive returned %d\n", check_archive(copy));
+
+    char    *entries[16];
+    size_t  no_entries = 16;
+    for (size_t i = 0; i < no_entries; i++) entries[i] = malloc(100);
+    printf("tar_index_list(folder_sym) returned %d:", tar_index_list(index, "folder_sym", entries, &no_entries));
+    for (size_t i = 0; i < no_entries; i++) printf(" %s", entries[i]);
+    printf("\n");
+    for (size_t i = 0; i < 16; i++) free(entries[i]);
+    size_t len = sizeof(buffer);
+    printf("tar_index_read_file(new_folder/file.txt) returned %ld\n", tar_index_read_file(copy, index, "new_folder/file.txt", 0, buffer, &len));
+    tar_index_free(index);
+
+    // the sidecar is updated with the appended entries only
+    printf("tar_index_load returned %d for the appended archive\n", tar_index_load(copy, sidecar, &index));
+    printf("tar_index_open returned %d\n", tar_index_open(copy, sidecar, &index));
+    tar_index_free(index);
+    printf("tar_index_load returned %d\n", tar_index_load(copy, sidecar, &index));
+    tar_index_free(index);
+
+    unlink(sidecar);
+    unlink(path);
+    close(copy);
+    printf("\n");
+}
+
+/**
+ * Fills dest with pseudo-random letters, the same ones for the same seed.
+ */
+static void fill_letters(uint8_t *dest, size_t len, uint64_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed    = seed * 6364136223846793005u + 1442695040888963407u;
+        dest[i] = 'a' + (seed >> 33) % 26;
+    }
+}
+
+void test_compressed() {
+    char            path[]  = "/tmp/lib_tar_gzip_XXXXXX";
+    char            gz_path[64], checkpoints[64], command[256];
+    int             fd      = mkstemp(path);
+    tar_writer_t    *writer;
+    if (fd == -1) {
+        perror("mkstemp");
+        return;
+    }
+    snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+    snprintf(checkpoints, sizeof(checkpoints), "%s.gz.ckpt", path);
+
+    // an archive of 1 MiB of data which does not compress too well, so that it gets several checkpoints
+    uint8_t *data = malloc(16384);
+    tar_writer_open(fd, &writer);
+    for (int i = 0; i < 64; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "files/%02d.txt", i);
+        fill_letters(data, 16384, i);
+        tar_writer_add_buffer(writer, name, data, 16384, 0644, 1671043200);
+    }
+    tar_writer_close(writer);
+    close(fd);
+    snprintf(command, sizeof(command), "gzip -c %s > %s", path, gz_path);
+    if (system(command) != 0) printf("could not compress %s\n", path);
+
+    int     gz_fd   = open(gz_path, O_RDONLY);
+    uint8_t buffer[100];
+    size_t  len     = sizeof(buffer);
+    printf("tar_source_attach returned %d\n", tar_source_attach(gz_fd, checkpoints, 64 << 10));
+    printf("check_archive returned %d\n", check_archive(gz_fd));
+
+    uint64_t    size;
+    uint32_t    n_checkpoints;
+    int         ret = tar_source_info(gz_fd, &size, &n_checkpoints);
+    printf("tar_source_info returned %d: size %lu, %u checkpoints\n", ret, size, n_checkpoints);
+    tar_source_detach(gz_fd);
+
+    // a second attach loads the checkpoints, reads decode from the closest one
+    tar_index_t *index;
+    tar_source_attach(gz_fd, checkpoints, 64 << 10);
+    ret = tar_source_info(gz_fd, &size, &n_checkpoints);
+    printf("tar_source_info returned %d after a new attach: %u checkpoints\n", ret, n_checkpoints);
+    printf("tar_index_build returned %d\n", tar_index_build(gz_fd, &index));
+    ssize_t read_ret = tar_index_read_file(gz_fd, index, "files/37.txt", 1000, buffer, &len);
+    fill_letters(data, 16384, 37);
+    printf("tar_index_read_file(files/37.txt) returned %ld, %zu bytes, %s\n", read_ret, len,
+           memcmp(buffer, data + 1000, 100) == 0 ? "matching" : "different");
+    len = sizeof(buffer);
+    read_ret = tar_index_read_file(gz_fd, index, "files/05.txt", 0, buffer, &len);
+    fill_letters(data, 16384, 5);
+    printf("tar_index_read_file(files/05.txt) returned %ld, %zu bytes, %s\n", read_ret, len,
+           memcmp(buffer, data, 100) == 0 ? "matching" : "different");
+    tar_index_free(index);
+    tar_source_detach(gz_fd);
+
+    free(data);
+    close(gz_fd);
+    unlink(checkpoints);
+    unlink(gz_path);
+    unlink(path);
+    printf("\n");
+}
+
+/**
+ * Builds, in a new directory of /tmp, a file with a 150 bytes name, a symlink to it, and a file whose
+ * 200 bytes path only fits in a ustar header split between its prefix and name fields.
+ * Returns zero on success, -1 otherwise.
+ */
+static int make_long_names(char *dir) {
+    char    long_name[151], deep[256], path[512], command[1024];
+    if (mkdtemp(dir) == NULL) return -1;
+    memset(long_name, 'n', 150);
+    long_name[150] = '\0';
+    snprintf(deep, sizeof(deep), "%.60s/%.60s/%.70s", long_name, long_name, long_name);
+
+    snprintf(command, sizeof(command), "mkdir -p %s/%.60s/%.60s && echo long > %s/%s && echo deep > %s/%s && ln -s %s %s/link",
+             dir, long_name, long_name, dir, long_name, dir, deep, long_name, dir);
+    if (system(command) != 0) return -1;
+    snprintf(path, sizeof(path), "%s/%s", dir, deep);
+    return access(path, F_OK);
+}
+
+void test_long_names() {
+    char    dir[]           = "/tmp/lib_tar_long_XXXXXX";
+    char    *formats[]      = {"ustar", "gnu", "pax"};
+    char    long_name[151], deep[256], path[64], command[1024];
+    if (make_long_names(dir) < 0) {
+        printf("could not build the long names\n\n");
+        return;
+    }
+    memset(long_name, 'n', 150);
+    long_name[150] = '\0';
+    snprintf(deep, sizeof(deep), "%.60s/%.60s/%.70s", long_name, long_name, long_name);
+
+    // ustar only holds the deep path, split on a '/', GNU and PAX archives hold everything
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s.%s.tar", dir, formats[i]);
+        if (i == 0) snprintf(command, sizeof(command), "tar --format=%s -C %s -cf %s %s", formats[i], dir, path, deep);
+        else        snprintf(command, sizeof(command), "tar --format=%s -C %s -cf %s %.60s %s link", formats[i], dir, path, long_name, long_name);
+        if (system(command) != 0) printf("could not write %s\n", path);
+
+        int         fd  = open(path, O_RDONLY);
+        uint8_t     buffer[8];
+        size_t      len = sizeof(buffer);
+        tar_index_t *index;
+        int     n_headers   = check_archive(fd);
+        ssize_t ret         = read_file(fd, deep, 0, buffer, &len);
+        printf("%s: check_archive returned %d, read_file(deep) returned %ld: %.*s", formats[i], n_headers, ret, (int) len, buffer);
+        if (i > 0) {
+            len = sizeof(buffer);
+            ret = read_file(fd, "link", 0, buffer, &len);
+            printf("%s: is_file(long) returned %d, read_file(link) returned %ld: %.*s", formats[i], is_file(fd, long_name), ret, (int) len, buffer);
+            tar_index_build(fd, &index);
+            printf("%s: tar_index_is_symlink(link) returned %d\n", formats[i], tar_index_is_symlink(index, "link"));
+            tar_index_free(index);
+        }
+        close(fd);
+        unlink(path);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0) printf("could not remove %s\n", dir);
+
+    // a 9 GiB entry, whose size only fits in base-256, in a sparse archive
+    char            big[]   = "/tmp/lib_tar_big_XXXXXX";
+    int             fd      = mkstemp(big);
+    tar_writer_t    *writer;
+    tar_header_t    header;
+    tar_iter_t      *iter;
+    tar_entry_t     entry;
+    uint64_t        size    = 9ULL << 30;
+    unlink(big);
+    tar_writer_open(fd, &writer);
+    tar_writer_add_buffer(writer, "big.bin", NULL, 0, 0644, 1671043200);
+    tar_writer_close(writer);
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) perror("pread");
+
+    unsigned checksum = 0;
+    header.size[0] = (char) 0x80;
+    for (int i = 11; i > 0; i--) header.size[i] = (char) (size >> (8 * (11 - i)));
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    for (size_t i = 0; i < sizeof(header); i++) checksum += ((uint8_t *) &header)[i];
+    snprintf(header.chksum, sizeof(header.chksum), "%06o", checksum);
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || ftruncate(fd, BLOCKSIZE + size + 2 * BLOCKSIZE) < 0) perror("pwrite");
+
+    uint8_t buffer[8];
+    size_t  len = sizeof(buffer);
+    tar_iter_open(fd, &iter);
+    int     ret     = tar_iter_next(iter, &entry);
+    ssize_t left    = read_file(fd, "big.bin", size - 100, buffer, &len);
+    printf("check_archive returned %d, tar_iter_next returned %d: size %lu, read_file(big.bin) returned %ld\n",
+           check_archive(fd), ret, entry.size, left);
+    tar_iter_close(iter);
+    close(fd);
+    printf("\n");
+}
+
+/**
+ * Rewrites the header at offset of the archive fd with another typeflag and size field, when given,
+ * and a valid checksum.
+ */
+static void rewrite_header(int fd, off_t offset, char typeflag, const char *size) {
+    tar_header_t    header;
+    unsigned        checksum = 0;
+    if (pread(fd, &header, sizeof(header), offset) != sizeof(header)) perror("pread");
+    if (typeflag != '\0') header.typeflag = typeflag;
+    if (size != NULL) memcpy(header.size, size, sizeof(header.size));
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    for (size_t i = 0; i < sizeof(header); i++) checksum += ((uint8_t *) &header)[i];
+    snprintf(header.chksum, sizeof(header.chksum), "%06o", checksum);
+    if (pwrite(fd, &header, sizeof(header), offset) != sizeof(header)) perror("pwrite");
+}
+
+void test_bad_sizes() {
+    // a size of -512 in base-256 leads back to its own header, a PAX size past 64 bits wraps around
+    const char  negative[12]    = {(char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff,
+                                   (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xfe, 0};
+    const char  *record         = "38 size=99999999999999999999999999999\n";
+    const char  *cases[]        = {"negative base-256 size", "huge PAX size"};
+    for (int i = 0; i < 2; i++) {
+        char            path[]  = "/tmp/lib_tar_sizes_XXXXXX";
+        int             fd      = mkstemp(path);
+        tar_writer_t    *writer;
+        unlink(path);
+        tar_writer_open(fd, &writer);
+        if (i == 1) tar_writer_add_buffer(writer, "pax", (const uint8_t *) record, strlen(record), 0644, 1671043200);
+        tar_writer_add_buffer(writer, "bad.bin", NULL, 0, 0644, 1671043200);
+        tar_writer_add_buffer(writer, "after.txt", (const uint8_t *) "after\n", 6, 0644, 1671043200);
+        tar_writer_close(writer);
+        if (i == 0) rewrite_header(fd, 0, '\0', negative);
+        else        rewrite_header(fd, 0, XHDTYPE, NULL);
+
+        tar_index_t     *index;
+        tar_archive_t   *archive;
+        tar_query_t     *query;
+        int             build   = tar_index_build(fd, &index);
+        if (build >= 0) tar_index_free(index);
+        tar_open(fd, 0, &archive);
+        tar_query_new(&query);
+        tar_query_add_path(query, "after.txt");
+        int             run     = tar_query_run(archive, query, NULL, NULL, NULL);
+        int             append  = tar_writer_append(fd, NULL, &writer);
+        if (append == 0) tar_writer_close(writer);
+        printf("%s: check_archive returned %d, exists(after.txt) %d, tar_index_build %d, tar_query_run %d, tar_writer_append %d\n",
+               cases[i], check_archive(fd), exists(fd, "after.txt"), build, run, append);
+        tar_query_free(query);
+        tar_close(archive);
+        close(fd);
+    }
+    printf("\n");
+}
+
+/**
+ * Writes the file whose descriptor is arg to the pipe following it, then closes both.
+ */
+static void *feed_pipe(void *arg) {
+    int     *fds = arg;
+    uint8_t buffer[4096];
+    ssize_t n_read;
+    while ((n_read = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        if (write(fds[1], buffer, n_read) != n_read) break;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+}
+
+/**
+ * Returns the read end of a pipe fed with archive.tar by a thread, which is set in thread.
+ */
+static int archive_pipe(pthread_t *thread, int *fds) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) < 0) return -1;
+    fds[0] = open("archive.tar", O_RDONLY);
+    fds[1] = pipe_fds[1];
+    pthread_create(thread, NULL, feed_pipe, fds);
+    return pipe_fds[0];
+}
+
+static void count_data(const tar_entry_t *entry, const uint8_t *data, size_t len, void *user_data) {
+    size_t *counts = user_data;
+    if (data == NULL) counts[0]++;
+    counts[1] += len;
+}
+
+void test_stream() {
+    pthread_t   thread;
+    int         fds[2];
+    int         fd = archive_pipe(&thread, fds);
+    if (fd < 0) {
+        perror("pipe");
+        return;
+    }
+    printf("check_archive on a pipe returned %d\n", check_archive(fd));
+    pthread_join(thread, NULL);
+    close(fd);
+
+    // a single pass validating, indexing and reading every byte of data
+    tar_index_t *index;
+    size_t      counts[2] = {0, 0};
+    fd = archive_pipe(&thread, fds);
+    int ret = tar_stream_check(fd, &index, count_data, counts);
+    printf("tar_stream_check returned %d: %zu entries, %zu bytes of data\n", ret, counts[0], counts[1]);
+    printf("tar_index_is_symlink(folder_sym) returned %d\n", ret >= 0 ? tar_index_is_symlink(index, "folder_sym") : -1);
+    if (ret >= 0) tar_index_free(index);
+    pthread_join(thread, NULL);
+    close(fd);
+
+    // entries skipped partially read or not at all
+    tar_iter_t  *iter;
+    tar_entry_t entry;
+    uint8_t     buffer[8];
+    int         n_read = 0;
+    fd = archive_pipe(&thread, fds);
+    tar_iter_open(fd, &iter);
+    while ((ret = tar_iter_next(iter, &entry)) > 0) {
+        if (entry.typeflag == REGTYPE && tar_iter_read(iter, buffer, sizeof(buffer)) > 0) n_read++;
+    }
+    printf("tar_iter_next on a pipe returned %d, read %d files\n", ret, n_read);
+    tar_iter_close(iter);
+    pthread_join(thread, NULL);
+    close(fd);
+    printf("\n");
+}
+
+void test_stats() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_archive_t   *archive;
+    tar_stats_t     stats;
+    char            *entries[16];
+    size_t          no_entries = 16;
+    for (size_t i = 0; i < no_entries; i++) entries[i] = malloc(100);
+    tar_open(fd, 0, &archive);
+    tar_exists(archive, "folder2/lib_tar.c");
+    tar_exists(archive, "missing");
+    tar_list(archive, "folder_sym", entries, &no_entries);
+
+    int         ret     = tar_get_stats(archive, &stats);
+    uint64_t    n_calls = 0;
+    for (int i = 0; i < TAR_LATENCY_BUCKETS; i++) n_calls += stats.latency[TAR_API_EXISTS][i];
+    printf("tar_get_stats returned %d: %lu headers, %lu checksum failures, %lu link hops, %lu calls of tar_exists, %s\n",
+           ret, stats.headers, stats.checksum_failures, stats.link_hops, n_calls,
+           stats.syscalls > 0 && stats.bytes_read > 0 ? "reads counted" : "no reads counted");
+    for (size_t i = 0; i < 16; i++) free(entries[i]);
+    tar_close(archive);
+    close(fd);
+    printf("\n");
+}
+
+void test_index_memory() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    // an index built in memory, then the same index loaded from its sidecar
+    tar_index_t         *index;
+    tar_index_memory_t  memory;
+    char                sidecar[] = "/tmp/archive.tar.memory.idx";
+    if (tar_index_build(fd, &index) < 0) return;
+    tar_index_memory(index, &memory);
+    printf("built index: %lu entries, %s, %lu allocations\n", memory.n_entries,
+           memory.entry_bytes <= memory.n_entries * TAR_INDEX_ENTRY_BYTES + 512 ? "entry bytes within bounds" : "entry bytes out of bounds",
+           memory.allocations);
+    tar_index_save(index, fd, sidecar);
+    tar_index_free(index);
+
+    if (tar_index_load(fd, sidecar, &index) >= 0) {
+        tar_index_memory(index, &memory);
+        printf("loaded index: %lu entries, %lu allocations, is_file(folder2/lib_tar.c) %d\n", memory.n_entries,
+               memory.allocations, tar_index_is_file(index, "folder2/lib_tar.c"));
+        tar_index_free(index);
+    }
+    unlink(sidecar);
+    close(fd);
+    printf("\n");
+}
+
+static int count_matches(size_t query, const tar_entry_t *entry, void *user_data) {
+    ((int *) user_data)[query]++;
+    return 0;
+}
+
+void test_query() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_query_t *query;
+    char        *paths[]    = {"lib_tar.c", "folder2/", "folder2", "missing"};
+    char        *patterns[] = {"*.c", "folder2/*.[ch]", "*/folder?", "*lib*", "folder2/", "tests"};
+    if (tar_query_new(&query) < 0) return;
+    for (size_t i = 0; i < 4; i++) tar_query_add_path(query, paths[i]);
+    for (size_t i = 0; i < 6; i++) tar_query_add_glob(query, patterns[i]);
+    printf("tar_query_add_glob of an unclosed set returned %ld\n", tar_query_add_glob(query, "folder[12"));
+
+    for (int flags = 0; flags <= TAR_OPEN_INDEX; flags += TAR_OPEN_INDEX) {
+        tar_archive_t   *archive;
+        uint8_t         found[2];
+        int             matches[10] = {0};
+        tar_open(fd, flags, &archive);
+        int ret = tar_query_run(archive, query, found, count_matches, matches);
+        printf("%s tar_query_run returned %d, matches:", flags ? "indexed" : "scanned", ret);
+        for (int i = 0; i < 10; i++) printf(" %d%s", matches[i], TAR_QUERY_FOUND(found, i) ? "" : "-");
+        printf(", without callback %d\n", tar_query_run(archive, query, NULL, NULL, NULL));
+        tar_close(archive);
+    }
+    tar_query_free(query);
+    close(fd);
+    printf("\n");
+}
+
+/**
+ * Writes the archive at path: the old release of test_diff() when is_new is zero, the new one otherwise.
+ */
+static void write_release(const char *path, int is_new) {
+    char            link[]  = "/tmp/lib_tar_diff_link_XXXXXX";
+    char            dir[]   = "/tmp/lib_tar_diff_dir_XXXXXX";
+    int             fd      = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    tar_writer_t    *writer;
+    if (fd == -1 || tar_writer_open(fd, &writer) < 0) return;
+
+    tar_writer_add_buffer(writer, "same.txt", (const uint8_t *) "same\n", 5, 0644, 1671043200);
+    tar_writer_add_buffer(writer, "edited.txt", (const uint8_t *) (is_new ? "abd\n" : "abc\n"), 4, 0644, 1671043200 + is_new);
+    tar_writer_add_buffer(writer, "resized.txt", (const uint8_t *) (is_new ? "xy\n" : "x\n"), is_new ? 3 : 2, 0644, 1671043200);
+    if (!is_new) tar_writer_add_buffer(writer, "removed.txt", (const uint8_t *) "gone\n", 5, 0644, 1671043200);
+    tar_writer_add_buffer(writer, "mode.txt", (const uint8_t *) "m\n", 2, is_new ? 0600 : 0644, 1671043200);
+    if (!is_new) tar_writer_add_buffer(writer, "kind", (const uint8_t *) "file\n", 5, 0644, 1671043200);
+    if (is_new && mkstemp(link) != -1) {
+        unlink(link);
+        if (symlink("same.txt", link) == 0) tar_writer_add_path(writer, link, "kind");
+        unlink(link);
+    }
+    if (!is_new) tar_writer_add_buffer(writer, "became_dir", (const uint8_t *) "file\n", 5, 0755, 1671043200);
+    if (is_new && mkdtemp(dir) != NULL) {
+        tar_writer_add_path(writer, dir, "became_dir");
+        rmdir(dir);
+    }
+    if (is_new) tar_writer_add_buffer(writer, "added.txt", (const uint8_t *) "new\n", 4, 0644, 1671043200);
+    tar_writer_close(writer);
+    close(fd);
+}
+
+static int print_change(int change, const tar_entry_t *old_entry, const tar_entry_t *new_entry, void *user_data) {
+    printf(" %d:%s", change, old_entry != NULL ? old_entry->name : new_entry->name);
+    return 0;
+}
+
+void test_diff() {
+    char    *paths[]    = {"/tmp/lib_tar_diff_old.tar", "/tmp/lib_tar_diff_new.tar"};
+    char    *sidecars[] = {"/tmp/lib_tar_diff_old.tar.idx", "/tmp/lib_tar_diff_new.tar.idx"};
+    int     fds[2];
+    write_release(paths[0], 0);
+    write_release(paths[1], 1);
+    for (int i = 0; i < 2; i++) {
+        unlink(sidecars[i]);
+        fds[i] = open(paths[i], O_RDONLY);
+    }
+
+    tar_archive_t *archives[2];
+    tar_open(fds[0], 0, &archives[0]);
+    tar_open(fds[1], TAR_OPEN_INDEX, &archives[1]);
+    printf("tar_diff returned");
+    printf(" %d\n", tar_diff(archives[0], archives[1], 0, print_change, NULL));
+    printf("tar_diff without callback returned %d\n", tar_diff(archives[0], archives[1], 0, NULL, NULL));
+    tar_close(archives[0]);
+    tar_close(archives[1]);
+
+    // the digests computed by the first diff are read from the sidecars by the second one
+    for (int pass = 0; pass < 2; pass++) {
+        tar_stats_t stats;
+        for (int i = 0; i < 2; i++) tar_open_sidecar(fds[i], sidecars[i], &archives[i]);
+        int ret = tar_diff(archives[0], archives[1], 1, NULL, NULL);
+        tar_get_stats(archives[0], &stats);
+        printf("tar_diff with sidecars returned %d, %s\n", ret, stats.bytes_read > 0 ? "data read" : "no data read");
+        tar_close(archives[0]);
+        tar_close(archives[1]);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        close(fds[i]);
+        unlink(sidecars[i]);
+        unlink(paths[i]);
+    }
+    printf("\n");
+}
+
+void test_send_entry() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    // the same range sent to a pipe, a file and a socket, then read back, with and without an index
+    uint8_t         expected[4096], sent[4096];
+    size_t          expected_len    = sizeof(expected);
+    const char      *outputs[]      = {"a pipe", "a file", "a socket"};
+    read_file(fd, "folder_sym/lib_tar.c", 6000, expected, &expected_len);
+
+    for (int flags = 0; flags <= TAR_OPEN_INDEX; flags += TAR_OPEN_INDEX) {
+        tar_archive_t *archive;
+        if (tar_open(fd, flags, &archive) < 0) break;
+        printf("%s:\n", flags ? "indexed handle" : "handle without index");
+
+        for (int output = 0; output < 3; output++) {
+            char    path[]  = "/tmp/lib_tar_send_XXXXXX";
+            int     fds[2]  = {-1, -1};
+            if (output == 0 && pipe(fds) < 0) break;
+            if (output == 1 && (fds[0] = mkstemp(path)) >= 0) {
+                unlink(path);
+                fds[1] = dup(fds[0]);
+            }
+            if (output == 2 && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) break;
+
+            size_t  len         = sizeof(sent);
+            ssize_t ret         = tar_send_entry(archive, "folder_sym/lib_tar.c", fds[1], 6000, &len);
+            ssize_t n_read      = output == 1 ? pread(fds[0], sent, sizeof(sent), 0) : read(fds[0], sent, sizeof(sent));
+            printf("tar_send_entry(folder_sym/lib_tar.c) to %s returned %ld, sent %zu bytes, %s read_file\n", outputs[output], ret, len,
+                   n_read == (ssize_t) expected_len && memcmp(sent, expected, expected_len) == 0 ? "the same as" : "not the same as");
+            close(fds[0]);
+            close(fds[1]);
+        }
+
+        // nothing is left to send at the end of the file, and nothing is sent past it
+        size_t  len = 100;
+        ssize_t ret = tar_send_entry(archive, "lib_tar.c", STDOUT_FILENO, 10091, &len);
+        printf("tar_send_entry at the end returned %ld, sent %zu bytes\n", ret, len);
+        len = 100;
+        ret = tar_send_entry(archive, "lib_tar.c", STDOUT_FILENO, 10092, &len);
+        printf("tar_send_entry past the end returned %ld, sent %zu bytes\n", ret, len);
+        printf("tar_send_entry of a directory returned %ld\n", tar_send_entry(archive, "folder2/", STDOUT_FILENO, 0, &len));
+        tar_close(archive);
+    }
+    close(fd);
+    printf("\n");
+}
+
+void test_iter() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    tar_iter_t *iter;
+    if (tar_iter_open(fd, &iter) < 0) return;
+
+    tar_entry_t entry;
+    int         ret;
+    while ((ret = tar_iter_next(iter, &entry)) > 0) {
+        // read the first bytes of regular files, skip the rest
+        uint8_t buffer[16] = {0};
+        ssize_t n_read = 0;
+        if (entry.typeflag == REGTYPE) n_read = tar_iter_read(iter, buffer, sizeof(buffer) - 1);
+
+        printf("%c %04o %6ld %-20s %-8s @%-6ld %s\n", entry.typeflag, entry.mode, entry.size, entry.name,
+               entry.linkname, entry.data_offset, n_read > 0 ? "read" : "");
+    }
+    printf("tar_iter_next returned %d\n\n", ret);
+    tar_iter_close(iter);
+}
+
+#define N_THREADS       8
+#define N_ITERATIONS    500
+
+typedef struct {
+    tar_archive_t   *archive;
+    uint8_t         *expected;
+    size_t          expected_len;
+    int             errors;
+} thread_arg_t;
+
+void *hammer_archive(void *arg) {
+    thread_arg_t    *t      = arg;
+    uint8_t         *buffer = malloc(t->expected_len);
+    char            names[8][100];
+    char            *entries[8];
+    for (int i = 0; i < 8; i++) entries[i] = names[i];
+
+    for (int i = 0; i < N_ITERATIONS; i++) {
+        size_t len = t->expected_len;
+        if (tar_read_file(t->archive, "folder2/lib_tar.c", 0, buffer, &len) != 0
+            || len != t->expected_len || memcmp(buffer, t->expected, len) != 0) t->errors++;
+
+        size_t no_entries = 8;
+        tar_list(t->archive, "folder_sym/", entries, &no_entries);
+        if (no_entries != 5) t->errors++;
+    }
+    free(buffer);
+    return NULL;
+}
+
+void test_threads() {
+    int fd = open("archive.tar", O_RDONLY);
+    if (fd == -1) {
+        perror("open(archive.tar)");
+        return;
+    }
+
+    for (int flags = 0; flags <= TAR_OPEN_INDEX; flags += TAR_OPEN_INDEX) {
+        tar_archive_t *archive;
+        if (tar_open(fd, flags, &archive) < 0) return;
+
+        // reference result, read by a single thread
+        uint8_t expected[16384];
+        size_t  expected_len = sizeof(expected);
+        read_file(fd, "folder2/lib_tar.c", 0, expected, &expected_len);
+
+        pthread_t       threads[N_THREADS];
+        thread_arg_t    args[N_THREADS];
+        for (int i = 0; i < N_THREADS; i++) {
+            args[i] = (thread_arg_t) {archive, expected, expected_len, 0};
+            pthread_create(&threads[i], NULL, hammer_archive, &args[i]);
+        }
+
+        int errors = 0;
+        for (int i = 0; i < N_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+            errors += args[i].errors;
+        }
+        printf("%d threads, %s archive: %d wrong results, file offset %ld\n", N_THREADS,
+               flags ? "indexed" : "scanned", errors, lseek(fd, 0, SEEK_CUR));
+        tar_close(archive);
+    }
+    printf("\n");
+}
+
 int main(int argc, char **argv) {
     if (argc < 2) {
         printf("Usage: %s tar_file\n", argv[0]);
@@ -190,6 +1238,29 @@ int main(int argc, char **argv) {
     //test_is_dir();
     //test_read_file();
     test_list();
+    test_index();
+    test_index_shadowed();
+    test_mmap();
+    test_threads();
+    test_iter();
+    test_list_page();
+    test_sidecar();
+    test_cache();
+    test_read_many();
+    test_aio();
+    test_extract();
+    test_extract_repeated();
+    test_writer();
+    test_append();
+    test_compressed();
+    test_stream();
+    test_long_names();
+    test_stats();
+    test_index_memory();
+    test_query();
+    test_diff();
+    test_send_entry();
+    test_bad_sizes();
 
     return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file